@@ -47,8 +47,114 @@ struct _EggBuffer
 
 	GByteArray *ar;
 	gsize       pos;
+	gsize       peak;  /* Longest length before the last reset. */
 };
 
+/*
+ * Varints take at most 5 bytes for 32-bit and 10 bytes for 64-bit integers.
+ * Writers reserve the worst case up front and store the bytes directly
+ * rather than appending them one at a time.  Readers decode anything that
+ * fits within a single 8-byte little-endian load without a bounds check
+ * per byte: the first byte with its continuation bit off is located from
+ * a mask of those bits, and the 7-bit groups are then compacted in three
+ * branchless steps.  Only varints longer than 8 bytes, or those near the
+ * end of the buffer, take the byte at a time path.
+ */
+#define VARINT32_MAX (5)
+#define VARINT64_MAX (10)
+
+static inline guint
+egg_buffer_encode_varint (guint8  *p,
+                          guint64  i)
+{
+	guint n = 0;
+
+	while (i > 0x7F) {
+		p[n++] = (i & 0x7F) | 0x80;
+		i >>= 7;
+	}
+	p[n++] = i;
+	return n;
+}
+
+static inline guint
+egg_buffer_decode_varint_word (const guint8 *p,
+                               guint64      *i)
+{
+	guint64 w;
+	guint64 stop;
+	guint n;
+
+	memcpy(&w, p, sizeof w);
+	w = GUINT64_FROM_LE(w);
+	stop = ~w & G_GUINT64_CONSTANT(0x8080808080808080);
+	if (G_UNLIKELY(!stop)) {
+		return 0;
+	}
+#if defined(__GNUC__)
+	n = (__builtin_ctzll(stop) + 1) >> 3;
+#else
+	for (n = 1; !(stop & 0x80); n++) {
+		stop >>= 8;
+	}
+	stop = G_GUINT64_CONSTANT(0x80) << (8 * (n - 1));
+#endif
+	w &= (stop ^ (stop - 1)) & G_GUINT64_CONSTANT(0x7F7F7F7F7F7F7F7F);
+	w = ((w & G_GUINT64_CONSTANT(0x7F007F007F007F00)) >> 1) |
+	     (w & G_GUINT64_CONSTANT(0x007F007F007F007F));
+	w = ((w & G_GUINT64_CONSTANT(0x3FFF00003FFF0000)) >> 2) |
+	     (w & G_GUINT64_CONSTANT(0x00003FFF00003FFF));
+	w = ((w & G_GUINT64_CONSTANT(0x0FFFFFFF00000000)) >> 4) |
+	     (w & G_GUINT64_CONSTANT(0x000000000FFFFFFF));
+	*i = w;
+	return n;
+}
+
+static inline gboolean
+egg_buffer_read_varint (EggBuffer *buffer,
+                        guint64   *i,
+                        guint      max)
+{
+	guint64 u = 0;
+	guint o = 0;
+	guint n;
+	guint8 b;
+
+	/*
+	 * NOTES:
+	 *
+	 *   Read each byte in the varint off the buffer.  The last byte is
+	 *   denoted by the Most-Significant-Bit being Off.
+	 *
+	 */
+
+	if (G_LIKELY(buffer->pos + 8 <= buffer->ar->len)) {
+		n = egg_buffer_decode_varint_word(&buffer->ar->data[buffer->pos], i);
+		if (G_LIKELY(n)) {
+			if (G_UNLIKELY(n > max))
+				return FALSE;
+			buffer->pos += n;
+			return TRUE;
+		}
+	}
+
+	do {
+		/*
+		 * Ensure there is space to read and we didn't overflow.
+		 */
+		if ((buffer->pos >= buffer->ar->len) || (o >= 7 * max))
+			return FALSE;
+
+		b = buffer->ar->data[buffer->pos++];
+		u |= ((guint64)(b & 0x7F) << o);
+		o += 7;
+	} while ((b & 0x80) != 0);
+
+	*i = u;
+
+	return TRUE;
+}
+
 static void
 egg_buffer_destroy (EggBuffer *buffer)
 {
@@ -102,6 +208,32 @@ egg_buffer_new_from_data (const guint8 *data,
 	return buffer;
 }
 
+/**
+ * egg_buffer_new_for_array:
+ * @ar: A #GByteArray.
+ *
+ * Creates a new instance of #EggBuffer that writes directly onto the end
+ * of @ar.  A reference is taken on @ar.  This allows encoding into storage
+ * owned by the caller without copying the result out of the buffer.
+ *
+ * Returns: The newly created instance of #EggBuffer.
+ *
+ * Side effects: None.
+ */
+EggBuffer*
+egg_buffer_new_for_array (GByteArray *ar)
+{
+	EggBuffer *buffer;
+
+	g_return_val_if_fail(ar != NULL, NULL);
+
+	buffer = g_slice_new0(EggBuffer);
+	buffer->ref_count = 1;
+	buffer->ar = g_byte_array_ref(ar);
+
+	return buffer;
+}
+
 /**
  * egg_buffer_write_int:
  * @buffer: An #EggBuffer.
@@ -145,7 +277,7 @@ void
 egg_buffer_write_uint (EggBuffer *buffer,
                        guint      i)
 {
-	guint8 b;
+	guint len;
 
 	g_return_if_fail(buffer != NULL);
 
@@ -159,11 +291,10 @@ egg_buffer_write_uint (EggBuffer *buffer,
 	 *
 	 */
 
-	do {
-		b = ((i > 0x7F) << 7) | (i & 0x7F);
-		g_byte_array_append(buffer->ar, &b, 1);
-		i >>= 7;
-	} while (i > 0);
+	len = buffer->ar->len;
+	g_byte_array_set_size(buffer->ar, len + VARINT32_MAX);
+	len += egg_buffer_encode_varint(&buffer->ar->data[len], i);
+	g_byte_array_set_size(buffer->ar, len);
 }
 
 /**
@@ -179,15 +310,44 @@ void
 egg_buffer_write_uint64 (EggBuffer *buffer,
                          guint64    i)
 {
-	guint8 b;
+	guint len;
 
 	g_return_if_fail(buffer != NULL);
 
-	do {
-		b = ((i > 0x7F) << 7) | (i & 0x7F);
-		g_byte_array_append(buffer->ar, &b, 1);
-		i >>= 7;
-	} while (i > 0);
+	len = buffer->ar->len;
+	g_byte_array_set_size(buffer->ar, len + VARINT64_MAX);
+	len += egg_buffer_encode_varint(&buffer->ar->data[len], i);
+	g_byte_array_set_size(buffer->ar, len);
+}
+
+/**
+ * egg_buffer_write_uint64_array:
+ * @buffer: An #EggBuffer.
+ * @v: An array of 64-bit unsigned integers.
+ * @n_v: The number of integers in @v.
+ *
+ * Encodes each integer in @v as a varint onto the end of the buffer.  The
+ * space for the worst case is reserved once for the whole array.
+ *
+ * Side effects: None.
+ */
+void
+egg_buffer_write_uint64_array (EggBuffer     *buffer,
+                               const guint64 *v,
+                               gsize          n_v)
+{
+	guint len;
+	gsize i;
+
+	g_return_if_fail(buffer != NULL);
+	g_return_if_fail(v != NULL || n_v == 0);
+
+	len = buffer->ar->len;
+	g_byte_array_set_size(buffer->ar, len + n_v * VARINT64_MAX);
+	for (i = 0; i < n_v; i++) {
+		len += egg_buffer_encode_varint(&buffer->ar->data[len], v[i]);
+	}
+	g_byte_array_set_size(buffer->ar, len);
 }
 
 /**
@@ -357,6 +517,36 @@ egg_buffer_write_data (EggBuffer    *buffer,
 	g_byte_array_append(buffer->ar, data, len);
 }
 
+/**
+ * egg_buffer_write_bytes:
+ * @buffer: An #EggBuffer.
+ * @data: The bytes to append or %NULL.
+ * @len: The number of bytes to append.
+ *
+ * Appends @len raw bytes onto the end of the buffer without a length
+ * prefix.  If @data is %NULL, @len zero bytes are appended.  The reader
+ * must know @len from elsewhere.
+ *
+ * Side effects: None.
+ */
+void
+egg_buffer_write_bytes (EggBuffer    *buffer,
+                        const guint8 *data,
+                        gsize         len)
+{
+	guint offset;
+
+	g_return_if_fail(buffer != NULL);
+	g_return_if_fail(len <= G_MAXUINT);
+
+	offset = buffer->ar->len;
+	g_byte_array_set_size(buffer->ar, offset + len);
+	if (data)
+		memcpy(&buffer->ar->data[offset], data, len);
+	else
+		memset(&buffer->ar->data[offset], 0, len);
+}
+
 /**
  * egg_buffer_get_buffer:
  * @buffer: An #EggBuffer.
@@ -440,33 +630,15 @@ gboolean
 egg_buffer_read_uint (EggBuffer *buffer,
                       guint     *i)
 {
-	guint u = 0, o = 0;
-	guint8 b = 0;
+	guint64 u;
 
 	g_return_val_if_fail(buffer != NULL, FALSE);
 	g_return_val_if_fail(i != NULL, FALSE);
 
-	/*
-	 * NOTES:
-	 *
-	 *   Read each byte in the varint off the buffer.  The last byte is
-	 *   denoted by the Most-Significant-Bit being Off.
-	 *
-	 */
-
-	do {
-		/*
-		 * Ensure there is space to read and we didn't overflow 32-bit.
-		 */
-		if ((buffer->pos >= buffer->ar->len) || (o > 28))
-			return FALSE;
-
-		b = buffer->ar->data[buffer->pos++];
-		u |= ((guint32)(b & 0x7F) << o);
-		o += 7;
-	} while ((b & 0x80) != 0);
+	if (!egg_buffer_read_varint(buffer, &u, VARINT32_MAX))
+		return FALSE;
 
-	*i = u;
+	*i = (guint32)u;
 
 	return TRUE;
 }
@@ -487,34 +659,44 @@ gboolean
 egg_buffer_read_uint64 (EggBuffer *buffer,
                         guint64   *i)
 {
-	guint o = 0;
-	guint8 b = 0;
-	guint64 u = 0;
-
 	g_return_val_if_fail(buffer != NULL, FALSE);
 	g_return_val_if_fail(i != NULL, FALSE);
 
-	/*
-	 * NOTES:
-	 *
-	 *   Read each byte in the varint off the buffer.  The last byte is
-	 *   denoted by the Most-Significant-Bit being Off.
-	 *
-	 */
+	return egg_buffer_read_varint(buffer, i, VARINT64_MAX);
+}
 
-	do {
-		/*
-		 * Ensure there is space to read and we didn't overflow 64-bit.
-		 */
-		if ((buffer->pos >= buffer->ar->len) || (o > 63))
-			return FALSE;
+/**
+ * egg_buffer_read_uint64_array:
+ * @buffer: An #EggBuffer.
+ * @v: A location for @n_v integers.
+ * @n_v: The number of integers to read.
+ *
+ * Reads @n_v consecutive varints from the buffer starting at the current
+ * offset.  On failure the contents of @v are undefined and the offset is
+ * left unchanged.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE.
+ *
+ * Side effects: None.
+ */
+gboolean
+egg_buffer_read_uint64_array (EggBuffer *buffer,
+                              guint64   *v,
+                              gsize      n_v)
+{
+	gsize pos;
+	gsize i;
 
-		b = buffer->ar->data[buffer->pos++];
-		u |= ((guint64)(b & 0x7F) << o);
-		o += 7;
-	} while ((b & 0x80) != 0);
+	g_return_val_if_fail(buffer != NULL, FALSE);
+	g_return_val_if_fail(v != NULL || n_v == 0, FALSE);
 
-	*i = u;
+	pos = buffer->pos;
+	for (i = 0; i < n_v; i++) {
+		if (!egg_buffer_read_varint(buffer, &v[i], VARINT64_MAX)) {
+			buffer->pos = pos;
+			return FALSE;
+		}
+	}
 
 	return TRUE;
 }
@@ -726,6 +908,37 @@ egg_buffer_read_data (EggBuffer  *buffer,
 	return FALSE;
 }
 
+/**
+ * egg_buffer_read_bytes:
+ * @buffer: An #EggBuffer
+ * @data: A location for the bytes.
+ * @len: The number of bytes to read.
+ *
+ * Reads @len raw bytes written with egg_buffer_write_bytes().  @data is
+ * set to point within the buffer and is valid for the lifetime of the
+ * buffer; it should not be modified or freed.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE.
+ *
+ * Side effects: None.
+ */
+gboolean
+egg_buffer_read_bytes (EggBuffer     *buffer,
+                       const guint8 **data,
+                       gsize          len)
+{
+	g_return_val_if_fail(buffer != NULL, FALSE);
+	g_return_val_if_fail(data != NULL, FALSE);
+
+	if (len > buffer->ar->len - buffer->pos)
+		return FALSE;
+
+	*data = &buffer->ar->data[buffer->pos];
+	buffer->pos += len;
+
+	return TRUE;
+}
+
 /**
  * egg_buffer_read_double:
  * @buffer: An #EggBuffer.
@@ -832,6 +1045,44 @@ egg_buffer_get_length (EggBuffer *buffer)
 	return buffer->ar->len;
 }
 
+/**
+ * egg_buffer_get_capacity:
+ * @buffer: An #EggBuffer.
+ *
+ * Retrieves the number of bytes @buffer has grown to hold.  Since
+ * egg_buffer_reset() keeps the storage, this may be much larger than the
+ * current length.
+ *
+ * Returns: The capacity of the buffer.
+ */
+gsize
+egg_buffer_get_capacity (EggBuffer *buffer)
+{
+	g_return_val_if_fail(buffer != NULL, 0);
+
+	return MAX(buffer->peak, buffer->ar->len);
+}
+
+/**
+ * egg_buffer_reset:
+ * @buffer: An #EggBuffer.
+ *
+ * Truncates @buffer to zero length and rewinds the read position so that
+ * it may be reused.  The storage already allocated for the buffer is kept
+ * so that subsequent writes do not need to grow it again.
+ *
+ * Side effects: None.
+ */
+void
+egg_buffer_reset (EggBuffer *buffer)
+{
+	g_return_if_fail(buffer != NULL);
+
+	buffer->peak = MAX(buffer->peak, buffer->ar->len);
+	g_byte_array_set_size(buffer->ar, 0);
+	buffer->pos = 0;
+}
+
 GType
 egg_buffer_get_type (void)
 {
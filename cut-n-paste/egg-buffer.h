@@ -52,15 +52,21 @@ GType          egg_buffer_get_type      (void) G_GNUC_CONST;
 EggBuffer*     egg_buffer_new           (void);
 EggBuffer*     egg_buffer_new_from_data (const guint8  *data,
                                          gsize          len);
+EggBuffer*     egg_buffer_new_for_array (GByteArray    *ar);
 EggBuffer*     egg_buffer_ref           (EggBuffer     *buffer);
 void           egg_buffer_unref         (EggBuffer     *buffer);
+void           egg_buffer_reset         (EggBuffer     *buffer);
 gsize          egg_buffer_get_pos       (EggBuffer     *buffer);
 gsize          egg_buffer_get_length    (EggBuffer     *buffer);
+gsize          egg_buffer_get_capacity  (EggBuffer     *buffer);
 void           egg_buffer_get_buffer    (EggBuffer     *buffer,
                                          const guint8 **data,
                                          gsize         *len);
 gboolean       egg_buffer_read_boolean  (EggBuffer     *buffer,
                                          gboolean      *b);
+gboolean       egg_buffer_read_bytes    (EggBuffer     *buffer,
+                                         const guint8 **data,
+                                         gsize          len);
 gboolean       egg_buffer_read_data     (EggBuffer     *buffer,
                                          guint8       **data,
                                          gsize         *len);
@@ -81,8 +87,15 @@ gboolean       egg_buffer_read_uint     (EggBuffer     *buffer,
                                          guint         *i);
 gboolean       egg_buffer_read_uint64   (EggBuffer     *buffer,
                                          guint64       *i);
+gboolean       egg_buffer_read_uint64_array
+                                        (EggBuffer     *buffer,
+                                         guint64       *v,
+                                         gsize          n_v);
 void           egg_buffer_write_boolean (EggBuffer     *buffer,
                                          gboolean       b);
+void           egg_buffer_write_bytes   (EggBuffer     *buffer,
+                                         const guint8  *data,
+                                         gsize          len);
 void           egg_buffer_write_data    (EggBuffer     *buffer,
                                          const guint8  *data,
                                          gsize          len);
@@ -103,6 +116,10 @@ void           egg_buffer_write_uint    (EggBuffer     *buffer,
                                          guint          i);
 void           egg_buffer_write_uint64  (EggBuffer     *buffer,
                                          guint64        i);
+void           egg_buffer_write_uint64_array
+                                        (EggBuffer     *buffer,
+                                         const guint64 *v,
+                                         gsize          n_v);
 
 static inline gint
 egg_buffer_bytes_for_int (gint i)
@@ -117,6 +134,19 @@ egg_buffer_bytes_for_int (gint i)
 	return b;
 }
 
+static inline gint
+egg_buffer_bytes_for_uint (guint i)
+{
+	gint b = 0;
+
+	do {
+		b++;
+		i >>= 7;
+	} while (i > 0);
+
+	return b;
+}
+
 G_END_DECLS
 
 #endif /* __EGG_BUFFER_H__ */
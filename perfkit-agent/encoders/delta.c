@@ -0,0 +1,643 @@
+/* delta.c
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <perfkit-agent/perfkit-agent.h>
+
+#ifdef G_LOG_DOMAIN
+#undef G_LOG_DOMAIN
+#endif
+#define G_LOG_DOMAIN "Delta"
+
+/*
+ * The Delta encoder is aimed at counter style sources which report mostly
+ * the same, slowly increasing values on every tick.  The default encoding
+ * of each buffer is rewritten so that every value is replaced by its
+ * difference from the previous value of the same row of the same source:
+ *
+ *   - Integer rows are written as a zigzag varint of the delta.
+ *   - Double rows are written as the XOR of their bits with the previous
+ *     bits.  Since consecutive values tend to share their sign, exponent
+ *     and high mantissa bits, only the bytes between the leading and
+ *     trailing zero bytes of the XOR are written, prefixed by a header
+ *     byte holding the number of trailing zero bytes and the number of
+ *     bytes written.  An unchanged value is a single zero byte.
+ *   - The relative timestamp of each sample is delta'd against the
+ *     previous sample of the same source.
+ *   - Everything else is copied untouched.
+ *
+ * Field tags are preserved so the stream stays self-describing.  Packed
+ * samples have no tags; their bitmap of present rows is copied and each
+ * present value is found and rewritten by the type of its row in the
+ * manifest.  Each
+ * encoding is written as a frame: a byte identifying it as a manifest or
+ * as samples, as the decoder needs the row types from the manifest,
+ * followed by the length of the frame as a varint.  The subscription
+ * concatenates the frames of several batches into one buffer, so a
+ * buffer may hold any number of frames.  The previous values of a source
+ * are reset whenever its manifest is encoded.
+ *
+ * Frames and sample data are rewritten straight onto the end of the
+ * subscription's buffer.  Their lengths are only known once written, so
+ * the length of a frame is padded to DELTA_FRAME_LEN_MAX bytes, and the
+ * data of a sample is moved up in the rare case its length needs more
+ * than the one byte reserved for it.
+ *
+ * Like the ZLib encoder, the state carries across buffers.  The encoder
+ * is not shareable, so the agent only ever attaches an instance to a
+ * single subscription.
+ */
+
+#define DELTA_TYPE_ENCODER    (delta_encoder_get_type())
+#define DELTA_ENCODER(o)      (G_TYPE_CHECK_INSTANCE_CAST((o), DELTA_TYPE_ENCODER, DeltaEncoder))
+#define DELTA_FRAME_MANIFEST  ('M')
+#define DELTA_FRAME_SAMPLES   ('S')
+#define DELTA_FRAME_LEN_MAX   (5)   /* Frames up to 32 GiB */
+#define DELTA_ZIGZAG(_i)      (((guint64)(_i) << 1) ^ (guint64)((gint64)(_i) >> 63))
+#define DELTA_UNZIGZAG(_u)    ((gint64)(((_u) >> 1) ^ -((_u) & 0x1)))
+
+typedef enum
+{
+	DELTA_ROW_RAW,
+	DELTA_ROW_SIGNED,
+	DELTA_ROW_UNSIGNED,
+	DELTA_ROW_DOUBLE,
+	DELTA_ROW_BOOLEAN,
+	DELTA_ROW_FLOAT,
+	DELTA_ROW_STRING,
+} DeltaRowKind;
+
+typedef struct
+{
+	gint     n_rows;
+	guint8  *kinds;     /* DeltaRowKind indexed by row id */
+	guint64 *prev;      /* Previous value indexed by row id */
+	guint64  prev_time; /* Previous relative timestamp */
+	gboolean packed;    /* Samples use the packed layout */
+} DeltaSource;
+
+typedef struct
+{
+	GObject     parent;
+
+	GMutex     *mutex;
+	GHashTable *sources;
+	GByteArray *scratch;
+} DeltaEncoder;
+
+typedef struct
+{
+	GObjectClass parent_class;
+} DeltaEncoderClass;
+
+static void delta_encoder_init_encoder (PkaEncoderIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(DeltaEncoder, delta_encoder, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(PKA_TYPE_ENCODER,
+                                              delta_encoder_init_encoder))
+
+static void
+delta_source_free (gpointer data)
+{
+	DeltaSource *source = data;
+
+	g_free(source->kinds);
+	g_free(source->prev);
+	g_slice_free(DeltaSource, source);
+}
+
+static inline gboolean
+delta_read_varint (const guint8 **p,
+                   const guint8  *end,
+                   guint64       *v)
+{
+	guint64 r = 0;
+	guint shift;
+	guint8 b;
+
+	for (shift = 0; *p < end && shift < 64; shift += 7) {
+		b = *(*p)++;
+		r |= (guint64)(b & 0x7F) << shift;
+		if (!(b & 0x80)) {
+			*v = r;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static inline void
+delta_write_varint (GByteArray *ar,
+                    guint64     v)
+{
+	guint8 buf[10];
+	gint n = 0;
+
+	do {
+		buf[n++] = ((v > 0x7F) << 7) | (v & 0x7F);
+		v >>= 7;
+	} while (v);
+	g_byte_array_append(ar, buf, n);
+}
+
+/*
+ * Write the XOR of two doubles, dropping its leading and trailing zero
+ * bytes.
+ */
+static inline void
+delta_write_xor (GByteArray *ar,
+                 guint64     x)
+{
+	guint8 buf[9];
+	guint trail = 0;
+	guint n = 0;
+
+	if (!x) {
+		buf[0] = 0;
+		g_byte_array_append(ar, buf, 1);
+		return;
+	}
+	while (!(x & 0xFF)) {
+		x >>= 8;
+		trail++;
+	}
+	while (x) {
+		buf[++n] = x & 0xFF;
+		x >>= 8;
+	}
+	buf[0] = (trail << 4) | n;
+	g_byte_array_append(ar, buf, n + 1);
+}
+
+/*
+ * Reserve a byte for the length of the data to be appended to @ar.
+ */
+static inline guint
+delta_begin_length (GByteArray *ar)
+{
+	guint offset = ar->len;
+
+	g_byte_array_set_size(ar, offset + 1);
+	return offset;
+}
+
+/*
+ * Write the length of the data appended since delta_begin_length().
+ */
+static inline void
+delta_end_length (GByteArray *ar,
+                  guint       offset)
+{
+	guint8 buf[10];
+	guint64 v;
+	guint len;
+	gint n = 0;
+
+	len = ar->len - offset - 1;
+	v = len;
+	do {
+		buf[n++] = ((v > 0x7F) << 7) | (v & 0x7F);
+		v >>= 7;
+	} while (v);
+	if (n > 1) {
+		g_byte_array_set_size(ar, ar->len + n - 1);
+		memmove(&ar->data[offset + n], &ar->data[offset + 1], len);
+	}
+	memcpy(&ar->data[offset], buf, n);
+}
+
+/*
+ * Begin a frame on the end of @ar.  The frame is complete once
+ * delta_end_frame() is called with the returned offset.
+ */
+static inline guint
+delta_begin_frame (GByteArray *ar,
+                   guint8      frame)
+{
+	guint offset = ar->len;
+
+	g_byte_array_append(ar, &frame, 1);
+	g_byte_array_set_size(ar, ar->len + DELTA_FRAME_LEN_MAX);
+	return offset;
+}
+
+/*
+ * Write the length of the frame begun at @offset as a padded varint.
+ */
+static inline void
+delta_end_frame (GByteArray *ar,
+                 guint       offset)
+{
+	guint8 *p = &ar->data[offset + 1];
+	guint64 len;
+	gint i;
+
+	len = ar->len - offset - 1 - DELTA_FRAME_LEN_MAX;
+	for (i = 0; i < DELTA_FRAME_LEN_MAX; i++) {
+		p[i] = (len & 0x7F) | ((i < DELTA_FRAME_LEN_MAX - 1) << 7);
+		len >>= 7;
+	}
+}
+
+static inline guint64
+delta_read_le64 (const guint8 *p)
+{
+	guint64 v = 0;
+	gint i;
+
+	for (i = 7; i >= 0; i--) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+/*
+ * Rewrite the fields of a single sample's data section.
+ */
+static gboolean
+delta_encoder_encode_payload (DeltaSource  *source,
+                              const guint8 *p,
+                              const guint8 *end,
+                              GByteArray   *ar)
+{
+	DeltaRowKind kind;
+	guint64 field;
+	guint64 len;
+	guint64 row;
+	guint64 u;
+	gint64 v;
+
+	while (p < end) {
+		if (!delta_read_varint(&p, end, &field)) {
+			return FALSE;
+		}
+		delta_write_varint(ar, field);
+		row = field >> 3;
+		kind = DELTA_ROW_RAW;
+		if (row >= 1 && row <= (guint64)source->n_rows) {
+			kind = source->kinds[row];
+		}
+		switch (field & 0x7) {
+		case 0: /* Varint */
+			if (!delta_read_varint(&p, end, &u)) {
+				return FALSE;
+			}
+			if (kind == DELTA_ROW_SIGNED) {
+				v = DELTA_UNZIGZAG(u);
+				delta_write_varint(ar, DELTA_ZIGZAG(v - source->prev[row]));
+				source->prev[row] = v;
+			} else if (kind == DELTA_ROW_UNSIGNED) {
+				delta_write_varint(ar, DELTA_ZIGZAG(u - source->prev[row]));
+				source->prev[row] = u;
+			} else {
+				delta_write_varint(ar, u);
+			}
+			break;
+		case 1: /* 64-bit */
+			if (end - p < 8) {
+				return FALSE;
+			}
+			if (kind == DELTA_ROW_DOUBLE) {
+				u = delta_read_le64(p);
+				delta_write_xor(ar, u ^ source->prev[row]);
+				source->prev[row] = u;
+			} else {
+				g_byte_array_append(ar, p, 8);
+			}
+			p += 8;
+			break;
+		case 2: /* Length delimited */
+			if (!delta_read_varint(&p, end, &len) ||
+			    len > (guint64)(end - p)) {
+				return FALSE;
+			}
+			delta_write_varint(ar, len);
+			g_byte_array_append(ar, p, len);
+			p += len;
+			break;
+		case 5: /* 32-bit */
+			if (end - p < 4) {
+				return FALSE;
+			}
+			g_byte_array_append(ar, p, 4);
+			p += 4;
+			break;
+		default:
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * Rewrite the data section of a single packed sample.  The values follow
+ * the bitmap of present rows untagged, in row order.
+ */
+static gboolean
+delta_encoder_encode_packed (DeltaSource  *source,
+                             const guint8 *p,
+                             const guint8 *end,
+                             GByteArray   *ar)
+{
+	const guint8 *bitmap = p;
+	guint64 len;
+	guint64 u;
+	gint64 v;
+	gint row;
+
+	if (end - p < (source->n_rows + 7) / 8) {
+		return FALSE;
+	}
+	g_byte_array_append(ar, p, (source->n_rows + 7) / 8);
+	p += (source->n_rows + 7) / 8;
+
+	for (row = 1; row <= source->n_rows; row++) {
+		if (!(bitmap[(row - 1) / 8] & (1 << ((row - 1) % 8)))) {
+			continue;
+		}
+		switch (source->kinds[row]) {
+		case DELTA_ROW_SIGNED:
+			if (!delta_read_varint(&p, end, &u)) {
+				return FALSE;
+			}
+			v = DELTA_UNZIGZAG(u);
+			delta_write_varint(ar, DELTA_ZIGZAG(v - source->prev[row]));
+			source->prev[row] = v;
+			break;
+		case DELTA_ROW_UNSIGNED:
+			if (!delta_read_varint(&p, end, &u)) {
+				return FALSE;
+			}
+			delta_write_varint(ar, DELTA_ZIGZAG(u - source->prev[row]));
+			source->prev[row] = u;
+			break;
+		case DELTA_ROW_DOUBLE:
+			if (end - p < 8) {
+				return FALSE;
+			}
+			u = delta_read_le64(p);
+			delta_write_xor(ar, u ^ source->prev[row]);
+			source->prev[row] = u;
+			p += 8;
+			break;
+		case DELTA_ROW_BOOLEAN:
+		case DELTA_ROW_FLOAT:
+			len = (source->kinds[row] == DELTA_ROW_BOOLEAN) ? 1 : 4;
+			if (len > (guint64)(end - p)) {
+				return FALSE;
+			}
+			g_byte_array_append(ar, p, len);
+			p += len;
+			break;
+		case DELTA_ROW_STRING:
+			if (!delta_read_varint(&p, end, &len) ||
+			    len > (guint64)(end - p)) {
+				return FALSE;
+			}
+			delta_write_varint(ar, len);
+			g_byte_array_append(ar, p, len);
+			p += len;
+			break;
+		default:
+			/* no other type can be appended to a packed sample */
+			return FALSE;
+		}
+	}
+	return p == end;
+}
+
+/*
+ * Rewrite the default encoding of samples in the scratch buffer onto the
+ * end of @ar.  @ar is left partially written on failure.
+ */
+static gboolean
+delta_encoder_encode_scratch (DeltaEncoder *delta,
+                              GByteArray   *ar)
+{
+	DeltaSource *source;
+	const guint8 *p = delta->scratch->data;
+	const guint8 *end = p + delta->scratch->len;
+	guint64 source_id;
+	guint64 field;
+	guint64 len;
+	guint64 t;
+	guint offset;
+
+	ENTRY;
+	while (p < end) {
+		/*
+		 * Source identifier.
+		 */
+		if (!delta_read_varint(&p, end, &field) || field != ((1 << 3) | 0) ||
+		    !delta_read_varint(&p, end, &source_id)) {
+			RETURN(FALSE);
+		}
+		source = g_hash_table_lookup(delta->sources,
+		                             GINT_TO_POINTER((gint)source_id));
+		if (!source) {
+			WARNING(Delta, "Sample for source %d without a manifest.",
+			        (gint)source_id);
+			RETURN(FALSE);
+		}
+		delta_write_varint(ar, field);
+		delta_write_varint(ar, source_id);
+
+		/*
+		 * Relative timestamp.
+		 */
+		if (!delta_read_varint(&p, end, &field) || field != ((2 << 3) | 0) ||
+		    !delta_read_varint(&p, end, &t)) {
+			RETURN(FALSE);
+		}
+		delta_write_varint(ar, field);
+		delta_write_varint(ar, DELTA_ZIGZAG(t - source->prev_time));
+		source->prev_time = t;
+
+		/*
+		 * Sample data.
+		 */
+		if (!delta_read_varint(&p, end, &field) || field != ((3 << 3) | 2) ||
+		    !delta_read_varint(&p, end, &len) || len > (guint64)(end - p)) {
+			RETURN(FALSE);
+		}
+		delta_write_varint(ar, field);
+		offset = delta_begin_length(ar);
+		if (source->packed) {
+			if (!delta_encoder_encode_packed(source, p, p + len, ar)) {
+				RETURN(FALSE);
+			}
+		} else if (!delta_encoder_encode_payload(source, p, p + len, ar)) {
+			RETURN(FALSE);
+		}
+		delta_end_length(ar, offset);
+		p += len;
+	}
+	RETURN(TRUE);
+}
+
+/*
+ * Encode samples using the default encoding and rewrite the result as
+ * deltas onto the end of @ar.
+ */
+static gboolean
+delta_encoder_encode_samples_append (PkaEncoder   *encoder,
+                                     PkaManifest  *manifest,
+                                     PkaSample   **samples,
+                                     gint          n_samples,
+                                     GByteArray   *ar)
+{
+	DeltaEncoder *delta = DELTA_ENCODER(encoder);
+	gboolean ret = FALSE;
+	guint offset;
+
+	ENTRY;
+	g_mutex_lock(delta->mutex);
+	g_byte_array_set_size(delta->scratch, 0);
+	if (!pka_encoder_encode_samples_append(NULL, manifest, samples,
+	                                       n_samples, delta->scratch)) {
+		GOTO(unlock);
+	}
+	offset = delta_begin_frame(ar, DELTA_FRAME_SAMPLES);
+	if (!(ret = delta_encoder_encode_scratch(delta, ar))) {
+		g_byte_array_set_size(ar, offset);
+		GOTO(unlock);
+	}
+	delta_end_frame(ar, offset);
+  unlock:
+	g_mutex_unlock(delta->mutex);
+	RETURN(ret);
+}
+
+/*
+ * Encode the manifest using the default encoding, which the decoder needs
+ * as is, and reset the previous values of its source.
+ */
+static gboolean
+delta_encoder_encode_manifest_append (PkaEncoder   *encoder,
+                                      PkaManifest  *manifest,
+                                      GByteArray   *ar)
+{
+	DeltaEncoder *delta = DELTA_ENCODER(encoder);
+	DeltaSource *source;
+	gboolean ret = FALSE;
+	guint offset;
+	gint i;
+
+	ENTRY;
+	g_mutex_lock(delta->mutex);
+	offset = delta_begin_frame(ar, DELTA_FRAME_MANIFEST);
+	if (!pka_encoder_encode_manifest_append(NULL, manifest, ar)) {
+		g_byte_array_set_size(ar, offset);
+		GOTO(unlock);
+	}
+	delta_end_frame(ar, offset);
+	source = g_slice_new0(DeltaSource);
+	source->n_rows = pka_manifest_get_n_rows(manifest);
+	source->packed = pka_manifest_get_packed(manifest);
+	source->kinds = g_new0(guint8, source->n_rows + 1);
+	source->prev = g_new0(guint64, source->n_rows + 1);
+	for (i = 1; i <= source->n_rows; i++) {
+		switch (pka_manifest_get_row_type(manifest, i)) {
+		case G_TYPE_INT:
+		case G_TYPE_INT64:
+			source->kinds[i] = DELTA_ROW_SIGNED;
+			break;
+		case G_TYPE_UINT:
+		case G_TYPE_UINT64:
+			source->kinds[i] = DELTA_ROW_UNSIGNED;
+			break;
+		case G_TYPE_DOUBLE:
+			source->kinds[i] = DELTA_ROW_DOUBLE;
+			break;
+		case G_TYPE_BOOLEAN:
+			source->kinds[i] = DELTA_ROW_BOOLEAN;
+			break;
+		case G_TYPE_FLOAT:
+			source->kinds[i] = DELTA_ROW_FLOAT;
+			break;
+		case G_TYPE_STRING:
+			source->kinds[i] = DELTA_ROW_STRING;
+			break;
+		default:
+			source->kinds[i] = DELTA_ROW_RAW;
+			break;
+		}
+	}
+	g_hash_table_replace(delta->sources,
+	                     GINT_TO_POINTER(pka_manifest_get_source_id(manifest)),
+	                     source);
+	ret = TRUE;
+  unlock:
+	g_mutex_unlock(delta->mutex);
+	RETURN(ret);
+}
+
+static void
+delta_encoder_init_encoder (PkaEncoderIface *iface)
+{
+	iface->encode_samples_append = delta_encoder_encode_samples_append;
+	iface->encode_manifest_append = delta_encoder_encode_manifest_append;
+}
+
+static void
+delta_encoder_finalize (GObject *object)
+{
+	DeltaEncoder *encoder = DELTA_ENCODER(object);
+
+	ENTRY;
+	g_hash_table_destroy(encoder->sources);
+	g_byte_array_free(encoder->scratch, TRUE);
+	g_mutex_free(encoder->mutex);
+	G_OBJECT_CLASS(delta_encoder_parent_class)->finalize(object);
+	EXIT;
+}
+
+static void
+delta_encoder_class_init (DeltaEncoderClass *klass)
+{
+	GObjectClass *object_class;
+
+	object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = delta_encoder_finalize;
+}
+
+static void
+delta_encoder_init (DeltaEncoder *encoder)
+{
+	encoder->mutex = g_mutex_new();
+	encoder->sources = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	                                         NULL, delta_source_free);
+	encoder->scratch = g_byte_array_sized_new(4096);
+}
+
+GObject*
+delta_encoder_new (GError **error)
+{
+	return g_object_new(DELTA_TYPE_ENCODER, NULL);
+}
+
+const PkaPluginInfo pka_plugin_info = {
+	.id          = "Delta",
+	.name        = "Delta Encoder",
+	.description = "Encodes samples as deltas from the previous sample "
+	               "of each source.",
+	.version     = "0.1.1",
+	.copyright   = "Copyright 2010 Christian Hergert",
+	.factory     = delta_encoder_new,
+	.plugin_type = PKA_PLUGIN_ENCODER,
+};
@@ -0,0 +1,241 @@
+/* zlib.c
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <zlib.h>
+#include <perfkit-agent/perfkit-agent.h>
+
+#ifdef G_LOG_DOMAIN
+#undef G_LOG_DOMAIN
+#endif
+#define G_LOG_DOMAIN "ZLib"
+
+/*
+ * The ZLib encoder compresses the default encoding of manifests and samples
+ * with a single deflate stream that lives as long as the encoder.  Each
+ * buffer is terminated with Z_SYNC_FLUSH so that it can be inflated as soon
+ * as it arrives, while the dictionary carries across buffers so that the
+ * highly repetitive sample stream compresses well even in small batches.
+ *
+ * Since the stream is stateful, the buffers must be inflated in the order
+ * they were produced by a single inflate stream on the other side.  The
+ * encoder is not shareable, so the agent only ever attaches an instance to
+ * one subscription.  If deflate() fails part way through a buffer, the
+ * receiver can no longer follow the stream, so the encoder fails every
+ * buffer after that and the subscription stops delivering with it.
+ */
+
+#define ZLIB_TYPE_ENCODER (zlib_encoder_get_type())
+#define ZLIB_ENCODER(o)   (G_TYPE_CHECK_INSTANCE_CAST((o), ZLIB_TYPE_ENCODER, ZlibEncoder))
+#define CHUNK_SIZE        (4096)
+
+typedef struct
+{
+	GObject     parent;
+
+	GMutex     *mutex;
+	z_stream    stream;
+	gboolean    stream_valid;
+	GByteArray *scratch;
+} ZlibEncoder;
+
+typedef struct
+{
+	GObjectClass parent_class;
+} ZlibEncoderClass;
+
+static void zlib_encoder_init_encoder (PkaEncoderIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(ZlibEncoder, zlib_encoder, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(PKA_TYPE_ENCODER,
+                                              zlib_encoder_init_encoder))
+
+/*
+ * Deflate the contents of the scratch buffer onto the end of @ar.  The
+ * output is flushed to a byte boundary so that the receiver can inflate
+ * everything written so far.
+ */
+static gboolean
+zlib_encoder_deflate (ZlibEncoder *encoder,
+                      GByteArray  *ar)
+{
+	z_stream *stream = &encoder->stream;
+	guint offset;
+	gint ret;
+
+	ENTRY;
+	stream->next_in = encoder->scratch->data;
+	stream->avail_in = encoder->scratch->len;
+	do {
+		offset = ar->len;
+		g_byte_array_set_size(ar, offset + CHUNK_SIZE);
+		stream->next_out = ar->data + offset;
+		stream->avail_out = CHUNK_SIZE;
+		ret = deflate(stream, Z_SYNC_FLUSH);
+		g_byte_array_set_size(ar, offset + CHUNK_SIZE - stream->avail_out);
+		/*
+		 * Z_BUF_ERROR only means no progress was possible, which happens
+		 * when the previous pass filled the chunk exactly.
+		 */
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			WARNING(ZLib, "deflate() failed: %s",
+			        stream->msg ? stream->msg : "unknown error");
+			deflateEnd(stream);
+			encoder->stream_valid = FALSE;
+			RETURN(FALSE);
+		}
+	} while (stream->avail_out == 0);
+	g_byte_array_set_size(encoder->scratch, 0);
+	RETURN(TRUE);
+}
+
+/*
+ * Encode samples using the default encoding and compress the result onto
+ * the end of @ar.
+ */
+static gboolean
+zlib_encoder_encode_samples_append (PkaEncoder   *encoder,
+                                    PkaManifest  *manifest,
+                                    PkaSample   **samples,
+                                    gint          n_samples,
+                                    GByteArray   *ar)
+{
+	ZlibEncoder *zlib = ZLIB_ENCODER(encoder);
+	gboolean ret = FALSE;
+
+	ENTRY;
+	g_mutex_lock(zlib->mutex);
+	if (!zlib->stream_valid) {
+		GOTO(unlock);
+	}
+	g_byte_array_set_size(zlib->scratch, 0);
+	if (!pka_encoder_encode_samples_append(NULL, manifest, samples,
+	                                       n_samples, zlib->scratch)) {
+		GOTO(unlock);
+	}
+	ret = zlib_encoder_deflate(zlib, ar);
+  unlock:
+	g_mutex_unlock(zlib->mutex);
+	RETURN(ret);
+}
+
+/*
+ * Encode the manifest using the default encoding and compress the result
+ * onto the end of @ar.
+ */
+static gboolean
+zlib_encoder_encode_manifest_append (PkaEncoder   *encoder,
+                                     PkaManifest  *manifest,
+                                     GByteArray   *ar)
+{
+	ZlibEncoder *zlib = ZLIB_ENCODER(encoder);
+	gboolean ret = FALSE;
+
+	ENTRY;
+	g_mutex_lock(zlib->mutex);
+	if (!zlib->stream_valid) {
+		GOTO(unlock);
+	}
+	g_byte_array_set_size(zlib->scratch, 0);
+	if (!pka_encoder_encode_manifest_append(NULL, manifest, zlib->scratch)) {
+		GOTO(unlock);
+	}
+	ret = zlib_encoder_deflate(zlib, ar);
+  unlock:
+	g_mutex_unlock(zlib->mutex);
+	RETURN(ret);
+}
+
+static void
+zlib_encoder_init_encoder (PkaEncoderIface *iface)
+{
+	iface->encode_samples_append = zlib_encoder_encode_samples_append;
+	iface->encode_manifest_append = zlib_encoder_encode_manifest_append;
+}
+
+static void
+zlib_encoder_finalize (GObject *object)
+{
+	ZlibEncoder *encoder = ZLIB_ENCODER(object);
+
+	ENTRY;
+	if (encoder->stream_valid) {
+		deflateEnd(&encoder->stream);
+	}
+	g_byte_array_free(encoder->scratch, TRUE);
+	g_mutex_free(encoder->mutex);
+	G_OBJECT_CLASS(zlib_encoder_parent_class)->finalize(object);
+	EXIT;
+}
+
+static void
+zlib_encoder_class_init (ZlibEncoderClass *klass)
+{
+	GObjectClass *object_class;
+
+	object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = zlib_encoder_finalize;
+}
+
+static void
+zlib_encoder_init (ZlibEncoder *encoder)
+{
+	encoder->mutex = g_mutex_new();
+	encoder->scratch = g_byte_array_sized_new(CHUNK_SIZE);
+}
+
+/*
+ * Create a new ZLib encoder using the compression level from the
+ * [encoder.zlib] configuration group.
+ */
+GObject*
+zlib_encoder_new (GError **error)
+{
+	ZlibEncoder *encoder;
+	gint level;
+
+	ENTRY;
+	level = pka_config_get_integer("encoder.zlib", "level",
+	                               Z_DEFAULT_COMPRESSION);
+	if (level != Z_DEFAULT_COMPRESSION) {
+		level = CLAMP(level, Z_NO_COMPRESSION, Z_BEST_COMPRESSION);
+	}
+	encoder = g_object_new(ZLIB_TYPE_ENCODER, NULL);
+	memset(&encoder->stream, 0, sizeof(encoder->stream));
+	if (deflateInit(&encoder->stream, level) != Z_OK) {
+		g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOMEM,
+		            "Failed to initialize deflate stream: %s",
+		            encoder->stream.msg ? encoder->stream.msg
+		                                : "unknown error");
+		g_object_unref(encoder);
+		RETURN(NULL);
+	}
+	encoder->stream_valid = TRUE;
+	RETURN(G_OBJECT(encoder));
+}
+
+const PkaPluginInfo pka_plugin_info = {
+	.id          = "ZLib",
+	.name        = "ZLib Encoder",
+	.description = "Compresses manifests and samples with a streaming "
+	               "deflate encoder.",
+	.version     = "0.1.1",
+	.copyright   = "Copyright 2010 Christian Hergert",
+	.factory     = zlib_encoder_new,
+	.plugin_type = PKA_PLUGIN_ENCODER,
+};
@@ -553,6 +553,7 @@ pka_listener_dbus_encoder_get_plugin_cb (GObject      *listener,  /* IN */
 		                         DBUS_TYPE_OBJECT_PATH, &plugin_path,
 		                         DBUS_TYPE_INVALID);
 		g_free(plugin_path);
+		g_free(plugin);
 	}
 	dbus_connection_send(priv->dbus, reply, NULL);
 	dbus_message_unref(reply);
@@ -637,6 +638,12 @@ static const gchar * SourceIntrospection =
 	" <interface name=\"org.perfkit.Agent.Source\">"
 	"  <method name=\"GetPlugin\">"
     "   <arg name=\"plugin\" direction=\"out\" type=\"o\"/>"
+	"  </method>"
+	"  <method name=\"GetStats\">"
+    "   <arg name=\"n_samples\" direction=\"out\" type=\"t\"/>"
+    "   <arg name=\"n_missed\" direction=\"out\" type=\"t\"/>"
+    "   <arg name=\"lateness\" direction=\"out\" type=\"au\"/>"
+    "   <arg name=\"duration\" direction=\"out\" type=\"au\"/>"
 	"  </method>"
 	" </interface>"
 	" <interface name=\"org.freedesktop.DBus.Introspectable\">"
@@ -694,6 +701,66 @@ pka_listener_dbus_source_get_plugin_cb (GObject      *listener,  /* IN */
 	EXIT;
 }
 
+/**
+ * pka_listener_dbus_source_get_stats_cb:
+ * @listener: A #PkaListenerDBus.
+ * @result: A #GAsyncResult.
+ * @user_data: A #DBusMessage containing the incoming method call.
+ *
+ * Handles the completion of the "source_get_stats" RPC.  A response
+ * to the message is created and sent as a reply to the caller.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_listener_dbus_source_get_stats_cb (GObject      *listener,  /* IN */
+                                       GAsyncResult *result,    /* IN */
+                                       gpointer      user_data) /* IN */
+{
+	PkaListenerDBusPrivate *priv;
+	DBusMessage *message = user_data;
+	DBusMessage *reply = NULL;
+	GError *error = NULL;
+	guint64 n_samples = 0;
+	guint64 n_missed = 0;
+	guint32 *lateness = NULL;
+	gsize lateness_len = 0;
+	guint32 *duration = NULL;
+	gsize duration_len = 0;
+
+	ENTRY;
+	priv = PKA_LISTENER_DBUS(listener)->priv;
+	if (!pka_listener_source_get_stats_finish(
+			PKA_LISTENER(listener),
+			result, 
+			&n_samples,
+			&n_missed,
+			&lateness,
+			&lateness_len,
+			&duration,
+			&duration_len,
+			&error)) {
+		reply = dbus_message_new_error(message, DBUS_ERROR_FAILED,
+		                               error->message);
+		g_error_free(error);
+	} else {
+		reply = dbus_message_new_method_return(message);
+		dbus_message_append_args(reply,
+		                         DBUS_TYPE_UINT64, &n_samples,
+		                         DBUS_TYPE_UINT64, &n_missed,
+		                         DBUS_TYPE_ARRAY, DBUS_TYPE_UINT32, &lateness, lateness_len,
+		                         DBUS_TYPE_ARRAY, DBUS_TYPE_UINT32, &duration, duration_len,
+		                         DBUS_TYPE_INVALID);
+		g_free(lateness);
+		g_free(duration);
+	}
+	dbus_connection_send(priv->dbus, reply, NULL);
+	dbus_message_unref(reply);
+	dbus_message_unref(message);
+	EXIT;
+}
+
 /**
  * pka_listener_dbus_handle_source_message:
  * @connection: A #DBusConnection.
@@ -753,6 +820,25 @@ pka_listener_dbus_handle_source_message (DBusConnection *connection, /* IN */
 			                                     dbus_message_ref(message));
 			ret = DBUS_HANDLER_RESULT_HANDLED;
 		}
+		else if (IS_MEMBER(message, "GetStats")) {
+			gint source = 0;
+			const gchar *dbus_path;
+
+			dbus_path = dbus_message_get_path(message);
+			if (sscanf(dbus_path, "/org/perfkit/Agent/Source/%d", &source) != 1) {
+				goto oom;
+			}
+			if (!dbus_message_get_args(message, NULL,
+			                           DBUS_TYPE_INVALID)) {
+				GOTO(oom);
+			}
+			pka_listener_source_get_stats_async(PKA_LISTENER(listener),
+			                                    source,
+			                                    NULL,
+			                                    pka_listener_dbus_source_get_stats_cb,
+			                                    dbus_message_ref(message));
+			ret = DBUS_HANDLER_RESULT_HANDLED;
+		}
 	}
 oom:
 	if (reply) {
@@ -771,6 +857,10 @@ static const gchar * ManagerIntrospection =
 	" <interface name=\"org.perfkit.Agent.Manager\">"
 	"  <method name=\"AddChannel\">"
     "   <arg name=\"channel\" direction=\"out\" type=\"o\"/>"
+	"  </method>"
+	"  <method name=\"AddEncoder\">"
+    "   <arg name=\"plugin\" direction=\"in\" type=\"o\"/>"
+    "   <arg name=\"encoder\" direction=\"out\" type=\"o\"/>"
 	"  </method>"
 	"  <method name=\"AddSource\">"
     "   <arg name=\"plugin\" direction=\"in\" type=\"o\"/>"
@@ -902,6 +992,54 @@ pka_listener_dbus_manager_add_channel_cb (GObject      *listener,  /* IN */
 	EXIT;
 }
 
+/**
+ * pka_listener_dbus_manager_add_encoder_cb:
+ * @listener: A #PkaListenerDBus.
+ * @result: A #GAsyncResult.
+ * @user_data: A #DBusMessage containing the incoming method call.
+ *
+ * Handles the completion of the "manager_add_encoder" RPC.  A response
+ * to the message is created and sent as a reply to the caller.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_listener_dbus_manager_add_encoder_cb (GObject      *listener,  /* IN */
+                                          GAsyncResult *result,    /* IN */
+                                          gpointer      user_data) /* IN */
+{
+	PkaListenerDBusPrivate *priv;
+	DBusMessage *message = user_data;
+	DBusMessage *reply = NULL;
+	GError *error = NULL;
+	gint encoder = 0;
+	gchar *encoder_path = NULL;
+
+	ENTRY;
+	priv = PKA_LISTENER_DBUS(listener)->priv;
+	if (!pka_listener_manager_add_encoder_finish(
+			PKA_LISTENER(listener),
+			result, 
+			&encoder,
+			&error)) {
+		reply = dbus_message_new_error(message, DBUS_ERROR_FAILED,
+		                               error->message);
+		g_error_free(error);
+	} else {
+		encoder_path = g_strdup_printf("/org/perfkit/Agent/Encoder/%d", encoder);
+		reply = dbus_message_new_method_return(message);
+		dbus_message_append_args(reply,
+		                         DBUS_TYPE_OBJECT_PATH, &encoder_path,
+		                         DBUS_TYPE_INVALID);
+		g_free(encoder_path);
+	}
+	dbus_connection_send(priv->dbus, reply, NULL);
+	dbus_message_unref(reply);
+	dbus_message_unref(message);
+	EXIT;
+}
+
 /**
  * pka_listener_dbus_manager_add_source_cb:
  * @listener: A #PkaListenerDBus.
@@ -1595,6 +1733,25 @@ pka_listener_dbus_handle_manager_message (DBusConnection *connection, /* IN */
 			                                       dbus_message_ref(message));
 			ret = DBUS_HANDLER_RESULT_HANDLED;
 		}
+		else if (IS_MEMBER(message, "AddEncoder")) {
+			gchar* plugin = NULL;
+			gchar* plugin_path = NULL;
+			if (!dbus_message_get_args(message, NULL,
+			                           DBUS_TYPE_OBJECT_PATH, &plugin_path,
+			                           DBUS_TYPE_INVALID)) {
+				GOTO(oom);
+			}
+			if (sscanf(plugin_path, "/org/perfkit/Agent/Plugin/%as", &plugin) != 1) {
+				goto oom;
+			}
+			pka_listener_manager_add_encoder_async(PKA_LISTENER(listener),
+			                                       plugin,
+			                                       NULL,
+			                                       pka_listener_dbus_manager_add_encoder_cb,
+			                                       dbus_message_ref(message));
+			g_free(plugin);
+			ret = DBUS_HANDLER_RESULT_HANDLED;
+		}
 		else if (IS_MEMBER(message, "AddSource")) {
 			gchar* plugin = NULL;
 			gchar* plugin_path = NULL;
@@ -3360,6 +3517,11 @@ static const gchar * SubscriptionIntrospection =
 	"  </method>"
 	"  <method name=\"GetSources\">"
     "   <arg name=\"sources\" direction=\"out\" type=\"ao\"/>"
+	"  </method>"
+	"  <method name=\"GetStats\">"
+    "   <arg name=\"queued\" direction=\"out\" type=\"t\"/>"
+    "   <arg name=\"delivered\" direction=\"out\" type=\"t\"/>"
+    "   <arg name=\"dropped\" direction=\"out\" type=\"t\"/>"
 	"  </method>"
 	"  <method name=\"Mute\">"
     "   <arg name=\"drain\" direction=\"in\" type=\"b\"/>"
@@ -3623,6 +3785,57 @@ pka_listener_dbus_subscription_get_sources_cb (GObject      *listener,  /* IN */
 	EXIT;
 }
 
+/**
+ * pka_listener_dbus_subscription_get_stats_cb:
+ * @listener: A #PkaListenerDBus.
+ * @result: A #GAsyncResult.
+ * @user_data: A #DBusMessage containing the incoming method call.
+ *
+ * Handles the completion of the "subscription_get_stats" RPC.  A response
+ * to the message is created and sent as a reply to the caller.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_listener_dbus_subscription_get_stats_cb (GObject      *listener,  /* IN */
+                                             GAsyncResult *result,    /* IN */
+                                             gpointer      user_data) /* IN */
+{
+	PkaListenerDBusPrivate *priv;
+	DBusMessage *message = user_data;
+	DBusMessage *reply = NULL;
+	GError *error = NULL;
+	guint64 queued = 0;
+	guint64 delivered = 0;
+	guint64 dropped = 0;
+
+	ENTRY;
+	priv = PKA_LISTENER_DBUS(listener)->priv;
+	if (!pka_listener_subscription_get_stats_finish(
+			PKA_LISTENER(listener),
+			result, 
+			&queued,
+			&delivered,
+			&dropped,
+			&error)) {
+		reply = dbus_message_new_error(message, DBUS_ERROR_FAILED,
+		                               error->message);
+		g_error_free(error);
+	} else {
+		reply = dbus_message_new_method_return(message);
+		dbus_message_append_args(reply,
+		                         DBUS_TYPE_UINT64, &queued,
+		                         DBUS_TYPE_UINT64, &delivered,
+		                         DBUS_TYPE_UINT64, &dropped,
+		                         DBUS_TYPE_INVALID);
+	}
+	dbus_connection_send(priv->dbus, reply, NULL);
+	dbus_message_unref(reply);
+	dbus_message_unref(message);
+	EXIT;
+}
+
 /**
  * pka_listener_dbus_subscription_mute_cb:
  * @listener: A #PkaListenerDBus.
@@ -4109,6 +4322,25 @@ pka_listener_dbus_handle_subscription_message (DBusConnection *connection, /* IN
 			                                            dbus_message_ref(message));
 			ret = DBUS_HANDLER_RESULT_HANDLED;
 		}
+		else if (IS_MEMBER(message, "GetStats")) {
+			gint subscription = 0;
+			const gchar *dbus_path;
+
+			dbus_path = dbus_message_get_path(message);
+			if (sscanf(dbus_path, "/org/perfkit/Agent/Subscription/%d", &subscription) != 1) {
+				goto oom;
+			}
+			if (!dbus_message_get_args(message, NULL,
+			                           DBUS_TYPE_INVALID)) {
+				GOTO(oom);
+			}
+			pka_listener_subscription_get_stats_async(PKA_LISTENER(listener),
+			                                          subscription,
+			                                          NULL,
+			                                          pka_listener_dbus_subscription_get_stats_cb,
+			                                          dbus_message_ref(message));
+			ret = DBUS_HANDLER_RESULT_HANDLED;
+		}
 		else if (IS_MEMBER(message, "Mute")) {
 			gint subscription = 0;
 			gboolean drain = 0;
@@ -33,6 +33,7 @@
 #include "pka-sample.h"
 #include "pka-source.h"
 #include "pka-source-simple.h"
+#include "pka-source-stream.h"
 #include "pka-spawn-info.h"
 #include "pka-subscription.h"
 #include "pka-version.h"
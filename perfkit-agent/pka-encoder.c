@@ -69,6 +69,9 @@ pka_resolution_apply (PkaResolution    res, /* IN */
 /**
  * pka_encoder_real_encode_samples:
  * @manifest: A #PkaManifest.
+ * @samples: An array of #PkaSample.
+ * @n_samples: The number of samples in @samples.
+ * @ar: A #GByteArray to append the encoded samples to.
  *
  * Default encoder for samples.
  *
@@ -76,11 +79,10 @@ pka_resolution_apply (PkaResolution    res, /* IN */
  * Side effects: None.
  */
 static gboolean
-pka_encoder_real_encode_samples (PkaManifest *manifest,  /* IN */
-                                 PkaSample  **samples,   /* IN */
-                                 gint         n_samples, /* IN */
-                                 guint8     **data,      /* OUT */
-                                 gsize       *data_len)  /* OUT */
+pka_encoder_real_encode_samples (PkaManifest  *manifest,  /* IN */
+                                 PkaSample   **samples,   /* IN */
+                                 gint          n_samples, /* IN */
+                                 GByteArray   *ar)        /* IN */
 {
 	EggBuffer *buf;
 	struct timespec mts;
@@ -92,11 +94,10 @@ pka_encoder_real_encode_samples (PkaManifest *manifest,  /* IN */
 	gsize tlen;
 	gint i;
 
-	g_return_val_if_fail(data != NULL, FALSE);
-	g_return_val_if_fail(data_len != NULL, FALSE);
+	g_return_val_if_fail(ar != NULL, FALSE);
 
 	ENTRY;
-	buf = egg_buffer_new();
+	buf = egg_buffer_new_for_array(ar);
 	pka_manifest_get_timespec(manifest, &mts);
 	res = pka_manifest_get_resolution(manifest);
 
@@ -132,26 +133,73 @@ pka_encoder_real_encode_samples (PkaManifest *manifest,  /* IN */
 		egg_buffer_write_data(buf, tbuf, tlen);
 	}
 
-	egg_buffer_get_buffer(buf, &tbuf, &tlen);
-	*data = g_malloc(tlen);
-	*data_len = tlen;
-	memcpy(*data, tbuf, tlen);
 	egg_buffer_unref(buf);
+	RETURN(TRUE);
+}
+
+/**
+ * pka_encoder_encode_samples_append:
+ * @encoder: A #PkaEncoder or %NULL.
+ * @manifest: A #PkaManifest.
+ * @samples: An array of #PkaSample.
+ * @n_samples: The number of samples in @samples.
+ * @ar: A #GByteArray to append the encoded samples to.
+ *
+ * Encodes @samples onto the end of @ar.  This allows the caller to keep a
+ * single output buffer around that is handed directly to the transport
+ * rather than copying the result of each encoding into it.  If @encoder
+ * is %NULL, the default encoding is used.
+ *
+ * Encoders that do not implement the encode_samples_append() vfunc fall
+ * back to encode_samples() and have their result copied onto @ar.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE.
+ * Side effects: None.
+ */
+gboolean
+pka_encoder_encode_samples_append (PkaEncoder   *encoder,   /* IN */
+                                   PkaManifest  *manifest,  /* IN */
+                                   PkaSample   **samples,   /* IN */
+                                   gint          n_samples, /* IN */
+                                   GByteArray   *ar)        /* IN */
+{
+	PkaEncoderIface *iface;
+	guint8 *data = NULL;
+	gsize data_len = 0;
+
+	g_return_val_if_fail(!encoder || PKA_IS_ENCODER(encoder), FALSE);
+	g_return_val_if_fail(ar != NULL, FALSE);
 
+	ENTRY;
+	if (!encoder) {
+		RETURN(pka_encoder_real_encode_samples(manifest, samples, n_samples,
+		                                       ar));
+	}
+	iface = PKA_ENCODER_GET_INTERFACE(encoder);
+	if (iface->encode_samples_append) {
+		RETURN(iface->encode_samples_append(encoder, manifest, samples,
+		                                    n_samples, ar));
+	}
+	if (!iface->encode_samples(encoder, manifest, samples, n_samples,
+	                           &data, &data_len)) {
+		RETURN(FALSE);
+	}
+	g_byte_array_append(ar, data, data_len);
+	g_free(data);
 	RETURN(TRUE);
 }
 
 /**
  * pka_encoder_encode_samples:
- * @encoder: A #PkaEncoder.
- * @manifest: The current #PkaManifest.
- * @samples An array of #PkaSample.
- * @n_samples: The number of #PkaSample in @samples.
- * @data: A location for a data buffer.
- * @data_len: A location for the data buffer length.
+ * @encoder: A #PkaEncoder or %NULL.
+ * @manifest: A #PkaManifest.
+ * @samples: An array of #PkaSample.
+ * @n_samples: The number of samples in @samples.
+ * @data: A location for the encoded buffer.
+ * @data_len: A location for the encoded buffer length.
  *
- * Encodes the samples into a buffer.  The resulting buffer is stored in
- * @data and the length of the buffer in @data_len.
+ * Encodes @samples into a newly allocated buffer which should be freed
+ * with g_free().  If @encoder is %NULL, the default encoding is used.
  *
  * Returns: %TRUE if successful; otherwise %FALSE.
  */
@@ -163,35 +211,66 @@ pka_encoder_encode_samples  (PkaEncoder   *encoder,
                              guint8      **data,
                              gsize        *data_len)
 {
+	PkaEncoderIface *iface;
+	GByteArray *ar;
+
+	g_return_val_if_fail(!encoder || PKA_IS_ENCODER(encoder), FALSE);
+	g_return_val_if_fail(data != NULL, FALSE);
+	g_return_val_if_fail(data_len != NULL, FALSE);
+
 	ENTRY;
 	if (encoder) {
-		RETURN(PKA_ENCODER_GET_INTERFACE(encoder)->
-				encode_samples(encoder, manifest, samples, n_samples,
-				               data, data_len));
+		iface = PKA_ENCODER_GET_INTERFACE(encoder);
+		if (iface->encode_samples) {
+			RETURN(iface->encode_samples(encoder, manifest, samples,
+			                             n_samples, data, data_len));
+		}
 	}
-	RETURN(pka_encoder_real_encode_samples(manifest, samples, n_samples,
-	                                       data, data_len));
+	/*
+	 * Encode into a fresh array and steal its storage so that the result
+	 * does not need to be copied.
+	 */
+	ar = g_byte_array_new();
+	if (!pka_encoder_encode_samples_append(encoder, manifest, samples,
+	                                       n_samples, ar)) {
+		g_byte_array_free(ar, TRUE);
+		RETURN(FALSE);
+	}
+	*data_len = ar->len;
+	*data = g_byte_array_free(ar, FALSE);
+	RETURN(TRUE);
 }
 
+/**
+ * pka_encoder_real_encode_manifest:
+ * @manifest: A #PkaManifest.
+ * @ar: A #GByteArray to append the encoded manifest to.
+ *
+ * Default encoder for manifests.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE.
+ * Side effects: None.
+ */
 static gboolean
 pka_encoder_real_encode_manifest (PkaManifest  *manifest, /* IN */
-                                  guint8      **data,     /* IN */
-                                  gsize        *data_len) /* IN */
+                                  GByteArray   *ar)       /* IN */
 {
-	EggBuffer *buf, *mbuf, *ebuf;
+	EggBuffer *buf;
 	struct timespec ts;
 	guint64 t;
-	const guint8 *tbuf;
-	gsize tlen;
+	const gchar *name;
+	guint type;
+	gsize rows_len = 0;
+	gsize row_len;
+	gsize name_len;
 	gint rows;
 	gint i;
 
 	g_return_val_if_fail(manifest != NULL, FALSE);
-	g_return_val_if_fail(data != NULL, FALSE);
-	g_return_val_if_fail(data_len != NULL, FALSE);
+	g_return_val_if_fail(ar != NULL, FALSE);
 
 	ENTRY;
-	buf = egg_buffer_new();
+	buf = egg_buffer_new_for_array(ar);
 
 	/*
 	 * Field 1: Timestamp.  Currently encoded in microseconds.  We should
@@ -216,65 +295,118 @@ pka_encoder_real_encode_manifest (PkaManifest  *manifest, /* IN */
 	egg_buffer_write_uint(buf, pka_manifest_get_source_id(manifest));
 
 	/*
-	 * Create a new buffer for the repeated data series.
+	 * The row descriptions are a repeated set of embedded messages, each
+	 * prefixed by their length.  Rather than encoding each row into its own
+	 * buffer to learn its length, compute the lengths up front so that
+	 * everything is written directly into the output.  Every tag used in a
+	 * row fits within a single byte.
 	 */
-	ebuf = egg_buffer_new();
+	#define ROW_LEN(_i, _type, _name_len)                  \
+	    (3 + egg_buffer_bytes_for_uint(_i) +               \
+	     egg_buffer_bytes_for_uint(_type) +                \
+	     egg_buffer_bytes_for_uint(_name_len) + _name_len)
+
+	rows = pka_manifest_get_n_rows(manifest);
+	for (i = 1; i <= rows; i++) {
+		name = pka_manifest_get_row_name(manifest, i);
+		name_len = name ? strlen(name) : 0;
+		type = pka_manifest_get_row_type(manifest, i);
+		row_len = ROW_LEN(i, type, name_len);
+		rows_len += egg_buffer_bytes_for_uint(row_len) + row_len;
+	}
 
 	/*
-	 * Write the manifest data description.  This is a set of embedded
-	 * messages within the message.
+	 * Add the repeated message length.
+	 */
+	egg_buffer_write_tag(buf, 4, EGG_BUFFER_REPEATED);
+	egg_buffer_write_uint(buf, rows_len);
+
+	/*
+	 * Write the manifest data description.
 	 */
-	rows = pka_manifest_get_n_rows(manifest);
 	for (i = 1; i <= rows; i++) {
-		mbuf = egg_buffer_new();
+		name = pka_manifest_get_row_name(manifest, i);
+		name_len = name ? strlen(name) : 0;
+		type = pka_manifest_get_row_type(manifest, i);
+		egg_buffer_write_uint(buf, ROW_LEN(i, type, name_len));
 
 		/*
 		 * Write the row identifier.
 		 */
-		egg_buffer_write_tag(mbuf, 1, EGG_BUFFER_UINT);
-		egg_buffer_write_uint(mbuf, i);
+		egg_buffer_write_tag(buf, 1, EGG_BUFFER_UINT);
+		egg_buffer_write_uint(buf, i);
 
 		/*
 		 * Write the row type.
 		 */
-		egg_buffer_write_tag(mbuf, 2, EGG_BUFFER_ENUM);
-		egg_buffer_write_uint(mbuf, pka_manifest_get_row_type(manifest, i));
+		egg_buffer_write_tag(buf, 2, EGG_BUFFER_ENUM);
+		egg_buffer_write_uint(buf, type);
 
 		/*
 		 * Write the row name.
 		 */
-		egg_buffer_write_tag(mbuf, 3, EGG_BUFFER_STRING);
-		egg_buffer_write_string(mbuf, pka_manifest_get_row_name(manifest, i));
-
-		/*
-		 * Embed the message as a data blob.
-		 */
-		egg_buffer_get_buffer(mbuf, &tbuf, &tlen);
-		egg_buffer_write_data(ebuf, tbuf, tlen);
-
-		egg_buffer_unref(mbuf);
+		egg_buffer_write_tag(buf, 3, EGG_BUFFER_STRING);
+		egg_buffer_write_string(buf, name);
 	}
 
-	/*
-	 * Add the repeated message length and data.
-	 */
-	egg_buffer_get_buffer(ebuf, &tbuf, &tlen);
-	egg_buffer_write_tag(buf, 4, EGG_BUFFER_REPEATED);
-	egg_buffer_write_data(buf, tbuf, tlen);
-	egg_buffer_unref(ebuf);
+	#undef ROW_LEN
 
 	/*
-	 * Copy the buffer to the destination.
+	 * Packed sample layout.  Only written when set so that manifests of
+	 * tagged samples are understood by older clients.
 	 */
-	egg_buffer_get_buffer(buf, &tbuf, &tlen);
-	*data = g_malloc(tlen);
-	*data_len = tlen;
-	memcpy(*data, tbuf, tlen);
+	if (pka_manifest_get_packed(manifest)) {
+		egg_buffer_write_tag(buf, 5, EGG_BUFFER_BOOLEAN);
+		egg_buffer_write_boolean(buf, TRUE);
+	}
 
 	egg_buffer_unref(buf);
 	RETURN(TRUE);
 }
 
+/**
+ * pka_encoder_encode_manifest_append:
+ * @encoder: A #PkaEncoder or %NULL.
+ * @manifest: A #PkaManifest.
+ * @ar: A #GByteArray to append the encoded manifest to.
+ *
+ * Encodes @manifest onto the end of @ar.  If @encoder is %NULL, the default
+ * encoding is used.  Encoders that do not implement the
+ * encode_manifest_append() vfunc fall back to encode_manifest() and have
+ * their result copied onto @ar.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE.
+ * Side effects: None.
+ */
+gboolean
+pka_encoder_encode_manifest_append (PkaEncoder  *encoder,  /* IN */
+                                    PkaManifest *manifest, /* IN */
+                                    GByteArray  *ar)       /* IN */
+{
+	PkaEncoderIface *iface;
+	guint8 *data = NULL;
+	gsize data_len = 0;
+
+	g_return_val_if_fail(!encoder || PKA_IS_ENCODER(encoder), FALSE);
+	g_return_val_if_fail(manifest != NULL, FALSE);
+	g_return_val_if_fail(ar != NULL, FALSE);
+
+	ENTRY;
+	if (!encoder) {
+		RETURN(pka_encoder_real_encode_manifest(manifest, ar));
+	}
+	iface = PKA_ENCODER_GET_INTERFACE(encoder);
+	if (iface->encode_manifest_append) {
+		RETURN(iface->encode_manifest_append(encoder, manifest, ar));
+	}
+	if (!iface->encode_manifest(encoder, manifest, &data, &data_len)) {
+		RETURN(FALSE);
+	}
+	g_byte_array_append(ar, data, data_len);
+	g_free(data);
+	RETURN(TRUE);
+}
+
 /**
  * pka_encoder_encode_manifest:
  * @encoder: A #PkaEncoder
@@ -293,7 +425,8 @@ pka_encoder_encode_manifest (PkaEncoder   *encoder,  /* IN */
                              guint8      **data,     /* IN */
                              gsize        *data_len) /* IN */
 {
-	gboolean ret;
+	PkaEncoderIface *iface;
+	GByteArray *ar;
 
 	g_return_val_if_fail(!encoder || PKA_IS_ENCODER(encoder), FALSE);
 	g_return_val_if_fail(manifest != NULL, FALSE);
@@ -302,12 +435,309 @@ pka_encoder_encode_manifest (PkaEncoder   *encoder,  /* IN */
 
 	ENTRY;
 	if (encoder) {
-		ret = PKA_ENCODER_GET_INTERFACE(encoder)->
-			encode_manifest(encoder, manifest, data, data_len);
-	} else {
-		ret = pka_encoder_real_encode_manifest(manifest, data, data_len);
+		iface = PKA_ENCODER_GET_INTERFACE(encoder);
+		if (iface->encode_manifest) {
+			RETURN(iface->encode_manifest(encoder, manifest,
+			                              data, data_len));
+		}
+	}
+	ar = g_byte_array_new();
+	if (!pka_encoder_encode_manifest_append(encoder, manifest, ar)) {
+		g_byte_array_free(ar, TRUE);
+		RETURN(FALSE);
+	}
+	*data_len = ar->len;
+	*data = g_byte_array_free(ar, FALSE);
+	RETURN(TRUE);
+}
+
+/*
+ * Buffers encoded by a shareable encoder are cached on the manifest or
+ * sample they were created from, so that subscriptions using the same
+ * encoder do not each encode the same data.  Entries are only ever
+ * prepended with an atomic compare-and-swap until the owner is released,
+ * so lookups do not need a lock.
+ */
+typedef struct _PkaEncoderCache PkaEncoderCache;
+
+struct _PkaEncoderCache
+{
+	PkaEncoderCache *next;
+	PkaEncoder      *encoder;  /* Encoder, or NULL for the default */
+	PkaManifest     *manifest; /* Time base of a sample, or NULL */
+	GByteArray      *encoded;
+};
+
+extern gpointer volatile* pka_manifest_get_cache (PkaManifest *manifest);
+extern gpointer volatile* pka_sample_get_cache   (PkaSample   *sample);
+
+/**
+ * pka_encoder_cache_clear:
+ * @cache: The cache of a manifest or sample.
+ *
+ * Internal method to release the cached buffers of a manifest or sample
+ * once it is no longer referenced.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_encoder_cache_clear (gpointer volatile *cache) /* IN */
+{
+	PkaEncoderCache *entry;
+
+	while ((entry = *cache)) {
+		*cache = entry->next;
+		if (entry->encoder) {
+			g_object_unref(entry->encoder);
+		}
+		if (entry->manifest) {
+			pka_manifest_unref(entry->manifest);
+		}
+		g_byte_array_unref(entry->encoded);
+		g_slice_free(PkaEncoderCache, entry);
+	}
+}
+
+/**
+ * pka_encoder_cache_lookup:
+ * @cache: The cache of a manifest or sample.
+ * @encoder: A #PkaEncoder or %NULL.
+ * @manifest: A #PkaManifest or %NULL.
+ *
+ * Looks up the buffer encoded by @encoder against @manifest.
+ *
+ * Returns: A new reference to the encoded buffer, or %NULL.
+ * Side effects: None.
+ */
+static GByteArray*
+pka_encoder_cache_lookup (gpointer volatile *cache,    /* IN */
+                          PkaEncoder        *encoder,  /* IN */
+                          PkaManifest       *manifest) /* IN */
+{
+	PkaEncoderCache *entry;
+
+	for (entry = g_atomic_pointer_get(cache); entry; entry = entry->next) {
+		if (entry->encoder == encoder && entry->manifest == manifest) {
+			return g_byte_array_ref(entry->encoded);
+		}
 	}
-	RETURN(ret);
+	return NULL;
+}
+
+/**
+ * pka_encoder_cache_insert:
+ * @cache: The cache of a manifest or sample.
+ * @encoder: A #PkaEncoder or %NULL.
+ * @manifest: A #PkaManifest or %NULL.
+ * @encoded: The buffer encoded by @encoder.
+ *
+ * Adds @encoded to @cache.  If another thread added a buffer for the same
+ * encoder in the meantime, that buffer is used instead.
+ *
+ * Returns: A new reference to the cached buffer.
+ * Side effects: The reference to @encoded is consumed.
+ */
+static GByteArray*
+pka_encoder_cache_insert (gpointer volatile *cache,    /* IN */
+                          PkaEncoder        *encoder,  /* IN */
+                          PkaManifest       *manifest, /* IN */
+                          GByteArray        *encoded)  /* IN */
+{
+	PkaEncoderCache *entry;
+	GByteArray *winner;
+
+	entry = g_slice_new(PkaEncoderCache);
+	entry->encoder = encoder ? g_object_ref(encoder) : NULL;
+	entry->manifest = manifest ? pka_manifest_ref(manifest) : NULL;
+	entry->encoded = encoded;
+	do {
+		entry->next = g_atomic_pointer_get(cache);
+		if ((winner = pka_encoder_cache_lookup(cache, encoder, manifest))) {
+			entry->next = NULL;
+			pka_encoder_cache_clear((gpointer volatile *)&entry);
+			return winner;
+		}
+	} while (!g_atomic_pointer_compare_and_exchange(cache, entry->next,
+	                                                entry));
+	return g_byte_array_ref(encoded);
+}
+
+/**
+ * pka_encoder_is_shareable:
+ * @encoder: A #PkaEncoder or %NULL.
+ *
+ * Checks if the output of @encoder may be shared between subscriptions.
+ * This is the case for the default encoding.  Stateful encoders, such as
+ * those carrying a compression dictionary across buffers, are not.
+ *
+ * Returns: %TRUE if @encoder is shareable; otherwise %FALSE.
+ * Side effects: None.
+ */
+gboolean
+pka_encoder_is_shareable (PkaEncoder *encoder) /* IN */
+{
+	g_return_val_if_fail(!encoder || PKA_IS_ENCODER(encoder), FALSE);
+
+	if (!encoder) {
+		return TRUE;
+	}
+	return PKA_ENCODER_GET_INTERFACE(encoder)->shareable;
+}
+
+G_LOCK_DEFINE_STATIC(claims);
+
+/**
+ * pka_encoder_claim_quark:
+ *
+ * Retrieves the quark for the owner of a stateful encoder.
+ *
+ * Returns: A #GQuark.
+ * Side effects: None.
+ */
+static GQuark
+pka_encoder_claim_quark (void)
+{
+	return g_quark_from_static_string("pka-encoder-claim");
+}
+
+/**
+ * pka_encoder_claim:
+ * @encoder: A #PkaEncoder or %NULL.
+ * @owner: The subscription attaching @encoder.
+ *
+ * Internal method to attach @encoder to @owner.  Encoders that are not
+ * shareable carry state across buffers, so they may only be attached to
+ * one owner at a time.
+ *
+ * Returns: %TRUE if @owner may use @encoder; otherwise %FALSE.
+ * Side effects: None.
+ */
+gboolean
+pka_encoder_claim (PkaEncoder *encoder, /* IN */
+                   gpointer    owner)   /* IN */
+{
+	gpointer current;
+	gboolean ret;
+
+	g_return_val_if_fail(!encoder || PKA_IS_ENCODER(encoder), FALSE);
+
+	if (pka_encoder_is_shareable(encoder)) {
+		return TRUE;
+	}
+	G_LOCK(claims);
+	current = g_object_get_qdata(G_OBJECT(encoder), pka_encoder_claim_quark());
+	if ((ret = (!current || current == owner))) {
+		g_object_set_qdata(G_OBJECT(encoder), pka_encoder_claim_quark(),
+		                   owner);
+	}
+	G_UNLOCK(claims);
+	return ret;
+}
+
+/**
+ * pka_encoder_release:
+ * @encoder: A #PkaEncoder or %NULL.
+ * @owner: The subscription detaching @encoder.
+ *
+ * Internal method to detach @encoder from @owner so that it may be
+ * attached elsewhere.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_encoder_release (PkaEncoder *encoder, /* IN */
+                     gpointer    owner)   /* IN */
+{
+	g_return_if_fail(!encoder || PKA_IS_ENCODER(encoder));
+
+	if (pka_encoder_is_shareable(encoder)) {
+		return;
+	}
+	G_LOCK(claims);
+	if (g_object_get_qdata(G_OBJECT(encoder),
+	                       pka_encoder_claim_quark()) == owner) {
+		g_object_set_qdata(G_OBJECT(encoder), pka_encoder_claim_quark(),
+		                   NULL);
+	}
+	G_UNLOCK(claims);
+}
+
+/**
+ * pka_encoder_encode_manifest_shared:
+ * @encoder: A shareable #PkaEncoder or %NULL.
+ * @manifest: A #PkaManifest.
+ *
+ * Encodes @manifest, or retrieves the buffer from a previous encoding of
+ * @manifest by @encoder.  A manifest must not be modified once it has
+ * been encoded.
+ *
+ * Returns: A #GByteArray which should be released with
+ *   g_byte_array_unref(), or %NULL on failure.
+ * Side effects: The encoded buffer is cached on @manifest.
+ */
+GByteArray*
+pka_encoder_encode_manifest_shared (PkaEncoder  *encoder,  /* IN */
+                                    PkaManifest *manifest) /* IN */
+{
+	gpointer volatile *cache;
+	GByteArray *encoded;
+
+	g_return_val_if_fail(pka_encoder_is_shareable(encoder), NULL);
+	g_return_val_if_fail(manifest != NULL, NULL);
+
+	ENTRY;
+	cache = pka_manifest_get_cache(manifest);
+	if ((encoded = pka_encoder_cache_lookup(cache, encoder, NULL))) {
+		RETURN(encoded);
+	}
+	encoded = g_byte_array_new();
+	if (!pka_encoder_encode_manifest_append(encoder, manifest, encoded)) {
+		g_byte_array_unref(encoded);
+		RETURN(NULL);
+	}
+	RETURN(pka_encoder_cache_insert(cache, encoder, NULL, encoded));
+}
+
+/**
+ * pka_encoder_encode_sample_shared:
+ * @encoder: A shareable #PkaEncoder or %NULL.
+ * @manifest: The #PkaManifest providing the time base of @sample.
+ * @sample: A #PkaSample.
+ *
+ * Encodes @sample, or retrieves the buffer from a previous encoding of
+ * @sample by @encoder against @manifest.  Since the encoder is shareable,
+ * the buffers of several samples may be concatenated.
+ *
+ * Returns: A #GByteArray which should be released with
+ *   g_byte_array_unref(), or %NULL on failure.
+ * Side effects: The encoded buffer is cached on @sample.
+ */
+GByteArray*
+pka_encoder_encode_sample_shared (PkaEncoder  *encoder,  /* IN */
+                                  PkaManifest *manifest, /* IN */
+                                  PkaSample   *sample)   /* IN */
+{
+	gpointer volatile *cache;
+	GByteArray *encoded;
+
+	g_return_val_if_fail(pka_encoder_is_shareable(encoder), NULL);
+	g_return_val_if_fail(manifest != NULL, NULL);
+	g_return_val_if_fail(sample != NULL, NULL);
+
+	ENTRY;
+	cache = pka_sample_get_cache(sample);
+	if ((encoded = pka_encoder_cache_lookup(cache, encoder, manifest))) {
+		RETURN(encoded);
+	}
+	encoded = g_byte_array_new();
+	if (!pka_encoder_encode_samples_append(encoder, manifest, &sample, 1,
+	                                       encoded)) {
+		g_byte_array_unref(encoded);
+		RETURN(NULL);
+	}
+	RETURN(pka_encoder_cache_insert(cache, encoder, manifest, encoded));
 }
 
 /**
@@ -336,6 +766,59 @@ pka_encoder_get_id (PkaEncoder *encoder) /* IN */
 	RETURN(GPOINTER_TO_INT(id));
 }
 
+/**
+ * pka_encoder_get_plugin:
+ * @encoder: A #PkaEncoder.
+ *
+ * Retrieves the #PkaPlugin that was used to create @encoder.
+ *
+ * Returns: A #PkaPlugin or %NULL.
+ * Side effects: None.
+ */
+PkaPlugin*
+pka_encoder_get_plugin (PkaEncoder *encoder) /* IN */
+{
+	g_return_val_if_fail(PKA_IS_ENCODER(encoder), NULL);
+	return g_object_get_data(G_OBJECT(encoder), "pka-encoder-plugin");
+}
+
+/**
+ * pka_encoder_set_plugin:
+ * @encoder: A #PkaEncoder.
+ * @plugin: A #PkaPlugin.
+ *
+ * Internal method to set the plugin that created @encoder.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_encoder_set_plugin (PkaEncoder *encoder, /* IN */
+                        PkaPlugin  *plugin)  /* IN */
+{
+	g_return_if_fail(PKA_IS_ENCODER(encoder));
+	g_return_if_fail(pka_encoder_get_plugin(encoder) == NULL);
+
+	ENTRY;
+	g_object_set_data_full(G_OBJECT(encoder), "pka-encoder-plugin",
+	                       g_object_ref(plugin), g_object_unref);
+	EXIT;
+}
+
+/**
+ * pka_encoder_error_quark:
+ *
+ * Retrieves the error domain for #PkaEncoder.
+ *
+ * Returns: A #GQuark.
+ * Side effects: None.
+ */
+GQuark
+pka_encoder_error_quark (void)
+{
+	return g_quark_from_static_string("pka-encoder-error-quark");
+}
+
 /**
  * pka_encoder_get_type:
  *
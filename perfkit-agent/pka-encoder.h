@@ -26,6 +26,7 @@
 #include <glib-object.h>
 
 #include "pka-manifest.h"
+#include "pka-plugin.h"
 #include "pka-sample.h"
 
 G_BEGIN_DECLS
@@ -34,6 +35,12 @@ G_BEGIN_DECLS
 #define PKA_ENCODER(o)               (G_TYPE_CHECK_INSTANCE_CAST((o),    PKA_TYPE_ENCODER, PkaEncoder))
 #define PKA_IS_ENCODER(o)            (G_TYPE_CHECK_INSTANCE_TYPE((o),    PKA_TYPE_ENCODER))
 #define PKA_ENCODER_GET_INTERFACE(o) (G_TYPE_INSTANCE_GET_INTERFACE((o), PKA_TYPE_ENCODER, PkaEncoderIface))
+#define PKA_ENCODER_ERROR            (pka_encoder_error_quark())
+
+typedef enum
+{
+	PKA_ENCODER_ERROR_IN_USE,
+} PkaEncoderError;
 
 typedef struct _PkaEncoder      PkaEncoder;
 typedef struct _PkaEncoderIface PkaEncoderIface;
@@ -52,10 +59,30 @@ struct _PkaEncoderIface
 	                             PkaManifest   *manifest,
 	                             guint8       **data,
 	                             gsize         *dapka_len);
+
+	gboolean (*encode_samples_append)  (PkaEncoder   *encoder,
+	                                    PkaManifest  *manifest,
+	                                    PkaSample   **samples,
+	                                    gint          n_samples,
+	                                    GByteArray   *ar);
+	gboolean (*encode_manifest_append) (PkaEncoder   *encoder,
+	                                    PkaManifest  *manifest,
+	                                    GByteArray   *ar);
+
+	/*
+	 * Encoders whose output only depends on their input, and which encode
+	 * several samples as the concatenation of encoding each sample, may
+	 * set this so that their output is shared between subscriptions.
+	 * Other encoders may carry state across buffers, so each instance is
+	 * only ever attached to one subscription at a time.
+	 */
+	gboolean shareable;
 };
 
 GType    pka_encoder_get_type        (void) G_GNUC_CONST;
+GQuark   pka_encoder_error_quark     (void) G_GNUC_CONST;
 gint     pka_encoder_get_id          (PkaEncoder     *encoder) G_GNUC_PURE;
+PkaPlugin* pka_encoder_get_plugin    (PkaEncoder     *encoder);
 gboolean pka_encoder_encode_samples  (PkaEncoder     *encoder,
                                       PkaManifest    *manifest,
                                       PkaSample     **samples,
@@ -66,6 +93,20 @@ gboolean pka_encoder_encode_manifest (PkaEncoder     *encoder,
                                       PkaManifest    *manifest,
                                       guint8        **data,
                                       gsize          *dapka_len);
+gboolean pka_encoder_encode_samples_append  (PkaEncoder   *encoder,
+                                             PkaManifest  *manifest,
+                                             PkaSample   **samples,
+                                             gint          n_samples,
+                                             GByteArray   *ar);
+gboolean pka_encoder_encode_manifest_append (PkaEncoder   *encoder,
+                                             PkaManifest  *manifest,
+                                             GByteArray   *ar);
+gboolean    pka_encoder_is_shareable           (PkaEncoder  *encoder);
+GByteArray* pka_encoder_encode_manifest_shared (PkaEncoder  *encoder,
+                                                PkaManifest *manifest);
+GByteArray* pka_encoder_encode_sample_shared   (PkaEncoder  *encoder,
+                                                PkaManifest *manifest,
+                                                PkaSample   *sample);
 
 G_END_DECLS
 
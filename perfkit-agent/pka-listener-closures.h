@@ -152,6 +152,11 @@ typedef struct
 {
 } ManagerAddChannelCall;
 
+typedef struct
+{
+	gchar *plugin;
+} ManagerAddEncoderCall;
+
 typedef struct
 {
 	gchar *plugin;
@@ -236,6 +241,11 @@ typedef struct
 	gint source;
 } SourceGetPluginCall;
 
+typedef struct
+{
+	gint source;
+} SourceGetStatsCall;
+
 typedef struct
 {
 	gint subscription;
@@ -264,6 +274,11 @@ typedef struct
 	gint subscription;
 } SubscriptionGetSourcesCall;
 
+typedef struct
+{
+	gint subscription;
+} SubscriptionGetStatsCall;
+
 typedef struct
 {
 	gint subscription;
@@ -504,6 +519,15 @@ ManagerAddChannelCall_Free (ManagerAddChannelCall *call) /* IN */
 	EXIT;
 }
 
+void
+ManagerAddEncoderCall_Free (ManagerAddEncoderCall *call) /* IN */
+{
+	ENTRY;
+	g_free(call->plugin);
+	g_slice_free(ManagerAddEncoderCall, call);
+	EXIT;
+}
+
 void
 ManagerAddSourceCall_Free (ManagerAddSourceCall *call) /* IN */
 {
@@ -654,6 +678,14 @@ SourceGetPluginCall_Free (SourceGetPluginCall *call) /* IN */
 	EXIT;
 }
 
+void
+SourceGetStatsCall_Free (SourceGetStatsCall *call) /* IN */
+{
+	ENTRY;
+	g_slice_free(SourceGetStatsCall, call);
+	EXIT;
+}
+
 void
 SubscriptionAddChannelCall_Free (SubscriptionAddChannelCall *call) /* IN */
 {
@@ -694,6 +726,14 @@ SubscriptionGetSourcesCall_Free (SubscriptionGetSourcesCall *call) /* IN */
 	EXIT;
 }
 
+void
+SubscriptionGetStatsCall_Free (SubscriptionGetStatsCall *call) /* IN */
+{
+	ENTRY;
+	g_slice_free(SubscriptionGetStatsCall, call);
+	EXIT;
+}
+
 void
 SubscriptionMuteCall_Free (SubscriptionMuteCall *call) /* IN */
 {
@@ -917,6 +957,13 @@ ManagerAddChannelCall_Create (void)
 	RETURN(g_slice_new0(ManagerAddChannelCall));
 }
 
+ManagerAddEncoderCall*
+ManagerAddEncoderCall_Create (void)
+{
+	ENTRY;
+	RETURN(g_slice_new0(ManagerAddEncoderCall));
+}
+
 ManagerAddSourceCall*
 ManagerAddSourceCall_Create (void)
 {
@@ -1043,6 +1090,13 @@ SourceGetPluginCall_Create (void)
 	RETURN(g_slice_new0(SourceGetPluginCall));
 }
 
+SourceGetStatsCall*
+SourceGetStatsCall_Create (void)
+{
+	ENTRY;
+	RETURN(g_slice_new0(SourceGetStatsCall));
+}
+
 SubscriptionAddChannelCall*
 SubscriptionAddChannelCall_Create (void)
 {
@@ -1078,6 +1132,13 @@ SubscriptionGetSourcesCall_Create (void)
 	RETURN(g_slice_new0(SubscriptionGetSourcesCall));
 }
 
+SubscriptionGetStatsCall*
+SubscriptionGetStatsCall_Create (void)
+{
+	ENTRY;
+	RETURN(g_slice_new0(SubscriptionGetStatsCall));
+}
+
 SubscriptionMuteCall*
 SubscriptionMuteCall_Create (void)
 {
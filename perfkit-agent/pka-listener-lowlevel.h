@@ -235,6 +235,15 @@ gboolean      pka_listener_manager_add_channel_finish         (PkaListener
                                                                GAsyncResult          *result,
                                                                gint                  *channel,
                                                                GError               **error);
+void          pka_listener_manager_add_encoder_async          (PkaListener           *listener,
+                                                               const gchar           *plugin,
+                                                               GCancellable          *cancellable,
+                                                               GAsyncReadyCallback    callback,
+                                                               gpointer               user_data);
+gboolean      pka_listener_manager_add_encoder_finish         (PkaListener           *listener,
+                                                               GAsyncResult          *result,
+                                                               gint                  *encoder,
+                                                               GError               **error);
 void          pka_listener_manager_add_source_async           (PkaListener           *listener,
                                                                const gchar           *plugin,
                                                                GCancellable          *cancellable,
@@ -393,6 +402,20 @@ gboolean      pka_listener_source_get_plugin_finish           (PkaListener
                                                                GAsyncResult          *result,
                                                                gchar                **plugin,
                                                                GError               **error);
+void          pka_listener_source_get_stats_async             (PkaListener           *listener,
+                                                               gint                   source,
+                                                               GCancellable          *cancellable,
+                                                               GAsyncReadyCallback    callback,
+                                                               gpointer               user_data);
+gboolean      pka_listener_source_get_stats_finish            (PkaListener           *listener,
+                                                               GAsyncResult          *result,
+                                                               guint64               *n_samples,
+                                                               guint64               *n_missed,
+                                                               guint32              **lateness,
+                                                               gsize                 *lateness_len,
+                                                               guint32              **duration,
+                                                               gsize                 *duration_len,
+                                                               GError               **error);
 void          pka_listener_subscription_add_channel_async     (PkaListener           *listener,
                                                                gint                   subscription,
                                                                gint                   channel,
@@ -441,6 +464,17 @@ gboolean      pka_listener_subscription_get_sources_finish    (PkaListener
                                                                gint                 **sources,
                                                                gsize                 *sources_len,
                                                                GError               **error);
+void          pka_listener_subscription_get_stats_async       (PkaListener           *listener,
+                                                               gint                   subscription,
+                                                               GCancellable          *cancellable,
+                                                               GAsyncReadyCallback    callback,
+                                                               gpointer               user_data);
+gboolean      pka_listener_subscription_get_stats_finish      (PkaListener           *listener,
+                                                               GAsyncResult          *result,
+                                                               guint64               *queued,
+                                                               guint64               *delivered,
+                                                               guint64               *dropped,
+                                                               GError               **error);
 void          pka_listener_subscription_mute_async            (PkaListener           *listener,
                                                                gint                   subscription,
                                                                gboolean               drain,
@@ -27,6 +27,7 @@
 #include "pka-log.h"
 #include "pka-manager.h"
 #include "pka-source.h"
+#include "pka-source-simple.h"
 #include "pka-subscription.h"
 #include "pka-version.h"
 
@@ -1901,25 +1902,6 @@ pka_listener_channel_unmute_finish (PkaListener    *listener, /* IN */
 	RETURN(ret);
 }
 
-#if 0
-static void
-pka_listener_encoder_get_plugin_cb (GObject      *listener,    /* IN */
-                                    GAsyncResult *result,      /* IN */
-                                    gpointer      user_data)   /* IN */
-{
-	GSimpleAsyncResult *real_result;
-
-	g_return_if_fail(PKA_IS_LISTENER(listener));
-	g_return_if_fail(RESULT_IS_VALID(encoder_get_plugin));
-
-	ENTRY;
-	real_result = GET_RESULT_POINTER(result);
-	g_simple_async_result_set_op_res_gpointer(real_result, result);
-	g_simple_async_result_complete(real_result);
-	EXIT;
-}
-#endif
-
 /**
  * pk_connection_encoder_get_plugin_async:
  * @connection: A #PkConnection.
@@ -1943,6 +1925,7 @@ pka_listener_encoder_get_plugin_async (PkaListener           *listener,    /* IN
                                        GAsyncReadyCallback    callback,    /* IN */
                                        gpointer               user_data)   /* IN */
 {
+	EncoderGetPluginCall *call;
 	GSimpleAsyncResult *result;
 
 	g_return_if_fail(PKA_IS_LISTENER(listener));
@@ -1952,15 +1935,12 @@ pka_listener_encoder_get_plugin_async (PkaListener           *listener,    /* IN
 	                                   callback,
 	                                   user_data,
 	                                   pka_listener_encoder_get_plugin_async);
-// TEMP TO TEST RPC RESULTS
+	call = EncoderGetPluginCall_Create();
+	call->encoder = encoder;
+	g_simple_async_result_set_op_res_gpointer(
+			result, call, (GDestroyNotify)EncoderGetPluginCall_Free);
 	g_simple_async_result_complete(result);
 	g_object_unref(result);
-#if 0
-	pka_encoder_get_plugin_async(instance,
-	                             NULL,
-	                             pka_listener_encoder_get_plugin_cb,
-	                             result);
-#endif
 	EXIT;
 }
 
@@ -1968,7 +1948,7 @@ pka_listener_encoder_get_plugin_async (PkaListener           *listener,    /* IN
  * pk_connection_encoder_get_plugin_finish:
  * @connection: A #PkConnection.
  * @result: A #GAsyncResult.
- * @pluign: A #gchar.
+ * @plugin: A #gchar.
  * @error: A #GError.
  *
  * Completes an asynchronous request for the "encoder_get_plugin_finish" RPC.
@@ -1981,26 +1961,30 @@ pka_listener_encoder_get_plugin_async (PkaListener           *listener,    /* IN
 gboolean
 pka_listener_encoder_get_plugin_finish (PkaListener    *listener, /* IN */
                                         GAsyncResult   *result,   /* IN */
-                                        gchar         **pluign,   /* OUT */
+                                        gchar         **plugin,   /* OUT */
                                         GError        **error)    /* OUT */
 {
-	ENTRY;
-// TEMP TO TEST RPC RESULTS
-	RETURN(TRUE);
-#if 0
-	GSimpleAsyncResult *real_result;
-	gboolean ret;
+	EncoderGetPluginCall *call;
+	PkaEncoder *encoder;
+	PkaPlugin *real_plugin;
+	gboolean ret = FALSE;
 
 	g_return_val_if_fail(PKA_IS_LISTENER(listener), FALSE);
+	g_return_val_if_fail(RESULT_IS_VALID(encoder_get_plugin), FALSE);
+	g_return_val_if_fail(plugin != NULL, FALSE);
 
 	ENTRY;
-	real_result = GET_RESULT_POINTER(result);
-	ret = pka_encoder_get_plugin_finish(instance,
-	                                    real_result,
-	                                    pluign,
-	                                    error);
+	call = GET_RESULT_POINTER(EncoderGetPluginCall, result);
+	if (!pka_manager_find_encoder(DEFAULT_CONTEXT, call->encoder,
+	                              &encoder, error)) {
+		GOTO(failed);
+	}
+	real_plugin = pka_encoder_get_plugin(encoder);
+	*plugin = g_strdup(real_plugin ? pka_plugin_get_id(real_plugin) : NULL);
+	g_object_unref(encoder);
+	ret = TRUE;
+  failed:
 	RETURN(ret);
-#endif
 }
 
 /**
@@ -2071,6 +2055,93 @@ pka_listener_manager_add_channel_finish (PkaListener    *listener, /* IN */
 	RETURN(FALSE);
 }
 
+/**
+ * pk_connection_manager_add_encoder_async:
+ * @connection: A #PkConnection.
+ * @plugin: A #const gchar.
+ * @cancellable: A #GCancellable.
+ * @callback: A #GAsyncReadyCallback.
+ * @user_data: A #gpointer.
+ *
+ * Asynchronously requests the "manager_add_encoder_async" RPC.  @callback
+ * MUST call pka_listener_manager_add_encoder_finish().
+ *
+ * Create a new encoder from a plugin in the Agent.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_listener_manager_add_encoder_async (PkaListener           *listener,    /* IN */
+                                        const gchar           *plugin,      /* IN */
+                                        GCancellable          *cancellable, /* IN */
+                                        GAsyncReadyCallback    callback,    /* IN */
+                                        gpointer               user_data)   /* IN */
+{
+	ManagerAddEncoderCall *call;
+	GSimpleAsyncResult *result;
+
+	g_return_if_fail(PKA_IS_LISTENER(listener));
+
+	ENTRY;
+	result = g_simple_async_result_new(G_OBJECT(listener),
+	                                   callback,
+	                                   user_data,
+	                                   pka_listener_manager_add_encoder_async);
+	call = ManagerAddEncoderCall_Create();
+	call->plugin = g_strdup(plugin);
+	g_simple_async_result_set_op_res_gpointer(
+			result, call, (GDestroyNotify)ManagerAddEncoderCall_Free);
+	g_simple_async_result_complete(result);
+	g_object_unref(result);
+	EXIT;
+}
+
+/**
+ * pk_connection_manager_add_encoder_finish:
+ * @connection: A #PkConnection.
+ * @result: A #GAsyncResult.
+ * @encoder: A #gint.
+ * @error: A #GError.
+ *
+ * Completes an asynchronous request for the "manager_add_encoder_finish" RPC.
+ *
+ * Create a new encoder from a plugin in the Agent.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ * Side effects: None.
+ */
+gboolean
+pka_listener_manager_add_encoder_finish (PkaListener    *listener, /* IN */
+                                         GAsyncResult   *result,   /* IN */
+                                         gint           *encoder,  /* OUT */
+                                         GError        **error)    /* OUT */
+{
+	ManagerAddEncoderCall *call;
+	PkaEncoder *real_encoder;
+	PkaPlugin *plugin;
+	gboolean ret = FALSE;
+
+	g_return_val_if_fail(PKA_IS_LISTENER(listener), FALSE);
+	g_return_val_if_fail(RESULT_IS_VALID(manager_add_encoder), FALSE);
+	g_return_val_if_fail(encoder != NULL, FALSE);
+
+	ENTRY;
+	call = GET_RESULT_POINTER(ManagerAddEncoderCall, result);
+	if (!pka_manager_find_plugin(DEFAULT_CONTEXT, call->plugin,
+	                             &plugin, error)) {
+		GOTO(failed);
+	}
+	if ((ret = pka_manager_add_encoder(DEFAULT_CONTEXT, plugin,
+	                                   &real_encoder, error))) {
+		*encoder = pka_encoder_get_id(real_encoder);
+		g_object_unref(real_encoder);
+	}
+	g_object_unref(plugin);
+  failed:
+	RETURN(ret);
+}
+
 /**
  * pk_connection_manager_add_source_async:
  * @connection: A #PkConnection.
@@ -2252,9 +2323,13 @@ pka_listener_manager_add_subscription_finish (PkaListener    *listener,     /* I
 	if ((ret = pka_manager_add_subscription(DEFAULT_CONTEXT,
 	                                        &real_subscription,
 	                                        error))) {
-		/*
-		 * TODO: Apply buffer timeout and sizing information.
-		 */
+		if (!pka_subscription_set_buffer(real_subscription, DEFAULT_CONTEXT,
+		                                 call->timeout, call->buffer_size,
+		                                 NULL)) {
+			WARNING(Listener, "Failed to apply buffer settings to "
+			                  "subscription %d.",
+			        pka_subscription_get_id(real_subscription));
+		}
 		*subscription = pka_subscription_get_id(real_subscription);
 		pka_subscription_unref(real_subscription);
 	}
@@ -3505,6 +3580,118 @@ pka_listener_source_get_plugin_finish (PkaListener    *listener, /* IN */
 	RETURN(ret);
 }
 
+/**
+ * pk_connection_source_get_stats_async:
+ * @connection: A #PkConnection.
+ * @source: A #gint.
+ * @cancellable: A #GCancellable.
+ * @callback: A #GAsyncReadyCallback.
+ * @user_data: A #gpointer.
+ *
+ * Asynchronously requests the "source_get_stats_async" RPC.  @callback
+ * MUST call pka_listener_source_get_stats_finish().
+ *
+ * Retrieves the sampling statistics of the source.  @n_samples is the
+ * number of samples taken and @n_missed the number of sampling periods
+ * that passed while a sample was late.  @lateness and @duration are
+ * histograms of how late each sample started and how long it took, where
+ * bucket n counts values below 2^n microseconds.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_listener_source_get_stats_async (PkaListener           *listener,    /* IN */
+                                     gint                   source,      /* IN */
+                                     GCancellable          *cancellable, /* IN */
+                                     GAsyncReadyCallback    callback,    /* IN */
+                                     gpointer               user_data)   /* IN */
+{
+	SourceGetStatsCall *call;
+	GSimpleAsyncResult *result;
+
+	g_return_if_fail(PKA_IS_LISTENER(listener));
+
+	ENTRY;
+	result = g_simple_async_result_new(G_OBJECT(listener),
+	                                   callback,
+	                                   user_data,
+	                                   pka_listener_source_get_stats_async);
+	call = SourceGetStatsCall_Create();
+	call->source = source;
+	g_simple_async_result_set_op_res_gpointer(
+			result, call, (GDestroyNotify)SourceGetStatsCall_Free);
+	g_simple_async_result_complete(result);
+	g_object_unref(result);
+	EXIT;
+}
+
+/**
+ * pk_connection_source_get_stats_finish:
+ * @connection: A #PkConnection.
+ * @result: A #GAsyncResult.
+ * @n_samples: A #guint64.
+ * @n_missed: A #guint64.
+ * @lateness: A #guint32.
+ * @lateness_len: A #gsize.
+ * @duration: A #guint32.
+ * @duration_len: A #gsize.
+ * @error: A #GError.
+ *
+ * Completes an asynchronous request for the "source_get_stats_finish" RPC.
+ *
+ * Retrieves the sampling statistics of the source.  Sources that are not
+ * sampled on a timer report empty statistics.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ * Side effects: None.
+ */
+gboolean
+pka_listener_source_get_stats_finish (PkaListener    *listener,     /* IN */
+                                      GAsyncResult   *result,       /* IN */
+                                      guint64        *n_samples,    /* OUT */
+                                      guint64        *n_missed,     /* OUT */
+                                      guint32       **lateness,     /* OUT */
+                                      gsize          *lateness_len, /* OUT */
+                                      guint32       **duration,     /* OUT */
+                                      gsize          *duration_len, /* OUT */
+                                      GError        **error)        /* OUT */
+{
+	PkaSourceSimpleStats stats = { 0 };
+	SourceGetStatsCall *call;
+	PkaSource *source;
+	gboolean ret = FALSE;
+
+	g_return_val_if_fail(PKA_IS_LISTENER(listener), FALSE);
+	g_return_val_if_fail(RESULT_IS_VALID(source_get_stats), FALSE);
+	g_return_val_if_fail(n_samples != NULL, FALSE);
+	g_return_val_if_fail(n_missed != NULL, FALSE);
+	g_return_val_if_fail(lateness != NULL, FALSE);
+	g_return_val_if_fail(lateness_len != NULL, FALSE);
+	g_return_val_if_fail(duration != NULL, FALSE);
+	g_return_val_if_fail(duration_len != NULL, FALSE);
+
+	ENTRY;
+	call = GET_RESULT_POINTER(SourceGetStatsCall, result);
+	if (!pka_manager_find_source(DEFAULT_CONTEXT, call->source,
+	                             &source, error)) {
+		GOTO(failed);
+	}
+	if (PKA_IS_SOURCE_SIMPLE(source)) {
+		pka_source_simple_get_stats(PKA_SOURCE_SIMPLE(source), &stats);
+	}
+	*n_samples = stats.n_samples;
+	*n_missed = stats.n_missed;
+	*lateness = g_memdup(stats.lateness, sizeof stats.lateness);
+	*lateness_len = G_N_ELEMENTS(stats.lateness);
+	*duration = g_memdup(stats.duration, sizeof stats.duration);
+	*duration_len = G_N_ELEMENTS(stats.duration);
+	g_object_unref(source);
+	ret = TRUE;
+  failed:
+	RETURN(ret);
+}
+
 /**
  * pk_connection_subscription_add_channel_async:
  * @connection: A #PkConnection.
@@ -3971,6 +4158,101 @@ pka_listener_subscription_get_sources_finish (PkaListener    *listener,    /* IN
 	RETURN(ret);
 }
 
+/**
+ * pk_connection_subscription_get_stats_async:
+ * @connection: A #PkConnection.
+ * @subscription: A #gint.
+ * @cancellable: A #GCancellable.
+ * @callback: A #GAsyncReadyCallback.
+ * @user_data: A #gpointer.
+ *
+ * Asynchronously requests the "subscription_get_stats_async" RPC.  @callback
+ * MUST call pka_listener_subscription_get_stats_finish().
+ *
+ * Retrieves the delivery counters for the subscription.  @queued is the
+ * number of samples handed to the subscription, @delivered the number
+ * delivered to the subscriber and @dropped the number dropped because the
+ * subscriber could not keep up or the buffer was discarded.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_listener_subscription_get_stats_async (PkaListener           *listener,     /* IN */
+                                           gint                   subscription, /* IN */
+                                           GCancellable          *cancellable,  /* IN */
+                                           GAsyncReadyCallback    callback,     /* IN */
+                                           gpointer               user_data)    /* IN */
+{
+	SubscriptionGetStatsCall *call;
+	GSimpleAsyncResult *result;
+
+	g_return_if_fail(PKA_IS_LISTENER(listener));
+
+	ENTRY;
+	result = g_simple_async_result_new(G_OBJECT(listener),
+	                                   callback,
+	                                   user_data,
+	                                   pka_listener_subscription_get_stats_async);
+	call = SubscriptionGetStatsCall_Create();
+	call->subscription = subscription;
+	g_simple_async_result_set_op_res_gpointer(
+			result, call, (GDestroyNotify)SubscriptionGetStatsCall_Free);
+	g_simple_async_result_complete(result);
+	g_object_unref(result);
+	EXIT;
+}
+
+/**
+ * pk_connection_subscription_get_stats_finish:
+ * @connection: A #PkConnection.
+ * @result: A #GAsyncResult.
+ * @queued: A #guint64.
+ * @delivered: A #guint64.
+ * @dropped: A #guint64.
+ * @error: A #GError.
+ *
+ * Completes an asynchronous request for the "subscription_get_stats_finish" RPC.
+ *
+ * Retrieves the delivery counters for the subscription.  @queued is the
+ * number of samples handed to the subscription, @delivered the number
+ * delivered to the subscriber and @dropped the number dropped because the
+ * subscriber could not keep up or the buffer was discarded.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ * Side effects: None.
+ */
+gboolean
+pka_listener_subscription_get_stats_finish (PkaListener    *listener,  /* IN */
+                                            GAsyncResult   *result,    /* IN */
+                                            guint64        *queued,    /* OUT */
+                                            guint64        *delivered, /* OUT */
+                                            guint64        *dropped,   /* OUT */
+                                            GError        **error)     /* OUT */
+{
+	SubscriptionGetStatsCall *call;
+	PkaSubscription *subscription;
+	gboolean ret = FALSE;
+
+	g_return_val_if_fail(PKA_IS_LISTENER(listener), FALSE);
+	g_return_val_if_fail(RESULT_IS_VALID(subscription_get_stats), FALSE);
+	g_return_val_if_fail(queued != NULL, FALSE);
+	g_return_val_if_fail(delivered != NULL, FALSE);
+	g_return_val_if_fail(dropped != NULL, FALSE);
+
+	ENTRY;
+	call = GET_RESULT_POINTER(SubscriptionGetStatsCall, result);
+	if (!pka_manager_find_subscription(DEFAULT_CONTEXT, call->subscription,
+	                                   &subscription, error)) {
+		GOTO(failed);
+	}
+	pka_subscription_get_stats(subscription, queued, delivered, dropped);
+	pka_subscription_unref(subscription);
+	ret = TRUE;
+  failed:
+	RETURN(ret);
+}
+
 /**
  * pk_connection_subscription_mute_async:
  * @connection: A #PkConnection.
@@ -4334,6 +4616,102 @@ pka_listener_subscription_set_buffer_finish (PkaListener    *listener, /* IN */
 	RETURN(ret);
 }
 
+/**
+ * pk_connection_subscription_set_encoder_async:
+ * @connection: A #PkConnection.
+ * @subscription: A #gint.
+ * @encoder: A #gint.
+ * @cancellable: A #GCancellable.
+ * @callback: A #GAsyncReadyCallback.
+ * @user_data: A #gpointer.
+ *
+ * Asynchronously requests the "subscription_set_encoder_async" RPC.  @callback
+ * MUST call pka_listener_subscription_set_encoder_finish().
+ *
+ * Sets the encoder used to encode manifests and samples delivered to the
+ * subscription.  An @encoder of -1 restores the default encoding.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_listener_subscription_set_encoder_async (PkaListener           *listener,     /* IN */
+                                             gint                   subscription, /* IN */
+                                             gint                   encoder,      /* IN */
+                                             GCancellable          *cancellable,  /* IN */
+                                             GAsyncReadyCallback    callback,     /* IN */
+                                             gpointer               user_data)    /* IN */
+{
+	SubscriptionSetEncoderCall *call;
+	GSimpleAsyncResult *result;
+
+	g_return_if_fail(PKA_IS_LISTENER(listener));
+
+	ENTRY;
+	result = g_simple_async_result_new(G_OBJECT(listener),
+	                                   callback,
+	                                   user_data,
+	                                   pka_listener_subscription_set_encoder_async);
+	call = SubscriptionSetEncoderCall_Create();
+	call->subscription = subscription;
+	call->encoder = encoder;
+	g_simple_async_result_set_op_res_gpointer(
+			result, call, (GDestroyNotify)SubscriptionSetEncoderCall_Free);
+	g_simple_async_result_complete(result);
+	g_object_unref(result);
+	EXIT;
+}
+
+/**
+ * pk_connection_subscription_set_encoder_finish:
+ * @connection: A #PkConnection.
+ * @result: A #GAsyncResult.
+ * @error: A #GError.
+ *
+ * Completes an asynchronous request for the "subscription_set_encoder_finish" RPC.
+ *
+ * Sets the encoder used to encode manifests and samples delivered to the
+ * subscription.  An @encoder of -1 restores the default encoding.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ * Side effects: None.
+ */
+gboolean
+pka_listener_subscription_set_encoder_finish (PkaListener    *listener, /* IN */
+                                              GAsyncResult   *result,   /* IN */
+                                              GError        **error)    /* OUT */
+{
+	SubscriptionSetEncoderCall *call;
+	PkaSubscription *subscription;
+	PkaEncoder *encoder = NULL;
+	gboolean ret = FALSE;
+
+	g_return_val_if_fail(PKA_IS_LISTENER(listener), FALSE);
+	g_return_val_if_fail(RESULT_IS_VALID(subscription_set_encoder), FALSE);
+
+	ENTRY;
+	call = GET_RESULT_POINTER(SubscriptionSetEncoderCall, result);
+	if (!pka_manager_find_subscription(DEFAULT_CONTEXT, call->subscription,
+	                                   &subscription, error)) {
+		GOTO(failed);
+	}
+	if (call->encoder >= 0) {
+		if (!pka_manager_find_encoder(DEFAULT_CONTEXT, call->encoder,
+		                              &encoder, error)) {
+			GOTO(unref);
+		}
+	}
+	ret = pka_subscription_set_encoder(subscription, DEFAULT_CONTEXT,
+	                                   encoder, error);
+	if (encoder) {
+		g_object_unref(encoder);
+	}
+  unref:
+	pka_subscription_unref(subscription);
+  failed:
+	RETURN(ret);
+}
+
 /**
  * pk_connection_subscription_unmute_async:
  * @connection: A #PkConnection.
@@ -25,6 +25,7 @@
 #endif
 #define G_LOG_DOMAIN "Manager"
 
+#include "pka-config.h"
 #include "pka-context.h"
 #include "pka-listener.h"
 #include "pka-log.h"
@@ -32,6 +33,7 @@
 #include "pka-plugin.h"
 #include "pka-source.h"
 #include "pka-source-simple.h"
+#include "pka-source-stream.h"
 
 #define AUTHORIZE_IOCTL(_c, _i)                                     \
     G_STMT_START {                                                  \
@@ -57,6 +59,10 @@
     } G_STMT_END
 
 extern void pka_source_notify_stopped (PkaSource *source);
+extern void pka_source_simple_set_n_workers (gint count);
+extern void pka_source_simple_set_aligned_default (gboolean aligned);
+extern void pka_source_stream_set_window_default (gint usec);
+extern void pka_source_stream_set_backlog_default (gint size);
 
 typedef struct
 {
@@ -240,6 +246,14 @@ pka_manager_init (void)
 	manager.sources = g_ptr_array_new();
 	manager.subscriptions = g_ptr_array_new();
 	manager.mainloop = g_main_loop_new(NULL, FALSE);
+	pka_source_simple_set_n_workers(
+		pka_config_get_integer("source.simple", "workers", 0));
+	pka_source_simple_set_aligned_default(
+		pka_config_get_boolean("source.simple", "aligned", FALSE));
+	pka_source_stream_set_window_default(
+		pka_config_get_integer("source.stream", "window", 1000));
+	pka_source_stream_set_backlog_default(
+		pka_config_get_integer("source.stream", "backlog", 65536));
 	pka_manager_load_all_plugins();
 	pka_manager_init_listeners();
 	/*
@@ -247,6 +261,8 @@ pka_manager_init (void)
 	 */
 	DEBUG(Source, "Registering %s source.",
 	      g_type_name(PKA_TYPE_SOURCE_SIMPLE));
+	DEBUG(Source, "Registering %s source.",
+	      g_type_name(PKA_TYPE_SOURCE_STREAM));
 	EXIT;
 }
 
@@ -455,6 +471,44 @@ pka_manager_add_source (PkaContext  *context, /* IN */
 	RETURN(TRUE);
 }
 
+/**
+ * pka_manager_configure_subscription:
+ * @subscription: A #PkaSubscription.
+ *
+ * Applies the delivery queue settings from the agent configuration to
+ * @subscription.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_manager_configure_subscription (PkaSubscription *subscription) /* IN */
+{
+	PkaSubscriptionOverflow overflow = PKA_SUBSCRIPTION_OVERFLOW_DROP_OLDEST;
+	gchar *policy;
+	gint queue_size;
+
+	ENTRY;
+	queue_size = pka_config_get_integer("subscription", "queue-size", 1024);
+	policy = pka_config_get_string("subscription", "overflow", "drop-oldest");
+	if (g_strcmp0(policy, "block") == 0) {
+		overflow = PKA_SUBSCRIPTION_OVERFLOW_BLOCK;
+	} else if (g_strcmp0(policy, "drop-newest") == 0) {
+		overflow = PKA_SUBSCRIPTION_OVERFLOW_DROP_NEWEST;
+	} else if (g_strcmp0(policy, "drop-oldest") != 0) {
+		WARNING(Manager, "Unknown overflow policy \"%s\". "
+		                 "Using drop-oldest.", policy);
+	}
+	if (queue_size < 1) {
+		WARNING(Manager, "Invalid subscription queue-size %d. Using 1024.",
+		        queue_size);
+		queue_size = 1024;
+	}
+	pka_subscription_set_queue(subscription, queue_size, overflow);
+	g_free(policy);
+	EXIT;
+}
+
 /**
  * pka_manager_add_subscription:
  * @context: A #PkaContext.
@@ -482,6 +536,7 @@ pka_manager_add_subscription (PkaContext       *context,      /* IN */
 	ENTRY;
 	AUTHORIZE_IOCTL(context, ADD_SUBSCRIPTION);
 	*subscription = pka_subscription_new();
+	pka_manager_configure_subscription(*subscription);
 	INFO(Subscription, "Added subscription %d on behalf of context %d.",
 	     pka_subscription_get_id(*subscription),
 	     pka_context_get_id(context));
@@ -580,7 +635,7 @@ pka_manager_find_encoder (PkaContext  *context,    /* IN */
 			/*
 			 * TODO: Verify permissions.
 			 */
-			*encoder = iter;
+			*encoder = g_object_ref(iter);
 			BREAK;
 		}
 	}
@@ -64,8 +64,12 @@ struct _PkaManifest
 	gint             source_id;   /* Channel assigned Source Id */
 	struct timespec  ts;          /* Time at which manifest is authoritative */
 	PkaResolution    resolution;  /* Relative timestamp resolution */
+	gboolean         packed;      /* Samples use the packed layout */
+	gpointer         cache;       /* Buffers from shareable encoders */
 };
 
+extern void pka_encoder_cache_clear (gpointer volatile *cache);
+
 static void
 pka_manifest_destroy (PkaManifest *manifest)
 {
@@ -78,6 +82,7 @@ pka_manifest_destroy (PkaManifest *manifest)
 		g_free(row->name);
 	}
 	g_array_unref(manifest->rows);
+	pka_encoder_cache_clear(&manifest->cache);
 	EXIT;
 }
 
@@ -249,6 +254,48 @@ pka_manifest_get_resolution (PkaManifest *manifest)
 	return manifest->resolution;
 }
 
+/**
+ * pka_manifest_set_packed:
+ * @manifest: A #PkaManifest.
+ * @packed: If samples use the packed layout.
+ *
+ * Sets if the samples described by @manifest use the packed layout.  Packed
+ * samples do not tag each field; they contain a bitmap of the rows that are
+ * present followed by the values of those rows in row order, which the
+ * client reads back using the row types of the manifest.  This saves a
+ * considerable share of the sample for sources with many rows.
+ *
+ * The samples of a packed manifest must be created with
+ * pka_sample_new_packed().  This must be set before the manifest is
+ * delivered.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_manifest_set_packed (PkaManifest *manifest, /* IN */
+                         gboolean     packed)   /* IN */
+{
+	g_return_if_fail(manifest != NULL);
+	manifest->packed = packed;
+}
+
+/**
+ * pka_manifest_get_packed:
+ * @manifest: A #PkaManifest.
+ *
+ * Retrieves if the samples described by @manifest use the packed layout.
+ *
+ * Returns: %TRUE if the samples are packed; otherwise %FALSE.
+ * Side effects: None.
+ */
+gboolean
+pka_manifest_get_packed (PkaManifest *manifest) /* IN */
+{
+	g_return_val_if_fail(manifest != NULL, FALSE);
+	return manifest->packed;
+}
+
 /**
  * pka_manifest_append:
  * @manifest: A #PkaManifest
@@ -401,6 +448,22 @@ pka_manifest_set_source_id (PkaManifest *manifest,
 	manifest->source_id = source_id;
 }
 
+/**
+ * pka_manifest_get_cache:
+ * @manifest: A #PkaManifest
+ *
+ * Internal method used by the encoders to cache the encoded manifest.
+ *
+ * Returns: The location of the cache.
+ * Side effects: None.
+ */
+gpointer volatile*
+pka_manifest_get_cache (PkaManifest *manifest) /* IN */
+{
+	g_return_val_if_fail(manifest != NULL, NULL);
+	return &manifest->cache;
+}
+
 /**
  * pka_manifest_compare:
  * @a: A #PkaManifest.
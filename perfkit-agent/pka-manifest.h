@@ -65,6 +65,9 @@ gint             pka_manifest_get_source_id  (PkaManifest   *manifest);
 PkaResolution    pka_manifest_get_resolution (PkaManifest   *manifest);
 void             pka_manifest_set_resolution (PkaManifest   *manifest,
                                               PkaResolution  resolution);
+gboolean         pka_manifest_get_packed     (PkaManifest   *manifest);
+void             pka_manifest_set_packed     (PkaManifest   *manifest,
+                                              gboolean       packed);
 void             pka_manifest_get_timespec   (PkaManifest     *manifest,
                                               struct timespec *ts);
 void             pka_manifest_set_timespec   (PkaManifest     *manifest,
@@ -29,11 +29,13 @@
 #include <glib/gprintf.h>
 
 #include "pka-config.h"
+#include "pka-encoder.h"
 #include "pka-log.h"
 #include "pka-plugin.h"
 #include "pka-source.h"
 
 extern void pka_source_set_plugin (PkaSource *source, PkaPlugin *plugin);
+extern void pka_encoder_set_plugin (PkaEncoder *encoder, PkaPlugin *plugin);
 
 /**
  * SECTION:pka-plugin
@@ -288,6 +290,8 @@ pka_plugin_create (PkaPlugin  *plugin, /* IN */
 		if (ret) {
 			if (priv->info->plugin_type == PKA_PLUGIN_SOURCE) {
 				pka_source_set_plugin(PKA_SOURCE(ret), plugin);
+			} else if (priv->info->plugin_type == PKA_PLUGIN_ENCODER) {
+				pka_encoder_set_plugin(PKA_ENCODER(ret), plugin);
 			}
 		}
 	}
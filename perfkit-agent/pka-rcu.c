@@ -0,0 +1,137 @@
+/* pka-rcu.c
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "pka-rcu.h"
+
+/**
+ * pka_rcu_init:
+ * @rcu: A #PkaRcu.
+ * @data: The initial snapshot.
+ *
+ * Initializes @rcu with @data as the published snapshot.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_rcu_init (PkaRcu   *rcu,  /* IN */
+              gpointer  data) /* IN */
+{
+	g_return_if_fail(rcu != NULL);
+
+	rcu->epoch = 0;
+	rcu->readers[0] = 0;
+	rcu->readers[1] = 0;
+	g_atomic_pointer_set(&rcu->data, data);
+}
+
+/*
+ * Grace periods flip the epoch twice and wait on whichever counter was
+ * left behind, so two of them must not interleave.  They are serialized
+ * here rather than under the writer lock of the caller, which is released
+ * before waiting.
+ */
+G_LOCK_DEFINE_STATIC(synchronize);
+
+/**
+ * pka_rcu_assign:
+ * @rcu: A #PkaRcu.
+ * @data: The new snapshot.
+ *
+ * Publishes @data as the current snapshot without waiting for readers.
+ * Writers must be serialized by the caller.  The previous snapshot may
+ * still be in use until pka_rcu_synchronize() returns, which should be
+ * called after releasing the writer lock.
+ *
+ * Returns: The previous snapshot.
+ * Side effects: None.
+ */
+gpointer
+pka_rcu_assign (PkaRcu   *rcu,  /* IN */
+                gpointer  data) /* IN */
+{
+	gpointer old;
+
+	g_return_val_if_fail(rcu != NULL, NULL);
+
+	old = rcu->data;
+	g_atomic_pointer_set(&rcu->data, data);
+	return old;
+}
+
+/**
+ * pka_rcu_synchronize:
+ * @rcu: A #PkaRcu.
+ *
+ * Waits until no reader can still be using a snapshot replaced before
+ * this was called.
+ *
+ * Returns: None.
+ * Side effects: Blocks until in-flight read sections complete.
+ */
+void
+pka_rcu_synchronize (PkaRcu *rcu) /* IN */
+{
+	gint epoch;
+	gint i;
+
+	g_return_if_fail(rcu != NULL);
+
+	G_LOCK(synchronize);
+	for (i = 0; i < 2; i++) {
+		/*
+		 * The atomic add is a full barrier, so readers registering in the
+		 * new epoch are guaranteed to observe the new snapshot.
+		 */
+		epoch = g_atomic_int_exchange_and_add(&rcu->epoch, 1) & 1;
+		while (g_atomic_int_get(&rcu->readers[epoch])) {
+			g_thread_yield();
+		}
+	}
+	G_UNLOCK(synchronize);
+}
+
+/**
+ * pka_rcu_replace:
+ * @rcu: A #PkaRcu.
+ * @data: The new snapshot.
+ *
+ * Publishes @data as the current snapshot and waits until no reader can
+ * still be using the previous one.  This must not be called with a lock
+ * that readers or other writers may wait on; use pka_rcu_assign() and
+ * pka_rcu_synchronize() instead.
+ *
+ * Returns: The previous snapshot, which the caller should free.
+ * Side effects: Blocks until in-flight read sections complete.
+ */
+gpointer
+pka_rcu_replace (PkaRcu   *rcu,  /* IN */
+                 gpointer  data) /* IN */
+{
+	gpointer old;
+
+	g_return_val_if_fail(rcu != NULL, NULL);
+
+	old = pka_rcu_assign(rcu, data);
+	pka_rcu_synchronize(rcu);
+	return old;
+}
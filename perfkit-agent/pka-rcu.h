@@ -0,0 +1,102 @@
+/* pka-rcu.h
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PKA_RCU_H__
+#define __PKA_RCU_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _PkaRcu PkaRcu;
+
+/*
+ * PkaRcu publishes an immutable snapshot that readers can use without
+ * taking a lock.  Writers build a new snapshot, swap it in with
+ * pka_rcu_replace() and free the previous one once it returns, which is
+ * after every reader that could have seen it has finished.
+ *
+ * Readers register in one of two counters selected by the current epoch.
+ * A writer flips the epoch so that new readers use the other counter, and
+ * waits for the previous counter to drain.  Doing so for both counters
+ * guarantees that no reader still references the old snapshot, without
+ * starving the writer while new readers keep arriving.
+ *
+ * Writers must be serialized by the caller.  They publish with
+ * pka_rcu_assign() while holding their lock and wait with
+ * pka_rcu_synchronize() once it is released, so that neither readers nor
+ * other writers queue behind a grace period.  pka_rcu_replace() does both
+ * and is meant for teardown.  A read section must not wait on anything
+ * held by a writer, and a grace period must not be waited for from within
+ * a read section of the same #PkaRcu.
+ */
+struct _PkaRcu
+{
+	volatile gint     epoch;
+	volatile gint     readers[2];
+	volatile gpointer data;
+};
+
+void     pka_rcu_init        (PkaRcu   *rcu,
+                              gpointer  data);
+gpointer pka_rcu_assign      (PkaRcu   *rcu,
+                              gpointer  data);
+void     pka_rcu_synchronize (PkaRcu   *rcu);
+gpointer pka_rcu_replace     (PkaRcu   *rcu,
+                              gpointer  data);
+
+/**
+ * pka_rcu_read_lock:
+ * @rcu: A #PkaRcu.
+ * @epoch: A location for the epoch to pass to pka_rcu_read_unlock().
+ *
+ * Begins a read section.  The returned snapshot is valid until
+ * pka_rcu_read_unlock() is called.
+ *
+ * Returns: The current snapshot.
+ * Side effects: None.
+ */
+static inline gpointer
+pka_rcu_read_lock (PkaRcu *rcu,   /* IN */
+                   gint   *epoch) /* OUT */
+{
+	*epoch = g_atomic_int_get(&rcu->epoch) & 1;
+	g_atomic_int_inc(&rcu->readers[*epoch]);
+	return g_atomic_pointer_get(&rcu->data);
+}
+
+/**
+ * pka_rcu_read_unlock:
+ * @rcu: A #PkaRcu.
+ * @epoch: The epoch from pka_rcu_read_lock().
+ *
+ * Ends a read section.  The snapshot must no longer be used.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static inline void
+pka_rcu_read_unlock (PkaRcu *rcu,   /* IN */
+                     gint    epoch) /* IN */
+{
+	g_atomic_int_add(&rcu->readers[epoch], -1);
+}
+
+G_END_DECLS
+
+#endif /* __PKA_RCU_H__ */
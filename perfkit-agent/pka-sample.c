@@ -43,14 +43,49 @@
  * Use the helper methods to help build your data buffer.
  */
 
+/*
+ * Samples are created on every tick of every source, so rather than going
+ * back to the allocator each time, released samples are kept on a free
+ * list along with their buffer.  The buffer is reset rather than freed so
+ * the capacity it grew to is available for the next sample.
+ *
+ * Each thread has its own free list so that a source producing samples
+ * does not need to take a lock.  Samples are usually released on a
+ * different thread than the one that created them (after the listener has
+ * delivered them), so any thread whose free list is full hands samples to
+ * a global depot which empty threads refill from.
+ */
+#define SAMPLE_POOL_MAX   (64)   /* Samples cached per thread */
+#define SAMPLE_DEPOT_MAX  (256)  /* Samples cached in the global depot */
+#define SAMPLE_BUFFER_MAX (4096) /* Largest buffer worth keeping around */
+
 struct _PkaSample
 {
 	volatile gint   ref_count;
 	struct timespec ts;
 	gint           source_id;       /* Source identifier within the channel. */
 	EggBuffer     *buf;             /* Protocol buffer style data blob. */
+	PkaSample     *next;            /* Next sample while in a free list. */
+	gpointer       cache;           /* Buffers from shareable encoders. */
+	PkaManifest   *manifest;        /* Schema of a packed sample. */
+	gint           last_row;        /* Last row appended to a packed sample. */
+	gint           n_consumers;     /* Subscriptions it was delivered to. */
 };
 
+typedef struct
+{
+	PkaSample *head;
+	guint      count;
+} PkaSamplePool;
+
+static GStaticPrivate pool_key = G_STATIC_PRIVATE_INIT;
+static GStaticPrivate tick_key = G_STATIC_PRIVATE_INIT;
+static PkaSamplePool  depot    = { NULL, 0 };
+
+G_LOCK_DEFINE_STATIC(depot);
+
+extern void pka_encoder_cache_clear (gpointer volatile *cache);
+
 /**
  * pka_sample_destroy:
  * @sample: A #PkaSample.
@@ -66,10 +101,175 @@ pka_sample_destroy (PkaSample *sample) /* IN */
 	g_return_if_fail(sample != NULL);
 
 	ENTRY;
+	pka_encoder_cache_clear(&sample->cache);
+	if (sample->manifest) {
+		pka_manifest_unref(sample->manifest);
+	}
 	egg_buffer_unref(sample->buf);
 	EXIT;
 }
 
+/**
+ * pka_sample_pool_free:
+ * @data: A #PkaSamplePool.
+ *
+ * Releases the free list of a thread that is exiting.  Samples are moved
+ * to the global depot while it has room; the rest are freed.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_sample_pool_free (gpointer data) /* IN */
+{
+	PkaSamplePool *pool = data;
+	PkaSample *sample;
+
+	ENTRY;
+	while ((sample = pool->head)) {
+		pool->head = sample->next;
+		G_LOCK(depot);
+		if (depot.count < SAMPLE_DEPOT_MAX) {
+			sample->next = depot.head;
+			depot.head = sample;
+			depot.count++;
+			sample = NULL;
+		}
+		G_UNLOCK(depot);
+		if (sample) {
+			pka_sample_destroy(sample);
+			g_slice_free(PkaSample, sample);
+		}
+	}
+	g_slice_free(PkaSamplePool, pool);
+	EXIT;
+}
+
+/**
+ * pka_sample_pool_get:
+ *
+ * Retrieves the sample free list for the current thread, creating it
+ * if needed.
+ *
+ * Returns: A #PkaSamplePool owned by the current thread.
+ * Side effects: None.
+ */
+static inline PkaSamplePool*
+pka_sample_pool_get (void)
+{
+	PkaSamplePool *pool;
+
+	if (G_UNLIKELY(!(pool = g_static_private_get(&pool_key)))) {
+		pool = g_slice_new0(PkaSamplePool);
+		g_static_private_set(&pool_key, pool, pka_sample_pool_free);
+	}
+	return pool;
+}
+
+/**
+ * pka_sample_alloc:
+ *
+ * Retrieves a sample from the current thread's free list, the global
+ * depot, or the allocator, in that order.  The sample's buffer is empty.
+ *
+ * Returns: A #PkaSample which needs to be initialized.
+ * Side effects: None.
+ */
+static PkaSample*
+pka_sample_alloc (void)
+{
+	PkaSamplePool *pool;
+	PkaSample *sample;
+
+	ENTRY;
+	pool = pka_sample_pool_get();
+	if (G_LIKELY((sample = pool->head))) {
+		pool->head = sample->next;
+		pool->count--;
+	} else {
+		G_LOCK(depot);
+		if ((sample = depot.head)) {
+			depot.head = sample->next;
+			depot.count--;
+		}
+		G_UNLOCK(depot);
+	}
+	if (sample) {
+		sample->next = NULL;
+		RETURN(sample);
+	}
+	sample = g_slice_new0(PkaSample);
+	sample->buf = egg_buffer_new();
+	RETURN(sample);
+}
+
+/**
+ * pka_sample_recycle:
+ * @sample: A #PkaSample.
+ *
+ * Returns @sample to the current thread's free list, or the global depot
+ * if that is full.  Samples whose buffer grew unusually large are freed
+ * so that a single burst does not pin memory for the lifetime of the
+ * agent.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_sample_recycle (PkaSample *sample) /* IN */
+{
+	PkaSamplePool *pool;
+
+	ENTRY;
+	pka_encoder_cache_clear(&sample->cache);
+	if (sample->manifest) {
+		pka_manifest_unref(sample->manifest);
+		sample->manifest = NULL;
+		sample->last_row = 0;
+	}
+	if (egg_buffer_get_capacity(sample->buf) <= SAMPLE_BUFFER_MAX) {
+		egg_buffer_reset(sample->buf);
+		pool = pka_sample_pool_get();
+		if (G_LIKELY(pool->count < SAMPLE_POOL_MAX)) {
+			sample->next = pool->head;
+			pool->head = sample;
+			pool->count++;
+			EXIT;
+		}
+		G_LOCK(depot);
+		if (depot.count < SAMPLE_DEPOT_MAX) {
+			sample->next = depot.head;
+			depot.head = sample;
+			depot.count++;
+			sample = NULL;
+		}
+		G_UNLOCK(depot);
+		if (!sample) {
+			EXIT;
+		}
+	}
+	pka_sample_destroy(sample);
+	g_slice_free(PkaSample, sample);
+	EXIT;
+}
+
+/**
+ * pka_sample_set_tick:
+ * @ts: The timestamp of the current tick or %NULL.
+ *
+ * Internal method used by aligned sources so that every sample created by
+ * the current thread during a tick gets the timestamp of the tick.  @ts
+ * must stay valid until the tick is cleared with %NULL.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_sample_set_tick (struct timespec *ts) /* IN */
+{
+	g_static_private_set(&tick_key, ts, NULL);
+}
+
 /**
  * pka_sample_new:
  *
@@ -82,13 +282,14 @@ pka_sample_destroy (PkaSample *sample) /* IN */
 PkaSample*
 pka_sample_new (void)
 {
+	struct timespec *tick;
 	PkaSample *sample;
 
 	ENTRY;
-	sample = g_slice_new0(PkaSample);
+	sample = pka_sample_alloc();
 	sample->ref_count = 1;
 	sample->source_id = -1;
-	sample->buf = egg_buffer_new();
+	sample->n_consumers = 0;
 	/*
 	 * XXX: Tests have shown on my dual-core x64 system that retrieving the
 	 *  realtime clock vs. monotonic clock are nearly identical.  Therefore,
@@ -98,7 +299,42 @@ pka_sample_new (void)
 	 *  strong change that this will not be the case.  We should once again
 	 *  consider using CLOCK_MONOTONIC at that point.
 	 */
-	clock_gettime(CLOCK_REALTIME, &sample->ts);
+	if ((tick = g_static_private_get(&tick_key))) {
+		sample->ts = *tick;
+	} else {
+		clock_gettime(CLOCK_REALTIME, &sample->ts);
+	}
+	RETURN(sample);
+}
+
+/**
+ * pka_sample_new_packed:
+ * @manifest: A packed #PkaManifest.
+ *
+ * Creates a new instance of #PkaSample using the packed layout described
+ * by @manifest (see pka_manifest_set_packed()).  Rather than tagging each
+ * field, the sample begins with a bitmap of the rows that are present and
+ * the values follow without tags.  Fields must therefore be appended in
+ * increasing row order using the append method matching the row type.
+ * Rows may be skipped.
+ *
+ * Returns: the newly created #PkaSample.
+ * Side effects: None.
+ */
+PkaSample*
+pka_sample_new_packed (PkaManifest *manifest) /* IN */
+{
+	PkaSample *sample;
+	gint n_rows;
+
+	g_return_val_if_fail(manifest != NULL, NULL);
+	g_return_val_if_fail(pka_manifest_get_packed(manifest), NULL);
+
+	ENTRY;
+	sample = pka_sample_new();
+	sample->manifest = pka_manifest_ref(manifest);
+	n_rows = pka_manifest_get_n_rows(manifest);
+	egg_buffer_write_bytes(sample->buf, NULL, (n_rows + 7) / 8);
 	RETURN(sample);
 }
 
@@ -127,7 +363,8 @@ pka_sample_ref (PkaSample *sample) /* IN */
  * @sample: A #PkaSample.
  *
  * Atomically decrements the reference count of @sample by one.  When the
- * reference count reaches zero, the structure and its resources are freed.
+ * reference count reaches zero, the sample is returned to the sample pool
+ * for reuse.
  *
  * Returns: None.
  * Side effects: None.
@@ -140,8 +377,7 @@ pka_sample_unref (PkaSample *sample) /* IN */
 
 	ENTRY;
 	if (g_atomic_int_dec_and_test(&sample->ref_count)) {
-		pka_sample_destroy(sample);
-		g_slice_free(PkaSample, sample);
+		pka_sample_recycle(sample);
 	}
 	EXIT;
 }
@@ -209,6 +445,58 @@ pka_sample_set_source_id (PkaSample *sample,    /* IN */
 	EXIT;
 }
 
+/**
+ * pka_sample_set_n_consumers:
+ * @sample: A #PkaSample.
+ * @n_consumers: The number of subscriptions @sample is delivered to.
+ *
+ * Internal method used by the source to note how many subscriptions
+ * will encode the sample.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_sample_set_n_consumers (PkaSample *sample,      /* IN */
+                            gint       n_consumers) /* IN */
+{
+	g_return_if_fail(sample != NULL);
+	sample->n_consumers = n_consumers;
+}
+
+/**
+ * pka_sample_get_n_consumers:
+ * @sample: A #PkaSample.
+ *
+ * Internal method used by the subscriptions to decide whether the
+ * encoding of the sample is worth caching.
+ *
+ * Returns: The number of subscriptions, or 0 if unknown.
+ * Side effects: None.
+ */
+gint
+pka_sample_get_n_consumers (PkaSample *sample) /* IN */
+{
+	g_return_val_if_fail(sample != NULL, 0);
+	return sample->n_consumers;
+}
+
+/**
+ * pka_sample_get_cache:
+ * @sample: A #PkaSample.
+ *
+ * Internal method used by the encoders to cache the encoded sample.
+ *
+ * Returns: The location of the cache.
+ * Side effects: None.
+ */
+gpointer volatile*
+pka_sample_get_cache (PkaSample *sample) /* IN */
+{
+	g_return_val_if_fail(sample != NULL, NULL);
+	return &sample->cache;
+}
+
 /**
  * pka_sample_get_timespec:
  * @sample: A #PkaSample
@@ -252,6 +540,47 @@ pka_sample_set_timespec (PkaSample       *sample, /* IN */
 	EXIT;
 }
 
+/**
+ * pka_sample_begin_field:
+ * @sample: A #PkaSample.
+ * @field: The field within the manifest.
+ * @tag: The wire type of the field.
+ * @type: The #GType of the field.
+ *
+ * Prepares @sample for the value of @field.  Tagged samples get the field
+ * tag.  Packed samples get the row marked present in the bitmap after
+ * checking that the rows are appended in order with their manifest type,
+ * since the client could not otherwise make sense of the values.
+ *
+ * Returns: %TRUE if the value should be written; otherwise %FALSE.
+ * Side effects: None.
+ */
+static inline gboolean
+pka_sample_begin_field (PkaSample     *sample, /* IN */
+                        gint           field,  /* IN */
+                        EggBufferTag   tag,    /* IN */
+                        GType          type)   /* IN */
+{
+	const guint8 *data;
+	gsize len;
+
+	if (G_LIKELY(!sample->manifest)) {
+		egg_buffer_write_tag(sample->buf, field, tag);
+		return TRUE;
+	}
+	if (field <= sample->last_row ||
+	    field > pka_manifest_get_n_rows(sample->manifest) ||
+	    pka_manifest_get_row_type(sample->manifest, field) != type) {
+		g_warning("Invalid field %d for packed sample (last row %d).",
+		          field, sample->last_row);
+		return FALSE;
+	}
+	egg_buffer_get_buffer(sample->buf, &data, &len);
+	((guint8 *)data)[(field - 1) / 8] |= 1 << ((field - 1) % 8);
+	sample->last_row = field;
+	return TRUE;
+}
+
 /**
  * pka_sample_append_boolean:
  * @sample: A #PkaSample.
@@ -270,8 +599,9 @@ pka_sample_append_boolean (PkaSample *sample, /* IN */
 	g_return_if_fail(sample != NULL);
 
 	ENTRY;
-	egg_buffer_write_tag(sample->buf, field, EGG_BUFFER_BOOLEAN);
-	egg_buffer_write_boolean(sample->buf, b);
+	if (pka_sample_begin_field(sample, field, EGG_BUFFER_BOOLEAN, G_TYPE_BOOLEAN)) {
+		egg_buffer_write_boolean(sample->buf, b);
+	}
 	EXIT;
 }
 
@@ -294,8 +624,9 @@ pka_sample_append_double (PkaSample *sample, /* IN */
 	g_return_if_fail(sample != NULL);
 
 	ENTRY;
-	egg_buffer_write_tag(sample->buf, field, EGG_BUFFER_DOUBLE);
-	egg_buffer_write_double(sample->buf, d);
+	if (pka_sample_begin_field(sample, field, EGG_BUFFER_DOUBLE, G_TYPE_DOUBLE)) {
+		egg_buffer_write_double(sample->buf, d);
+	}
 	EXIT;
 }
 
@@ -318,8 +649,9 @@ pka_sample_append_float (PkaSample *sample, /* IN */
 	g_return_if_fail(sample != NULL);
 
 	ENTRY;
-	egg_buffer_write_tag(sample->buf, field, EGG_BUFFER_FLOAT);
-	egg_buffer_write_float(sample->buf, f);
+	if (pka_sample_begin_field(sample, field, EGG_BUFFER_FLOAT, G_TYPE_FLOAT)) {
+		egg_buffer_write_float(sample->buf, f);
+	}
 	EXIT;
 }
 
@@ -342,8 +674,9 @@ pka_sample_append_int (PkaSample *sample, /* IN */
 	g_return_if_fail(sample != NULL);
 
 	ENTRY;
-	egg_buffer_write_tag(sample->buf, field, EGG_BUFFER_INT);
-	egg_buffer_write_int(sample->buf, i);
+	if (pka_sample_begin_field(sample, field, EGG_BUFFER_INT, G_TYPE_INT)) {
+		egg_buffer_write_int(sample->buf, i);
+	}
 	EXIT;
 }
 
@@ -366,8 +699,9 @@ pka_sample_append_int64 (PkaSample *sample, /* IN */
 	g_return_if_fail(sample != NULL);
 
 	ENTRY;
-	egg_buffer_write_tag(sample->buf, field, EGG_BUFFER_INT64);
-	egg_buffer_write_int64(sample->buf, i);
+	if (pka_sample_begin_field(sample, field, EGG_BUFFER_INT64, G_TYPE_INT64)) {
+		egg_buffer_write_int64(sample->buf, i);
+	}
 	EXIT;
 }
 
@@ -390,8 +724,9 @@ pka_sample_append_string (PkaSample   *sample, /* IN */
 	g_return_if_fail(sample != NULL);
 
 	ENTRY;
-	egg_buffer_write_tag(sample->buf, field, EGG_BUFFER_STRING);
-	egg_buffer_write_string(sample->buf, s);
+	if (pka_sample_begin_field(sample, field, EGG_BUFFER_STRING, G_TYPE_STRING)) {
+		egg_buffer_write_string(sample->buf, s);
+	}
 	EXIT;
 }
 
@@ -414,8 +749,9 @@ pka_sample_append_uint (PkaSample *sample, /* IN */
 	g_return_if_fail(sample != NULL);
 
 	ENTRY;
-	egg_buffer_write_tag(sample->buf, field, EGG_BUFFER_UINT);
-	egg_buffer_write_uint(sample->buf, u);
+	if (pka_sample_begin_field(sample, field, EGG_BUFFER_UINT, G_TYPE_UINT)) {
+		egg_buffer_write_uint(sample->buf, u);
+	}
 	EXIT;
 }
 
@@ -438,8 +774,75 @@ pka_sample_append_uint64 (PkaSample *sample, /* IN */
 	g_return_if_fail(sample != NULL);
 
 	ENTRY;
-	egg_buffer_write_tag(sample->buf, field, EGG_BUFFER_UINT64);
-	egg_buffer_write_uint64(sample->buf, u);
+	if (pka_sample_begin_field(sample, field, EGG_BUFFER_UINT64, G_TYPE_UINT64)) {
+		egg_buffer_write_uint64(sample->buf, u);
+	}
+	EXIT;
+}
+
+/**
+ * pka_sample_append_uint64_array:
+ * @sample: A #PkaSample.
+ * @field: The field within the manifest of the first value.
+ * @u: An array of #guint64 to append to the buffer.
+ * @n_u: The number of values in @u.
+ *
+ * Appends the 64-bit unsigned integers @u to the fields starting at @field.
+ * Packed samples mark all of the rows at once and encode the values with a
+ * single call to egg_buffer_write_uint64_array(), which is cheaper than
+ * appending them one at a time for sources with many counters.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_sample_append_uint64_array (PkaSample     *sample, /* IN */
+                                gint           field,  /* IN */
+                                const guint64 *u,      /* IN */
+                                gsize          n_u)    /* IN */
+{
+	const guint8 *data;
+	gsize len;
+	gsize i;
+
+	g_return_if_fail(sample != NULL);
+	g_return_if_fail(u != NULL || n_u == 0);
+
+	ENTRY;
+	if (G_LIKELY(!sample->manifest)) {
+		for (i = 0; i < n_u; i++) {
+			egg_buffer_write_tag(sample->buf, field + i, EGG_BUFFER_UINT64);
+			egg_buffer_write_uint64(sample->buf, u[i]);
+		}
+		EXIT;
+	}
+	if (!n_u) {
+		EXIT;
+	}
+	/*
+	 * Check every row before marking any of them, so that a bad call
+	 * leaves the sample as it was.
+	 */
+	if (field <= sample->last_row ||
+	    field + n_u - 1 > pka_manifest_get_n_rows(sample->manifest)) {
+		GOTO(invalid);
+	}
+	for (i = 0; i < n_u; i++) {
+		if (pka_manifest_get_row_type(sample->manifest,
+		                              field + i) != G_TYPE_UINT64) {
+			GOTO(invalid);
+		}
+	}
+	egg_buffer_get_buffer(sample->buf, &data, &len);
+	for (i = 0; i < n_u; i++) {
+		((guint8 *)data)[(field + i - 1) / 8] |= 1 << ((field + i - 1) % 8);
+	}
+	sample->last_row = field + n_u - 1;
+	egg_buffer_write_uint64_array(sample->buf, u, n_u);
+	EXIT;
+  invalid:
+	g_warning("Invalid fields %d to %d for packed sample (last row %d).",
+	          field, (gint)(field + n_u - 1), sample->last_row);
 	EXIT;
 }
 
@@ -469,8 +872,10 @@ pka_sample_append_timeval (PkaSample *sample, /* IN */
 
 	ENTRY;
 	usec = (tv->tv_sec * G_USEC_PER_SEC) + tv->tv_usec;
-	egg_buffer_write_tag(sample->buf, field, EGG_BUFFER_UINT64);
-	egg_buffer_write_uint64(sample->buf, usec);
+	if (pka_sample_begin_field(sample, field, EGG_BUFFER_UINT64,
+	                           G_TYPE_UINT64)) {
+		egg_buffer_write_uint64(sample->buf, usec);
+	}
 	EXIT;
 }
 
@@ -36,6 +36,7 @@ typedef struct _PkaSample PkaSample;
 
 GType       pka_sample_get_type       (void) G_GNUC_CONST;
 PkaSample*  pka_sample_new            (void);
+PkaSample*  pka_sample_new_packed     (PkaManifest      *manifest);
 PkaSample*  pka_sample_ref            (PkaSample        *sample);
 void        pka_sample_unref          (PkaSample        *sample);
 void        pka_sample_get_data       (PkaSample        *sample,
@@ -73,6 +74,10 @@ void        pka_sample_append_uint64  (PkaSample        *sample,
 void        pka_sample_append_timeval (PkaSample        *sample,
                                        gint              field,
                                        GTimeVal         *tv);
+void        pka_sample_append_uint64_array (PkaSample     *sample,
+                                            gint           field,
+                                            const guint64 *u,
+                                            gsize          n_u);
 
 G_END_DECLS
 
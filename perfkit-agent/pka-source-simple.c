@@ -27,6 +27,7 @@
 
 #include <egg-time.h>
 #include <pthread.h>
+#include <unistd.h>
 #include <perfkit-agent/perfkit-agent.h>
 
 /**
@@ -39,12 +40,45 @@
 
 G_DEFINE_TYPE(PkaSourceSimple, pka_source_simple, PKA_TYPE_SOURCE)
 
+/*
+ * How late a source must be before an idle worker steals it from a busy
+ * worker.  Short callbacks finish well within this, so sources (and the
+ * ticks of aligned sources) stay on their worker unless it is blocked.
+ */
+#define STEAL_DELAY_NSEC (10 * 1000 * 1000)
+
+typedef struct
+{
+	guint            id;
+	pthread_mutex_t  mutex;
+	pthread_cond_t   cond;
+	GPtrArray       *heap;    /* Min-heap of sources ordered by timeout */
+	gboolean         busy;    /* Running a callback without the mutex */
+	gboolean         kicked;  /* Woken to watch a busy worker */
+	GThread         *thread;
+	PkaSourceSimpleStats stats; /* Timing of the callbacks run here */
+} PkaSimpleWorker;
+
+typedef struct
+{
+	guint64 lateness; /* usec between the deadline and the callback */
+	guint64 duration; /* usec spent in the callback */
+	guint64 missed;   /* Whole periods passed since the deadline */
+} PkaSimpleTiming;
+
 struct _PkaSourceSimplePrivate
 {
 	pthread_mutex_t       mutex;
 	pthread_cond_t        cond;
 	struct timespec       freq;
 	struct timespec       timeout;
+	gint                  heap_index;  /* Position in the worker heap or -1 */
+	PkaSimpleWorker      *worker;      /* Worker owning the source */
+	gboolean              attached;    /* Attached to the shared pool */
+	gboolean              busy;        /* Callback running on a worker */
+	gboolean              aligned;     /* Deadlines snap to the tick grid */
+	pthread_mutex_t       stats_mutex;
+	PkaSourceSimpleStats  stats;       /* Timing of the callbacks */
 	gboolean              dedicated;
 	gboolean              running;
 	GThread              *thread;
@@ -57,6 +91,7 @@ enum
 	PROP_0,
 	PROP_USE_THREAD,
 	PROP_FREQ,
+	PROP_ALIGNED,
 };
 
 enum
@@ -65,11 +100,20 @@ enum
 	LAST_SIGNAL
 };
 
-static pthread_cond_t   cond;
-static pthread_mutex_t  mutex;
 static gboolean         running = FALSE;
-static GPtrArray       *sources = NULL;
-static GThread         *thread  = NULL;
+static PkaSimpleWorker *workers = NULL;
+static guint            n_workers = 0;
+static gint             n_workers_requested = 0;
+static gboolean         aligned_default = FALSE;
+static PkaSimpleWorker *tick_worker = NULL;     /* Runs the aligned sources */
+static struct timespec  tick_offset = { 0, 0 }; /* Realtime - monotonic */
+
+static PkaSourceSimpleStats dedicated_stats; /* Timing of dedicated threads */
+
+G_LOCK_DEFINE_STATIC(tick);
+G_LOCK_DEFINE_STATIC(dedicated_stats);
+
+extern void pka_sample_set_tick (struct timespec *ts);
 static guint            signals[LAST_SIGNAL] = {0};
 
 /**
@@ -265,51 +309,299 @@ pka_source_simple_get_use_thread (PkaSourceSimple *source) /* IN */
 	RETURN(source->priv->dedicated);
 }
 
+/**
+ * pka_source_simple_set_aligned:
+ * @source: A #PkaSourceSimple.
+ * @aligned: If the source should sample on the shared tick grid.
+ *
+ * Sets if @source samples on the shared tick grid.  Aligned sources are
+ * due at whole multiples of their frequency on the monotonic clock, so
+ * sources with equal or harmonic frequencies are due at the same instants.
+ * Those sources are run from a single wakeup, and every sample created
+ * during the tick gets the same timestamp, the one of the tick.  Their
+ * deadlines advance by their frequency rather than being taken from when
+ * they last ran, so they do not drift.
+ *
+ * The default comes from the [source.simple] aligned key of the
+ * configuration.  Changing it while the source is running takes effect
+ * from its next sample.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_source_simple_set_aligned (PkaSourceSimple *source,  /* IN */
+                               gboolean         aligned) /* IN */
+{
+	g_return_if_fail(PKA_IS_SOURCE_SIMPLE(source));
+
+	ENTRY;
+	source->priv->aligned = aligned;
+	EXIT;
+}
+
+/**
+ * pka_source_simple_get_aligned:
+ * @source: A #PkaSourceSimple.
+ *
+ * Retrieves if @source samples on the shared tick grid.
+ *
+ * Returns: %TRUE if @source is aligned; otherwise %FALSE.
+ * Side effects: None.
+ */
+gboolean
+pka_source_simple_get_aligned (PkaSourceSimple *source) /* IN */
+{
+	g_return_val_if_fail(PKA_IS_SOURCE_SIMPLE(source), FALSE);
+	return source->priv->aligned;
+}
+
+/**
+ * pka_source_simple_set_aligned_default:
+ * @aligned: If new sources should sample on the shared tick grid.
+ *
+ * Internal method used by the manager to set the default for
+ * pka_source_simple_set_aligned() from the configuration.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_source_simple_set_aligned_default (gboolean aligned) /* IN */
+{
+	aligned_default = aligned;
+}
+
+/**
+ * pka_source_simple_snap:
+ * @source: A #PkaSourceSimple.
+ * @now: The current monotonic time.
+ *
+ * Sets the next timeout of @source to the first multiple of its frequency
+ * after @now.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static inline void
+pka_source_simple_snap (PkaSourceSimple *source, /* IN */
+                        struct timespec *now)    /* IN */
+{
+	PkaSourceSimplePrivate *priv = source->priv;
+	guint64 freq;
+	guint64 next;
+
+	freq = ((guint64)priv->freq.tv_sec * G_NSEC_PER_SEC) + priv->freq.tv_nsec;
+	next = ((guint64)now->tv_sec * G_NSEC_PER_SEC) + now->tv_nsec;
+	if (freq) {
+		next = ((next / freq) + 1) * freq;
+	}
+	priv->timeout.tv_sec = next / G_NSEC_PER_SEC;
+	priv->timeout.tv_nsec = next % G_NSEC_PER_SEC;
+}
+
 /**
  * pka_source_simple_update:
  * @source: A #PkaSourceSimple.
+ * @now: The current monotonic time.
  *
- * Updates the next timeout to now + frequency.
+ * Updates the next timeout to @now + frequency.  Aligned sources advance
+ * their previous deadline by the frequency instead, and skip ahead to the
+ * first multiple of the frequency after @now when they fell behind.
  *
  * Returns: None.
  * Side effects: None.
  */
 static inline void
-pka_source_simple_update (PkaSourceSimple *source) /* IN */
+pka_source_simple_update (PkaSourceSimple *source, /* IN */
+                          struct timespec *now)    /* IN */
 {
 	PkaSourceSimplePrivate *priv;
-	struct timespec *freq;
-	struct timespec ts;
 
 	ENTRY;
 	priv = source->priv;
-	freq = &priv->freq;
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-	timespec_add(&ts, freq, &priv->timeout);
+	if (!priv->aligned) {
+		timespec_add(now, &priv->freq, &priv->timeout);
+		EXIT;
+	}
+	timespec_add(&priv->timeout, &priv->freq, &priv->timeout);
+	if (timespec_compare(&priv->timeout, now) <= 0) {
+		pka_source_simple_snap(source, now);
+	}
 	EXIT;
 }
 
+/**
+ * pka_source_simple_tick_time:
+ * @tick: The monotonic deadline of a tick.
+ * @ts: A location for the realtime timestamp of the tick.
+ *
+ * Converts the deadline of a tick into the realtime clock used for sample
+ * timestamps.  The offset between the clocks is shared by all workers so
+ * that samples of the same tick get the same timestamp; it is only updated
+ * when the realtime clock has been stepped by more than a millisecond.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_source_simple_tick_time (struct timespec *tick, /* IN */
+                             struct timespec *ts)   /* OUT */
+{
+	struct timespec mono;
+	struct timespec real;
+	struct timespec offset;
+	struct timespec diff;
+
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	timespec_subtract(&real, &mono, &offset);
+	G_LOCK(tick);
+	if (timespec_compare(&offset, &tick_offset) >= 0) {
+		timespec_subtract(&offset, &tick_offset, &diff);
+	} else {
+		timespec_subtract(&tick_offset, &offset, &diff);
+	}
+	if (diff.tv_sec || diff.tv_nsec > 1000 * 1000) {
+		tick_offset = offset;
+	}
+	timespec_add(tick, &tick_offset, ts);
+	G_UNLOCK(tick);
+}
+
+/**
+ * pka_source_simple_bucket:
+ * @usec: A duration in microseconds.
+ *
+ * Retrieves the histogram bucket for @usec.  Bucket 0 counts durations
+ * under a microsecond and bucket n durations from 2^(n-1) up to 2^n
+ * microseconds.  The last bucket also counts everything longer.
+ *
+ * Returns: The index of the bucket.
+ * Side effects: None.
+ */
+static inline guint
+pka_source_simple_bucket (guint64 usec) /* IN */
+{
+	guint bucket = 0;
+
+	while (usec && bucket < PKA_SOURCE_SIMPLE_N_BUCKETS - 1) {
+		usec >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+/**
+ * pka_source_simple_record:
+ * @stats: A #PkaSourceSimpleStats.
+ * @timing: The timing of a callback.
+ *
+ * Adds the timing of a callback to @stats.  The caller must hold the lock
+ * protecting @stats.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static inline void
+pka_source_simple_record (PkaSourceSimpleStats  *stats,  /* IN/OUT */
+                          const PkaSimpleTiming *timing) /* IN */
+{
+	stats->n_samples++;
+	stats->n_missed += timing->missed;
+	stats->lateness[pka_source_simple_bucket(timing->lateness)]++;
+	stats->duration[pka_source_simple_bucket(timing->duration)]++;
+}
+
+/**
+ * pka_source_simple_merge:
+ * @stats: A #PkaSourceSimpleStats.
+ * @other: A #PkaSourceSimpleStats to add to @stats.
+ *
+ * Adds the counters of @other to @stats.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_source_simple_merge (PkaSourceSimpleStats       *stats, /* IN/OUT */
+                         const PkaSourceSimpleStats *other) /* IN */
+{
+	gint i;
+
+	stats->n_samples += other->n_samples;
+	stats->n_missed += other->n_missed;
+	for (i = 0; i < PKA_SOURCE_SIMPLE_N_BUCKETS; i++) {
+		stats->lateness[i] += other->lateness[i];
+		stats->duration[i] += other->duration[i];
+	}
+}
+
 /**
  * pka_source_simple_invoke:
  * @source: A #PkaSourceSimple.
+ * @now: The current monotonic time.
+ * @clock: The monotonic time the callback starts.
+ * @timing: A location for the timing of the callback.
  *
- * Invokes the callback to generate a new sample.
+ * Invokes the callback to generate a new sample.  The timing of the
+ * callback is recorded in the statistics of @source and stored in @timing
+ * for the statistics of the worker.  @clock is updated to when the callback
+ * returned, so that a worker running several sources in a row reads the
+ * clock once per callback.
  *
  * Returns: None.
  * Side effects: None.
  */
 static inline void
-pka_source_simple_invoke (PkaSourceSimple *source) /* IN */
+pka_source_simple_invoke (PkaSourceSimple *source, /* IN */
+                          struct timespec *now,    /* IN */
+                          struct timespec *clock,  /* IN/OUT */
+                          PkaSimpleTiming *timing) /* OUT */
 {
 	PkaSourceSimplePrivate *priv = source->priv;
 	GValue params = { 0 };
+	struct timespec deadline;
+	struct timespec start;
+	struct timespec diff;
+	struct timespec tick;
+	gboolean aligned;
+	guint64 freq;
 
 	ENTRY;
-	pka_source_simple_update(source);
+	deadline = priv->timeout;
+	start = *clock;
+	if ((aligned = priv->aligned)) {
+		pka_source_simple_tick_time(&priv->timeout, &tick);
+		pka_sample_set_tick(&tick);
+	}
+	pka_source_simple_update(source, now);
 	g_value_init(&params, PKA_TYPE_SOURCE_SIMPLE);
 	g_value_set_object(&params, source);
 	g_closure_invoke(priv->sample, NULL, 1, &params, NULL);
 	g_value_unset(&params);
+	if (aligned) {
+		pka_sample_set_tick(NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, clock);
+
+	/*
+	 * Record how late the callback ran, for how long, and how many
+	 * periods were missed while it was late.
+	 */
+	timing->lateness = 0;
+	timing->missed = 0;
+	if (timespec_compare(&start, &deadline) > 0) {
+		timespec_subtract(&start, &deadline, &diff);
+		timespec_to_usec(&diff, &timing->lateness);
+		timespec_to_usec(&priv->freq, &freq);
+		timing->missed = freq ? timing->lateness / freq : 0;
+	}
+	timespec_subtract(clock, &start, &diff);
+	timespec_to_usec(&diff, &timing->duration);
+	pthread_mutex_lock(&priv->stats_mutex);
+	pka_source_simple_record(&priv->stats, timing);
+	pthread_mutex_unlock(&priv->stats_mutex);
 	EXIT;
 }
 
@@ -318,7 +610,8 @@ pka_source_simple_invoke (PkaSourceSimple *source) /* IN */
  * @source: A #PkaSource.
  *
  * This method will block until the sources timeout has occurred or the
- * condition has been signaled by another thread.
+ * condition has been signaled by another thread.  Used by the dedicated
+ * worker.
  *
  * Returns: %TRUE if the source is not finished.
  * Side effects: None.
@@ -343,57 +636,308 @@ pka_source_simple_wait (PkaSourceSimple *source,     /* IN */
 	              sub.tv_sec, sub.tv_nsec);
 #endif
 	pthread_cond_timedwait(wait_cond, wait_mutex, &priv->timeout);
-	RETURN((wait_cond == &priv->cond) ? priv->running : running);
+	RETURN(priv->running);
 }
 
 /**
- * pka_source_simple_compare_func:
- * @a: A pointer to a #PkaSourceSimple.
- * @b: A pointer to a #PkaSourceSimple.
+ * pka_source_simple_heap_less:
+ * @worker: A #PkaSimpleWorker.
+ * @i: An index within the heap of @worker.
+ * @j: An index within the heap of @worker.
  *
- * A qsort style compare function suitable for sorting a GPtrArray.
+ * Checks if the source at @i in the heap of @worker times out before the
+ * source at @j.
  *
- * Returns: Same as qsort.
+ * Returns: %TRUE if @i is due before @j; otherwise %FALSE.
  * Side effects: None.
  */
-static gint
-pka_source_simple_compare_func (gconstpointer a, /* IN */
-                                gconstpointer b) /* IN */
+static inline gboolean
+pka_source_simple_heap_less (PkaSimpleWorker *worker, /* IN */
+                             guint            i,      /* IN */
+                             guint            j)      /* IN */
 {
-	PkaSourceSimple **sa = (PkaSourceSimple **)a;
-	PkaSourceSimple **sb = (PkaSourceSimple **)b;
-	PkaSourceSimplePrivate *pa = (*sa)->priv;
-	PkaSourceSimplePrivate *pb = (*sb)->priv;
+	PkaSourceSimple *a = g_ptr_array_index(worker->heap, i);
+	PkaSourceSimple *b = g_ptr_array_index(worker->heap, j);
 
-	return timespec_compare(&pa->timeout, &pb->timeout);
+	return timespec_compare(&a->priv->timeout, &b->priv->timeout) < 0;
 }
 
 /**
- * pka_source_simple_is_ready:
+ * pka_source_simple_heap_swap:
+ * @worker: A #PkaSimpleWorker.
+ * @i: An index within the heap of @worker.
+ * @j: An index within the heap of @worker.
+ *
+ * Swaps the sources at @i and @j within the heap of @worker, keeping their
+ * heap index up to date.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static inline void
+pka_source_simple_heap_swap (PkaSimpleWorker *worker, /* IN */
+                             guint            i,      /* IN */
+                             guint            j)      /* IN */
+{
+	PkaSourceSimple *a = g_ptr_array_index(worker->heap, i);
+	PkaSourceSimple *b = g_ptr_array_index(worker->heap, j);
+
+	g_ptr_array_index(worker->heap, i) = b;
+	g_ptr_array_index(worker->heap, j) = a;
+	b->priv->heap_index = i;
+	a->priv->heap_index = j;
+}
+
+/**
+ * pka_source_simple_heap_sift:
+ * @worker: A #PkaSimpleWorker.
+ * @i: An index within the heap of @worker.
+ *
+ * Restores the heap order after the timeout of the source at @i has
+ * changed, moving it towards the root or the leaves as needed.  The mutex
+ * of @worker must be held.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_source_simple_heap_sift (PkaSimpleWorker *worker, /* IN */
+                             guint            i)      /* IN */
+{
+	guint child;
+
+	while (i > 0 && pka_source_simple_heap_less(worker, i, (i - 1) / 2)) {
+		pka_source_simple_heap_swap(worker, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+	while ((child = (i * 2) + 1) < worker->heap->len) {
+		if (child + 1 < worker->heap->len &&
+		    pka_source_simple_heap_less(worker, child + 1, child)) {
+			child++;
+		}
+		if (!pka_source_simple_heap_less(worker, child, i)) {
+			break;
+		}
+		pka_source_simple_heap_swap(worker, i, child);
+		i = child;
+	}
+}
+
+/**
+ * pka_source_simple_heap_push:
+ * @worker: A #PkaSimpleWorker.
  * @source: A #PkaSourceSimple.
  *
- * Checks to see if the #PkaSourceSimple has timed out and is ready to be
- * executed.
+ * Adds @source to the heap of @worker.  The mutex of @worker must be held.
  *
- * Returns: %TRUE if @source is ready; otherwise %FALSE.
+ * Returns: None.
  * Side effects: None.
  */
-static inline gboolean
-pka_source_simple_is_ready (PkaSourceSimple *source) /* IN */
+static void
+pka_source_simple_heap_push (PkaSimpleWorker *worker, /* IN */
+                             PkaSourceSimple *source) /* IN */
 {
-	struct timespec ts;
+	source->priv->heap_index = worker->heap->len;
+	g_ptr_array_add(worker->heap, source);
+	pka_source_simple_heap_sift(worker, worker->heap->len - 1);
+}
 
-	ENTRY;
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-	RETURN((timespec_compare(&ts, &source->priv->timeout) >= 0));
+/**
+ * pka_source_simple_heap_remove:
+ * @worker: A #PkaSimpleWorker.
+ * @source: A #PkaSourceSimple within the heap of @worker.
+ *
+ * Removes @source from the heap of @worker by moving the last source into
+ * its place.  The mutex of @worker must be held.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_source_simple_heap_remove (PkaSimpleWorker *worker, /* IN */
+                               PkaSourceSimple *source) /* IN */
+{
+	guint i = source->priv->heap_index;
+	guint last = worker->heap->len - 1;
+
+	if (i != last) {
+		pka_source_simple_heap_swap(worker, i, last);
+	}
+	g_ptr_array_remove_index(worker->heap, last);
+	source->priv->heap_index = -1;
+	if (i != last) {
+		pka_source_simple_heap_sift(worker, i);
+	}
+}
+
+/**
+ * pka_source_simple_heap_pop_due:
+ * @worker: A #PkaSimpleWorker.
+ * @now: The current monotonic time.
+ *
+ * Removes the root of the heap of @worker if it is due at @now and marks
+ * it as running.  The mutex of @worker must be held.
+ *
+ * Returns: The due #PkaSourceSimple or %NULL.
+ * Side effects: None.
+ */
+static PkaSourceSimple*
+pka_source_simple_heap_pop_due (PkaSimpleWorker *worker, /* IN */
+                                struct timespec *now)    /* IN */
+{
+	PkaSourceSimple *source;
+
+	if (!worker->heap->len) {
+		return NULL;
+	}
+	source = g_ptr_array_index(worker->heap, 0);
+	if (timespec_compare(now, &source->priv->timeout) < 0) {
+		return NULL;
+	}
+	pka_source_simple_heap_remove(worker, source);
+	source->priv->busy = TRUE;
+	return source;
+}
+
+/**
+ * pka_source_simple_kick:
+ * @worker: A #PkaSimpleWorker.
+ *
+ * Wakes the first idle worker after @worker so that it watches the heap of
+ * @worker for sources to steal while @worker is running a callback.  No
+ * worker mutex may be held.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_source_simple_kick (PkaSimpleWorker *worker) /* IN */
+{
+	PkaSimpleWorker *peer;
+	guint i;
+
+	for (i = 1; i < n_workers; i++) {
+		peer = &workers[(worker->id + i) % n_workers];
+		if (!peer->busy) {
+			pthread_mutex_lock(&peer->mutex);
+			peer->kicked = TRUE;
+			pthread_cond_broadcast(&peer->cond);
+			pthread_mutex_unlock(&peer->mutex);
+			break;
+		}
+	}
+}
+
+/**
+ * pka_source_simple_run:
+ * @worker: A #PkaSimpleWorker.
+ * @source: A #PkaSourceSimple taken from a heap.
+ * @now: The current monotonic time.
+ * @clock: The monotonic time the callback starts.
+ *
+ * Invokes the callback of @source without holding the mutex of @worker so
+ * that idle workers can steal the other due sources of @worker meanwhile.
+ * @source is then added to the heap of @worker unless it was removed from
+ * the pool while running.  The mutex of @worker must be held.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_source_simple_run (PkaSimpleWorker *worker, /* IN */
+                       PkaSourceSimple *source, /* IN */
+                       struct timespec *now,    /* IN */
+                       struct timespec *clock)  /* IN/OUT */
+{
+	PkaSimpleTiming timing;
+	gboolean pending;
+
+	worker->busy = TRUE;
+	pending = worker->heap->len > 0;
+	pthread_mutex_unlock(&worker->mutex);
+	if (pending) {
+		pka_source_simple_kick(worker);
+	}
+	pka_source_simple_invoke(source, now, clock, &timing);
+	pthread_mutex_lock(&worker->mutex);
+	pka_source_simple_record(&worker->stats, &timing);
+	worker->busy = FALSE;
+	source->priv->busy = FALSE;
+	if (source->priv->attached) {
+		pka_source_simple_heap_push(worker, source);
+	}
+	pthread_cond_broadcast(&worker->cond);
+}
+
+/**
+ * pka_source_simple_steal:
+ * @worker: A #PkaSimpleWorker.
+ * @now: The current monotonic time.
+ * @deadline: A location for when a source of a busy worker can be stolen.
+ * @has_deadline: A location for if @deadline was set.
+ *
+ * Looks for a source that is late by more than %STEAL_DELAY_NSEC in the
+ * heaps of the workers that are running a callback and takes it over.
+ * Workers that are not busy run their own sources.  No worker mutex may be
+ * held.
+ *
+ * Returns: The stolen #PkaSourceSimple, now owned by @worker, or %NULL.
+ * Side effects: None.
+ */
+static PkaSourceSimple*
+pka_source_simple_steal (PkaSimpleWorker *worker,       /* IN */
+                         struct timespec *now,          /* IN */
+                         struct timespec *deadline,     /* OUT */
+                         gboolean        *has_deadline) /* OUT */
+{
+	PkaSourceSimple *source = NULL;
+	PkaSourceSimple *root;
+	PkaSimpleWorker *peer;
+	struct timespec delay = { 0, STEAL_DELAY_NSEC };
+	struct timespec late;
+	guint i;
+
+	timespec_subtract(now, &delay, &late);
+	*has_deadline = FALSE;
+	for (i = 1; i < n_workers && !source; i++) {
+		peer = &workers[(worker->id + i) % n_workers];
+		if (!peer->busy) {
+			continue;
+		}
+		pthread_mutex_lock(&peer->mutex);
+		if (peer->busy) {
+			if ((source = pka_source_simple_heap_pop_due(peer, &late))) {
+				source->priv->worker = worker;
+			} else if (peer->heap->len) {
+				root = g_ptr_array_index(peer->heap, 0);
+				timespec_add(&root->priv->timeout, &delay, &late);
+				if (!*has_deadline || timespec_compare(&late, deadline) < 0) {
+					*deadline = late;
+					*has_deadline = TRUE;
+				}
+				timespec_subtract(now, &delay, &late);
+			}
+		}
+		pthread_mutex_unlock(&peer->mutex);
+	}
+	return source;
 }
 
 /**
  * pka_source_simple_shared_worker:
- * @user_data: None.
+ * @user_data: A #PkaSimpleWorker.
+ *
+ * A threaded worker from the shared pool that dispatches the callbacks of
+ * its sources when their timeout occurs.
+ *
+ * Each worker keeps its sources in a binary min-heap ordered by their
+ * timeout, so the next source to run is always at the root and
+ * rescheduling one is O(log n).  The clock is read once per wakeup; every
+ * source due at that time is run and rescheduled relative to it.
  *
- * A threaded worker that can dispatch the callbacks when their
- * timeout occurs.
+ * Callbacks run without the worker mutex held.  When a worker has nothing
+ * due, it steals due sources from workers stuck in a callback, so a source
+ * that blocks only delays the worker running it.
  *
  * Returns: None.
  * Side effects: None.
@@ -401,36 +945,69 @@ pka_source_simple_is_ready (PkaSourceSimple *source) /* IN */
 static gpointer
 pka_source_simple_shared_worker (gpointer user_data) /* IN */
 {
+	PkaSimpleWorker *worker = user_data;
 	PkaSourceSimple *source;
-	gboolean dirty;
-	gint i;
+	PkaSourceSimple *root;
+	struct timespec deadline;
+	struct timespec clock;
+	struct timespec now;
+	gboolean has_deadline;
+	guint n_due;
+	guint n_run;
 
 	ENTRY;
-	pthread_mutex_lock(&mutex);
-  next:
-	if (!sources->len) {
-		pthread_cond_wait(&cond, &mutex);
-		goto next;
-	} else {
-		source = g_ptr_array_index(sources, 0);
-		if (!pka_source_simple_wait(source, &cond, &mutex)) {
-			goto unlock_and_finish;
+	pthread_mutex_lock(&worker->mutex);
+	while (running) {
+		worker->kicked = FALSE;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		clock = now;
+		/*
+		 * Run each source at most once per wakeup, even if its frequency
+		 * is shorter than the time the batch took.
+		 */
+		n_run = 0;
+		for (n_due = worker->heap->len; n_due; n_due--) {
+			if (!(source = pka_source_simple_heap_pop_due(worker, &now))) {
+				break;
+			}
+			pka_source_simple_run(worker, source, &now, &clock);
+			n_run++;
+		}
+		if (n_run) {
+			continue;
+		}
+		has_deadline = FALSE;
+		if (n_workers > 1) {
+			pthread_mutex_unlock(&worker->mutex);
+			source = pka_source_simple_steal(worker, &now, &deadline,
+			                                 &has_deadline);
+			pthread_mutex_lock(&worker->mutex);
+			if (source) {
+				TRACE(Simple, "Worker %u stole source %d.", worker->id,
+				      pka_source_get_id(PKA_SOURCE(source)));
+				clock_gettime(CLOCK_MONOTONIC, &clock);
+				pka_source_simple_run(worker, source, &now, &clock);
+				continue;
+			}
+		}
+		if (worker->kicked || !running) {
+			continue;
+		}
+		if (worker->heap->len) {
+			root = g_ptr_array_index(worker->heap, 0);
+			if (!has_deadline ||
+			    timespec_compare(&root->priv->timeout, &deadline) < 0) {
+				deadline = root->priv->timeout;
+				has_deadline = TRUE;
+			}
+		}
+		if (has_deadline) {
+			pthread_cond_timedwait(&worker->cond, &worker->mutex, &deadline);
+		} else {
+			pthread_cond_wait(&worker->cond, &worker->mutex);
 		}
 	}
-	dirty = FALSE;
-	for (i = 0; i < sources->len; i++) {
-		source = g_ptr_array_index(sources, i);
-		if (pka_source_simple_is_ready(source)) {
-			pka_source_simple_invoke(source);
-			dirty = TRUE;
-		} else break;
-	}
-	if (dirty) {
-		g_ptr_array_sort(sources, pka_source_simple_compare_func);
-	}
-	goto next;
-  unlock_and_finish:
-	pthread_mutex_unlock(&mutex);
+	pthread_mutex_unlock(&worker->mutex);
 	RETURN(NULL);
 }
 
@@ -448,11 +1025,19 @@ pka_source_simple_worker (gpointer user_data) /* IN */
 {
 	PkaSourceSimple *source = user_data;
 	PkaSourceSimplePrivate *priv = source->priv;
+	PkaSimpleTiming timing;
+	struct timespec clock;
+	struct timespec now;
 
 	ENTRY;
 	pthread_mutex_lock(&priv->mutex);
 	while (pka_source_simple_wait(source, &priv->cond, &priv->mutex)) {
-		pka_source_simple_invoke(source);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		clock = now;
+		pka_source_simple_invoke(source, &now, &clock, &timing);
+		G_LOCK(dedicated_stats);
+		pka_source_simple_record(&dedicated_stats, &timing);
+		G_UNLOCK(dedicated_stats);
 	}
 	pthread_mutex_unlock(&priv->mutex);
 	RETURN(NULL);
@@ -482,30 +1067,193 @@ pka_source_simple_init_pthreads (pthread_mutex_t *init_mutex, /* IN */
 	EXIT;
 }
 
+/**
+ * pka_source_simple_set_n_workers:
+ * @count: The number of shared workers, or 0 for the default.
+ *
+ * Internal method used by the manager to size the pool of shared workers
+ * from the configuration.  The default is half of the online CPUs.  This
+ * has no effect once the pool is running.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_source_simple_set_n_workers (gint count) /* IN */
+{
+	ENTRY;
+	if (count < 0) {
+		WARNING(Source, "Invalid shared worker count %d. Using default.",
+		        count);
+		count = 0;
+	}
+	n_workers_requested = count;
+	EXIT;
+}
+
+/**
+ * pka_source_simple_init_pool:
+ *
+ * Creates the pool of shared workers on first use.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_source_simple_init_pool (void)
+{
+	static gsize initialized = FALSE;
+	PkaSimpleWorker *worker;
+	GError *error = NULL;
+	glong n_cpus;
+	guint i;
+
+	if (g_once_init_enter(&initialized)) {
+		if (!(n_workers = n_workers_requested)) {
+			n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+			n_workers = MAX(1, n_cpus / 2);
+		}
+		INFO(Source, "Starting %u shared workers.", n_workers);
+		workers = g_new0(PkaSimpleWorker, n_workers);
+		running = TRUE;
+		for (i = 0; i < n_workers; i++) {
+			worker = &workers[i];
+			worker->id = i;
+			worker->heap = g_ptr_array_new();
+			pka_source_simple_init_pthreads(&worker->mutex, &worker->cond);
+		}
+		for (i = 0; i < n_workers; i++) {
+			worker = &workers[i];
+			worker->thread = g_thread_create(pka_source_simple_shared_worker,
+			                                 worker, FALSE, &error);
+			if (!worker->thread) {
+				CRITICAL(Source, "Failed to initialize shared worker: %s",
+				         error->message);
+				g_clear_error(&error);
+			}
+		}
+		g_once_init_leave(&initialized, TRUE);
+	}
+}
+
+/**
+ * pka_source_simple_lock_worker:
+ * @source: A #PkaSourceSimple attached to the pool.
+ *
+ * Locks the worker owning @source.  Since sources move between workers
+ * when stolen, the owner is checked again once locked.
+ *
+ * Returns: The locked #PkaSimpleWorker.
+ * Side effects: None.
+ */
+static PkaSimpleWorker*
+pka_source_simple_lock_worker (PkaSourceSimple *source) /* IN */
+{
+	PkaSimpleWorker *worker;
+
+	for (;;) {
+		worker = source->priv->worker;
+		pthread_mutex_lock(&worker->mutex);
+		if (worker == source->priv->worker) {
+			return worker;
+		}
+		pthread_mutex_unlock(&worker->mutex);
+	}
+}
+
 static void
 pka_source_simple_remove_from_shared (PkaSourceSimple *source) /* IN */
 {
+	PkaSourceSimplePrivate *priv = source->priv;
+	PkaSimpleWorker *worker;
+	gboolean removed = FALSE;
+
 	ENTRY;
-	pthread_mutex_lock(&mutex);
-	g_ptr_array_remove(sources, source);
-	pthread_cond_signal(&cond);
-	pthread_mutex_unlock(&mutex);
-	source->priv->running = FALSE;
+	if (priv->worker) {
+		worker = pka_source_simple_lock_worker(source);
+		removed = priv->attached;
+		priv->attached = FALSE;
+		if (priv->heap_index >= 0) {
+			pka_source_simple_heap_remove(worker, source);
+		}
+		/*
+		 * Wait for a running callback so none is invoked after the
+		 * source has been stopped.
+		 */
+		while (priv->busy) {
+			pthread_cond_wait(&worker->cond, &worker->mutex);
+		}
+		pthread_mutex_unlock(&worker->mutex);
+	}
+	priv->running = FALSE;
 	g_signal_emit(source, signals[CLEANUP], 0);
+	if (removed) {
+		g_object_unref(source);
+	}
 	EXIT;
 }
 
+/**
+ * pka_source_simple_least_loaded:
+ *
+ * Retrieves the worker with the fewest sources.  The lengths are only a
+ * hint, so they are read without locking.
+ *
+ * Returns: A #PkaSimpleWorker.
+ * Side effects: None.
+ */
+static PkaSimpleWorker*
+pka_source_simple_least_loaded (void)
+{
+	PkaSimpleWorker *worker = &workers[0];
+	guint i;
+
+	for (i = 1; i < n_workers; i++) {
+		if (workers[i].heap->len < worker->heap->len) {
+			worker = &workers[i];
+		}
+	}
+	return worker;
+}
+
 static void
 pka_source_simple_add_to_shared (PkaSourceSimple *source) /* IN */
 {
+	PkaSourceSimplePrivate *priv = source->priv;
+	PkaSimpleWorker *worker;
+	struct timespec now;
+
 	ENTRY;
 	INFO(Source, "Attaching source %d to cooperative thread manager.",
 	     pka_source_get_id(PKA_SOURCE(source)));
-	pthread_mutex_lock(&mutex);
-	g_ptr_array_add(sources, g_object_ref(source));
-	g_ptr_array_sort(sources, pka_source_simple_compare_func);
-	pthread_cond_signal(&cond);
-	pthread_mutex_unlock(&mutex);
+	pka_source_simple_init_pool();
+	if (priv->aligned) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		pka_source_simple_snap(source, &now);
+	}
+	if (!priv->worker && priv->aligned) {
+		/*
+		 * Aligned sources share a worker so each tick is one wakeup.  The
+		 * pool only takes them over when that worker is blocked.
+		 */
+		G_LOCK(tick);
+		if (!tick_worker) {
+			tick_worker = pka_source_simple_least_loaded();
+		}
+		priv->worker = tick_worker;
+		G_UNLOCK(tick);
+	}
+	if (!priv->worker) {
+		priv->worker = pka_source_simple_least_loaded();
+	}
+	worker = pka_source_simple_lock_worker(source);
+	if (!priv->attached) {
+		priv->attached = TRUE;
+		g_object_ref(source);
+		pka_source_simple_heap_push(worker, source);
+		pthread_cond_broadcast(&worker->cond);
+	}
+	pthread_mutex_unlock(&worker->mutex);
 	EXIT;
 }
 
@@ -525,6 +1273,7 @@ pka_source_simple_started (PkaSource    *source,     /* IN */
 	PkaSourceSimplePrivate *priv;
 	GError *error = NULL;
 	GValue params[2] = { { 0 } };
+	struct timespec now;
 
 	ENTRY;
 	priv = PKA_SOURCE_SIMPLE(source)->priv;
@@ -540,6 +1289,10 @@ pka_source_simple_started (PkaSource    *source,     /* IN */
 	}
 	if (priv->dedicated) {
 		g_assert(!priv->thread && !priv->running);
+		if (priv->aligned) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			pka_source_simple_snap(PKA_SOURCE_SIMPLE(source), &now);
+		}
 		priv->running = TRUE;
 		priv->thread = g_thread_create(pka_source_simple_worker,
 		                               source, FALSE, &error);
@@ -657,6 +1410,67 @@ pka_source_simple_set_frequency (PkaSourceSimple *source,    /* IN */
 	EXIT;
 }
 
+/**
+ * pka_source_simple_get_stats:
+ * @source: A #PkaSourceSimple.
+ * @stats: A location for the #PkaSourceSimpleStats.
+ *
+ * Retrieves the timing statistics of the callbacks of @source since it
+ * was created.  Lateness is measured from the deadline of each sample to
+ * the start of its callback.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_source_simple_get_stats (PkaSourceSimple      *source, /* IN */
+                             PkaSourceSimpleStats *stats)  /* OUT */
+{
+	PkaSourceSimplePrivate *priv;
+
+	g_return_if_fail(PKA_IS_SOURCE_SIMPLE(source));
+	g_return_if_fail(stats != NULL);
+
+	ENTRY;
+	priv = source->priv;
+	pthread_mutex_lock(&priv->stats_mutex);
+	*stats = priv->stats;
+	pthread_mutex_unlock(&priv->stats_mutex);
+	EXIT;
+}
+
+/**
+ * pka_source_simple_get_total_stats:
+ * @stats: A location for the #PkaSourceSimpleStats.
+ *
+ * Retrieves the timing statistics of every callback run by the shared
+ * workers and the dedicated threads, including sources that have since
+ * been destroyed.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_source_simple_get_total_stats (PkaSourceSimpleStats *stats) /* OUT */
+{
+	PkaSimpleWorker *worker;
+	guint i;
+
+	g_return_if_fail(stats != NULL);
+
+	ENTRY;
+	G_LOCK(dedicated_stats);
+	*stats = dedicated_stats;
+	G_UNLOCK(dedicated_stats);
+	for (i = 0; workers && i < n_workers; i++) {
+		worker = &workers[i];
+		pthread_mutex_lock(&worker->mutex);
+		pka_source_simple_merge(stats, &worker->stats);
+		pthread_mutex_unlock(&worker->mutex);
+	}
+	EXIT;
+}
+
 static void
 pka_source_simple_finalize (GObject *object) /* IN */
 {
@@ -665,6 +1479,7 @@ pka_source_simple_finalize (GObject *object) /* IN */
 	ENTRY;
 	pthread_cond_destroy(&priv->cond);
 	pthread_mutex_destroy(&priv->mutex);
+	pthread_mutex_destroy(&priv->stats_mutex);
 	if (priv->sample) {
 		g_closure_unref(priv->sample);
 	}
@@ -682,6 +1497,10 @@ pka_source_simple_get_property (GObject    *object,  /* IN */
 	case PROP_FREQ:
 		g_value_set_pointer(value, &PKA_SOURCE_SIMPLE(object)->priv->freq);
 		break;
+	case PROP_ALIGNED:
+		g_value_set_boolean(value,
+			pka_source_simple_get_aligned(PKA_SOURCE_SIMPLE(object)));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 	}
@@ -702,6 +1521,10 @@ pka_source_simple_set_property (GObject      *object,  /* IN */
 		pka_source_simple_set_frequency(PKA_SOURCE_SIMPLE(object),
 		                                g_value_get_pointer(value));
 		break;
+	case PROP_ALIGNED:
+		pka_source_simple_set_aligned(PKA_SOURCE_SIMPLE(object),
+		                              g_value_get_boolean(value));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 	}
@@ -712,7 +1535,6 @@ pka_source_simple_class_init (PkaSourceSimpleClass *klass) /* IN */
 {
 	GObjectClass *object_class;
 	PkaSourceClass *source_class;
-	GError *error = NULL;
 
 	object_class = G_OBJECT_CLASS(klass);
 	object_class->finalize = pka_source_simple_finalize;
@@ -754,6 +1576,19 @@ pka_source_simple_class_init (PkaSourceSimpleClass *klass) /* IN */
 	                                                     "The sampling frequency",
 	                                                     G_PARAM_READWRITE));
 
+	/**
+	 * PkaSourceSimple:aligned
+	 *
+	 * The "aligned" property.
+	 */
+	g_object_class_install_property(object_class,
+	                                PROP_ALIGNED,
+	                                g_param_spec_boolean("aligned",
+	                                                     "Aligned",
+	                                                     "Sample on the shared tick grid",
+	                                                     FALSE,
+	                                                     G_PARAM_READWRITE));
+
 	/**
 	 * PkaSourceSimple:cleanup:
 	 *
@@ -771,26 +1606,9 @@ pka_source_simple_class_init (PkaSourceSimpleClass *klass) /* IN */
 	                                0);
 
 	/*
-	 * Initialize shared worker pthread synchronization.
-	 */
-	pka_source_simple_init_pthreads(&mutex, &cond);
-
-	/*
-	 * Initialize global data fields.
+	 * The pool of shared workers is started when the first source is
+	 * attached so that it can be sized from the configuration.
 	 */
-	sources = g_ptr_array_new();
-	running = TRUE;
-
-	/*
-	 * Spawn the worker thread.
-	 */
-	thread = g_thread_create(pka_source_simple_shared_worker,
-	                         NULL, FALSE, &error);
-	if (!thread) {
-		CRITICAL(Source, "Failed to initialize monitor thread: %s",
-		         error->message);
-		g_error_free(error);
-	}
 }
 
 static void
@@ -801,7 +1619,10 @@ pka_source_simple_init (PkaSourceSimple *source) /* IN */
 	                                           PKA_TYPE_SOURCE_SIMPLE,
 	                                           PkaSourceSimplePrivate);
 	timespec_from_double(1.0, &source->priv->freq);
+	source->priv->heap_index = -1;
+	source->priv->aligned = aligned_default;
 	pka_source_simple_init_pthreads(&source->priv->mutex,
 	                                &source->priv->cond);
+	pthread_mutex_init(&source->priv->stats_mutex, NULL);
 	EXIT;
 }
@@ -38,6 +38,9 @@ G_BEGIN_DECLS
 typedef struct _PkaSourceSimple        PkaSourceSimple;
 typedef struct _PkaSourceSimpleClass   PkaSourceSimpleClass;
 typedef struct _PkaSourceSimplePrivate PkaSourceSimplePrivate;
+typedef struct _PkaSourceSimpleStats   PkaSourceSimpleStats;
+
+#define PKA_SOURCE_SIMPLE_N_BUCKETS (24)
 
 /**
  * PkaSourceSimpleFunc:
@@ -81,6 +84,28 @@ struct _PkaSourceSimpleClass
 	PkaSourceClass parent_class;
 };
 
+/**
+ * PkaSourceSimpleStats:
+ * @n_samples: The number of callbacks run.
+ * @n_missed: The number of whole periods that passed before a late
+ *   callback started.
+ * @lateness: Histogram of the delay between each deadline and the start
+ *   of its callback.
+ * @duration: Histogram of the time spent in each callback.
+ *
+ * Timing statistics of the callbacks of simple sources.  Bucket 0 of the
+ * histograms counts values under a microsecond and bucket n values from
+ * 2^(n-1) up to 2^n microseconds.  The last bucket also counts everything
+ * longer.
+ */
+struct _PkaSourceSimpleStats
+{
+	guint64 n_samples;
+	guint64 n_missed;
+	guint32 lateness[PKA_SOURCE_SIMPLE_N_BUCKETS];
+	guint32 duration[PKA_SOURCE_SIMPLE_N_BUCKETS];
+};
+
 GType      pka_source_simple_get_type             (void) G_GNUC_CONST;
 PkaSource* pka_source_simple_new                  (void);
 PkaSource* pka_source_simple_new_full             (PkaSourceSimpleFunc    callback,
@@ -104,6 +129,12 @@ void       pka_source_simple_set_use_thread       (PkaSourceSimple       *source
                                                    gboolean               use_thread);
 void       pka_source_simple_set_frequency        (PkaSourceSimple       *source,
                                                    const GTimeVal        *frequency);
+gboolean   pka_source_simple_get_aligned          (PkaSourceSimple       *source);
+void       pka_source_simple_set_aligned          (PkaSourceSimple       *source,
+                                                   gboolean               aligned);
+void       pka_source_simple_get_stats            (PkaSourceSimple       *source,
+                                                   PkaSourceSimpleStats  *stats);
+void       pka_source_simple_get_total_stats      (PkaSourceSimpleStats  *stats);
 
 G_END_DECLS
 
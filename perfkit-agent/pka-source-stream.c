@@ -0,0 +1,608 @@
+/* pka-source-stream.c
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __linux__
+#error "Perfkit has not yet been ported to your platform."
+#endif
+
+#ifdef G_LOG_DOMAIN
+#undef G_LOG_DOMAIN
+#endif
+#define G_LOG_DOMAIN "Stream"
+
+#include <egg-time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <perfkit-agent/perfkit-agent.h>
+
+/**
+ * SECTION:pka-source-stream
+ * @title: PkaSourceStream
+ * @short_description: Base class for sources fed by file descriptors.
+ *
+ * #PkaSourceStream is the base class for sources that are pushed data
+ * rather than polled.  A subclass adds the file descriptors it reads with
+ * pka_source_stream_add_fd(), typically when the source is started, and
+ * implements the read() virtual method.
+ *
+ * The descriptors of every stream source are watched by a single agent I/O
+ * thread using epoll.  Data is read into a ring buffer kept for each
+ * descriptor, the backlog, and handed to the subclass once the batching
+ * window has passed since the first unread byte arrived, or as soon as the
+ * backlog is full.  Events arriving in a burst are therefore delivered
+ * together, and an idle source causes no wakeups at all.
+ */
+
+G_DEFINE_ABSTRACT_TYPE(PkaSourceStream, pka_source_stream, PKA_TYPE_SOURCE)
+
+#define MAX_EVENTS (32)
+
+typedef struct
+{
+	guint64          id;        /* Key in the I/O loop, used as epoll data */
+	PkaSourceStream *stream;
+	gint             fd;
+	guint8          *ring;      /* Backlog of unread data */
+	guint8          *scratch;   /* Used to unwrap the backlog */
+	gsize            size;      /* Capacity of ring, a power of two */
+	gsize            start;     /* Offset of the first unread byte */
+	gsize            len;       /* Unread bytes */
+	gboolean         pending;   /* Waiting for the window to pass */
+	struct timespec  deadline;
+	gboolean         busy;      /* Subclass is reading the backlog */
+	gboolean         removed;   /* Removed while busy, free when done */
+} PkaStreamFd;
+
+struct _PkaSourceStreamPrivate
+{
+	GPtrArray *fds;      /* PkaStreamFd of the source */
+	guint      window;   /* usec to batch data for */
+	gsize      backlog;  /* Size of the ring of each descriptor */
+};
+
+static gint             io_epoll = -1;
+static pthread_mutex_t  io_mutex;
+static GHashTable      *io_fds = NULL;     /* id to PkaStreamFd */
+static GPtrArray       *io_pending = NULL; /* PkaStreamFd within a window */
+static guint64          io_seq = 0;
+static guint            window_default = 1000;
+static gsize            backlog_default = 65536;
+
+/**
+ * pka_source_stream_set_window_default:
+ * @usec: The batching window in microseconds.
+ *
+ * Internal method used by the manager to set the batching window of new
+ * stream sources from the configuration.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_source_stream_set_window_default (gint usec) /* IN */
+{
+	ENTRY;
+	window_default = MAX(usec, 0);
+	EXIT;
+}
+
+/**
+ * pka_source_stream_set_backlog_default:
+ * @size: The size of the backlog in bytes.
+ *
+ * Internal method used by the manager to set the backlog size of new
+ * stream sources from the configuration.  The size is rounded up to a
+ * power of two.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_source_stream_set_backlog_default (gint size) /* IN */
+{
+	ENTRY;
+	for (backlog_default = 4096; backlog_default < size;) {
+		backlog_default <<= 1;
+	}
+	EXIT;
+}
+
+/**
+ * pka_source_stream_free_fd:
+ * @sfd: A #PkaStreamFd.
+ *
+ * Frees a descriptor that is no longer watched.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_source_stream_free_fd (PkaStreamFd *sfd) /* IN */
+{
+	g_free(sfd->ring);
+	g_free(sfd->scratch);
+	g_slice_free(PkaStreamFd, sfd);
+}
+
+/**
+ * pka_source_stream_drop_fd:
+ * @sfd: A #PkaStreamFd.
+ *
+ * Stops watching @sfd.  It is freed unless the subclass is reading it, in
+ * which case the I/O loop frees it afterwards.  The I/O mutex must be held.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_source_stream_drop_fd (PkaStreamFd *sfd) /* IN */
+{
+	epoll_ctl(io_epoll, EPOLL_CTL_DEL, sfd->fd, NULL);
+	g_hash_table_remove(io_fds, &sfd->id);
+	g_ptr_array_remove_fast(io_pending, sfd);
+	g_ptr_array_remove_fast(sfd->stream->priv->fds, sfd);
+	if (sfd->busy) {
+		sfd->removed = TRUE;
+	} else {
+		pka_source_stream_free_fd(sfd);
+	}
+}
+
+/**
+ * pka_source_stream_deliver:
+ * @sfd: A #PkaStreamFd.
+ *
+ * Hands the backlog of @sfd to the subclass.  The backlog is unwrapped
+ * first if it wraps around the end of the ring.  The I/O mutex must be
+ * held.
+ *
+ * Returns: %FALSE if @sfd was removed by the subclass.
+ * Side effects: None.
+ */
+static gboolean
+pka_source_stream_deliver (PkaStreamFd *sfd) /* IN */
+{
+	PkaSourceStreamClass *klass;
+	gsize head;
+	gsize consumed = 0;
+
+	sfd->pending = FALSE;
+	g_ptr_array_remove_fast(io_pending, sfd);
+	if (!sfd->len) {
+		return TRUE;
+	}
+	if (sfd->start + sfd->len > sfd->size) {
+		if (!sfd->scratch) {
+			sfd->scratch = g_malloc(sfd->size);
+		}
+		head = sfd->size - sfd->start;
+		memcpy(sfd->scratch, sfd->ring + sfd->start, head);
+		memcpy(sfd->scratch + head, sfd->ring, sfd->len - head);
+		memcpy(sfd->ring, sfd->scratch, sfd->len);
+		sfd->start = 0;
+	}
+	klass = PKA_SOURCE_STREAM_GET_CLASS(sfd->stream);
+	if (klass->read) {
+		sfd->busy = TRUE;
+		consumed = klass->read(sfd->stream, sfd->fd,
+		                       sfd->ring + sfd->start, sfd->len);
+		sfd->busy = FALSE;
+		if (sfd->removed) {
+			pka_source_stream_free_fd(sfd);
+			return FALSE;
+		}
+	} else {
+		consumed = sfd->len;
+	}
+	if (consumed >= sfd->len) {
+		sfd->start = 0;
+		sfd->len = 0;
+	} else if (!consumed && sfd->len == sfd->size) {
+		WARNING(Stream, "Dropping %" G_GSIZE_FORMAT " bytes the source "
+		        "could not read from %d.", sfd->len, sfd->fd);
+		sfd->start = 0;
+		sfd->len = 0;
+	} else {
+		sfd->start = (sfd->start + consumed) & (sfd->size - 1);
+		sfd->len -= consumed;
+	}
+	return TRUE;
+}
+
+/**
+ * pka_source_stream_fill:
+ * @sfd: A #PkaStreamFd.
+ * @now: The current monotonic time.
+ *
+ * Reads the available data of @sfd into its backlog.  The backlog is
+ * delivered straight away if it filled up, or if the end of the stream was
+ * reached, after which @sfd is removed.  The I/O mutex must be held.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_source_stream_fill (PkaStreamFd     *sfd, /* IN */
+                        struct timespec *now) /* IN */
+{
+	PkaSourceStreamClass *klass;
+	PkaSourceStream *stream;
+	struct timespec window;
+	struct iovec iov[2];
+	gsize offset;
+	gssize n;
+	gint fd;
+
+	offset = (sfd->start + sfd->len) & (sfd->size - 1);
+	iov[0].iov_base = sfd->ring + offset;
+	iov[0].iov_len = MIN(sfd->size - sfd->len, sfd->size - offset);
+	iov[1].iov_base = sfd->ring;
+	iov[1].iov_len = sfd->size - sfd->len - iov[0].iov_len;
+	if ((n = readv(sfd->fd, iov, 2)) < 0) {
+		if (errno == EAGAIN || errno == EINTR) {
+			return;
+		}
+		WARNING(Stream, "Failed to read from %d: %s",
+		        sfd->fd, g_strerror(errno));
+	}
+	if (n <= 0) {
+		stream = sfd->stream;
+		fd = sfd->fd;
+		if (pka_source_stream_deliver(sfd)) {
+			pka_source_stream_drop_fd(sfd);
+			klass = PKA_SOURCE_STREAM_GET_CLASS(stream);
+			if (klass->closed) {
+				klass->closed(stream, fd);
+			}
+		}
+		return;
+	}
+	sfd->len += n;
+	if (sfd->len == sfd->size) {
+		pka_source_stream_deliver(sfd);
+	} else if (!sfd->pending) {
+		sfd->pending = TRUE;
+		timespec_from_usec(&window, sfd->stream->priv->window);
+		timespec_add(now, &window, &sfd->deadline);
+		g_ptr_array_add(io_pending, sfd);
+	}
+}
+
+/**
+ * pka_source_stream_io_loop:
+ * @data: None.
+ *
+ * The agent I/O thread.  Waits for data on the descriptors of every stream
+ * source and delivers the backlogs whose window has passed.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static gpointer
+pka_source_stream_io_loop (gpointer data) /* IN */
+{
+	struct epoll_event events[MAX_EVENTS];
+	struct timespec left;
+	struct timespec now;
+	PkaStreamFd *sfd;
+	guint64 usec;
+	gint timeout;
+	gint n;
+	gint i;
+
+	for (;;) {
+		/*
+		 * Sleep until data arrives or the earliest window passes.
+		 */
+		pthread_mutex_lock(&io_mutex);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		timeout = -1;
+		for (i = 0; i < io_pending->len; i++) {
+			sfd = g_ptr_array_index(io_pending, i);
+			usec = 0;
+			if (timespec_compare(&sfd->deadline, &now) > 0) {
+				timespec_subtract(&sfd->deadline, &now, &left);
+				timespec_to_usec(&left, &usec);
+			}
+			/* round up so the window has passed when we wake */
+			if (timeout < 0 || (usec + 999) / 1000 < timeout) {
+				timeout = (usec + 999) / 1000;
+			}
+		}
+		pthread_mutex_unlock(&io_mutex);
+
+		n = epoll_wait(io_epoll, events, MAX_EVENTS, timeout);
+		if (n < 0 && errno != EINTR) {
+			CRITICAL(Stream, "Failed to wait for data: %s",
+			         g_strerror(errno));
+			break;
+		}
+
+		pthread_mutex_lock(&io_mutex);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for (i = 0; i < n; i++) {
+			/* the descriptor may have been removed meanwhile */
+			if ((sfd = g_hash_table_lookup(io_fds, &events[i].data.u64))) {
+				pka_source_stream_fill(sfd, &now);
+			}
+		}
+		for (i = io_pending->len - 1; i >= 0; i--) {
+			if (i >= io_pending->len) {
+				continue;
+			}
+			sfd = g_ptr_array_index(io_pending, i);
+			if (timespec_compare(&sfd->deadline, &now) <= 0) {
+				pka_source_stream_deliver(sfd);
+			}
+		}
+		pthread_mutex_unlock(&io_mutex);
+	}
+	return NULL;
+}
+
+/**
+ * pka_source_stream_init_loop:
+ *
+ * Starts the agent I/O thread on first use.
+ *
+ * Returns: %TRUE if the I/O thread is running.
+ * Side effects: None.
+ */
+static gboolean
+pka_source_stream_init_loop (void)
+{
+	static gsize initialized = FALSE;
+	pthread_mutexattr_t attr;
+	GError *error = NULL;
+
+	if (g_once_init_enter(&initialized)) {
+		/* sources may add or remove descriptors while reading */
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&io_mutex, &attr);
+		pthread_mutexattr_destroy(&attr);
+		io_fds = g_hash_table_new(g_int64_hash, g_int64_equal);
+		io_pending = g_ptr_array_new();
+		if ((io_epoll = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+			CRITICAL(Stream, "Failed to create epoll instance: %s",
+			         g_strerror(errno));
+		} else if (!g_thread_create(pka_source_stream_io_loop, NULL,
+		                            FALSE, &error)) {
+			CRITICAL(Stream, "Failed to start I/O thread: %s",
+			         error->message);
+			g_error_free(error);
+			close(io_epoll);
+			io_epoll = -1;
+		}
+		g_once_init_leave(&initialized, TRUE);
+	}
+	return io_epoll >= 0;
+}
+
+/**
+ * pka_source_stream_add_fd:
+ * @stream: A #PkaSourceStream.
+ * @fd: A readable file descriptor.
+ * @error: A location for a #GError, or %NULL.
+ *
+ * Starts watching @fd for data, which is handed to the read() virtual
+ * method of @stream.  @fd remains owned by the caller and should be
+ * non-blocking.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ * Side effects: None.
+ */
+gboolean
+pka_source_stream_add_fd (PkaSourceStream  *stream, /* IN */
+                          gint              fd,     /* IN */
+                          GError          **error)  /* OUT */
+{
+	struct epoll_event event;
+	PkaStreamFd *sfd;
+	gboolean ret = FALSE;
+
+	g_return_val_if_fail(PKA_IS_SOURCE_STREAM(stream), FALSE);
+	g_return_val_if_fail(fd >= 0, FALSE);
+
+	ENTRY;
+	if (!pka_source_stream_init_loop()) {
+		g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+		            "The agent I/O thread is not running.");
+		RETURN(FALSE);
+	}
+	pthread_mutex_lock(&io_mutex);
+	sfd = g_slice_new0(PkaStreamFd);
+	sfd->id = ++io_seq;
+	sfd->stream = stream;
+	sfd->fd = fd;
+	sfd->size = stream->priv->backlog;
+	sfd->ring = g_malloc(sfd->size);
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u64 = sfd->id;
+	if (epoll_ctl(io_epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+		            "Cannot watch %d: %s", fd, g_strerror(errno));
+		pka_source_stream_free_fd(sfd);
+		GOTO(unlock);
+	}
+	g_hash_table_insert(io_fds, &sfd->id, sfd);
+	g_ptr_array_add(stream->priv->fds, sfd);
+	ret = TRUE;
+  unlock:
+	pthread_mutex_unlock(&io_mutex);
+	RETURN(ret);
+}
+
+/**
+ * pka_source_stream_remove_fd:
+ * @stream: A #PkaSourceStream.
+ * @fd: A file descriptor added with pka_source_stream_add_fd().
+ *
+ * Stops watching @fd.  Unread data in its backlog is discarded.  This may
+ * be called from the read() virtual method.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_source_stream_remove_fd (PkaSourceStream *stream, /* IN */
+                             gint             fd)     /* IN */
+{
+	PkaStreamFd *sfd;
+	gint i;
+
+	g_return_if_fail(PKA_IS_SOURCE_STREAM(stream));
+
+	ENTRY;
+	pthread_mutex_lock(&io_mutex);
+	for (i = 0; i < stream->priv->fds->len; i++) {
+		sfd = g_ptr_array_index(stream->priv->fds, i);
+		if (sfd->fd == fd) {
+			pka_source_stream_drop_fd(sfd);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&io_mutex);
+	EXIT;
+}
+
+/**
+ * pka_source_stream_remove_all:
+ * @stream: A #PkaSourceStream.
+ *
+ * Stops watching every descriptor of @stream.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_source_stream_remove_all (PkaSourceStream *stream) /* IN */
+{
+	ENTRY;
+	if (!io_fds) {
+		EXIT;
+	}
+	pthread_mutex_lock(&io_mutex);
+	while (stream->priv->fds->len) {
+		pka_source_stream_drop_fd(g_ptr_array_index(stream->priv->fds, 0));
+	}
+	pthread_mutex_unlock(&io_mutex);
+	EXIT;
+}
+
+/**
+ * pka_source_stream_set_window:
+ * @stream: A #PkaSourceStream.
+ * @usec: The batching window in microseconds.
+ *
+ * Sets how long data is collected after the first unread byte arrives
+ * before it is handed to the subclass.  A window of 0 hands over the data
+ * as soon as it is read.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_source_stream_set_window (PkaSourceStream *stream, /* IN */
+                              guint            usec)   /* IN */
+{
+	g_return_if_fail(PKA_IS_SOURCE_STREAM(stream));
+
+	ENTRY;
+	stream->priv->window = usec;
+	EXIT;
+}
+
+/**
+ * pka_source_stream_get_window:
+ * @stream: A #PkaSourceStream.
+ *
+ * Retrieves the batching window of @stream.
+ *
+ * Returns: The window in microseconds.
+ * Side effects: None.
+ */
+guint
+pka_source_stream_get_window (PkaSourceStream *stream) /* IN */
+{
+	g_return_val_if_fail(PKA_IS_SOURCE_STREAM(stream), 0);
+	return stream->priv->window;
+}
+
+static void
+pka_source_stream_stopped (PkaSource *source) /* IN */
+{
+	ENTRY;
+	pka_source_stream_remove_all(PKA_SOURCE_STREAM(source));
+	EXIT;
+}
+
+static void
+pka_source_stream_dispose (GObject *object) /* IN */
+{
+	ENTRY;
+	pka_source_stream_remove_all(PKA_SOURCE_STREAM(object));
+	G_OBJECT_CLASS(pka_source_stream_parent_class)->dispose(object);
+	EXIT;
+}
+
+static void
+pka_source_stream_finalize (GObject *object) /* IN */
+{
+	ENTRY;
+	g_ptr_array_free(PKA_SOURCE_STREAM(object)->priv->fds, TRUE);
+	G_OBJECT_CLASS(pka_source_stream_parent_class)->finalize(object);
+	EXIT;
+}
+
+static void
+pka_source_stream_class_init (PkaSourceStreamClass *klass) /* IN */
+{
+	GObjectClass *object_class;
+	PkaSourceClass *source_class;
+
+	object_class = G_OBJECT_CLASS(klass);
+	object_class->dispose = pka_source_stream_dispose;
+	object_class->finalize = pka_source_stream_finalize;
+	g_type_class_add_private(object_class, sizeof(PkaSourceStreamPrivate));
+
+	/*
+	 * Subclasses overriding stopped must chain up so their descriptors
+	 * are no longer watched.
+	 */
+	source_class = PKA_SOURCE_CLASS(klass);
+	source_class->stopped = pka_source_stream_stopped;
+}
+
+static void
+pka_source_stream_init (PkaSourceStream *stream) /* IN */
+{
+	ENTRY;
+	stream->priv = G_TYPE_INSTANCE_GET_PRIVATE(stream,
+	                                           PKA_TYPE_SOURCE_STREAM,
+	                                           PkaSourceStreamPrivate);
+	stream->priv->fds = g_ptr_array_new();
+	stream->priv->window = window_default;
+	stream->priv->backlog = backlog_default;
+	EXIT;
+}
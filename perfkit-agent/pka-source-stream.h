@@ -0,0 +1,85 @@
+/* pka-source-stream.h
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined (__PERFKIT_AGENT_INSIDE__) && !defined (PERFKIT_COMPILATION)
+#error "Only <perfkit-agent/perfkit-agent.h> can be included directly."
+#endif
+
+#ifndef __PKA_SOURCE_STREAM_H__
+#define __PKA_SOURCE_STREAM_H__
+
+#include "pka-source.h"
+
+G_BEGIN_DECLS
+
+#define PKA_TYPE_SOURCE_STREAM            (pka_source_stream_get_type())
+#define PKA_SOURCE_STREAM(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), PKA_TYPE_SOURCE_STREAM, PkaSourceStream))
+#define PKA_SOURCE_STREAM_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), PKA_TYPE_SOURCE_STREAM, PkaSourceStream const))
+#define PKA_SOURCE_STREAM_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  PKA_TYPE_SOURCE_STREAM, PkaSourceStreamClass))
+#define PKA_IS_SOURCE_STREAM(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), PKA_TYPE_SOURCE_STREAM))
+#define PKA_IS_SOURCE_STREAM_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  PKA_TYPE_SOURCE_STREAM))
+#define PKA_SOURCE_STREAM_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  PKA_TYPE_SOURCE_STREAM, PkaSourceStreamClass))
+
+typedef struct _PkaSourceStream        PkaSourceStream;
+typedef struct _PkaSourceStreamClass   PkaSourceStreamClass;
+typedef struct _PkaSourceStreamPrivate PkaSourceStreamPrivate;
+
+struct _PkaSourceStream
+{
+	PkaSource parent;
+
+	/*< private >*/
+	PkaSourceStreamPrivate *priv;
+};
+
+/**
+ * PkaSourceStreamClass:
+ * @read: Handles the data read from a file descriptor of the source.  The
+ *   data is the backlog of @fd, of which the first bytes returned are
+ *   consumed; the rest, such as a partial record, is handed over again
+ *   with the next data.
+ * @closed: Notification that @fd reached the end of the stream and was
+ *   removed from the source.  The descriptor is not closed.
+ */
+struct _PkaSourceStreamClass
+{
+	PkaSourceClass parent_class;
+
+	gsize (*read)   (PkaSourceStream *stream,
+	                 gint             fd,
+	                 const guint8    *data,
+	                 gsize            len);
+	void  (*closed) (PkaSourceStream *stream,
+	                 gint             fd);
+
+	gpointer reserved[8];
+};
+
+GType    pka_source_stream_get_type   (void) G_GNUC_CONST;
+gboolean pka_source_stream_add_fd     (PkaSourceStream  *stream,
+                                       gint              fd,
+                                       GError          **error);
+void     pka_source_stream_remove_fd  (PkaSourceStream  *stream,
+                                       gint              fd);
+void     pka_source_stream_set_window (PkaSourceStream  *stream,
+                                       guint             usec);
+guint    pka_source_stream_get_window (PkaSourceStream  *stream);
+
+G_END_DECLS
+
+#endif /* __PKA_SOURCE_STREAM_H__ */
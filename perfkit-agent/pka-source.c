@@ -26,6 +26,7 @@
 
 #include "pka-channel.h"
 #include "pka-log.h"
+#include "pka-rcu.h"
 #include "pka-source.h"
 #include "pka-subscription.h"
 
@@ -54,10 +55,18 @@ G_DEFINE_ABSTRACT_TYPE (PkaSource, pka_source, G_TYPE_OBJECT)
  *   Signalling of Started, Stopped, Muted, and Unmuted signals happens
  *   from the main loop to simplify locking models.  It also helps give
  *   some sort of guarantee of thread to the source implementations.
+ *
+ *   Sample delivery happens on every tick of every source, so it does not
+ *   take the source lock.  Instead, whenever the manifest or the set of
+ *   subscriptions changes (with the writer lock held), an immutable
+ *   snapshot of both is published through a #PkaRcu which the delivery
+ *   path reads without locking.
  */
 
 extern void pka_sample_set_source_id   (PkaSample   *sample,
                                         gint         source_id);
+extern void pka_sample_set_n_consumers (PkaSample   *sample,
+                                        gint         n_consumers);
 extern void pka_manifest_set_source_id (PkaManifest *manifest,
                                         gint         source_id);
 
@@ -71,8 +80,16 @@ struct _PkaSourcePrivate
 	PkaManifest   *manifest;
 	GPtrArray     *subscriptions;
 	PkaChannel    *channel;
+	PkaRcu         snapshot;      /* PkaSourceSnapshot for delivery */
 };
 
+typedef struct
+{
+	PkaManifest      *manifest;
+	guint             n_subscriptions;
+	PkaSubscription  *subscriptions[1];
+} PkaSourceSnapshot;
+
 enum
 {
 	STARTED,
@@ -341,6 +358,106 @@ pka_source_set_channel (PkaSource  *source,  /* IN */
 	RETURN(ret);
 }
 
+/**
+ * pka_source_snapshot_new:
+ * @priv: A #PkaSourcePrivate.
+ *
+ * Creates a snapshot of the current manifest and subscriptions of the
+ * source.  The writer lock must be held.
+ *
+ * Returns: A newly allocated #PkaSourceSnapshot.
+ * Side effects: None.
+ */
+static PkaSourceSnapshot*
+pka_source_snapshot_new (PkaSourcePrivate *priv) /* IN */
+{
+	PkaSourceSnapshot *snapshot;
+	guint n = priv->subscriptions->len;
+	gint i;
+
+	ENTRY;
+	snapshot = g_malloc0(sizeof(PkaSourceSnapshot) +
+	                     (n * sizeof(PkaSubscription *)));
+	if (priv->manifest) {
+		snapshot->manifest = pka_manifest_ref(priv->manifest);
+	}
+	snapshot->n_subscriptions = n;
+	for (i = 0; i < n; i++) {
+		snapshot->subscriptions[i] = pka_subscription_ref(
+				g_ptr_array_index(priv->subscriptions, i));
+	}
+	RETURN(snapshot);
+}
+
+/**
+ * pka_source_snapshot_free:
+ * @snapshot: A #PkaSourceSnapshot.
+ *
+ * Frees @snapshot and releases the references it holds.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_source_snapshot_free (PkaSourceSnapshot *snapshot) /* IN */
+{
+	gint i;
+
+	ENTRY;
+	if (snapshot->manifest) {
+		pka_manifest_unref(snapshot->manifest);
+	}
+	for (i = 0; i < snapshot->n_subscriptions; i++) {
+		pka_subscription_unref(snapshot->subscriptions[i]);
+	}
+	g_free(snapshot);
+	EXIT;
+}
+
+/**
+ * pka_source_publish_locked:
+ * @source: A #PkaSource.
+ *
+ * Publishes a new snapshot of the manifest and subscriptions for the
+ * delivery path.  The writer lock must be held.  The previous snapshot
+ * must be passed to pka_source_retire() once the lock is released.
+ *
+ * Returns: The previous snapshot.
+ * Side effects: None.
+ */
+static PkaSourceSnapshot*
+pka_source_publish_locked (PkaSource *source) /* IN */
+{
+	PkaSourcePrivate *priv = source->priv;
+	PkaSourceSnapshot *snapshot;
+
+	ENTRY;
+	snapshot = pka_rcu_assign(&priv->snapshot,
+	                          pka_source_snapshot_new(priv));
+	RETURN(snapshot);
+}
+
+/**
+ * pka_source_retire:
+ * @source: A #PkaSource.
+ * @snapshot: A #PkaSourceSnapshot.
+ *
+ * Frees @snapshot once no sample delivery can still be using it.  The
+ * writer lock must not be held.
+ *
+ * Returns: None.
+ * Side effects: Waits for in-flight sample deliveries to complete.
+ */
+static void
+pka_source_retire (PkaSource         *source,   /* IN */
+                   PkaSourceSnapshot *snapshot) /* IN */
+{
+	ENTRY;
+	pka_rcu_synchronize(&source->priv->snapshot);
+	pka_source_snapshot_free(snapshot);
+	EXIT;
+}
+
 /**
  * pka_source_deliver_sample:
  * @source: a #PkaSource.
@@ -361,7 +478,8 @@ pka_source_deliver_sample (PkaSource *source, /* IN */
                            PkaSample *sample) /* IN */
 {
 	PkaSourcePrivate *priv;
-	PkaSubscription *subscription;
+	PkaSourceSnapshot *snapshot;
+	gint epoch;
 	gint i;
 
 	g_return_if_fail(PKA_IS_SOURCE(source));
@@ -371,16 +489,16 @@ pka_source_deliver_sample (PkaSource *source, /* IN */
 	priv = source->priv;
 	pka_sample_set_source_id(sample, priv->id);
 	/*
-	 * Notify subscribers of the incoming sample.
-	 * Reader lock required to ensure subscriptions integrity.
+	 * Notify subscribers of the incoming sample.  The snapshot remains
+	 * valid until the read section is left, so no lock is needed.
 	 */
-	g_static_rw_lock_reader_lock(&priv->rw_lock);
-	for (i = 0; i < priv->subscriptions->len; i++) {
-		subscription = g_ptr_array_index(priv->subscriptions, i);
-		pka_subscription_deliver_sample(subscription, source,
-		                                priv->manifest, sample);
+	snapshot = pka_rcu_read_lock(&priv->snapshot, &epoch);
+	pka_sample_set_n_consumers(sample, snapshot->n_subscriptions);
+	for (i = 0; i < snapshot->n_subscriptions; i++) {
+		pka_subscription_deliver_sample(snapshot->subscriptions[i], source,
+		                                snapshot->manifest, sample);
 	}
-	g_static_rw_lock_reader_unlock(&priv->rw_lock);
+	pka_rcu_read_unlock(&priv->snapshot, epoch);
 	EXIT;
 }
 
@@ -404,6 +522,7 @@ pka_source_deliver_manifest (PkaSource   *source,   /* IN */
                              PkaManifest *manifest) /* IN */
 {
 	PkaSourcePrivate *priv;
+	PkaSourceSnapshot *snapshot;
 	PkaSubscription *subscription;
 	gint i;
 
@@ -422,7 +541,9 @@ pka_source_deliver_manifest (PkaSource   *source,   /* IN */
 		pka_manifest_unref(priv->manifest);
 	}
 	priv->manifest = pka_manifest_ref(manifest);
+	snapshot = pka_source_publish_locked(source);
 	g_static_rw_lock_writer_unlock(&priv->rw_lock);
+	pka_source_retire(source, snapshot);
 	/*
 	 * Notify all of our subscribers of the new manifest.
 	 * Requires read lock to ensure subscription integrity.  I wish that
@@ -471,6 +592,7 @@ pka_source_add_subscription (PkaSource       *source,       /* IN */
                              PkaSubscription *subscription) /* IN */
 {
 	PkaSourcePrivate *priv;
+	PkaSourceSnapshot *snapshot;
 	PkaManifest *manifest = NULL;
 
 	g_return_if_fail(PKA_IS_SOURCE(source));
@@ -483,6 +605,7 @@ pka_source_add_subscription (PkaSource       *source,       /* IN */
 		manifest = pka_manifest_ref(priv->manifest);
 	}
 	g_ptr_array_add(priv->subscriptions, pka_subscription_ref(subscription));
+	snapshot = pka_source_publish_locked(source);
 	/*
 	 * If this is the first subscription and we are running, then the source
 	 * is in a automatic-muted state.  We will notify it to unmute.
@@ -491,6 +614,7 @@ pka_source_add_subscription (PkaSource       *source,       /* IN */
 		pka_source_queue_unmuted(source);
 	}
 	g_static_rw_lock_writer_unlock(&priv->rw_lock);
+	pka_source_retire(source, snapshot);
 	/*
 	 * Ensure the current manifest is delivered.  We do this outside of the
 	 * write lock to make sure that other work can happen concurrently.  It
@@ -529,6 +653,7 @@ pka_source_remove_subscription (PkaSource       *source,       /* IN */
                                 PkaSubscription *subscription) /* IN */
 {
 	PkaSourcePrivate *priv;
+	PkaSourceSnapshot *snapshot = NULL;
 
 	g_return_if_fail(PKA_IS_SOURCE(source));
 	g_return_if_fail(subscription != NULL);
@@ -537,6 +662,7 @@ pka_source_remove_subscription (PkaSource       *source,       /* IN */
 	priv = source->priv;
 	g_static_rw_lock_writer_lock(&priv->rw_lock);
 	if (g_ptr_array_remove_fast(priv->subscriptions, subscription)) {
+		snapshot = pka_source_publish_locked(source);
 		pka_subscription_unref(subscription);
 	}
 	/*
@@ -547,6 +673,9 @@ pka_source_remove_subscription (PkaSource       *source,       /* IN */
 		pka_source_queue_muted(source);
 	}
 	g_static_rw_lock_writer_unlock(&priv->rw_lock);
+	if (snapshot) {
+		pka_source_retire(source, snapshot);
+	}
 	EXIT;
 }
 
@@ -602,6 +731,7 @@ void
 pka_source_notify_stopped (PkaSource *source) /* IN */
 {
 	PkaSourcePrivate *priv;
+	gint i;
 
 	g_return_if_fail(PKA_IS_SOURCE(source));
 
@@ -613,6 +743,15 @@ pka_source_notify_stopped (PkaSource *source) /* IN */
 		pka_source_queue_stopped(source);
 	}
 	g_static_rw_lock_writer_unlock(&priv->rw_lock);
+	/*
+	 * Make sure samples buffered by our subscriptions are not held back
+	 * waiting for samples that will never come.
+	 */
+	g_static_rw_lock_reader_lock(&priv->rw_lock);
+	for (i = 0; i < priv->subscriptions->len; i++) {
+		pka_subscription_flush(g_ptr_array_index(priv->subscriptions, i));
+	}
+	g_static_rw_lock_reader_unlock(&priv->rw_lock);
 	EXIT;
 }
 
@@ -792,6 +931,7 @@ pka_source_finalize (GObject *object) /* IN */
 		g_object_remove_weak_pointer(G_OBJECT(priv->channel),
 		                             (gpointer *)&priv->channel);
 	}
+	pka_source_snapshot_free(pka_rcu_replace(&priv->snapshot, NULL));
 	G_OBJECT_CLASS(pka_source_parent_class)->finalize(object);
 	EXIT;
 }
@@ -948,4 +1088,6 @@ pka_source_init (PkaSource *source) /* IN */
 	 *   to the subscribers whose bit-field is set in a 64-bit bitmap.
 	 */
 	source->priv->subscriptions = g_ptr_array_new();
+	pka_rcu_init(&source->priv->snapshot,
+	             pka_source_snapshot_new(source->priv));
 }
@@ -19,6 +19,7 @@
 #include "pka-encoder.h"
 #include "pka-marshal.h"
 #include "pka-log.h"
+#include "pka-rcu.h"
 #include "pka-subscription.h"
 
 #ifdef G_LOG_DOMAIN
@@ -27,6 +28,32 @@
 #define G_LOG_DOMAIN "Subscription"
 
 #define IS_AUTHORIZED(_context, _ioctl, _target) (TRUE)
+#define DEFAULT_QUEUE_SIZE                       (1024)
+#define COUNTER_ADD(_c, _n)                      __sync_fetch_and_add(&(_c), _n)
+#define COUNTER_GET(_c)                          __sync_fetch_and_add(&(_c), 0)
+
+/*
+ * Samples are handed from the sources to the subscription's dispatcher
+ * thread through a bounded ring so that a slow consumer can never stall a
+ * sampling thread.  Producers reserve a cell by advancing ring_tail with a
+ * compare and swap while the cell's seq equals its position, and publish
+ * it by incrementing seq.  Cells are consumed the same way from ring_head,
+ * by the dispatcher or by a producer dropping the oldest sample, and are
+ * released for the next lap by advancing seq by the size of the ring.
+ * Positions wrap, so they are only ever compared by their difference.
+ *
+ * Manifests, flush and discard requests must never be dropped, so they go
+ * through a short locked queue instead.  Each is stamped with ring_tail
+ * when it is queued and handled once every sample before it has been
+ * consumed, which keeps their order with respect to the samples of the
+ * thread that queued them.
+ */
+typedef struct
+{
+	volatile gint  seq;
+	PkaManifest   *manifest;
+	PkaSample     *sample;
+} PkaSubscriptionCell;
 
 struct _PkaSubscription
 {
@@ -36,20 +63,436 @@ struct _PkaSubscription
 	gint                  id;
 	PkaSubscriptionState  state;
 	GTimeVal              created_at;
-	gint                   buffer_timeout;
-	gint                   buffer_size;
 	GTree                *channels;
 	GTree                *sources;
 	GTree                *manifests;
-	PkaEncoder           *encoder;
-	GClosure             *manifest_closure;
-	GClosure             *sample_closure;
+	PkaRcu                handlers;       /* PkaSubscriptionHandlers */
+
+	PkaSubscriptionCell  *ring;           /* Queue of samples */
+	guint                 ring_mask;      /* Cells within ring less one */
+	volatile gint         ring_head;      /* Next cell to consume */
+	volatile gint         ring_tail;      /* Next cell to produce */
+	volatile gint         queue_size;     /* Maximum samples within ring */
+	volatile gint         overflow;       /* PkaSubscriptionOverflow */
+	volatile gint         sleeping;       /* Dispatcher waits on queue_cond */
+	volatile gint         n_blocked;      /* Producers waiting on space_cond */
+	volatile gint         n_control;      /* Items within control */
+	GMutex               *queue_mutex;
+	GCond                *queue_cond;     /* Signaled when items are queued */
+	GCond                *space_cond;     /* Signaled when the ring drains */
+	GQueue               *control;        /* Queue of PkaSubscriptionItem */
+	volatile gint         shutdown;
+	guint64               n_queued;
+	guint64               n_delivered;
+	guint64               n_dropped;
+	GThread              *dispatcher;
+
+	/*
+	 * The following are owned by the dispatcher thread.
+	 */
+	GPtrArray            *batches;        /* Array of PkaSubscriptionBatch */
+	gsize                 buffer_len;     /* Raw sample bytes pending */
+	GTimeVal              flush_at;       /* Deadline for pending batches */
+	GByteArray           *output;         /* Encoded output for handlers */
+	PkaEncoder           *broken;         /* Stateful encoder that failed */
 };
 
-extern void pka_source_add_subscription    (PkaSource       *source,
-                                            PkaSubscription *subscription);
-extern void pka_source_remove_subscription (PkaSource       *source,
-                                            PkaSubscription *subscription);
+typedef enum
+{
+	PKA_SUBSCRIPTION_ITEM_MANIFEST,
+	PKA_SUBSCRIPTION_ITEM_FLUSH,
+	PKA_SUBSCRIPTION_ITEM_DISCARD,
+} PkaSubscriptionItemType;
+
+typedef struct
+{
+	PkaSubscriptionItemType  type;
+	gint                     ticket;   /* ring_tail when queued */
+	PkaManifest             *manifest;
+} PkaSubscriptionItem;
+
+/*
+ * Samples are buffered per-manifest so that each group can be handed to the
+ * encoder in a single call.  The manifest provides the time base for the
+ * relative timestamps, so samples of differing manifests cannot be mixed.
+ */
+typedef struct
+{
+	PkaManifest *manifest;
+	GPtrArray   *samples;
+} PkaSubscriptionBatch;
+
+/*
+ * The state needed to deliver manifests and samples is published as an
+ * immutable snapshot so that delivery, which happens for every sample of
+ * every source, does not need to take the subscription lock.  Writers
+ * hold the writer lock, copy the current snapshot, modify it and swap it
+ * in with pka_subscription_publish_locked(), then free the previous one with
+ * pka_subscription_retire() once the lock is released.
+ */
+typedef struct
+{
+	PkaEncoder *encoder;
+	GClosure   *manifest_closure;
+	GClosure   *sample_closure;
+	gint        buffer_timeout;
+	gint        buffer_size;
+} PkaSubscriptionHandlers;
+
+static gpointer pka_subscription_dispatcher (gpointer user_data);
+
+extern void     pka_source_add_subscription    (PkaSource       *source,
+                                                PkaSubscription *subscription);
+extern void     pka_source_remove_subscription (PkaSource       *source,
+                                                PkaSubscription *subscription);
+extern gboolean pka_encoder_claim              (PkaEncoder      *encoder,
+                                                gpointer         owner);
+extern void     pka_encoder_release            (PkaEncoder      *encoder,
+                                                gpointer         owner);
+extern gint     pka_sample_get_n_consumers     (PkaSample       *sample);
+
+/**
+ * pka_subscription_handlers_copy:
+ * @handlers: A #PkaSubscriptionHandlers or %NULL.
+ *
+ * Creates a copy of @handlers, or a new empty set if @handlers is %NULL.
+ *
+ * Returns: A newly allocated #PkaSubscriptionHandlers.
+ * Side effects: None.
+ */
+static PkaSubscriptionHandlers*
+pka_subscription_handlers_copy (PkaSubscriptionHandlers *handlers) /* IN */
+{
+	PkaSubscriptionHandlers *copy;
+
+	ENTRY;
+	copy = g_slice_new0(PkaSubscriptionHandlers);
+	if (handlers) {
+		*copy = *handlers;
+		if (copy->encoder) {
+			g_object_ref(copy->encoder);
+		}
+		if (copy->manifest_closure) {
+			g_closure_ref(copy->manifest_closure);
+		}
+		if (copy->sample_closure) {
+			g_closure_ref(copy->sample_closure);
+		}
+	}
+	RETURN(copy);
+}
+
+/**
+ * pka_subscription_handlers_free:
+ * @handlers: A #PkaSubscriptionHandlers.
+ *
+ * Frees @handlers and releases the references it holds.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_subscription_handlers_free (PkaSubscriptionHandlers *handlers) /* IN */
+{
+	ENTRY;
+	if (handlers->encoder) {
+		g_object_unref(handlers->encoder);
+	}
+	if (handlers->manifest_closure) {
+		g_closure_unref(handlers->manifest_closure);
+	}
+	if (handlers->sample_closure) {
+		g_closure_unref(handlers->sample_closure);
+	}
+	g_slice_free(PkaSubscriptionHandlers, handlers);
+	EXIT;
+}
+
+/**
+ * pka_subscription_publish_locked:
+ * @subscription: A #PkaSubscription.
+ * @handlers: A #PkaSubscriptionHandlers.
+ *
+ * Publishes @handlers for use by the delivery path.  The writer lock must
+ * be held.  The previous set must be passed to pka_subscription_retire()
+ * once the lock is released.
+ *
+ * Returns: The previous #PkaSubscriptionHandlers.
+ * Side effects: None.
+ */
+static PkaSubscriptionHandlers*
+pka_subscription_publish_locked (PkaSubscription         *subscription, /* IN */
+                                 PkaSubscriptionHandlers *handlers)     /* IN */
+{
+	ENTRY;
+	RETURN(pka_rcu_assign(&subscription->handlers, handlers));
+}
+
+/**
+ * pka_subscription_retire:
+ * @subscription: A #PkaSubscription.
+ * @handlers: A #PkaSubscriptionHandlers.
+ *
+ * Frees @handlers once no delivery can still be using them.  The writer
+ * lock must not be held and this must not be called from a handler on the
+ * dispatcher thread.
+ *
+ * Returns: None.
+ * Side effects: Waits for in-flight deliveries to complete.
+ */
+static void
+pka_subscription_retire (PkaSubscription         *subscription, /* IN */
+                         PkaSubscriptionHandlers *handlers)     /* IN */
+{
+	ENTRY;
+	pka_rcu_synchronize(&subscription->handlers);
+	pka_subscription_handlers_free(handlers);
+	EXIT;
+}
+
+/**
+ * pka_subscription_item_new:
+ * @type: A #PkaSubscriptionItemType.
+ * @manifest: A #PkaManifest or %NULL.
+ *
+ * Creates a new control item holding a reference to @manifest.
+ *
+ * Returns: A newly allocated #PkaSubscriptionItem.
+ * Side effects: None.
+ */
+static inline PkaSubscriptionItem*
+pka_subscription_item_new (PkaSubscriptionItemType  type,     /* IN */
+                           PkaManifest             *manifest) /* IN */
+{
+	PkaSubscriptionItem *item;
+
+	item = g_slice_new(PkaSubscriptionItem);
+	item->type = type;
+	item->ticket = 0;
+	item->manifest = manifest ? pka_manifest_ref(manifest) : NULL;
+	return item;
+}
+
+/**
+ * pka_subscription_item_free:
+ * @item: A #PkaSubscriptionItem.
+ *
+ * Frees @item and releases the references it holds.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static inline void
+pka_subscription_item_free (PkaSubscriptionItem *item) /* IN */
+{
+	if (item->manifest) {
+		pka_manifest_unref(item->manifest);
+	}
+	g_slice_free(PkaSubscriptionItem, item);
+}
+
+/**
+ * pka_subscription_ring_new:
+ * @subscription: A #PkaSubscription.
+ * @n_cells: The number of cells, a power of two.
+ *
+ * Allocates an empty ring of @n_cells for @subscription.  No producer or
+ * consumer may be using the ring.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_subscription_ring_new (PkaSubscription *subscription, /* IN */
+                           guint            n_cells)      /* IN */
+{
+	guint i;
+
+	subscription->ring = g_new0(PkaSubscriptionCell, n_cells);
+	subscription->ring_mask = n_cells - 1;
+	subscription->ring_head = 0;
+	subscription->ring_tail = 0;
+	for (i = 0; i < n_cells; i++) {
+		subscription->ring[i].seq = i;
+	}
+}
+
+/**
+ * pka_subscription_ring_len:
+ * @subscription: A #PkaSubscription.
+ *
+ * Retrieves the number of cells reserved and not yet consumed.
+ *
+ * Returns: The number of samples within the ring.
+ * Side effects: None.
+ */
+static inline gint
+pka_subscription_ring_len (PkaSubscription *subscription) /* IN */
+{
+	return (gint)((guint)g_atomic_int_get(&subscription->ring_tail) -
+	              (guint)g_atomic_int_get(&subscription->ring_head));
+}
+
+/**
+ * pka_subscription_ring_push:
+ * @subscription: A #PkaSubscription.
+ * @manifest: The #PkaManifest for @sample.
+ * @sample: A #PkaSample.
+ *
+ * Queues @sample for the dispatcher unless the ring already holds the
+ * queue size worth of samples.
+ *
+ * Returns: %TRUE if @sample was queued; otherwise %FALSE.
+ * Side effects: None.
+ */
+static gboolean
+pka_subscription_ring_push (PkaSubscription *subscription, /* IN */
+                            PkaManifest     *manifest,     /* IN */
+                            PkaSample       *sample)       /* IN */
+{
+	PkaSubscriptionCell *cell;
+	gint pos;
+	gint dif;
+
+	do {
+		if (pka_subscription_ring_len(subscription) >=
+		    g_atomic_int_get(&subscription->queue_size)) {
+			return FALSE;
+		}
+		pos = g_atomic_int_get(&subscription->ring_tail);
+		cell = &subscription->ring[pos & subscription->ring_mask];
+		dif = (gint)((guint)g_atomic_int_get(&cell->seq) - (guint)pos);
+		if (dif < 0) {
+			return FALSE;
+		}
+	} while (dif > 0 ||
+	         !g_atomic_int_compare_and_exchange(&subscription->ring_tail,
+	                                            pos, (guint)pos + 1));
+	cell->manifest = pka_manifest_ref(manifest);
+	cell->sample = pka_sample_ref(sample);
+	/*
+	 * The increment is a full barrier, so the contents are visible before
+	 * the cell is and the check for a sleeping dispatcher that follows
+	 * cannot be ordered before it.
+	 */
+	g_atomic_int_inc(&cell->seq);
+	return TRUE;
+}
+
+/**
+ * pka_subscription_ring_pop:
+ * @subscription: A #PkaSubscription.
+ * @manifest: A location for the #PkaManifest.
+ * @sample: A location for the #PkaSample.
+ *
+ * Takes the oldest sample from the ring.  The caller owns the references
+ * stored in @manifest and @sample.
+ *
+ * Returns: %TRUE if a sample was taken; %FALSE if the ring is empty or the
+ *   oldest cell is still being written.
+ * Side effects: None.
+ */
+static gboolean
+pka_subscription_ring_pop (PkaSubscription  *subscription, /* IN */
+                           PkaManifest     **manifest,     /* OUT */
+                           PkaSample       **sample)       /* OUT */
+{
+	PkaSubscriptionCell *cell;
+	gint pos;
+	gint dif;
+
+	do {
+		pos = g_atomic_int_get(&subscription->ring_head);
+		cell = &subscription->ring[pos & subscription->ring_mask];
+		dif = (gint)((guint)g_atomic_int_get(&cell->seq) - ((guint)pos + 1));
+		if (dif < 0) {
+			return FALSE;
+		}
+	} while (dif > 0 ||
+	         !g_atomic_int_compare_and_exchange(&subscription->ring_head,
+	                                            pos, (guint)pos + 1));
+	*manifest = cell->manifest;
+	*sample = cell->sample;
+	cell->manifest = NULL;
+	cell->sample = NULL;
+	g_atomic_int_add(&cell->seq, subscription->ring_mask);
+	return TRUE;
+}
+
+/**
+ * pka_subscription_ring_free:
+ * @subscription: A #PkaSubscription.
+ *
+ * Releases the samples left in the ring and frees it.  No producer or
+ * consumer may be using the ring.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_subscription_ring_free (PkaSubscription *subscription) /* IN */
+{
+	PkaManifest *manifest;
+	PkaSample *sample;
+
+	while (pka_subscription_ring_pop(subscription, &manifest, &sample)) {
+		pka_manifest_unref(manifest);
+		pka_sample_unref(sample);
+	}
+	g_free(subscription->ring);
+	subscription->ring = NULL;
+}
+
+/**
+ * pka_subscription_start_dispatcher:
+ * @subscription: A #PkaSubscription.
+ *
+ * Starts the dispatcher thread of @subscription.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_subscription_start_dispatcher (PkaSubscription *subscription) /* IN */
+{
+	GError *error = NULL;
+
+	ENTRY;
+	subscription->shutdown = FALSE;
+	subscription->dispatcher = g_thread_create(pka_subscription_dispatcher,
+	                                           subscription, TRUE, &error);
+	if (!subscription->dispatcher) {
+		ERROR(Threads, "Error creating dispatcher for subscription %d: %s",
+		      subscription->id, error->message);
+		g_error_free(error);
+	}
+	EXIT;
+}
+
+/**
+ * pka_subscription_stop_dispatcher:
+ * @subscription: A #PkaSubscription.
+ *
+ * Stops the dispatcher thread of @subscription and waits for it to exit.
+ * Queued items are left in place.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_subscription_stop_dispatcher (PkaSubscription *subscription) /* IN */
+{
+	ENTRY;
+	g_mutex_lock(subscription->queue_mutex);
+	g_atomic_int_set(&subscription->shutdown, TRUE);
+	g_cond_signal(subscription->queue_cond);
+	g_mutex_unlock(subscription->queue_mutex);
+	if (subscription->dispatcher) {
+		g_thread_join(subscription->dispatcher);
+		subscription->dispatcher = NULL;
+	}
+	EXIT;
+}
 
 /**
  * pka_subscription_destroy:
@@ -63,24 +506,58 @@ extern void pka_source_remove_subscription (PkaSource       *source,
 static void
 pka_subscription_destroy (PkaSubscription *subscription) /* IN */
 {
+	PkaSubscriptionHandlers *handlers;
+
 	g_return_if_fail(subscription != NULL);
 
 	ENTRY;
+	/*
+	 * Stop the dispatcher.  Anything still queued is dropped; the sources
+	 * hold a reference while attached, so nobody is producing anymore.
+	 */
+	pka_subscription_stop_dispatcher(subscription);
+	pka_subscription_ring_free(subscription);
+	g_queue_foreach(subscription->control,
+	                (GFunc)pka_subscription_item_free, NULL);
+	g_queue_free(subscription->control);
+	g_cond_free(subscription->queue_cond);
+	g_cond_free(subscription->space_cond);
+	g_mutex_free(subscription->queue_mutex);
 	g_tree_unref(subscription->channels);
 	g_tree_unref(subscription->sources);
 	g_tree_unref(subscription->manifests);
-	if (subscription->manifest_closure) {
-		g_closure_unref(subscription->manifest_closure);
-	}
-	if (subscription->sample_closure) {
-		g_closure_unref(subscription->sample_closure);
-	}
-	if (subscription->encoder) {
-		g_object_unref(subscription->encoder);
+	handlers = pka_rcu_replace(&subscription->handlers, NULL);
+	pka_encoder_release(handlers->encoder, subscription);
+	pka_subscription_handlers_free(handlers);
+	g_ptr_array_unref(subscription->batches);
+	g_byte_array_unref(subscription->output);
+	if (subscription->broken) {
+		g_object_unref(subscription->broken);
 	}
 	EXIT;
 }
 
+/**
+ * pka_subscription_batch_free:
+ * @batch: A #PkaSubscriptionBatch.
+ *
+ * Frees @batch and releases the references held to its manifest and
+ * buffered samples.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_subscription_batch_free (PkaSubscriptionBatch *batch) /* IN */
+{
+	ENTRY;
+	g_ptr_array_foreach(batch->samples, (GFunc)pka_sample_unref, NULL);
+	g_ptr_array_unref(batch->samples);
+	pka_manifest_unref(batch->manifest);
+	g_slice_free(PkaSubscriptionBatch, batch);
+	EXIT;
+}
+
 /**
  * g_int_compare:
  * @a: A pointer to #gint.
@@ -130,6 +607,19 @@ pka_subscription_new (void)
 	INITIALIZE_TREE(channels, g_object_unref);
 	INITIALIZE_TREE(sources, g_object_unref);
 	INITIALIZE_TREE(manifests, pka_manifest_unref);
+	subscription->batches = g_ptr_array_new_with_free_func(
+			(GDestroyNotify)pka_subscription_batch_free);
+	subscription->output = g_byte_array_new();
+	pka_rcu_init(&subscription->handlers,
+	             pka_subscription_handlers_copy(NULL));
+	subscription->queue_mutex = g_mutex_new();
+	subscription->queue_cond = g_cond_new();
+	subscription->space_cond = g_cond_new();
+	subscription->control = g_queue_new();
+	subscription->queue_size = DEFAULT_QUEUE_SIZE;
+	subscription->overflow = PKA_SUBSCRIPTION_OVERFLOW_DROP_OLDEST;
+	pka_subscription_ring_new(subscription, DEFAULT_QUEUE_SIZE);
+	pka_subscription_start_dispatcher(subscription);
 	RETURN(subscription);
 }
 
@@ -149,6 +639,7 @@ pka_subscription_set_encoder (PkaSubscription  *subscription, /* IN */
                               PkaEncoder       *encoder,      /* IN */
                               GError          **error)        /* OUT */
 {
+	PkaSubscriptionHandlers *handlers;
 	gboolean ret = FALSE;
 
 	g_return_val_if_fail(subscription != NULL, FALSE);
@@ -157,14 +648,34 @@ pka_subscription_set_encoder (PkaSubscription  *subscription, /* IN */
 
 	ENTRY;
 	g_static_rw_lock_writer_lock(&subscription->rw_lock);
-	if (subscription->encoder) {
-		g_object_unref(subscription->encoder);
-		subscription->encoder = NULL;
+	/*
+	 * Encoders that are not shareable carry state across buffers, so
+	 * their output would interleave if they encoded for two streams.
+	 */
+	if (!pka_encoder_claim(encoder, subscription)) {
+		g_set_error(error, PKA_ENCODER_ERROR, PKA_ENCODER_ERROR_IN_USE,
+		            "Encoder %d is already attached to another subscription.",
+		            pka_encoder_get_id(encoder));
+		GOTO(unlock);
+	}
+	handlers = pka_subscription_handlers_copy(subscription->handlers.data);
+	if (handlers->encoder) {
+		if (handlers->encoder != encoder) {
+			pka_encoder_release(handlers->encoder, subscription);
+		}
+		g_object_unref(handlers->encoder);
+		handlers->encoder = NULL;
 	}
 	if (encoder) {
-		subscription->encoder = g_object_ref(encoder);
+		handlers->encoder = g_object_ref(encoder);
 	}
+	handlers = pka_subscription_publish_locked(subscription, handlers);
+	ret = TRUE;
+  unlock:
 	g_static_rw_lock_writer_unlock(&subscription->rw_lock);
+	if (ret) {
+		pka_subscription_retire(subscription, handlers);
+	}
 	RETURN(ret);
 }
 
@@ -446,6 +957,7 @@ pka_subscription_remove_source (PkaSubscription  *subscription, /* IN */
 	}
 	key = pka_source_get_id(source);
 	pka_source_remove_subscription(source, subscription);
+	pka_subscription_flush(subscription);
 	g_static_rw_lock_writer_lock(&subscription->rw_lock);
 	g_tree_remove(subscription->sources, &key);
 	g_static_rw_lock_writer_unlock(&subscription->rw_lock);
@@ -512,6 +1024,136 @@ pka_subscription_set_state (PkaSubscription       *subscription, /* IN */
   	RETURN(ret);
 }
 
+/**
+ * pka_subscription_wake:
+ * @subscription: A #PkaSubscription.
+ *
+ * Wakes the dispatcher if it is waiting for work.  This must follow a
+ * full barrier after the work was made visible.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static inline void
+pka_subscription_wake (PkaSubscription *subscription) /* IN */
+{
+	if (G_UNLIKELY(g_atomic_int_get(&subscription->sleeping))) {
+		g_mutex_lock(subscription->queue_mutex);
+		g_cond_signal(subscription->queue_cond);
+		g_mutex_unlock(subscription->queue_mutex);
+	}
+}
+
+/**
+ * pka_subscription_enqueue_control:
+ * @subscription: A #PkaSubscription.
+ * @type: A #PkaSubscriptionItemType.
+ * @manifest: A #PkaManifest or %NULL.
+ *
+ * Queues a manifest, flush or discard request for the dispatcher thread.
+ * These are never dropped so that the stream delivered to the handlers
+ * stays decodable.  They are handled after every sample queued before
+ * them.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_subscription_enqueue_control (PkaSubscription         *subscription, /* IN */
+                                  PkaSubscriptionItemType  type,         /* IN */
+                                  PkaManifest             *manifest)     /* IN */
+{
+	PkaSubscriptionItem *item;
+
+	ENTRY;
+	item = pka_subscription_item_new(type, manifest);
+	g_mutex_lock(subscription->queue_mutex);
+	/*
+	 * The ticket is read under the lock so that tickets never decrease
+	 * along the control queue.
+	 */
+	item->ticket = g_atomic_int_get(&subscription->ring_tail);
+	g_queue_push_tail(subscription->control, item);
+	g_atomic_int_inc(&subscription->n_control);
+	g_cond_signal(subscription->queue_cond);
+	g_mutex_unlock(subscription->queue_mutex);
+	EXIT;
+}
+
+/**
+ * pka_subscription_enqueue_sample:
+ * @subscription: A #PkaSubscription.
+ * @manifest: The #PkaManifest for @sample.
+ * @sample: A #PkaSample.
+ *
+ * Queues @sample for the dispatcher thread without taking a lock.
+ *
+ * If the ring is full, the overflow policy decides whether the caller
+ * blocks until the dispatcher catches up, the oldest queued sample is
+ * dropped, or @sample itself is dropped.
+ *
+ * Returns: None.
+ * Side effects: May block the caller with %PKA_SUBSCRIPTION_OVERFLOW_BLOCK.
+ */
+static void
+pka_subscription_enqueue_sample (PkaSubscription *subscription, /* IN */
+                                 PkaManifest     *manifest,     /* IN */
+                                 PkaSample       *sample)       /* IN */
+{
+	PkaManifest *old_manifest;
+	PkaSample *old_sample;
+
+	ENTRY;
+	COUNTER_ADD(subscription->n_queued, 1);
+	while (!pka_subscription_ring_push(subscription, manifest, sample)) {
+		switch (g_atomic_int_get(&subscription->overflow)) {
+		CASE(PKA_SUBSCRIPTION_OVERFLOW_BLOCK);
+			/*
+			 * The increment of n_blocked and the check that follows pair
+			 * with the dispatcher advancing ring_head before it reads
+			 * n_blocked, so one of them sees the other.
+			 */
+			g_mutex_lock(subscription->queue_mutex);
+			g_atomic_int_inc(&subscription->n_blocked);
+			if (!g_atomic_int_get(&subscription->shutdown) &&
+			    pka_subscription_ring_len(subscription) >=
+			    g_atomic_int_get(&subscription->queue_size)) {
+				g_cond_wait(subscription->space_cond,
+				            subscription->queue_mutex);
+			}
+			g_atomic_int_add(&subscription->n_blocked, -1);
+			g_mutex_unlock(subscription->queue_mutex);
+			BREAK;
+		CASE(PKA_SUBSCRIPTION_OVERFLOW_DROP_OLDEST);
+			/*
+			 * Steal the oldest sample.  If it is still being written, or
+			 * another producer takes the space first, drop this one
+			 * rather than spin.
+			 */
+			if (pka_subscription_ring_pop(subscription, &old_manifest,
+			                              &old_sample)) {
+				pka_manifest_unref(old_manifest);
+				pka_sample_unref(old_sample);
+				COUNTER_ADD(subscription->n_dropped, 1);
+				if (pka_subscription_ring_push(subscription, manifest,
+				                               sample)) {
+					GOTO(queued);
+				}
+			}
+			COUNTER_ADD(subscription->n_dropped, 1);
+			EXIT;
+		CASE(PKA_SUBSCRIPTION_OVERFLOW_DROP_NEWEST);
+			COUNTER_ADD(subscription->n_dropped, 1);
+			EXIT;
+		default:
+			g_assert_not_reached();
+		}
+	}
+  queued:
+	pka_subscription_wake(subscription);
+	EXIT;
+}
+
 /**
  * pka_subscription_mute:
  * @subscription: A #PkaSubscriptionState.
@@ -531,10 +1173,18 @@ pka_subscription_mute (PkaSubscription  *subscription, /* IN */
 	gboolean ret;
 
 	ENTRY;
-	/* FIXME: Add support for draining the buffer. */
-	ret = pka_subscription_set_state(subscription, context,
-	                                 PKA_SUBSCRIPTION_MUTED,
-	                                 error);
+	if ((ret = pka_subscription_set_state(subscription, context,
+	                                      PKA_SUBSCRIPTION_MUTED,
+	                                      error))) {
+		/*
+		 * Deliver the buffered samples if we were asked to drain the
+		 * buffer, otherwise they are dropped.
+		 */
+		pka_subscription_enqueue_control(subscription,
+		                                 drain ? PKA_SUBSCRIPTION_ITEM_FLUSH
+		                                       : PKA_SUBSCRIPTION_ITEM_DISCARD,
+		                                 NULL);
+	}
 	RETURN(ret);
 }
 
@@ -568,7 +1218,9 @@ pka_subscription_unmute (PkaSubscription  *subscription, /* IN */
  * @source: A #PkaSource.
  * @manifest: A #PkaManifest.
  *
- * Delivers @manifest from @souce to the subscriptions handlers.
+ * Delivers @manifest from @souce to the subscriptions handlers.  The
+ * manifest is queued behind any samples already queued and handed to the
+ * handler from the dispatcher thread.
  *
  * Returns: None.
  * Side effects: None.
@@ -578,54 +1230,606 @@ pka_subscription_deliver_manifest (PkaSubscription *subscription, /* IN */
                                    PkaSource       *source,       /* IN */
                                    PkaManifest     *manifest)     /* IN */
 {
-	GValue params[3] = { { 0 } };
-	guint8 *buffer = NULL;
-	gsize buffer_len = 0;
-
 	g_return_if_fail(subscription != NULL);
 	g_return_if_fail(manifest != NULL);
 	g_return_if_fail(PKA_IS_SOURCE(source));
 
 	ENTRY;
-	g_static_rw_lock_reader_lock(&subscription->rw_lock);
-	if (G_LIKELY(subscription->manifest_closure)) {
-		if (!pka_encoder_encode_manifest(NULL, manifest, &buffer, &buffer_len)) {
-			WARNING(Subscription, "Subscription %d failed to encode manifest.",
-					subscription->id);
-			GOTO(failed);
-		}
-		DUMP_BYTES(Manifest, buffer, buffer_len);
-		/*
-		 * XXX: It should be obvious that this marshalling isn't very fast.
-		 *   But I've certainly done worse.  At least it handles things cleanly
-		 *   with regard to using libffi.
-		 */
-		g_value_init(&params[0], PKA_TYPE_SUBSCRIPTION);
-		g_value_init(&params[1], G_TYPE_POINTER);
-		g_value_init(&params[2], G_TYPE_ULONG);
-		g_value_set_boxed(&params[0], subscription);
-		g_value_set_pointer(&params[1], buffer);
-		g_value_set_ulong(&params[2], buffer_len);
-		g_closure_invoke(subscription->manifest_closure, NULL,
-		                 3, &params[0], NULL);
-		g_value_unset(&params[0]);
-		g_value_unset(&params[1]);
-		g_value_unset(&params[2]);
-		g_free(buffer);
-	}
-  failed:
-	g_static_rw_lock_reader_unlock(&subscription->rw_lock);
+	pka_subscription_enqueue_control(subscription,
+	                                 PKA_SUBSCRIPTION_ITEM_MANIFEST,
+	                                 manifest);
 	EXIT;
 }
 
 /**
- * pka_subscription_deliver_sample:
+ * pka_subscription_invoke_closure:
+ * @subscription: A #PkaSubscription.
+ * @closure: The manifest or sample handler.
+ * @buffer: An encoded buffer.
+ * @buffer_len: The length of @buffer in bytes.
+ *
+ * Hands an encoded buffer to a handler.  The subscription is passed
+ * without taking a reference since the dispatcher thread must never be the
+ * one to release the last reference.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_subscription_invoke_closure (PkaSubscription *subscription, /* IN */
+                                 GClosure        *closure,      /* IN */
+                                 const guint8    *buffer,       /* IN */
+                                 gsize            buffer_len)   /* IN */
+{
+	GValue params[3] = { { 0 } };
+
+	ENTRY;
+	/*
+	 * XXX: It should be obvious that this marshalling isn't very fast.
+	 *   But I've certainly done worse.  Batching at least amortizes it
+	 *   across many samples.
+	 */
+	g_value_init(&params[0], PKA_TYPE_SUBSCRIPTION);
+	g_value_init(&params[1], G_TYPE_POINTER);
+	g_value_init(&params[2], G_TYPE_ULONG);
+	g_value_set_static_boxed(&params[0], subscription);
+	g_value_set_pointer(&params[1], (gpointer)buffer);
+	g_value_set_ulong(&params[2], buffer_len);
+	g_closure_invoke(closure, NULL, 3, &params[0], NULL);
+	g_value_unset(&params[0]);
+	g_value_unset(&params[1]);
+	g_value_unset(&params[2]);
+	EXIT;
+}
+
+/**
+ * pka_subscription_encode_batch:
+ * @encoder: A #PkaEncoder or %NULL.
+ * @batch: A #PkaSubscriptionBatch.
+ * @output: A #GByteArray to append the encoded samples to.
+ *
+ * Encodes the samples of @batch onto the end of @output.  The output of
+ * shareable encoders is the same for every subscription using them, so a
+ * sample delivered to several subscriptions is only encoded once and the
+ * buffer is shared between them.  Caching costs an allocation and a
+ * copy per sample though, so runs of samples only this subscription
+ * receives, like everything encoded by other encoders, are encoded
+ * straight into @output with one call.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE.
+ * Side effects: None.
+ */
+static gboolean
+pka_subscription_encode_batch (PkaEncoder           *encoder, /* IN */
+                               PkaSubscriptionBatch *batch,   /* IN */
+                               GByteArray           *output)  /* IN */
+{
+	PkaSample **samples = (PkaSample **)batch->samples->pdata;
+	GByteArray *encoded;
+	gint n_samples = batch->samples->len;
+	gint begin;
+	gint i;
+
+	ENTRY;
+	if (!pka_encoder_is_shareable(encoder)) {
+		RETURN(pka_encoder_encode_samples_append(encoder, batch->manifest,
+		                                         samples, n_samples,
+		                                         output));
+	}
+	for (i = 0; i < n_samples;) {
+		if (pka_sample_get_n_consumers(samples[i]) == 1) {
+			for (begin = i++; i < n_samples; i++) {
+				if (pka_sample_get_n_consumers(samples[i]) != 1) {
+					BREAK;
+				}
+			}
+			if (!pka_encoder_encode_samples_append(encoder,
+			                                       batch->manifest,
+			                                       samples + begin,
+			                                       i - begin, output)) {
+				RETURN(FALSE);
+			}
+			continue;
+		}
+		encoded = pka_encoder_encode_sample_shared(encoder, batch->manifest,
+		                                           samples[i++]);
+		if (!encoded) {
+			RETURN(FALSE);
+		}
+		g_byte_array_append(output, encoded->data, encoded->len);
+		g_byte_array_unref(encoded);
+	}
+	RETURN(TRUE);
+}
+
+/**
+ * pka_subscription_encoder_failed:
+ * @subscription: A #PkaSubscription.
+ * @handlers: The #PkaSubscriptionHandlers that failed to encode.
+ *
+ * Handles a failure of the encoder.  A buffer of the default or another
+ * shareable encoding can simply be dropped.  The state of other encoders
+ * carries across buffers, so once one of them fails the stream can no
+ * longer be decoded; nothing more is delivered with that encoder until
+ * another one is set.
+ *
+ * This must be called from the dispatcher thread.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_subscription_encoder_failed (PkaSubscription         *subscription, /* IN */
+                                 PkaSubscriptionHandlers *handlers)     /* IN */
+{
+	ENTRY;
+	if (pka_encoder_is_shareable(handlers->encoder)) {
+		EXIT;
+	}
+	WARNING(Subscription, "Subscription %d stopped delivering, encoder %d "
+	        "can no longer produce a decodable stream.",
+	        subscription->id, pka_encoder_get_id(handlers->encoder));
+	if (subscription->broken) {
+		g_object_unref(subscription->broken);
+	}
+	subscription->broken = g_object_ref(handlers->encoder);
+	EXIT;
+}
+
+/**
+ * pka_subscription_is_broken:
+ * @subscription: A #PkaSubscription.
+ * @handlers: The #PkaSubscriptionHandlers to deliver with.
+ *
+ * Checks if the encoder of @handlers has failed for this subscription.
+ *
+ * Returns: %TRUE if nothing may be delivered with @handlers.
+ * Side effects: None.
+ */
+static inline gboolean
+pka_subscription_is_broken (PkaSubscription         *subscription, /* IN */
+                            PkaSubscriptionHandlers *handlers)     /* IN */
+{
+	return (subscription->broken &&
+	        subscription->broken == handlers->encoder);
+}
+
+/**
+ * pka_subscription_flush_batches:
+ * @subscription: A #PkaSubscription.
+ * @handlers: The #PkaSubscriptionHandlers to deliver with.
+ * @deliver: If the buffered samples should be delivered or dropped.
+ *
+ * Encodes all of the buffered samples and delivers them to the sample
+ * handler as a single buffer.  Each group of samples sharing a manifest
+ * is encoded with one call to pka_encoder_encode_samples_append() directly
+ * into the subscription's output buffer, which is then handed to the
+ * handler without further copies.
+ *
+ * This must be called from the dispatcher thread and @handlers must have
+ * been retrieved within a read section that is still active.
+ *
+ * Returns: None.
+ * Side effects: The sample buffer is emptied.
+ */
+static void
+pka_subscription_flush_batches (PkaSubscription         *subscription, /* IN */
+                                PkaSubscriptionHandlers *handlers,     /* IN */
+                                gboolean                 deliver)      /* IN */
+{
+	PkaSubscriptionBatch *batch;
+	GByteArray *output;
+	guint64 delivered = 0;
+	guint64 dropped = 0;
+	guint mark;
+	gint i;
+
+	ENTRY;
+	subscription->flush_at.tv_sec = 0;
+	subscription->flush_at.tv_usec = 0;
+	if (!subscription->batches->len) {
+		EXIT;
+	}
+	/*
+	 * The output buffer keeps its storage across flushes so that steady
+	 * state delivery does not allocate.
+	 */
+	output = subscription->output;
+	g_byte_array_set_size(output, 0);
+	for (i = 0; i < subscription->batches->len; i++) {
+		batch = g_ptr_array_index(subscription->batches, i);
+		if (!deliver || !handlers->sample_closure ||
+		    pka_subscription_is_broken(subscription, handlers)) {
+			dropped += batch->samples->len;
+			continue;
+		}
+		mark = output->len;
+		if (!pka_subscription_encode_batch(handlers->encoder, batch,
+		                                   output)) {
+			WARNING(Subscription, "Subscription %d failed to encode samples.",
+			        subscription->id);
+			g_byte_array_set_size(output, mark);
+			dropped += batch->samples->len;
+			pka_subscription_encoder_failed(subscription, handlers);
+			continue;
+		}
+		delivered += batch->samples->len;
+	}
+	if (output->len) {
+		DUMP_BYTES(Sample, output->data, output->len);
+		pka_subscription_invoke_closure(subscription,
+		                                handlers->sample_closure,
+		                                output->data, output->len);
+	}
+	g_ptr_array_set_size(subscription->batches, 0);
+	subscription->buffer_len = 0;
+	COUNTER_ADD(subscription->n_delivered, delivered);
+	COUNTER_ADD(subscription->n_dropped, dropped);
+	EXIT;
+}
+
+/**
+ * pka_subscription_flush_expired:
+ * @subscription: A #PkaSubscription.
+ *
+ * Checks if the buffer timeout has passed for the buffered samples.
+ *
+ * Returns: %TRUE if the buffered samples should be flushed.
+ * Side effects: None.
+ */
+static inline gboolean
+pka_subscription_flush_expired (PkaSubscription *subscription) /* IN */
+{
+	GTimeVal now;
+
+	if (!subscription->flush_at.tv_sec) {
+		return FALSE;
+	}
+	g_get_current_time(&now);
+	return ((now.tv_sec > subscription->flush_at.tv_sec) ||
+	        ((now.tv_sec == subscription->flush_at.tv_sec) &&
+	         (now.tv_usec >= subscription->flush_at.tv_usec)));
+}
+
+/**
+ * pka_subscription_buffer_sample:
+ * @subscription: A #PkaSubscription.
+ * @handlers: The #PkaSubscriptionHandlers to deliver with.
+ * @manifest: The #PkaManifest for @sample.
+ * @sample: A #PkaSample.
+ *
+ * Buffers @sample until either the buffer timeout passes or the buffered
+ * sample data exceeds the buffer size.  If neither is set, the sample is
+ * delivered immediately.
+ *
+ * This must be called from the dispatcher thread.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_subscription_buffer_sample (PkaSubscription         *subscription, /* IN */
+                                PkaSubscriptionHandlers *handlers,     /* IN */
+                                PkaManifest             *manifest,     /* IN */
+                                PkaSample               *sample)       /* IN */
+{
+	PkaSubscriptionBatch *batch = NULL;
+	const guint8 *data;
+	gsize data_len;
+	gint i;
+
+	ENTRY;
+	/*
+	 * Find the batch for the manifest.  There are only ever a handful of
+	 * sources on a subscription, so a linear scan is cheapest.
+	 */
+	for (i = 0; i < subscription->batches->len; i++) {
+		batch = g_ptr_array_index(subscription->batches, i);
+		if (batch->manifest == manifest) {
+			break;
+		}
+		batch = NULL;
+	}
+	if (!batch) {
+		batch = g_slice_new(PkaSubscriptionBatch);
+		batch->manifest = pka_manifest_ref(manifest);
+		batch->samples = g_ptr_array_new();
+		g_ptr_array_add(subscription->batches, batch);
+	}
+	g_ptr_array_add(batch->samples, pka_sample_ref(sample));
+	pka_sample_get_data(sample, &data, &data_len);
+	subscription->buffer_len += data_len;
+	/*
+	 * Flush immediately if buffering is disabled or the size threshold has
+	 * been reached.  Otherwise, make sure the deadline is armed so the
+	 * samples do not wait longer than the buffer timeout.
+	 */
+	if ((!handlers->buffer_size && !handlers->buffer_timeout) ||
+	    (handlers->buffer_size &&
+	     subscription->buffer_len >= handlers->buffer_size)) {
+		pka_subscription_flush_batches(subscription, handlers, TRUE);
+	} else if (handlers->buffer_timeout && !subscription->flush_at.tv_sec) {
+		g_get_current_time(&subscription->flush_at);
+		g_time_val_add(&subscription->flush_at,
+		               handlers->buffer_timeout * G_GINT64_CONSTANT(1000));
+	}
+	EXIT;
+}
+
+/**
+ * pka_subscription_dispatch_item:
+ * @subscription: A #PkaSubscription.
+ * @handlers: The #PkaSubscriptionHandlers to deliver with.
+ * @item: A #PkaSubscriptionItem.
+ *
+ * Handles a manifest, flush or discard request.
+ *
+ * This must be called from the dispatcher thread.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pka_subscription_dispatch_item (PkaSubscription         *subscription, /* IN */
+                                PkaSubscriptionHandlers *handlers,     /* IN */
+                                PkaSubscriptionItem     *item)         /* IN */
+{
+	GByteArray *output;
+
+	ENTRY;
+	switch (item->type) {
+	CASE(PKA_SUBSCRIPTION_ITEM_MANIFEST);
+		/*
+		 * Samples buffered against a previous manifest must reach the
+		 * handler before the new manifest replaces it on the other side.
+		 */
+		pka_subscription_flush_batches(subscription, handlers, TRUE);
+		if (!handlers->manifest_closure ||
+		    pka_subscription_is_broken(subscription, handlers)) {
+			BREAK;
+		}
+		/*
+		 * The encoding of a manifest by a shareable encoder is cached
+		 * on the manifest, so it is only encoded once no matter how
+		 * many subscriptions receive it.
+		 */
+		if (pka_encoder_is_shareable(handlers->encoder)) {
+			output = pka_encoder_encode_manifest_shared(handlers->encoder,
+			                                            item->manifest);
+		} else {
+			output = g_byte_array_ref(subscription->output);
+			g_byte_array_set_size(output, 0);
+			if (!pka_encoder_encode_manifest_append(handlers->encoder,
+			                                        item->manifest,
+			                                        output)) {
+				g_byte_array_unref(output);
+				output = NULL;
+			}
+		}
+		if (!output) {
+			WARNING(Subscription,
+			        "Subscription %d failed to encode manifest.",
+			        subscription->id);
+			pka_subscription_encoder_failed(subscription, handlers);
+			BREAK;
+		}
+		DUMP_BYTES(Manifest, output->data, output->len);
+		pka_subscription_invoke_closure(subscription,
+		                                handlers->manifest_closure,
+		                                output->data, output->len);
+		g_byte_array_unref(output);
+		BREAK;
+	CASE(PKA_SUBSCRIPTION_ITEM_FLUSH);
+		pka_subscription_flush_batches(subscription, handlers, TRUE);
+		BREAK;
+	CASE(PKA_SUBSCRIPTION_ITEM_DISCARD);
+		pka_subscription_flush_batches(subscription, handlers, FALSE);
+		BREAK;
+	default:
+		g_assert_not_reached();
+	}
+	EXIT;
+}
+
+/**
+ * pka_subscription_dispatch_control:
+ * @subscription: A #PkaSubscription.
+ * @handlers: The #PkaSubscriptionHandlers to deliver with.
+ *
+ * Handles the control items whose preceding samples have all been taken
+ * from the ring.
+ *
+ * This must be called from the dispatcher thread.
+ *
+ * Returns: %TRUE if any item was handled.
+ * Side effects: None.
+ */
+static gboolean
+pka_subscription_dispatch_control (PkaSubscription         *subscription, /* IN */
+                                   PkaSubscriptionHandlers *handlers)     /* IN */
+{
+	PkaSubscriptionItem *item;
+	GQueue items = G_QUEUE_INIT;
+	gboolean ret = FALSE;
+	gint head;
+
+	ENTRY;
+	if (G_LIKELY(!g_atomic_int_get(&subscription->n_control))) {
+		RETURN(FALSE);
+	}
+	g_mutex_lock(subscription->queue_mutex);
+	head = g_atomic_int_get(&subscription->ring_head);
+	while ((item = g_queue_peek_head(subscription->control))) {
+		if ((gint)((guint)head - (guint)item->ticket) < 0) {
+			break;
+		}
+		g_queue_push_tail(&items, g_queue_pop_head(subscription->control));
+		g_atomic_int_add(&subscription->n_control, -1);
+	}
+	g_mutex_unlock(subscription->queue_mutex);
+	while ((item = g_queue_pop_head(&items))) {
+		pka_subscription_dispatch_item(subscription, handlers, item);
+		pka_subscription_item_free(item);
+		ret = TRUE;
+	}
+	RETURN(ret);
+}
+
+/**
+ * pka_subscription_dispatch:
+ * @subscription: A #PkaSubscription.
+ *
+ * Processes the queued samples and control items in order, then flushes
+ * the buffered samples if the buffer timeout has passed.
+ *
+ * Returns: %TRUE if any sample or control item was handled.
+ * Side effects: None.
+ */
+static gboolean
+pka_subscription_dispatch (PkaSubscription *subscription) /* IN */
+{
+	PkaSubscriptionHandlers *handlers;
+	PkaManifest *manifest;
+	PkaSample *sample;
+	gboolean ret = FALSE;
+	gint epoch;
+
+	ENTRY;
+	handlers = pka_rcu_read_lock(&subscription->handlers, &epoch);
+	for (;;) {
+		ret |= pka_subscription_dispatch_control(subscription, handlers);
+		if (!pka_subscription_ring_pop(subscription, &manifest, &sample)) {
+			break;
+		}
+		ret = TRUE;
+		/*
+		 * Producers blocked on a full ring can continue as soon as a cell
+		 * is free rather than once the handlers have run.
+		 */
+		if (G_UNLIKELY(g_atomic_int_get(&subscription->n_blocked))) {
+			g_mutex_lock(subscription->queue_mutex);
+			g_cond_broadcast(subscription->space_cond);
+			g_mutex_unlock(subscription->queue_mutex);
+		}
+		pka_subscription_buffer_sample(subscription, handlers,
+		                               manifest, sample);
+		pka_manifest_unref(manifest);
+		pka_sample_unref(sample);
+	}
+	if (pka_subscription_flush_expired(subscription)) {
+		pka_subscription_flush_batches(subscription, handlers, TRUE);
+	}
+	pka_rcu_read_unlock(&subscription->handlers, epoch);
+	RETURN(ret);
+}
+
+/**
+ * pka_subscription_has_work:
+ * @subscription: A #PkaSubscription.
+ *
+ * Checks if a sample has been published at the head of the ring or a
+ * control item is queued.
+ *
+ * Returns: %TRUE if the dispatcher has work.
+ * Side effects: None.
+ */
+static inline gboolean
+pka_subscription_has_work (PkaSubscription *subscription) /* IN */
+{
+	PkaSubscriptionCell *cell;
+	gint head;
+
+	head = g_atomic_int_get(&subscription->ring_head);
+	cell = &subscription->ring[head & subscription->ring_mask];
+	return ((g_atomic_int_get(&cell->seq) == (gint)((guint)head + 1)) ||
+	        g_atomic_int_get(&subscription->n_control));
+}
+
+/**
+ * pka_subscription_dispatcher:
+ * @user_data: A #PkaSubscription.
+ *
+ * Dedicated thread that encodes and delivers manifests and samples to the
+ * handlers.  Sampling threads only ever queue work for it, so the time
+ * spent in the handlers never delays the sources.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static gpointer
+pka_subscription_dispatcher (gpointer user_data) /* IN */
+{
+	PkaSubscription *subscription = user_data;
+
+	ENTRY;
+	while (!g_atomic_int_get(&subscription->shutdown)) {
+		if (!pka_subscription_dispatch(subscription) &&
+		    pka_subscription_has_work(subscription)) {
+			/*
+			 * Control items are waiting on a sample that a producer has
+			 * reserved but not yet written.
+			 */
+			g_thread_yield();
+			continue;
+		}
+		/*
+		 * Producers only take the lock to wake us when sleeping is set.
+		 * Setting it is a full barrier, so either the check for work
+		 * below sees their sample or they see that we are sleeping.
+		 */
+		g_mutex_lock(subscription->queue_mutex);
+		g_atomic_int_inc(&subscription->sleeping);
+		if (!g_atomic_int_get(&subscription->shutdown) &&
+		    !pka_subscription_has_work(subscription)) {
+			if (subscription->flush_at.tv_sec) {
+				g_cond_timed_wait(subscription->queue_cond,
+				                  subscription->queue_mutex,
+				                  &subscription->flush_at);
+			} else {
+				g_cond_wait(subscription->queue_cond,
+				            subscription->queue_mutex);
+			}
+		}
+		g_atomic_int_add(&subscription->sleeping, -1);
+		g_mutex_unlock(subscription->queue_mutex);
+	}
+	RETURN(NULL);
+}
+
+/**
+ * pka_subscription_flush:
+ * @subscription: A #PkaSubscription.
+ *
+ * Requests delivery of any samples that are currently buffered or queued
+ * by @subscription regardless of the buffer timeout and size.
+ *
+ * Returns: None.
+ * Side effects: Buffered samples are delivered by the dispatcher.
+ */
+void
+pka_subscription_flush (PkaSubscription *subscription) /* IN */
+{
+	g_return_if_fail(subscription != NULL);
+
+	ENTRY;
+	pka_subscription_enqueue_control(subscription,
+	                                 PKA_SUBSCRIPTION_ITEM_FLUSH,
+	                                 NULL);
+	EXIT;
+}
+
+/**
+ * pka_subscription_deliver_sample:
  * @subscription: A #PkaSubscription.
  *
  * Delivers @sample from @source to the @subscription.  @manifest should
  * be the current manifest for the source that has already been sent
  * to pka_subscription_deliver_manifest().
  *
+ * The sample is queued for the dispatcher thread, which buffers it
+ * according to the buffer timeout and size.  If the queue is full, the
+ * overflow policy set with pka_subscription_set_queue() is applied.
+ *
  * Returns: None.
  * Side effects: None.
  */
@@ -635,50 +1839,109 @@ pka_subscription_deliver_sample (PkaSubscription *subscription, /* IN */
                                  PkaManifest     *manifest,     /* IN */
                                  PkaSample       *sample)       /* IN */
 {
-	GValue params[3] = { { 0 } };
-	guint8 *buffer = NULL;
-	gsize buffer_len = 0;
-	PkaSample *samples[1] = { sample };
+	PkaSubscriptionHandlers *handlers;
+	gboolean has_handler;
+	gint epoch;
 
 	g_return_if_fail(subscription != NULL);
 	g_return_if_fail(sample != NULL);
 	g_return_if_fail(PKA_IS_SOURCE(source));
 
-	/*
-	 * TODO: In the recent rewrite of this, we didn't implement buffering.
-	 *   We need to add back support for buffering based on timeouts or
-	 *   size of raw-data.
-	 */
+	ENTRY;
+	handlers = pka_rcu_read_lock(&subscription->handlers, &epoch);
+	has_handler = (handlers->sample_closure != NULL);
+	pka_rcu_read_unlock(&subscription->handlers, epoch);
+	if (G_UNLIKELY(!has_handler || !manifest)) {
+		EXIT;
+	}
+	pka_subscription_enqueue_sample(subscription, manifest, sample);
+	EXIT;
+}
+
+/**
+ * pka_subscription_set_queue:
+ * @subscription: A #PkaSubscription.
+ * @queue_size: The maximum number of samples to queue.
+ * @overflow: A #PkaSubscriptionOverflow.
+ *
+ * Sets the number of samples that may be queued for the dispatcher and
+ * what happens to new samples when the queue is full.  The ring is sized
+ * to the next power of two; growing it past that is only possible before
+ * any source has been added to @subscription.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_subscription_set_queue (PkaSubscription         *subscription, /* IN */
+                            guint                    queue_size,   /* IN */
+                            PkaSubscriptionOverflow  overflow)     /* IN */
+{
+	guint n_cells;
+
+	g_return_if_fail(subscription != NULL);
+	g_return_if_fail(queue_size > 0);
+	g_return_if_fail(queue_size <= G_MAXINT / 2);
 
 	ENTRY;
-	g_static_rw_lock_reader_lock(&subscription->rw_lock);
-	if (G_LIKELY(subscription->sample_closure)) {
-		if (!pka_encoder_encode_samples(NULL, manifest, samples, 1,
-		                                &buffer, &buffer_len)) {
-			WARNING(Subscription, "Subscription %d failed to encode sample.",
-			        subscription->id);
-			GOTO(failed);
+	n_cells = 1 << g_bit_storage(queue_size - 1);
+	g_static_rw_lock_writer_lock(&subscription->rw_lock);
+	if (n_cells != subscription->ring_mask + 1) {
+		if (g_tree_nnodes(subscription->sources)) {
+			WARNING(Subscription, "Subscription %d already has sources, "
+			        "keeping a queue of %u samples.",
+			        subscription->id, subscription->ring_mask + 1);
+			queue_size = MIN(queue_size, subscription->ring_mask + 1);
+		} else {
+			/*
+			 * Nothing produces into the ring without a source, and the
+			 * dispatcher is stopped while it is replaced.
+			 */
+			pka_subscription_stop_dispatcher(subscription);
+			pka_subscription_ring_free(subscription);
+			pka_subscription_ring_new(subscription, n_cells);
+			pka_subscription_start_dispatcher(subscription);
 		}
-		DUMP_BYTES(Sample, buffer, buffer_len);
-		/*
-		 * XXX: It should be obvious that this marshalling isn't very fast.
-		 *   But I've certainly done worse.
-		 */
-		g_value_init(&params[0], PKA_TYPE_SUBSCRIPTION);
-		g_value_init(&params[1], G_TYPE_POINTER);
-		g_value_init(&params[2], G_TYPE_ULONG);
-		g_value_set_boxed(&params[0], subscription);
-		g_value_set_pointer(&params[1], buffer);
-		g_value_set_ulong(&params[2], buffer_len);
-		g_closure_invoke(subscription->sample_closure, NULL,
-		                 3, &params[0], NULL);
-		g_value_unset(&params[0]);
-		g_value_unset(&params[1]);
-		g_value_unset(&params[2]);
-		g_free(buffer);
 	}
-  failed:
-	g_static_rw_lock_reader_unlock(&subscription->rw_lock);
+	g_atomic_int_set(&subscription->queue_size, queue_size);
+	g_atomic_int_set(&subscription->overflow, overflow);
+	g_static_rw_lock_writer_unlock(&subscription->rw_lock);
+	g_mutex_lock(subscription->queue_mutex);
+	g_cond_broadcast(subscription->space_cond);
+	g_mutex_unlock(subscription->queue_mutex);
+	EXIT;
+}
+
+/**
+ * pka_subscription_get_stats:
+ * @subscription: A #PkaSubscription.
+ * @queued: A location for the number of samples handed to @subscription.
+ * @delivered: A location for the number of samples delivered.
+ * @dropped: A location for the number of samples dropped.
+ *
+ * Retrieves the delivery counters for @subscription.  Samples that are
+ * neither delivered nor dropped are still pending.  Samples are counted
+ * as dropped if they were refused by the overflow policy, failed to
+ * encode, or were discarded while muting.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pka_subscription_get_stats (PkaSubscription *subscription, /* IN */
+                            guint64         *queued,       /* OUT */
+                            guint64         *delivered,    /* OUT */
+                            guint64         *dropped)      /* OUT */
+{
+	g_return_if_fail(subscription != NULL);
+	g_return_if_fail(queued != NULL);
+	g_return_if_fail(delivered != NULL);
+	g_return_if_fail(dropped != NULL);
+
+	ENTRY;
+	*queued = COUNTER_GET(subscription->n_queued);
+	*delivered = COUNTER_GET(subscription->n_delivered);
+	*dropped = COUNTER_GET(subscription->n_dropped);
 	EXIT;
 }
 
@@ -714,6 +1977,7 @@ pka_subscription_set_handlers (PkaSubscription  *subscription,     /* IN */
                                GDestroyNotify    sample_destroy,   /* IN */
                                GError          **error)            /* IN */
 {
+	PkaSubscriptionHandlers *handlers;
 	GClosure *manifest;
 	GClosure *sample;
 
@@ -733,18 +1997,21 @@ pka_subscription_set_handlers (PkaSubscription  *subscription,     /* IN */
 	g_closure_set_marshal(manifest, pka_marshal_VOID__POINTER_ULONG);
 	g_closure_set_marshal(sample, pka_marshal_VOID__POINTER_ULONG);
 	/*
-	 * Store the closures. Requires writer lock.
+	 * Publish the closures. Requires writer lock.
 	 */
 	g_static_rw_lock_writer_lock(&subscription->rw_lock);
-	if (subscription->manifest_closure) {
-		g_closure_unref(subscription->manifest_closure);
+	handlers = pka_subscription_handlers_copy(subscription->handlers.data);
+	if (handlers->manifest_closure) {
+		g_closure_unref(handlers->manifest_closure);
 	}
-	if (subscription->sample_closure) {
-		g_closure_unref(subscription->sample_closure);
+	if (handlers->sample_closure) {
+		g_closure_unref(handlers->sample_closure);
 	}
-	subscription->manifest_closure = manifest;
-	subscription->sample_closure = sample;
+	handlers->manifest_closure = manifest;
+	handlers->sample_closure = sample;
+	handlers = pka_subscription_publish_locked(subscription, handlers);
 	g_static_rw_lock_writer_unlock(&subscription->rw_lock);
+	pka_subscription_retire(subscription, handlers);
 	EXIT;
 }
 
@@ -793,18 +2060,36 @@ pka_subscription_get_buffer (PkaSubscription *subscription,   /* IN */
                              gint            *buffer_timeout, /* OUT */
                              gint            *buffer_size)    /* OUT */
 {
+	PkaSubscriptionHandlers *handlers;
+	gint epoch;
+
 	g_return_if_fail(subscription != NULL);
 	g_return_if_fail(buffer_timeout != NULL);
 	g_return_if_fail(buffer_size != NULL);
 
 	ENTRY;
-	g_static_rw_lock_reader_lock(&subscription->rw_lock);
-	*buffer_timeout = subscription->buffer_timeout;
-	*buffer_size = subscription->buffer_size;
-	g_static_rw_lock_reader_unlock(&subscription->rw_lock);
+	handlers = pka_rcu_read_lock(&subscription->handlers, &epoch);
+	*buffer_timeout = handlers->buffer_timeout;
+	*buffer_size = handlers->buffer_size;
+	pka_rcu_read_unlock(&subscription->handlers, epoch);
 	EXIT;
 }
 
+/**
+ * pka_subscription_set_buffer:
+ * @subscription: A #PkaSubscription.
+ * @context: A #PkaContext.
+ * @buffer_timeout: The maximum number of milliseconds to buffer samples.
+ * @buffer_size: The number of bytes of sample data to buffer.
+ * @error: A location for a #GError, or %NULL.
+ *
+ * Sets the buffering thresholds for @subscription.  Samples are delivered
+ * to the handler when either threshold is reached.  If both are 0, samples
+ * are delivered as they arrive.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ * Side effects: Currently buffered samples are delivered.
+ */
 gboolean
 pka_subscription_set_buffer (PkaSubscription  *subscription,   /* IN */
                              PkaContext       *context,        /* IN */
@@ -812,6 +2097,7 @@ pka_subscription_set_buffer (PkaSubscription  *subscription,   /* IN */
                              gint              buffer_size,    /* IN */
                              GError          **error)          /* OUT */
 {
+	PkaSubscriptionHandlers *handlers;
 	gboolean ret = FALSE;
 
 	g_return_val_if_fail(subscription != NULL, FALSE);
@@ -822,12 +2108,17 @@ pka_subscription_set_buffer (PkaSubscription  *subscription,   /* IN */
 		GOTO(failed);
 	}
 	g_static_rw_lock_writer_lock(&subscription->rw_lock);
-	subscription->buffer_timeout = buffer_timeout;
-	subscription->buffer_size = buffer_size;
+	handlers = pka_subscription_handlers_copy(subscription->handlers.data);
+	handlers->buffer_timeout = buffer_timeout;
+	handlers->buffer_size = buffer_size;
+	handlers = pka_subscription_publish_locked(subscription, handlers);
+	g_static_rw_lock_writer_unlock(&subscription->rw_lock);
+	pka_subscription_retire(subscription, handlers);
 	/*
-	 * TODO: Flush buffers (once re-implemented).
+	 * Flush anything buffered under the previous settings so that the
+	 * new thresholds apply from a clean slate.
 	 */
-	g_static_rw_lock_writer_unlock(&subscription->rw_lock);
+	pka_subscription_flush(subscription);
 	ret = TRUE;
   failed:
 	RETURN(ret);
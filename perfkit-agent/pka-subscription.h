@@ -25,6 +25,7 @@
 
 #include "pka-channel.h"
 #include "pka-context.h"
+#include "pka-encoder.h"
 #include "pka-manifest.h"
 #include "pka-sample.h"
 #include "pka-source.h"
@@ -67,6 +68,22 @@ typedef enum
 	PKA_SUBSCRIPTION_MUTED,
 } PkaSubscriptionState;
 
+/**
+ * PkaSubscriptionOverflow:
+ * @PKA_SUBSCRIPTION_OVERFLOW_BLOCK: Block the source until there is space.
+ * @PKA_SUBSCRIPTION_OVERFLOW_DROP_OLDEST: Drop the oldest queued sample.
+ * @PKA_SUBSCRIPTION_OVERFLOW_DROP_NEWEST: Drop the incoming sample.
+ *
+ * What to do with a new sample when the delivery queue of a subscription
+ * is full.
+ */
+typedef enum
+{
+	PKA_SUBSCRIPTION_OVERFLOW_BLOCK,
+	PKA_SUBSCRIPTION_OVERFLOW_DROP_OLDEST,
+	PKA_SUBSCRIPTION_OVERFLOW_DROP_NEWEST,
+} PkaSubscriptionOverflow;
+
 gint             pka_subscription_get_id           (PkaSubscription *subscription);
 GType            pka_subscription_get_type         (void) G_GNUC_CONST;
 PkaSubscription* pka_subscription_new              (void);
@@ -88,6 +105,10 @@ gboolean         pka_subscription_remove_source    (PkaSubscription  *subscripti
                                                     PkaContext       *context,
                                                     PkaSource        *source,
                                                     GError          **error);
+gboolean         pka_subscription_set_encoder      (PkaSubscription  *subscription,
+                                                    PkaContext       *context,
+                                                    PkaEncoder       *encoder,
+                                                    GError          **error);
 void             pka_subscription_set_handlers     (PkaSubscription  *subscription,
                                                     PkaContext       *context,
                                                     PkaManifestFunc   manifest_func,
@@ -122,6 +143,14 @@ gboolean         pka_subscription_set_buffer       (PkaSubscription  *subscripti
 void             pka_subscription_get_buffer       (PkaSubscription  *subscription,
                                                     gint             *buffer_timeout,
                                                     gint             *buffer_size);
+void             pka_subscription_flush            (PkaSubscription  *subscription);
+void             pka_subscription_set_queue        (PkaSubscription  *subscription,
+                                                    guint             queue_size,
+                                                    PkaSubscriptionOverflow overflow);
+void             pka_subscription_get_stats        (PkaSubscription  *subscription,
+                                                    guint64          *queued,
+                                                    guint64          *delivered,
+                                                    guint64          *dropped);
 
 G_END_DECLS
 
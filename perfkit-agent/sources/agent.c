@@ -0,0 +1,158 @@
+/* agent.c
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <perfkit-agent/perfkit-agent.h>
+
+#ifdef G_LOG_DOMAIN
+#undef G_LOG_DOMAIN
+#endif
+#define G_LOG_DOMAIN "Agent"
+
+/*
+ * The Agent source samples the agent itself.  It reports how late and how
+ * long the callbacks of all simple sources ran since its previous sample,
+ * so the sampling overhead of a session can be recorded next to the data.
+ */
+
+typedef struct
+{
+	PkaManifest          *manifest;
+	PkaSourceSimpleStats  last;
+} Agent;
+
+/*
+ * Find the upper bound in microseconds of the bucket holding the given
+ * percentile of @hist.
+ */
+static guint
+agent_percentile (const guint32 *hist,
+                  guint64        total,
+                  guint          percent)
+{
+	guint64 rank;
+	guint64 seen = 0;
+	gint i;
+
+	if (!total) {
+		return 0;
+	}
+	rank = (total * percent + 99) / 100;
+	for (i = 0; i < PKA_SOURCE_SIMPLE_N_BUCKETS; i++) {
+		seen += hist[i];
+		if (seen >= rank) {
+			break;
+		}
+	}
+	return 1U << MIN(i, PKA_SOURCE_SIMPLE_N_BUCKETS - 1);
+}
+
+/*
+ * Handle a sample callback from the PkaSourceSimple.
+ */
+static void
+agent_sample (PkaSourceSimple *source,
+              gpointer         user_data)
+{
+	Agent *state = user_data;
+	PkaSourceSimpleStats stats;
+	guint32 lateness[PKA_SOURCE_SIMPLE_N_BUCKETS];
+	guint32 duration[PKA_SOURCE_SIMPLE_N_BUCKETS];
+	guint64 n_samples;
+	PkaSample *s;
+	gint i;
+
+	ENTRY;
+	if (G_UNLIKELY(!state->manifest)) {
+		TRACE(Agent, "Initializing manifest");
+		state->manifest = pka_manifest_sized_new(6);
+		pka_manifest_append(state->manifest, "samples", G_TYPE_UINT64);
+		pka_manifest_append(state->manifest, "missed", G_TYPE_UINT64);
+		pka_manifest_append(state->manifest, "lateness-p50", G_TYPE_UINT);
+		pka_manifest_append(state->manifest, "lateness-p99", G_TYPE_UINT);
+		pka_manifest_append(state->manifest, "duration-p50", G_TYPE_UINT);
+		pka_manifest_append(state->manifest, "duration-p99", G_TYPE_UINT);
+		pka_source_deliver_manifest(PKA_SOURCE(source), state->manifest);
+	}
+
+	/*
+	 * Only report the callbacks run since the previous sample.
+	 */
+	pka_source_simple_get_total_stats(&stats);
+	n_samples = stats.n_samples - state->last.n_samples;
+	for (i = 0; i < PKA_SOURCE_SIMPLE_N_BUCKETS; i++) {
+		lateness[i] = stats.lateness[i] - state->last.lateness[i];
+		duration[i] = stats.duration[i] - state->last.duration[i];
+	}
+
+	s = pka_sample_new();
+	pka_sample_append_uint64(s, 1, n_samples);
+	pka_sample_append_uint64(s, 2, stats.n_missed - state->last.n_missed);
+	pka_sample_append_uint(s, 3, agent_percentile(lateness, n_samples, 50));
+	pka_sample_append_uint(s, 4, agent_percentile(lateness, n_samples, 99));
+	pka_sample_append_uint(s, 5, agent_percentile(duration, n_samples, 50));
+	pka_sample_append_uint(s, 6, agent_percentile(duration, n_samples, 99));
+	pka_source_deliver_sample(PKA_SOURCE(source), s);
+	pka_sample_unref(s);
+	state->last = stats;
+	EXIT;
+}
+
+/*
+ * Free the agent state when source is destroyed.
+ */
+static void
+agent_free (gpointer data)
+{
+	Agent *state = data;
+
+	g_return_if_fail(state != NULL);
+
+	ENTRY;
+	if (state->manifest) {
+		pka_manifest_unref(state->manifest);
+	}
+	g_slice_free(Agent, data);
+	EXIT;
+}
+
+/*
+ * Create a new PkaSourceSimple for sampling the agent.
+ */
+GObject*
+agent_new (GError **error)
+{
+	PkaSource *source;
+	Agent *agent;
+
+	ENTRY;
+	agent = g_slice_new0(Agent);
+	source = pka_source_simple_new();
+	pka_source_simple_set_sample_callback(PKA_SOURCE_SIMPLE(source),
+	                                      agent_sample, agent, agent_free);
+	RETURN(G_OBJECT(source));
+}
+
+const PkaPluginInfo pka_plugin_info = {
+	.id          = "Agent",
+	.name        = "Agent overhead",
+	.description = "Sampling lateness and callback duration of the agent.",
+	.version     = "0.1.1",
+	.copyright   = "Copyright 2010 Christian Hergert",
+	.factory     = agent_new,
+	.plugin_type = PKA_PLUGIN_SOURCE,
+};
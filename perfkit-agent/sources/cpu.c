@@ -28,86 +28,308 @@
 
 #include "src-utils.h"
 
+#ifdef G_LOG_DOMAIN
+#undef G_LOG_DOMAIN
+#endif
+#define G_LOG_DOMAIN "Cpu"
+
+/*
+ * The Cpu source reads /proc/stat through a SrcUtilsProc, which keeps the
+ * file open and re-reads it with pread() into a buffer that grows until
+ * the whole file fits, which matters on hosts with hundreds of CPUs.  The
+ * lines are parsed by hand since sscanf() dominated the cost of a tick.
+ *
+ * By default a sample is delivered per CPU, followed by a sample for the
+ * aggregate "cpu" line with CPU Number -1 that also carries the system wide
+ * rows.  With "wide" set in the [source.cpu] group every CPU is delivered
+ * in a single packed sample per tick instead.
+ */
+
+#define CPU_N_TIMES    (9)
+#define IS_ROW(p,name) (strncmp((p), name, sizeof(name) - 1) == 0)
+
+typedef struct
+{
+	gint    num;
+	guint64 times[CPU_N_TIMES];
+} CpuTimes;
+
 typedef struct
 {
-	PkaManifest *manifest;
+	PkaManifest  *manifest;
+	gboolean      wide;         /* Deliver all CPUs in one sample */
+	SrcUtilsProc *proc;         /* /proc/stat */
+	GArray       *cpus;         /* CpuTimes of each online CPU */
+	GArray       *wide_cpus;    /* CPU numbers of the wide manifest rows */
+	CpuTimes      total;        /* The aggregate "cpu" line */
+	guint64       ctxt;
+	guint64       intr;
+	guint64       processes;
+	guint64       procs_running;
+	guint64       procs_blocked;
 } CpuData;
 
+static const gchar *time_names[CPU_N_TIMES] = {
+	"User",
+	"Nice",
+	"System",
+	"Idle",
+	"I/O Wait",
+	"IRQ",
+	"Soft IRQ",
+	"VM Stolen",
+	"VM Guest",
+};
 
-/**
- * parse_cpu_stat_line:
- * @*str: (IN) The line to parse
- * @*val: (IN/OUT) The pointer to the int array
- * @Returns: Status on whether or not the parsing was successful.
- *
- * Parses a line from /proc/stat sinto an int array.
- *
- **/
-gboolean
-parse_cpu_stat_line (gchar *str, /* IN */
-                     gint *val) /* IN/OUT */
+/*
+ * Parse an unsigned integer following optional spaces.  Missing columns
+ * are read as 0 without moving past the end of the line.
+ */
+static inline const gchar*
+cpu_parse_uint64 (const gchar *p,
+                  guint64     *v)
+{
+	guint64 u = 0;
+
+	while (*p == ' ') {
+		p++;
+	}
+	while (*p >= '0' && *p <= '9') {
+		u = u * 10 + (*p - '0');
+		p++;
+	}
+	*v = u;
+	return p;
+}
+
+/*
+ * Parse the time columns of a "cpu" line.
+ */
+static inline const gchar*
+cpu_parse_times (const gchar *p,
+                 CpuTimes    *times)
+{
+	gint i;
+
+	for (i = 0; i < CPU_N_TIMES; i++) {
+		p = cpu_parse_uint64(p, &times->times[i]);
+	}
+	return p;
+}
+
+/*
+ * Parse the rows of interest from the contents of /proc/stat.
+ */
+static void
+cpu_parse (CpuData     *cpud,
+           const gchar *p)
+{
+	CpuTimes *times;
+	guint64 num;
+
+	g_array_set_size(cpud->cpus, 0);
+	while (p && *p) {
+		if (IS_ROW(p, "cpu ")) {
+			p = cpu_parse_times(p + 3, &cpud->total);
+		} else if (IS_ROW(p, "cpu")) {
+			g_array_set_size(cpud->cpus, cpud->cpus->len + 1);
+			times = &g_array_index(cpud->cpus, CpuTimes, cpud->cpus->len - 1);
+			p = cpu_parse_uint64(p + 3, &num);
+			times->num = num;
+			p = cpu_parse_times(p, times);
+		} else if (IS_ROW(p, "ctxt ")) {
+			p = cpu_parse_uint64(p + 5, &cpud->ctxt);
+		} else if (IS_ROW(p, "intr ")) {
+			/* only the total, the per interrupt counts follow */
+			p = cpu_parse_uint64(p + 5, &cpud->intr);
+		} else if (IS_ROW(p, "processes ")) {
+			p = cpu_parse_uint64(p + 10, &cpud->processes);
+		} else if (IS_ROW(p, "procs_running ")) {
+			p = cpu_parse_uint64(p + 14, &cpud->procs_running);
+		} else if (IS_ROW(p, "procs_blocked ")) {
+			p = cpu_parse_uint64(p + 14, &cpud->procs_blocked);
+		}
+		if ((p = strchr(p, '\n'))) {
+			p++;
+		}
+	}
+}
+
+/*
+ * Append the system wide rows starting at @row.
+ */
+static void
+cpu_append_system (CpuData   *cpud,
+                   PkaSample *s,
+                   gint       row)
 {
-	if (!strncmp(str, "cpu ", 4)) {
+	pka_sample_append_uint64(s, row++, cpud->ctxt);
+	pka_sample_append_uint64(s, row++, cpud->intr);
+	pka_sample_append_uint64(s, row++, cpud->processes);
+	pka_sample_append_uint(s, row++, cpud->procs_running);
+	pka_sample_append_uint(s, row++, cpud->procs_blocked);
+}
+
+/*
+ * Add the system wide rows to @manifest.
+ */
+static void
+cpu_manifest_append_system (PkaManifest *manifest)
+{
+	pka_manifest_append(manifest, "Context Switches", G_TYPE_UINT64);
+	pka_manifest_append(manifest, "Interrupts", G_TYPE_UINT64);
+	pka_manifest_append(manifest, "Processes", G_TYPE_UINT64);
+	pka_manifest_append(manifest, "Running", G_TYPE_UINT);
+	pka_manifest_append(manifest, "Blocked", G_TYPE_UINT);
+}
+
+/*
+ * Deliver a sample per CPU and one for the aggregate line.  The times are
+ * 64-bit, since the aggregate line sums the jiffies of every CPU and soon
+ * outgrows an integer on large hosts.
+ */
+static void
+cpu_sample_narrow (PkaSourceSimple *source,
+                   CpuData         *cpud)
+{
+	CpuTimes *times;
+	PkaSample *s;
+	gint i;
+	gint j;
+
+	if (G_UNLIKELY(!cpud->manifest)) {
+		cpud->manifest = pka_manifest_sized_new(15);
+		pka_manifest_append(cpud->manifest, "CPU Number", G_TYPE_INT);
+		for (i = 0; i < CPU_N_TIMES; i++) {
+			pka_manifest_append(cpud->manifest, time_names[i],
+			                    G_TYPE_UINT64);
+		}
+		cpu_manifest_append_system(cpud->manifest);
+		pka_source_deliver_manifest(PKA_SOURCE(source), cpud->manifest);
+	}
+
+	for (i = 0; i < cpud->cpus->len; i++) {
+		times = &g_array_index(cpud->cpus, CpuTimes, i);
+		s = pka_sample_new();
+		pka_sample_append_int(s, 1, times->num);
+		for (j = 0; j < CPU_N_TIMES; j++) {
+			pka_sample_append_uint64(s, j + 2, times->times[j]);
+		}
+		pka_source_deliver_sample(PKA_SOURCE(source), s);
+		pka_sample_unref(s);
+	}
+
+	s = pka_sample_new();
+	pka_sample_append_int(s, 1, -1);
+	for (j = 0; j < CPU_N_TIMES; j++) {
+		pka_sample_append_uint64(s, j + 2, cpud->total.times[j]);
+	}
+	cpu_append_system(cpud, s, CPU_N_TIMES + 2);
+	pka_source_deliver_sample(PKA_SOURCE(source), s);
+	pka_sample_unref(s);
+}
+
+/*
+ * Check whether the wide manifest has rows for exactly the online CPUs.
+ * Comparing the count alone would miss a CPU going offline while another
+ * comes online.
+ */
+static gboolean
+cpu_wide_matches (CpuData *cpud)
+{
+	gint i;
+
+	if (!cpud->manifest || cpud->wide_cpus->len != cpud->cpus->len) {
 		return FALSE;
 	}
+	for (i = 0; i < cpud->cpus->len; i++) {
+		if (g_array_index(cpud->wide_cpus, gint, i) !=
+		    g_array_index(cpud->cpus, CpuTimes, i).num) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
 
-	return 10 == sscanf(str, "cpu%d %d %d %d %d %d %d %d %d %d",
-	                    &val[0], &val[1], &val[2], &val[3], &val[4],
-	                    &val[5], &val[6], &val[7], &val[8], &val[9]);
-} /* parse_cpu_stat_line */
+/*
+ * Deliver every CPU in a single packed sample.  The manifest is rebuilt
+ * when the set of online CPUs changes.
+ */
+static void
+cpu_sample_wide (PkaSourceSimple *source,
+                 CpuData         *cpud)
+{
+	CpuTimes *times;
+	PkaSample *s;
+	gchar *name;
+	gint n_rows;
+	gint row;
+	gint i;
+	gint j;
 
+	n_rows = CPU_N_TIMES + 5 + cpud->cpus->len * CPU_N_TIMES;
+	if (G_UNLIKELY(!cpu_wide_matches(cpud))) {
+		if (cpud->manifest) {
+			pka_manifest_unref(cpud->manifest);
+		}
+		g_array_set_size(cpud->wide_cpus, 0);
+		cpud->manifest = pka_manifest_sized_new(n_rows);
+		pka_manifest_set_packed(cpud->manifest, TRUE);
+		for (i = 0; i < CPU_N_TIMES; i++) {
+			pka_manifest_append(cpud->manifest, time_names[i],
+			                    G_TYPE_UINT64);
+		}
+		cpu_manifest_append_system(cpud->manifest);
+		for (i = 0; i < cpud->cpus->len; i++) {
+			times = &g_array_index(cpud->cpus, CpuTimes, i);
+			g_array_append_val(cpud->wide_cpus, times->num);
+			for (j = 0; j < CPU_N_TIMES; j++) {
+				name = g_strdup_printf("CPU %d %s", times->num,
+				                       time_names[j]);
+				pka_manifest_append(cpud->manifest, name, G_TYPE_UINT64);
+				g_free(name);
+			}
+		}
+		pka_source_deliver_manifest(PKA_SOURCE(source), cpud->manifest);
+	}
+
+	s = pka_sample_new_packed(cpud->manifest);
+	row = 1;
+	pka_sample_append_uint64_array(s, row, cpud->total.times, CPU_N_TIMES);
+	row += CPU_N_TIMES;
+	cpu_append_system(cpud, s, row);
+	row += 5;
+	for (i = 0; i < cpud->cpus->len; i++) {
+		times = &g_array_index(cpud->cpus, CpuTimes, i);
+		pka_sample_append_uint64_array(s, row, times->times, CPU_N_TIMES);
+		row += CPU_N_TIMES;
+	}
+	pka_source_deliver_sample(PKA_SOURCE(source), s);
+	pka_sample_unref(s);
+}
 
 /*
  * Handle a sample callback from the PkaSourceSimple.
  */
-static inline void
+static void
 cpu_sample (PkaSourceSimple *source,
-            gpointer user_data)
+            gpointer         user_data)
 {
-  CpuData *cpud = user_data;
-  gchar *curr;
-  gchar fileBuf[1024];
-  gint cpuData[10];
-
-  /*
-   * Create and deliver our manifest if it has not yet been done.
-   */
-  if (G_UNLIKELY(!cpud->manifest)) {
-    cpud->manifest = pka_manifest_sized_new(17);
-    pka_manifest_append(cpud->manifest, "CPU Number", G_TYPE_INT);
-    pka_manifest_append(cpud->manifest, "User", G_TYPE_INT);
-    pka_manifest_append(cpud->manifest, "Nice", G_TYPE_INT);
-    pka_manifest_append(cpud->manifest, "System", G_TYPE_INT);
-    pka_manifest_append(cpud->manifest, "Idle", G_TYPE_INT);
-    pka_manifest_append(cpud->manifest, "I/O Wait", G_TYPE_INT);
-    pka_manifest_append(cpud->manifest, "IRQ", G_TYPE_INT);
-    pka_manifest_append(cpud->manifest, "Soft IRQ", G_TYPE_INT);
-    pka_manifest_append(cpud->manifest, "VM Stolen", G_TYPE_INT);
-    pka_manifest_append(cpud->manifest, "VM Guest", G_TYPE_INT);
-    pka_source_deliver_manifest(PKA_SOURCE(source), cpud->manifest);
-  }
-
-  // Read in /proc/stat first.
-  src_utils_read_file("/proc/stat", fileBuf, 1024);
-  curr = fileBuf;
-
-  while (curr != NULL) {
-     gchar *next = src_utils_str_tok('\n', curr);
-     PkaSample *s;
-     gint i;
-
-     if (parse_cpu_stat_line(curr, cpuData)) {
-        // Then cpuData has valid data.  Return a sample.
-        s = pka_sample_new();
-
-        for (i = 0; i < 10; i++)
-           pka_sample_append_int(s, i+1, cpuData[i]);
-
-        pka_source_deliver_sample(PKA_SOURCE(source), s);
-        pka_sample_unref(s);
-     }
-     curr = next;
-  }
+	CpuData *cpud = user_data;
+	const gchar *contents;
+
+	ENTRY;
+	if (!(contents = src_utils_proc_read(cpud->proc, NULL))) {
+		EXIT;
+	}
+	cpu_parse(cpud, contents);
+	src_utils_proc_release(cpud->proc);
+	if (cpud->wide) {
+		cpu_sample_wide(source, cpud);
+	} else {
+		cpu_sample_narrow(source, cpud);
+	}
+	EXIT;
 }
 
 
@@ -139,6 +361,9 @@ cpu_free (gpointer data)
 	if (cpud->manifest) {
 		pka_manifest_unref(cpud->manifest);
 	}
+	src_utils_proc_close(cpud->proc);
+	g_array_unref(cpud->cpus);
+	g_array_unref(cpud->wide_cpus);
 	g_slice_free(CpuData, data);
 	EXIT;
 }
@@ -155,6 +380,10 @@ cpu_new (GError **error) /* OUT */
 
 	ENTRY;
 	cpu = g_slice_new0(CpuData);
+	cpu->proc = src_utils_proc_open("/proc/stat");
+	cpu->cpus = g_array_new(FALSE, FALSE, sizeof(CpuTimes));
+	cpu->wide_cpus = g_array_new(FALSE, FALSE, sizeof(gint));
+	cpu->wide = pka_config_get_boolean("source.cpu", "wide", FALSE);
 	source = pka_source_simple_new_full(cpu_sample,
 	                                    cpu_spawn,
 	                                    cpu,
@@ -20,211 +20,181 @@
 #include "config.h"
 #endif
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <gdk/gdk.h>
-#include <gdk/gdkx.h>
-#include <glib/gprintf.h>
+#include <gtk/gtk.h>
 
-static void
-gdkevent_handle_destroy (GdkEvent   *event,
-                         GIOChannel *channel)
-{
-	gchar buffer[32];
-
-	g_snprintf(buffer, sizeof(buffer), "%d|%p\n",
-	           GDK_DESTROY,
-	           event->any.window);
-	g_io_channel_write_chars(channel, buffer, -1, NULL, NULL);
-	g_io_channel_flush(channel, NULL);
-}
-
-static void
-gdkevent_handle_expose (GdkEvent   *event,
-                        GIOChannel *channel)
-{
-	gchar buffer[128];
-
-	g_snprintf(buffer, sizeof(buffer), "%d|%p|%d|%d|%d|%d\n",
-	           GDK_EXPOSE,
-	           event->expose.window,
-	           event->expose.area.x,
-	           event->expose.area.y,
-	           event->expose.area.width,
-	           event->expose.area.height);
-	g_io_channel_write_chars(channel, buffer, -1, NULL, NULL);
-	g_io_channel_flush(channel, NULL);
-}
-
-static void
-gdkevent_handle_motion_notfiy (GdkEvent   *event,
-                               GIOChannel *channel)
-{
-	gchar buffer[128];
-
-	g_snprintf(buffer, sizeof(buffer), "%d|%p|%0.1f|%0.1f|%u\n",
-	           GDK_MOTION_NOTIFY,
-	           event->motion.window,
-	           event->motion.x,
-	           event->motion.y,
-	           event->motion.state);
-	g_io_channel_write_chars(channel, buffer, -1, NULL, NULL);
-	g_io_channel_flush(channel, NULL);
-}
-
-static void
-gdkevent_handle_button (GdkEvent   *event,
-                        GIOChannel *channel)
-{
-	gchar buffer[128];
-
-	g_snprintf(buffer, sizeof(buffer), "%d|%p|%u|%0.1f|%0.1f|%u\n",
-	           event->any.type,
-	           event->button.window,
-	           event->button.button,
-	           event->button.x,
-	           event->button.y,
-	           event->button.state);
-	g_io_channel_write_chars(channel, buffer, -1, NULL, NULL);
-	g_io_channel_flush(channel, NULL);
-}
-
-static void
-gdkevent_handle_key (GdkEvent   *event,
-                     GIOChannel *channel)
-{
-	gchar buffer[128];
-
-	g_snprintf(buffer, sizeof(buffer), "%d|%p|%u|%u\n",
-	           event->any.type,
-	           event->key.window,
-	           event->key.keyval,
-	           event->key.state);
-	g_io_channel_write_chars(channel, buffer, -1, NULL, NULL);
-	g_io_channel_flush(channel, NULL);
-}
-
-static void
-gdkevent_handle_crossing (GdkEvent   *event,
-                          GIOChannel *channel)
-{
-	gchar buffer[128];
-
-	g_snprintf(buffer, sizeof(buffer), "%d|%p|%u|%u\n",
-	           event->any.type,
-	           event->crossing.window,
-	           event->crossing.mode,
-	           event->crossing.state);
-	g_io_channel_write_chars(channel, buffer, -1, NULL, NULL);
-	g_io_channel_flush(channel, NULL);
-}
-
-static void
-gdkevent_handle_focus (GdkEvent   *event,
-                       GIOChannel *channel)
-{
-	gchar buffer[128];
-
-	g_snprintf(buffer, sizeof(buffer), "%d|%p|%u\n",
-	           event->any.type,
-	           event->focus_change.window,
-	           event->focus_change.in);
-	g_io_channel_write_chars(channel, buffer, -1, NULL, NULL);
-	g_io_channel_flush(channel, NULL);
-}
+#include "gdkevent-ring.h"
 
-static void
-gdkevent_handle_configure (GdkEvent   *event,
-                           GIOChannel *channel)
-{
-	gchar buffer[128];
+/*
+ * Each event is copied into the next record of the ring shared with the
+ * GdkEvent source and published with a single store, without formatting
+ * or a system call, so that recording events costs the Gtk+ main loop as
+ * little as possible.
+ */
 
-	g_snprintf(buffer, sizeof(buffer), "%d|%p|%d|%d|%d|%d\n",
-	           event->any.type,
-	           event->configure.window,
-	           event->configure.x,
-	           event->configure.y,
-	           event->configure.width,
-	           event->configure.height);
-	g_io_channel_write_chars(channel, buffer, -1, NULL, NULL);
-	g_io_channel_flush(channel, NULL);
-}
+static GdkeventRing *ring = NULL;
 
 static void
-gdkevent_handle_any (GdkEvent   *event,
-                     GIOChannel *channel)
+gdkevent_record (GdkEvent *event)
 {
-	gchar buffer[32];
+	GdkeventRecord *record;
+	guint64 head;
 
-	g_snprintf(buffer, sizeof(buffer), "%d|%p\n",
-	           event->any.type,
-	           event->configure.window);
-	g_io_channel_write_chars(channel, buffer, -1, NULL, NULL);
-	g_io_channel_flush(channel, NULL);
-}
-
-static void
-gdkevent_dispatcher (GdkEvent *event,
-                     gpointer  data)
-{
-	GIOChannel *channel = data;
+	head = ring->head;
+	if (G_UNLIKELY(head - ring->tail >= GDKEVENT_RING_N_RECORDS)) {
+		ring->dropped++;
+		return;
+	}
+	record = &ring->records[head & (GDKEVENT_RING_N_RECORDS - 1)];
+	memset(record, 0, sizeof(*record));
+	record->type = event->any.type;
+	record->time = gdk_event_get_time(event);
+	record->window = GPOINTER_TO_SIZE(event->any.window);
 
 	switch (event->type) {
-	case GDK_NOTHING:
-		break;
-	case GDK_DELETE:
-		gdkevent_handle_any(event, channel);
-		break;
-	case GDK_DESTROY:
-		gdkevent_handle_destroy(event, channel);
-		break;
 	case GDK_EXPOSE:
-		gdkevent_handle_expose(event, channel);
+		record->x = event->expose.area.x;
+		record->y = event->expose.area.y;
+		record->width = event->expose.area.width;
+		record->height = event->expose.area.height;
 		break;
 	case GDK_MOTION_NOTIFY:
-		gdkevent_handle_motion_notfiy(event, channel);
+		record->x = event->motion.x;
+		record->y = event->motion.y;
+		record->state = event->motion.state;
 		break;
 	case GDK_BUTTON_PRESS:
 	case GDK_2BUTTON_PRESS:
 	case GDK_3BUTTON_PRESS:
 	case GDK_BUTTON_RELEASE:
-		gdkevent_handle_button(event, channel);
+		record->x = event->button.x;
+		record->y = event->button.y;
+		record->state = event->button.state;
+		record->detail = event->button.button;
 		break;
 	case GDK_KEY_PRESS:
 	case GDK_KEY_RELEASE:
-		gdkevent_handle_key(event, channel);
+		record->state = event->key.state;
+		record->detail = event->key.keyval;
 		break;
 	case GDK_ENTER_NOTIFY:
 	case GDK_LEAVE_NOTIFY:
-		gdkevent_handle_crossing(event, channel);
+		record->x = event->crossing.x;
+		record->y = event->crossing.y;
+		record->state = event->crossing.state;
+		record->detail = event->crossing.mode;
 		break;
 	case GDK_FOCUS_CHANGE:
-		gdkevent_handle_focus(event, channel);
+		record->detail = event->focus_change.in;
 		break;
 	case GDK_CONFIGURE:
-		gdkevent_handle_configure(event, channel);
-		break;
-	case GDK_MAP:
-	case GDK_UNMAP:
-		gdkevent_handle_any(event, channel);
+		record->x = event->configure.x;
+		record->y = event->configure.y;
+		record->width = event->configure.width;
+		record->height = event->configure.height;
 		break;
 	default:
 		/*
 		 * TODO: Handle more of these specificaly.
 		 */
-		gdkevent_handle_any(event, channel);
 		break;
 	}
 
+	/* the record must be complete before it is published */
+	__sync_synchronize();
+	ring->head = head + 1;
+}
+
+static void
+gdkevent_dispatcher (GdkEvent *event,
+                     gpointer  data)
+{
+	if (event->type != GDK_NOTHING) {
+		gdkevent_record(event);
+	}
 	gtk_main_do_event(event);
 }
 
+/*
+ * Removes the ring and this module from the environment, so that the
+ * Gtk+ programs spawned by the inferior neither load the module nor become
+ * a second producer on the ring.
+ */
+static void
+gdkevent_environ_clear (void)
+{
+	const gchar *modules;
+	gchar **names;
+	GString *str;
+	gint i;
+
+	g_unsetenv(GDKEVENT_RING_ENV);
+	if (!(modules = g_getenv("GTK_MODULES"))) {
+		return;
+	}
+	names = g_strsplit(modules, ":", 0);
+	str = g_string_new(NULL);
+	for (i = 0; names[i]; i++) {
+		if (!names[i][0] || !strcmp(names[i], GDKEVENT_MODULE)) {
+			continue;
+		}
+		if (str->len) {
+			g_string_append_c(str, ':');
+		}
+		g_string_append(str, names[i]);
+	}
+	if (str->len) {
+		g_setenv("GTK_MODULES", str->str, TRUE);
+	} else {
+		g_unsetenv("GTK_MODULES");
+	}
+	g_string_free(str, TRUE);
+	g_strfreev(names);
+}
+
 gint
 gtk_module_init (gint   argc,
                  gchar *argv[])
 {
-	GIOChannel *channel = NULL;
+	gpointer map;
+	gchar *name;
+	gint fd;
+
+	if (!(name = g_strdup(g_getenv(GDKEVENT_RING_ENV)))) {
+		g_warning("%s is not set, events will not be recorded.",
+		          GDKEVENT_RING_ENV);
+		return 0;
+	}
+	gdkevent_environ_clear();
+	if ((fd = shm_open(name, O_RDWR, 0)) < 0) {
+		g_warning("Failed to open event ring %s: %s",
+		          name, g_strerror(errno));
+		goto out;
+	}
+	map = mmap(NULL, sizeof(GdkeventRing), PROT_READ | PROT_WRITE,
+	           MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		g_warning("Failed to map event ring %s: %s",
+		          name, g_strerror(errno));
+		goto out;
+	}
+	ring = map;
+	if (ring->magic != GDKEVENT_RING_MAGIC ||
+	    ring->n_records != GDKEVENT_RING_N_RECORDS) {
+		g_warning("Event ring %s is incompatible.", name);
+		munmap(map, sizeof(GdkeventRing));
+		ring = NULL;
+		goto out;
+	}
+	gdk_event_handler_set(gdkevent_dispatcher, NULL, NULL);
 
-	channel = g_io_channel_unix_new(0);
-	gdk_event_handler_set(gdkevent_dispatcher, channel,
-	                      (GDestroyNotify)g_io_channel_unref);
+  out:
+	g_free(name);
 	return 0;
 }
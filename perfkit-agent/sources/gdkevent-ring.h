@@ -0,0 +1,74 @@
+/* gdkevent-ring.h
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GDKEVENT_RING_H__
+#define __GDKEVENT_RING_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * The GdkEvent source and the Gtk+ module loaded into the inferior share
+ * a ring of fixed size event records in POSIX shared memory.  The module
+ * is the only producer and the source the only consumer, so the ring needs
+ * no lock: the producer writes a record and then publishes it by advancing
+ * head, the consumer reads up to head and then releases the records by
+ * advancing tail.  When the ring is full the producer drops the event and
+ * counts it, so the Gtk+ main loop never waits on the agent.
+ *
+ * The module is the only producer because it removes itself and the ring
+ * from the environment once loaded, so that the processes the inferior
+ * spawns in turn do not write to the same ring.
+ */
+
+#define GDKEVENT_MODULE         "gdkevent-module"
+#define GDKEVENT_RING_ENV       "PERFKIT_GDKEVENT_RING"
+#define GDKEVENT_RING_MAGIC     (0x504b4552)
+#define GDKEVENT_RING_N_RECORDS (4096)
+#define GDKEVENT_RING_CACHELINE (64)
+
+typedef struct
+{
+	gint32  type;    /* GdkEventType */
+	guint32 time;    /* Server time of the event in msec, or 0 */
+	guint64 window;  /* Address of the GdkWindow */
+	gdouble x;
+	gdouble y;
+	gint32  width;
+	gint32  height;
+	guint32 state;   /* Modifier state */
+	guint32 detail;  /* Button, keyval, crossing mode or focus in */
+} GdkeventRecord;
+
+typedef struct
+{
+	guint32 magic;
+	guint32 n_records;     /* A power of two */
+	guint8  pad0[GDKEVENT_RING_CACHELINE - 8];
+	guint64 head;          /* Written by the producer */
+	guint64 dropped;       /* Written by the producer */
+	guint8  pad1[GDKEVENT_RING_CACHELINE - 16];
+	guint64 tail;          /* Written by the consumer */
+	guint8  pad2[GDKEVENT_RING_CACHELINE - 8];
+	GdkeventRecord records[GDKEVENT_RING_N_RECORDS];
+} GdkeventRing;
+
+G_END_DECLS
+
+#endif /* __GDKEVENT_RING_H__ */
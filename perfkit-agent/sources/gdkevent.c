@@ -16,8 +16,16 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <perfkit-agent/perfkit-agent.h>
 
+#include "gdkevent-ring.h"
+#include "src-utils.h"
+
 #define GDKEVENT_TYPE_SOURCE            (gdkevent_get_type())
 #define GDKEVENT_SOURCE(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GDKEVENT_TYPE_SOURCE, Gdkevent))
 #define GDKEVENT_SOURCE_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), GDKEVENT_TYPE_SOURCE, Gdkevent const))
@@ -26,13 +34,21 @@
 #define GDKEVENT_IS_SOURCE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  GDKEVENT_TYPE_SOURCE))
 #define GDKEVENT_SOURCE_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  GDKEVENT_TYPE_SOURCE, GdkeventClass))
 
+
+/*
+ * The module publishes events into shared memory rather than writing them
+ * to a descriptor, so there is nothing for PkaSourceStream to watch or to
+ * read() on the agent I/O thread.  Polling the ring head is a couple of
+ * loads, so the source stays a PkaSourceSimple sampled on a shared worker.
+ */
+
 typedef struct _Gdkevent        Gdkevent;
 typedef struct _GdkeventClass   GdkeventClass;
 typedef struct _GdkeventPrivate GdkeventPrivate;
 
 struct _Gdkevent
 {
-	PkaSource parent;
+	PkaSourceSimple parent;
 
 	/*< private >*/
 	GdkeventPrivate *priv;
@@ -40,30 +56,254 @@ struct _Gdkevent
 
 struct _GdkeventClass
 {
-	PkaSourceClass parent_class;
+	PkaSourceSimpleClass parent_class;
 };
 
-G_DEFINE_TYPE(Gdkevent, gdkevent, PKA_TYPE_SOURCE)
+G_DEFINE_TYPE(Gdkevent, gdkevent, PKA_TYPE_SOURCE_SIMPLE)
 
 struct _GdkeventPrivate
 {
-	gpointer dummy;
+	gchar        *name;     /* Name of the shared memory object */
+	GdkeventRing *ring;     /* Ring shared with the module */
+	guint64       dropped;  /* Events dropped already reported */
+	PkaManifest  *manifest;
 };
 
+static gint gdkevent_seq = 0;
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * gdkevent_ring_close --
+ *
+ *    Unmaps the event ring and removes its shared memory object.  An
+ *    inferior still running keeps its own mapping, so it is unaffected.
+ *
+ * Returns:
+ *    None.
+ *
+ * Side effects:
+ *    The shared memory object is unlinked.
+ *
+ *----------------------------------------------------------------------------
+ */
+
 static void
-gdkevent_started (PkaSource    *source,
-                  PkaSpawnInfo *spawn_info)
+gdkevent_ring_close (GdkeventPrivate *priv) /* IN */
+{
+	if (priv->ring) {
+		munmap(priv->ring, sizeof(GdkeventRing));
+		shm_unlink(priv->name);
+		priv->ring = NULL;
+	}
+	g_free(priv->name);
+	priv->name = NULL;
+	priv->dropped = 0;
+}
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * gdkevent_modify_spawn_info --
+ *
+ *    Creates a new event ring and sets up the environment of the inferior so
+ *    that Gtk+ loads the event module and the module finds the ring.
+ *
+ * Returns:
+ *    TRUE if successful; otherwise FALSE and @error is set.
+ *
+ * Side effects:
+ *    A shared memory object is created.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static gboolean
+gdkevent_modify_spawn_info (PkaSource     *source,     /* IN */
+                            PkaSpawnInfo  *spawn_info, /* IN/OUT */
+                            GError       **error)      /* OUT */
 {
+	GdkeventPrivate *priv = GDKEVENT_SOURCE(source)->priv;
+	gpointer map;
+	gint errsv;
+	gint fd;
+
+	ENTRY;
+	if (spawn_info->pid) {
+		g_warning("GdkEvent source cannot attach to a running process.");
+		RETURN(TRUE);
+	}
+	/*
+	 * The ring of a previous spawn is normally closed when the source is
+	 * stopped.  Each inferior gets a fresh ring either way.
+	 */
+	gdkevent_ring_close(priv);
+	priv->name = g_strdup_printf("/perfkit-gdkevent-%d-%d", (gint)getpid(),
+	                             g_atomic_int_exchange_and_add(&gdkevent_seq, 1));
+	if ((fd = shm_open(priv->name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0) {
+		GOTO(error);
+	}
+	if (ftruncate(fd, sizeof(GdkeventRing)) < 0) {
+		close(fd);
+		GOTO(unlink);
+	}
+	map = mmap(NULL, sizeof(GdkeventRing), PROT_READ | PROT_WRITE,
+	           MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		GOTO(unlink);
+	}
+	priv->ring = map;
+	priv->ring->magic = GDKEVENT_RING_MAGIC;
+	priv->ring->n_records = GDKEVENT_RING_N_RECORDS;
+
+	if (!spawn_info->env) {
+		spawn_info->env = src_utils_environ_copy();
+	}
+	src_utils_environ_set(&spawn_info->env, "GTK_MODULES", GDKEVENT_MODULE,
+	                      ':');
+	src_utils_environ_set(&spawn_info->env, GDKEVENT_RING_ENV, priv->name, 0);
+	RETURN(TRUE);
+
+  unlink:
+	errsv = errno;
+	shm_unlink(priv->name);
+	errno = errsv;
+  error:
+	errsv = errno;
+	g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+	            "Failed to create event ring %s: %s",
+	            priv->name, g_strerror(errsv));
+	g_free(priv->name);
+	priv->name = NULL;
+	RETURN(FALSE);
 }
 
+/*
+ *----------------------------------------------------------------------------
+ *
+ * gdkevent_sample --
+ *
+ *    Drains the records published by the module since the last sample and
+ *    delivers a sample for each of them.
+ *
+ * Returns:
+ *    None.
+ *
+ * Side effects:
+ *    The records are released to the module.
+ *
+ *----------------------------------------------------------------------------
+ */
+
 static void
-gdkevent_stopped (PkaSource *source)
+gdkevent_sample (PkaSourceSimple *source,    /* IN */
+                 gpointer         user_data) /* IN */
 {
+	GdkeventPrivate *priv = GDKEVENT_SOURCE(source)->priv;
+	GdkeventRecord *record;
+	GdkeventRing *ring;
+	PkaSample *s;
+	guint64 dropped;
+	guint64 head;
+	guint64 tail;
+
+	if (!(ring = priv->ring)) {
+		return;
+	}
+
+	ENTRY;
+	if (G_UNLIKELY(!priv->manifest)) {
+		priv->manifest = pka_manifest_sized_new(9);
+		pka_manifest_set_packed(priv->manifest, TRUE);
+		pka_manifest_append(priv->manifest, "Type", G_TYPE_INT);
+		pka_manifest_append(priv->manifest, "Window", G_TYPE_UINT64);
+		pka_manifest_append(priv->manifest, "Time", G_TYPE_UINT);
+		pka_manifest_append(priv->manifest, "X", G_TYPE_DOUBLE);
+		pka_manifest_append(priv->manifest, "Y", G_TYPE_DOUBLE);
+		pka_manifest_append(priv->manifest, "Width", G_TYPE_INT);
+		pka_manifest_append(priv->manifest, "Height", G_TYPE_INT);
+		pka_manifest_append(priv->manifest, "State", G_TYPE_UINT);
+		pka_manifest_append(priv->manifest, "Detail", G_TYPE_UINT);
+		pka_source_deliver_manifest(PKA_SOURCE(source), priv->manifest);
+	}
+
+	/*
+	 * Records up to head are complete once head is read.
+	 */
+	head = ring->head;
+	__sync_synchronize();
+	for (tail = ring->tail; tail != head; tail++) {
+		record = &ring->records[tail & (GDKEVENT_RING_N_RECORDS - 1)];
+		s = pka_sample_new_packed(priv->manifest);
+		pka_sample_append_int(s, 1, record->type);
+		pka_sample_append_uint64(s, 2, record->window);
+		pka_sample_append_uint(s, 3, record->time);
+		pka_sample_append_double(s, 4, record->x);
+		pka_sample_append_double(s, 5, record->y);
+		pka_sample_append_int(s, 6, record->width);
+		pka_sample_append_int(s, 7, record->height);
+		pka_sample_append_uint(s, 8, record->state);
+		pka_sample_append_uint(s, 9, record->detail);
+		pka_source_deliver_sample(PKA_SOURCE(source), s);
+		pka_sample_unref(s);
+	}
+
+	/*
+	 * Release the records only after they are no longer read.
+	 */
+	__sync_synchronize();
+	ring->tail = head;
+
+	dropped = ring->dropped;
+	if (dropped != priv->dropped) {
+		g_warning("GdkEvent ring was full, %" G_GUINT64_FORMAT
+		          " events were dropped.", dropped - priv->dropped);
+		priv->dropped = dropped;
+	}
+	EXIT;
+}
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * gdkevent_stopped --
+ *
+ *    Closes the event ring once the source is stopped so that the channel
+ *    can be started again with a new inferior.
+ *
+ * Returns:
+ *    None.
+ *
+ * Side effects:
+ *    The shared memory object is unlinked.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+gdkevent_stopped (PkaSource *source) /* IN */
+{
+	ENTRY;
+	/*
+	 * PkaSourceSimple waits for a running sample callback and invokes no
+	 * more afterwards, so the ring is no longer read once this returns.
+	 */
+	PKA_SOURCE_CLASS(gdkevent_parent_class)->stopped(source);
+	gdkevent_ring_close(GDKEVENT_SOURCE(source)->priv);
+	EXIT;
 }
 
 static void
 gdkevent_finalize (GObject *object)
 {
+	GdkeventPrivate *priv = GDKEVENT_SOURCE(object)->priv;
+
+	gdkevent_ring_close(priv);
+	if (priv->manifest) {
+		pka_manifest_unref(priv->manifest);
+	}
+
 	G_OBJECT_CLASS(gdkevent_parent_class)->finalize(object);
 }
 
@@ -78,16 +318,23 @@ gdkevent_class_init (GdkeventClass *klass)
 	g_type_class_add_private(object_class, sizeof(GdkeventPrivate));
 
 	source_class = PKA_SOURCE_CLASS(klass);
-	source_class->started = gdkevent_started;
+	source_class->modify_spawn_info = gdkevent_modify_spawn_info;
 	source_class->stopped = gdkevent_stopped;
 }
 
 static void
 gdkevent_init (Gdkevent *gdkevent)
 {
+	GTimeVal freq = { 0 };
+
 	gdkevent->priv = G_TYPE_INSTANCE_GET_PRIVATE(gdkevent,
 	                                             GDKEVENT_TYPE_SOURCE,
 	                                             GdkeventPrivate);
+	pka_source_simple_set_sample_callback(PKA_SOURCE_SIMPLE(gdkevent),
+	                                      gdkevent_sample, NULL, NULL);
+	g_time_val_add(&freq, pka_config_get_integer("source.gdkevent",
+	                                             "frequency", 50) * 1000);
+	pka_source_simple_set_frequency(PKA_SOURCE_SIMPLE(gdkevent), &freq);
 }
 
 GObject *
@@ -101,7 +348,7 @@ const PkaPluginInfo pka_plugin_info = {
 	.name        = "Gtk+ events",
 	.description = "This source provides information about the events "
 	               "processed by the Gtk+ main loop.",
-	.version     = "0.1.1",
+	.version     = "0.2.0",
 	.copyright   = "Christian Hergert",
 	.factory     = gdkevent_new,
 	.plugin_type = PKA_PLUGIN_SOURCE,
@@ -16,12 +16,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <fcntl.h>
 #include <stdio.h>
-#include <string.h>
-#include <unistd.h>
 #include <perfkit-agent/perfkit-agent.h>
 
+#include "src-utils.h"
+
 #ifdef G_LOG_DOMAIN
 #undef G_LOG_DOMAIN
 #endif
@@ -31,6 +30,7 @@ typedef struct
 {
 	PkaManifest *manifest;
 	GPid pid;
+	SrcUtilsProc *statm;
 	gint size;
 	gint resident;
 	gint share;
@@ -46,19 +46,13 @@ typedef struct
 static inline gboolean
 memory_read (Memory *state)
 {
-	gint fd;
-	gchar path[64];
-	gchar buffer[64];
+	const gchar *buffer;
  
  	ENTRY;
-	memset(path, 0, sizeof(path));
-	snprintf(path, sizeof(path), "/proc/%d/statm", state->pid);
-	fd = open(path, O_RDONLY);
-	if (fd < 0) {
-		RETURN(FALSE);
+	if (G_UNLIKELY(!state->statm)) {
+		state->statm = src_utils_proc_open_pid(state->pid, "statm");
 	}
-	if (read(fd, buffer, sizeof(buffer)) < 1) {
-		close(fd);
+	if (!(buffer = src_utils_proc_read(state->statm, NULL))) {
 		RETURN(FALSE);
 	}
 	sscanf(buffer,
@@ -70,7 +64,7 @@ memory_read (Memory *state)
 	       &state->lib,
 	       &state->data,
 	       &state->dt);
-	close(fd);
+	src_utils_proc_release(state->statm);
 	RETURN(TRUE);
 }
 
@@ -136,8 +130,14 @@ memory_spawn (PkaSourceSimple *source,
               PkaSpawnInfo    *spawn_info,
               gpointer         user_data)
 {
+	Memory *state = user_data;
+
 	ENTRY;
-	((Memory *)user_data)->pid = spawn_info->pid;
+	if (state->statm) {
+		src_utils_proc_close(state->statm);
+		state->statm = NULL;
+	}
+	state->pid = spawn_info->pid;
 	EXIT;
 }
 
@@ -155,6 +155,9 @@ memory_free (gpointer data)
 	if (state->manifest) {
 		pka_manifest_unref(state->manifest);
 	}
+	if (state->statm) {
+		src_utils_proc_close(state->statm);
+	}
 	g_slice_free(Memory, data);
 	EXIT;
 }
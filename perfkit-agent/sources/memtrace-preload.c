@@ -0,0 +1,527 @@
+/* memtrace-preload.c
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "memtrace-ring.h"
+
+/*
+ * Preloaded into the process by the Memtrace source to record its
+ * allocations, including the aligned ones.  Each hook appends a record to
+ * a buffer private to the thread, which is copied into the shared ring as
+ * a whole block, so the cost of an allocation is a clock read and a store
+ * in the common case.
+ *
+ * The records of a free are taken before the memory is released and the
+ * records of an allocation after it is obtained, so the timestamps order
+ * the reuse of an address even across the buffers of different threads.
+ */
+
+#define MEMTRACE_BOOTSTRAP_SIZE (4096)
+#define MEMTRACE_FULL_RETRIES   (4)
+#define MEMTRACE_HOOK           __attribute__((visibility("default")))
+
+typedef struct
+{
+	uint64_t       first;      /* Time of the oldest buffered record */
+	uint32_t       n_records;
+	int            registered; /* Flushed on thread exit */
+	MemtraceRecord records[MEMTRACE_BLOCK_N_RECORDS];
+} MemtraceBuffer;
+
+static void* (*real_malloc)  (size_t) = NULL;
+static void* (*real_calloc)  (size_t, size_t) = NULL;
+static void* (*real_realloc) (void*, size_t) = NULL;
+static void  (*real_free)    (void*) = NULL;
+static int   (*real_posix_memalign) (void**, size_t, size_t) = NULL;
+static void* (*real_memalign)       (size_t, size_t) = NULL;
+static void* (*real_aligned_alloc)  (size_t, size_t) = NULL;
+static void* (*real_mmap)    (void*, size_t, int, int, int, off_t) = NULL;
+static void* (*real_mmap64)  (void*, size_t, int, int, int, off64_t) = NULL;
+static int   (*real_munmap)  (void*, size_t) = NULL;
+
+static MemtraceRing *ring = NULL;
+static pthread_key_t buffer_key;
+static int resolving = 0;
+
+/*
+ * dlsym() may allocate before the real allocator is known, which is
+ * served from this arena and never freed.
+ */
+static char bootstrap[MEMTRACE_BOOTSTRAP_SIZE] __attribute__((aligned(16)));
+static size_t bootstrap_used = 0;
+
+static __thread MemtraceBuffer buffer __attribute__((tls_model("initial-exec")));
+static __thread int in_hook __attribute__((tls_model("initial-exec")));
+
+static void
+memtrace_resolve (void)
+{
+	resolving = 1;
+	real_malloc = dlsym(RTLD_NEXT, "malloc");
+	real_calloc = dlsym(RTLD_NEXT, "calloc");
+	real_realloc = dlsym(RTLD_NEXT, "realloc");
+	real_free = dlsym(RTLD_NEXT, "free");
+	real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+	real_memalign = dlsym(RTLD_NEXT, "memalign");
+	real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+	real_mmap = dlsym(RTLD_NEXT, "mmap");
+	real_mmap64 = dlsym(RTLD_NEXT, "mmap64");
+	real_munmap = dlsym(RTLD_NEXT, "munmap");
+	resolving = 0;
+}
+
+static void*
+memtrace_bootstrap_alloc (size_t size) /* IN */
+{
+	void *ptr;
+
+	size = (size + 15) & ~(size_t)15;
+	if (bootstrap_used + size > sizeof(bootstrap)) {
+		return NULL;
+	}
+	ptr = bootstrap + bootstrap_used;
+	bootstrap_used += size;
+	return ptr;
+}
+
+static inline int
+memtrace_is_bootstrap (void *ptr) /* IN */
+{
+	return (char *)ptr >= bootstrap &&
+	       (char *)ptr < bootstrap + sizeof(bootstrap);
+}
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * memtrace_flush --
+ *
+ *    Copies the buffered records of the calling thread into a block of
+ *    the ring.  If the ring is full, the thread yields a few times in case
+ *    the agent is about to drain it, then drops the records rather than
+ *    stall the allocation.
+ *
+ * Returns:
+ *    None.
+ *
+ * Side effects:
+ *    The buffer is emptied.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+memtrace_flush (MemtraceBuffer *buf) /* IN */
+{
+	MemtraceRing *r = ring;
+	MemtraceBlock *block;
+	uint64_t head;
+	int retries = 0;
+
+	if (!buf->n_records || !r) {
+		buf->n_records = 0;
+		return;
+	}
+	for (;;) {
+		head = r->head;
+		if (head - r->tail >= MEMTRACE_RING_N_BLOCKS) {
+			if (++retries > MEMTRACE_FULL_RETRIES) {
+				__sync_fetch_and_add(&r->dropped, buf->n_records);
+				buf->n_records = 0;
+				return;
+			}
+			sched_yield();
+			continue;
+		}
+		if (__sync_bool_compare_and_swap(&r->head, head, head + 1)) {
+			break;
+		}
+	}
+	block = &r->blocks[head & (MEMTRACE_RING_N_BLOCKS - 1)];
+	memcpy(block->records, buf->records,
+	       buf->n_records * sizeof(MemtraceRecord));
+	block->n_records = buf->n_records;
+
+	/* the block must be complete before it is published */
+	__sync_synchronize();
+	block->seq = head + 1;
+	buf->n_records = 0;
+}
+
+static void
+memtrace_thread_exit (void *data) /* IN */
+{
+	in_hook = 1;
+	memtrace_flush(data);
+	in_hook = 0;
+}
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * memtrace_record --
+ *
+ *    Appends a record to the buffer of the calling thread.  The buffer is
+ *    flushed when it is full or its oldest record is older than
+ *    MEMTRACE_FLUSH_NSEC, so a thread allocating slowly is not reported
+ *    late for long.
+ *
+ * Returns:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+memtrace_record (uint32_t  type,   /* IN */
+                 void     *addr,   /* IN */
+                 size_t    size,   /* IN */
+                 void     *caller) /* IN */
+{
+	MemtraceBuffer *buf = &buffer;
+	MemtraceRecord *rec;
+	struct timespec ts;
+	uint64_t now;
+
+	if (!ring || in_hook) {
+		return;
+	}
+	in_hook = 1;
+	if (!buf->registered) {
+		buf->registered = 1;
+		pthread_setspecific(buffer_key, buf);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	if (!buf->n_records) {
+		buf->first = now;
+	}
+	rec = &buf->records[buf->n_records++];
+	rec->addr = (uintptr_t)addr;
+	rec->size = size;
+	rec->caller = (uintptr_t)caller;
+	rec->time = now;
+	rec->type = type;
+	if (buf->n_records == MEMTRACE_BLOCK_N_RECORDS ||
+	    now - buf->first >= MEMTRACE_FLUSH_NSEC) {
+		memtrace_flush(buf);
+	}
+	in_hook = 0;
+}
+
+/*
+ * A forked child has a copy of the mapping, but the ring belongs to the
+ * process the agent spawned.
+ */
+static void
+memtrace_atfork_child (void)
+{
+	ring = NULL;
+	buffer.n_records = 0;
+}
+
+static void
+memtrace_exit (void)
+{
+	in_hook = 1;
+	memtrace_flush(&buffer);
+}
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * memtrace_init --
+ *
+ *    Maps the ring named in the environment.  Only the first process to
+ *    map it traces into it; other processes it starts inherit the
+ *    environment but not the ring.
+ *
+ * Returns:
+ *    None.
+ *
+ * Side effects:
+ *    Tracing starts.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void __attribute__((constructor))
+memtrace_init (void)
+{
+	const char *name;
+	int32_t pid;
+	void *map;
+	int fd;
+
+	if (!real_malloc) {
+		memtrace_resolve();
+	}
+	if (!(name = getenv(MEMTRACE_RING_ENV))) {
+		return;
+	}
+	if ((fd = shm_open(name, O_RDWR, 0)) < 0) {
+		return;
+	}
+	map = real_mmap(NULL, sizeof(MemtraceRing), PROT_READ | PROT_WRITE,
+	                MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return;
+	}
+	/*
+	 * The process may claim the ring again after exec(), which keeps its
+	 * pid.
+	 */
+	pid = getpid();
+	if (((MemtraceRing *)map)->magic != MEMTRACE_RING_MAGIC ||
+	    ((MemtraceRing *)map)->n_blocks != MEMTRACE_RING_N_BLOCKS ||
+	    (!__sync_bool_compare_and_swap(&((MemtraceRing *)map)->pid, 0, pid) &&
+	     ((MemtraceRing *)map)->pid != pid)) {
+		real_munmap(map, sizeof(MemtraceRing));
+		return;
+	}
+	if (pthread_key_create(&buffer_key, memtrace_thread_exit) != 0) {
+		real_munmap(map, sizeof(MemtraceRing));
+		return;
+	}
+	pthread_atfork(NULL, NULL, memtrace_atfork_child);
+	atexit(memtrace_exit);
+	ring = map;
+}
+
+MEMTRACE_HOOK void*
+malloc (size_t size) /* IN */
+{
+	void *ptr;
+
+	if (__builtin_expect(!real_malloc, 0)) {
+		if (resolving) {
+			return memtrace_bootstrap_alloc(size);
+		}
+		memtrace_resolve();
+	}
+	if ((ptr = real_malloc(size))) {
+		memtrace_record(MEMTRACE_MALLOC, ptr, size,
+		                __builtin_return_address(0));
+	}
+	return ptr;
+}
+
+MEMTRACE_HOOK void*
+calloc (size_t nmemb, /* IN */
+        size_t size)  /* IN */
+{
+	void *ptr;
+
+	if (__builtin_expect(!real_calloc, 0)) {
+		if (resolving) {
+			/* the arena is zero filled and never reused */
+			return memtrace_bootstrap_alloc(nmemb * size);
+		}
+		memtrace_resolve();
+	}
+	if ((ptr = real_calloc(nmemb, size))) {
+		memtrace_record(MEMTRACE_MALLOC, ptr, nmemb * size,
+		                __builtin_return_address(0));
+	}
+	return ptr;
+}
+
+MEMTRACE_HOOK void*
+realloc (void   *old,  /* IN */
+         size_t  size) /* IN */
+{
+	size_t avail;
+	void *ptr;
+
+	if (__builtin_expect(!real_realloc, 0)) {
+		if (resolving) {
+			return memtrace_bootstrap_alloc(size);
+		}
+		memtrace_resolve();
+	}
+	if (memtrace_is_bootstrap(old)) {
+		/* the size of the old block is unknown, copy what may be it */
+		avail = bootstrap + sizeof(bootstrap) - (char *)old;
+		if ((ptr = malloc(size))) {
+			memcpy(ptr, old, size < avail ? size : avail);
+		}
+		return ptr;
+	}
+	if (old) {
+		memtrace_record(MEMTRACE_FREE, old, 0, NULL);
+	}
+	if ((ptr = real_realloc(old, size))) {
+		memtrace_record(MEMTRACE_MALLOC, ptr, size,
+		                __builtin_return_address(0));
+	} else if (old && size) {
+		/* the old block is still allocated */
+		memtrace_record(MEMTRACE_MALLOC, old, malloc_usable_size(old),
+		                __builtin_return_address(0));
+	}
+	return ptr;
+}
+
+/*
+ * The aligned allocators are released with free(), so they are traced as
+ * well or their frees would never match an allocation.  The bootstrap
+ * arena does not serve them; dlsym() only uses malloc() and calloc().
+ */
+MEMTRACE_HOOK int
+posix_memalign (void   **memptr,    /* OUT */
+                size_t   alignment, /* IN */
+                size_t   size)      /* IN */
+{
+	int ret;
+
+	if (__builtin_expect(!real_posix_memalign, 0)) {
+		if (resolving) {
+			return ENOMEM;
+		}
+		memtrace_resolve();
+	}
+	if (!(ret = real_posix_memalign(memptr, alignment, size))) {
+		memtrace_record(MEMTRACE_MALLOC, *memptr, size,
+		                __builtin_return_address(0));
+	}
+	return ret;
+}
+
+MEMTRACE_HOOK void*
+memalign (size_t alignment, /* IN */
+          size_t size)      /* IN */
+{
+	void *ptr;
+
+	if (__builtin_expect(!real_memalign, 0)) {
+		if (resolving) {
+			return NULL;
+		}
+		memtrace_resolve();
+	}
+	if ((ptr = real_memalign(alignment, size))) {
+		memtrace_record(MEMTRACE_MALLOC, ptr, size,
+		                __builtin_return_address(0));
+	}
+	return ptr;
+}
+
+MEMTRACE_HOOK void*
+aligned_alloc (size_t alignment, /* IN */
+               size_t size)      /* IN */
+{
+	void *ptr;
+
+	if (__builtin_expect(!real_aligned_alloc, 0)) {
+		if (resolving) {
+			return NULL;
+		}
+		memtrace_resolve();
+	}
+	if ((ptr = real_aligned_alloc(alignment, size))) {
+		memtrace_record(MEMTRACE_MALLOC, ptr, size,
+		                __builtin_return_address(0));
+	}
+	return ptr;
+}
+
+MEMTRACE_HOOK void
+free (void *ptr) /* IN */
+{
+	if (!ptr || memtrace_is_bootstrap(ptr)) {
+		return;
+	}
+	if (__builtin_expect(!real_free, 0)) {
+		memtrace_resolve();
+	}
+	memtrace_record(MEMTRACE_FREE, ptr, 0, NULL);
+	real_free(ptr);
+}
+
+MEMTRACE_HOOK void*
+mmap (void   *addr,   /* IN */
+      size_t  length, /* IN */
+      int     prot,   /* IN */
+      int     flags,  /* IN */
+      int     fd,     /* IN */
+      off_t   offset) /* IN */
+{
+	void *ptr;
+
+	if (__builtin_expect(!real_mmap, 0)) {
+		memtrace_resolve();
+	}
+	ptr = real_mmap(addr, length, prot, flags, fd, offset);
+	/* only anonymous mappings are memory of the process */
+	if (ptr != MAP_FAILED && (flags & MAP_ANONYMOUS)) {
+		memtrace_record(MEMTRACE_MMAP, ptr, length,
+		                __builtin_return_address(0));
+	}
+	return ptr;
+}
+
+/* programs built with large file support call mmap64() */
+MEMTRACE_HOOK void*
+mmap64 (void    *addr,   /* IN */
+        size_t   length, /* IN */
+        int      prot,   /* IN */
+        int      flags,  /* IN */
+        int      fd,     /* IN */
+        off64_t  offset) /* IN */
+{
+	void *ptr;
+
+	if (__builtin_expect(!real_mmap64, 0)) {
+		memtrace_resolve();
+	}
+	ptr = real_mmap64(addr, length, prot, flags, fd, offset);
+	if (ptr != MAP_FAILED && (flags & MAP_ANONYMOUS)) {
+		memtrace_record(MEMTRACE_MMAP, ptr, length,
+		                __builtin_return_address(0));
+	}
+	return ptr;
+}
+
+MEMTRACE_HOOK int
+munmap (void   *addr,   /* IN */
+        size_t  length) /* IN */
+{
+	if (__builtin_expect(!real_munmap, 0)) {
+		memtrace_resolve();
+	}
+	memtrace_record(MEMTRACE_MUNMAP, addr, length, NULL);
+	return real_munmap(addr, length);
+}
@@ -0,0 +1,91 @@
+/* memtrace-ring.h
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MEMTRACE_RING_H__
+#define __MEMTRACE_RING_H__
+
+#include <stdint.h>
+
+/*
+ * The Memtrace source and the preload library share a ring of blocks of
+ * allocation records in POSIX shared memory.  Each thread of the process
+ * buffers its records privately and copies a whole block into the ring
+ * when its buffer fills or gets old, so the ring is touched once per
+ * block rather than once per allocation.
+ *
+ * Any thread may produce: a block is reserved by advancing head with a
+ * compare and swap, only while it is less than a ring ahead of tail, and
+ * published by setting its seq to its index plus one.  The source is the
+ * only consumer; it reads published blocks in order and releases them by
+ * advancing tail.  A thread that finds the ring full for too long drops
+ * its block and counts the records, so the process never stops on the
+ * agent.
+ *
+ * The library is written without GLib, so this header only uses the
+ * C library types.
+ */
+
+#define MEMTRACE_RING_ENV        "PERFKIT_MEMTRACE_RING"
+#define MEMTRACE_RING_MAGIC      (0x504b4d54)
+#define MEMTRACE_RING_CACHELINE  (64)
+#define MEMTRACE_RING_N_BLOCKS   (512)  /* A power of two */
+#define MEMTRACE_BLOCK_N_RECORDS (256)
+#define MEMTRACE_FLUSH_NSEC      (100000000ULL)
+
+typedef enum
+{
+	MEMTRACE_MALLOC = 1,
+	MEMTRACE_FREE   = 2,
+	MEMTRACE_MMAP   = 3,
+	MEMTRACE_MUNMAP = 4,
+} MemtraceType;
+
+typedef struct
+{
+	uint64_t addr;
+	uint64_t size;     /* 0 for frees */
+	uint64_t caller;   /* Return address of the allocation call */
+	uint64_t time;     /* CLOCK_MONOTONIC in nanoseconds */
+	uint32_t type;     /* MemtraceType */
+	uint32_t pad;
+} MemtraceRecord;
+
+typedef struct
+{
+	uint64_t       seq;
+	uint32_t       n_records;
+	uint32_t       pad;
+	MemtraceRecord records[MEMTRACE_BLOCK_N_RECORDS];
+} MemtraceBlock;
+
+typedef struct
+{
+	uint32_t      magic;
+	uint32_t      n_blocks;
+	int32_t       pid;        /* Process tracing into the ring, 0 if none */
+	uint32_t      pad0;
+	uint8_t       pad1[MEMTRACE_RING_CACHELINE - 16];
+	uint64_t      head;       /* Reserved by producers */
+	uint64_t      dropped;    /* Records dropped on a full ring */
+	uint8_t       pad2[MEMTRACE_RING_CACHELINE - 16];
+	uint64_t      tail;       /* Written by the consumer */
+	uint8_t       pad3[MEMTRACE_RING_CACHELINE - 8];
+	MemtraceBlock blocks[MEMTRACE_RING_N_BLOCKS];
+} MemtraceRing;
+
+#endif /* __MEMTRACE_RING_H__ */
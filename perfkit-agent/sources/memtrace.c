@@ -0,0 +1,697 @@
+/* memtrace.c
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <perfkit-agent/perfkit-agent.h>
+
+#include "memtrace-ring.h"
+#include "src-utils.h"
+
+#ifdef G_LOG_DOMAIN
+#undef G_LOG_DOMAIN
+#endif
+#define G_LOG_DOMAIN "Memtrace"
+
+/*
+ * The Memtrace source preloads libmemtrace-preload into the process it
+ * spawns, which records every malloc, free, realloc and anonymous mmap
+ * into a ring shared with the source (see memtrace-ring.h).  Every tick
+ * the source drains the ring and keeps the allocations still live by
+ * address and by call site.
+ *
+ * It delivers a sample with the allocation and free rates, the live bytes
+ * and allocations, and a histogram of the sizes allocated during the tick,
+ * followed by a sample for each of the call sites holding the most live
+ * bytes.
+ *
+ * The blocks of different threads arrive out of order, so a free may be
+ * read before the allocation it releases.  Such frees are kept with their
+ * time until the allocation shows up, and dropped after
+ * MEMTRACE_ORPHAN_NSEC if it never does, as for memory allocated before
+ * the library was loaded.  Likewise an allocation and free of an address
+ * may be read after a newer allocation of the same address by another
+ * thread, so live allocations keep their time and older records of their
+ * address are ignored.
+ */
+
+#define MEMTRACE_TYPE_SOURCE            (memtrace_get_type())
+#define MEMTRACE_SOURCE(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), MEMTRACE_TYPE_SOURCE, Memtrace))
+#define MEMTRACE_SOURCE_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), MEMTRACE_TYPE_SOURCE, Memtrace const))
+#define MEMTRACE_SOURCE_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  MEMTRACE_TYPE_SOURCE, MemtraceClass))
+#define MEMTRACE_IS_SOURCE(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), MEMTRACE_TYPE_SOURCE))
+#define MEMTRACE_IS_SOURCE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  MEMTRACE_TYPE_SOURCE))
+#define MEMTRACE_SOURCE_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  MEMTRACE_TYPE_SOURCE, MemtraceClass))
+
+#define MEMTRACE_N_CLASSES   (24)
+#define MEMTRACE_ORPHAN_NSEC (G_GUINT64_CONSTANT(10000000000))
+#define MEMTRACE_LIBRARY     PACKAGE_LIB_DIR "/perfkit-agent/libmemtrace-preload.so"
+
+/*
+ * Rows of the manifest.  The size classes follow the summary rows and the
+ * call site rows follow the size classes.
+ */
+enum
+{
+	ROW_ALLOCATIONS = 1,
+	ROW_FREES,
+	ROW_ALLOCATED_BYTES,
+	ROW_LIVE_BYTES,
+	ROW_LIVE_ALLOCATIONS,
+	ROW_DROPPED,
+	ROW_SIZE_CLASS,
+	ROW_SITE = ROW_SIZE_CLASS + MEMTRACE_N_CLASSES,
+	ROW_SITE_LIVE_BYTES,
+	ROW_SITE_LIVE_ALLOCATIONS,
+	ROW_SITE_ALLOCATIONS,
+};
+
+typedef struct _Memtrace        Memtrace;
+typedef struct _MemtraceClass   MemtraceClass;
+typedef struct _MemtracePrivate MemtracePrivate;
+
+struct _Memtrace
+{
+	PkaSourceSimple parent;
+
+	/*< private >*/
+	MemtracePrivate *priv;
+};
+
+struct _MemtraceClass
+{
+	PkaSourceSimpleClass parent_class;
+};
+
+G_DEFINE_TYPE(Memtrace, memtrace, PKA_TYPE_SOURCE_SIMPLE)
+
+typedef struct
+{
+	guint64 caller;
+	guint64 live_bytes;
+	guint64 live_count;
+	guint64 n_allocs;
+} MemtraceSite;
+
+typedef struct
+{
+	guint64       size;
+	guint64       time;  /* Time of the allocation */
+	MemtraceSite *site;
+} MemtraceLive;
+
+struct _MemtracePrivate
+{
+	gchar        *name;      /* Name of the shared memory object */
+	MemtraceRing *ring;      /* Ring shared with the library */
+	gint          n_sites;   /* Call sites delivered per tick */
+	PkaManifest  *manifest;
+	GHashTable   *live;      /* Address => MemtraceLive */
+	GHashTable   *sites;     /* Caller => MemtraceSite */
+	GHashTable   *orphans;   /* Address => time of an early free */
+	guint64       last_time; /* Time of the newest record */
+	guint64       live_bytes;
+	guint64       live_count;
+
+	/* Since the previous tick */
+	gdouble       last;      /* CLOCK_MONOTONIC in seconds */
+	guint64       n_allocs;
+	guint64       n_frees;
+	guint64       alloc_bytes;
+	guint64       classes[MEMTRACE_N_CLASSES];
+};
+
+static gint memtrace_seq = 0;
+
+static void
+memtrace_live_free (gpointer data) /* IN */
+{
+	g_slice_free(MemtraceLive, data);
+}
+
+static void
+memtrace_site_free (gpointer data) /* IN */
+{
+	g_slice_free(MemtraceSite, data);
+}
+
+static void
+memtrace_orphan_free (gpointer data) /* IN */
+{
+	g_slice_free(guint64, data);
+}
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * memtrace_ring_close --
+ *
+ *    Unmaps the ring and removes its shared memory object.  An inferior
+ *    still running keeps its own mapping, so it is unaffected.
+ *
+ * Returns:
+ *    None.
+ *
+ * Side effects:
+ *    The shared memory object is unlinked.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+memtrace_ring_close (MemtracePrivate *priv) /* IN */
+{
+	if (priv->ring) {
+		munmap(priv->ring, sizeof(MemtraceRing));
+		shm_unlink(priv->name);
+		priv->ring = NULL;
+	}
+	g_free(priv->name);
+	priv->name = NULL;
+}
+
+/*
+ * Forget the allocations of a previous inferior.
+ */
+static void
+memtrace_reset (MemtracePrivate *priv) /* IN */
+{
+	struct timespec ts;
+
+	g_hash_table_remove_all(priv->live);
+	g_hash_table_remove_all(priv->sites);
+	g_hash_table_remove_all(priv->orphans);
+	priv->last_time = 0;
+	priv->live_bytes = 0;
+	priv->live_count = 0;
+	priv->n_allocs = 0;
+	priv->n_frees = 0;
+	priv->alloc_bytes = 0;
+	memset(priv->classes, 0, sizeof(priv->classes));
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	priv->last = ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * memtrace_modify_spawn_info --
+ *
+ *    Creates a new ring and sets up the environment of the inferior so
+ *    that the library is preloaded and finds the ring.
+ *
+ * Returns:
+ *    TRUE if successful; otherwise FALSE and @error is set.
+ *
+ * Side effects:
+ *    A shared memory object is created.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static gboolean
+memtrace_modify_spawn_info (PkaSource     *source,     /* IN */
+                            PkaSpawnInfo  *spawn_info, /* IN/OUT */
+                            GError       **error)      /* OUT */
+{
+	MemtracePrivate *priv = MEMTRACE_SOURCE(source)->priv;
+	gchar *library;
+	gpointer map;
+	gint errsv;
+	gint fd;
+
+	ENTRY;
+	/*
+	 * The ring of a previous spawn is normally closed when the source is
+	 * stopped.  Each inferior gets a fresh ring either way.
+	 */
+	memtrace_ring_close(priv);
+	memtrace_reset(priv);
+	if (spawn_info->pid) {
+		g_warning("Memtrace source cannot attach to a running process.");
+		RETURN(TRUE);
+	}
+	priv->name = g_strdup_printf("/perfkit-memtrace-%d-%d", (gint)getpid(),
+	                             g_atomic_int_exchange_and_add(&memtrace_seq, 1));
+	if ((fd = shm_open(priv->name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0) {
+		GOTO(error);
+	}
+	if (ftruncate(fd, sizeof(MemtraceRing)) < 0) {
+		errsv = errno;
+		close(fd);
+		shm_unlink(priv->name);
+		errno = errsv;
+		GOTO(error);
+	}
+	map = mmap(NULL, sizeof(MemtraceRing), PROT_READ | PROT_WRITE,
+	           MAP_SHARED, fd, 0);
+	errsv = errno;
+	close(fd);
+	if (map == MAP_FAILED) {
+		shm_unlink(priv->name);
+		errno = errsv;
+		GOTO(error);
+	}
+	priv->ring = map;
+	priv->ring->magic = MEMTRACE_RING_MAGIC;
+	priv->ring->n_blocks = MEMTRACE_RING_N_BLOCKS;
+
+	library = pka_config_get_string("source.memtrace", "library",
+	                                MEMTRACE_LIBRARY);
+	if (!spawn_info->env) {
+		spawn_info->env = src_utils_environ_copy();
+	}
+	src_utils_environ_set(&spawn_info->env, "LD_PRELOAD", library, ':');
+	src_utils_environ_set(&spawn_info->env, MEMTRACE_RING_ENV, priv->name, 0);
+	g_free(library);
+	RETURN(TRUE);
+
+  error:
+	errsv = errno;
+	g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+	            "Failed to create allocation ring %s: %s",
+	            priv->name, g_strerror(errsv));
+	g_free(priv->name);
+	priv->name = NULL;
+	RETURN(FALSE);
+}
+
+/*
+ * Account an allocation of the process.
+ */
+static void
+memtrace_alloc (MemtracePrivate      *priv, /* IN */
+                const MemtraceRecord *rec)  /* IN */
+{
+	MemtraceSite *site;
+	MemtraceLive *live;
+	gpointer key = GSIZE_TO_POINTER(rec->addr);
+	guint64 *freed;
+	guint bucket;
+
+	priv->n_allocs++;
+	priv->alloc_bytes += rec->size;
+	bucket = rec->size ? MIN(g_bit_storage(rec->size),
+	                         MEMTRACE_N_CLASSES - 1) : 0;
+	priv->classes[bucket]++;
+
+	if (!(site = g_hash_table_lookup(priv->sites, GSIZE_TO_POINTER(rec->caller)))) {
+		site = g_slice_new0(MemtraceSite);
+		site->caller = rec->caller;
+		g_hash_table_insert(priv->sites, GSIZE_TO_POINTER(rec->caller), site);
+	}
+	site->n_allocs++;
+
+	/*
+	 * A free of this address read earlier and taken after this allocation
+	 * released it already.
+	 */
+	if ((freed = g_hash_table_lookup(priv->orphans, key))) {
+		if (*freed >= rec->time) {
+			g_hash_table_remove(priv->orphans, key);
+			return;
+		}
+		g_hash_table_remove(priv->orphans, key);
+	}
+
+	/*
+	 * Released before a newer allocation of the address which was read
+	 * first, or a free we did not see, such as from an untraced allocator
+	 * call.
+	 */
+	if ((live = g_hash_table_lookup(priv->live, key))) {
+		if (live->time > rec->time) {
+			return;
+		}
+		live->site->live_bytes -= live->size;
+		live->site->live_count--;
+		priv->live_bytes -= live->size;
+		priv->live_count--;
+	} else {
+		live = g_slice_new(MemtraceLive);
+		g_hash_table_insert(priv->live, key, live);
+	}
+	live->size = rec->size;
+	live->time = rec->time;
+	live->site = site;
+	site->live_bytes += rec->size;
+	site->live_count++;
+	priv->live_bytes += rec->size;
+	priv->live_count++;
+}
+
+/*
+ * Account a free of the process.  Partial munmaps of a traced mapping
+ * are not tracked.
+ */
+static void
+memtrace_free (MemtracePrivate      *priv, /* IN */
+               const MemtraceRecord *rec)  /* IN */
+{
+	MemtraceLive *live;
+	gpointer key = GSIZE_TO_POINTER(rec->addr);
+	guint64 *freed;
+
+	priv->n_frees++;
+	if ((live = g_hash_table_lookup(priv->live, key))) {
+		/* releases an older allocation of the address */
+		if (live->time > rec->time) {
+			return;
+		}
+		live->site->live_bytes -= live->size;
+		live->site->live_count--;
+		priv->live_bytes -= live->size;
+		priv->live_count--;
+		g_hash_table_remove(priv->live, key);
+	} else if ((freed = g_hash_table_lookup(priv->orphans, key))) {
+		*freed = MAX(*freed, rec->time);
+	} else {
+		freed = g_slice_new(guint64);
+		*freed = rec->time;
+		g_hash_table_insert(priv->orphans, key, freed);
+	}
+}
+
+static gboolean
+memtrace_orphan_expired (gpointer key,       /* IN */
+                         gpointer value,     /* IN */
+                         gpointer user_data) /* IN */
+{
+	return *(guint64 *)value + MEMTRACE_ORPHAN_NSEC < *(guint64 *)user_data;
+}
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * memtrace_drain --
+ *
+ *    Accounts the records of every block published since the previous
+ *    tick.  Blocks reserved but not yet published stop the drain until
+ *    the next tick so that blocks are accounted in order.
+ *
+ * Returns:
+ *    None.
+ *
+ * Side effects:
+ *    The blocks are released to the library.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+memtrace_drain (MemtracePrivate *priv) /* IN */
+{
+	MemtraceRing *ring = priv->ring;
+	MemtraceBlock *block;
+	const MemtraceRecord *rec;
+	guint64 tail;
+	guint i;
+
+	for (tail = ring->tail; tail != ring->head; tail++) {
+		block = &ring->blocks[tail & (MEMTRACE_RING_N_BLOCKS - 1)];
+		if (block->seq != tail + 1) {
+			break;
+		}
+		__sync_synchronize();
+		for (i = 0; i < block->n_records; i++) {
+			rec = &block->records[i];
+			switch (rec->type) {
+			case MEMTRACE_MALLOC:
+			case MEMTRACE_MMAP:
+				memtrace_alloc(priv, rec);
+				break;
+			case MEMTRACE_FREE:
+			case MEMTRACE_MUNMAP:
+				memtrace_free(priv, rec);
+				break;
+			default:
+				break;
+			}
+			priv->last_time = MAX(priv->last_time, rec->time);
+		}
+
+		/* release the block only after it is no longer read */
+		__sync_synchronize();
+		ring->tail = tail + 1;
+	}
+	g_hash_table_foreach_remove(priv->orphans, memtrace_orphan_expired,
+	                            &priv->last_time);
+}
+
+static gint
+memtrace_site_compare (gconstpointer a, /* IN */
+                       gconstpointer b) /* IN */
+{
+	const MemtraceSite *x = *(const MemtraceSite **)a;
+	const MemtraceSite *y = *(const MemtraceSite **)b;
+
+	return (x->live_bytes < y->live_bytes) - (x->live_bytes > y->live_bytes);
+}
+
+/*
+ * Deliver the call sites holding the most live bytes.
+ */
+static void
+memtrace_deliver_sites (PkaSource       *source, /* IN */
+                        MemtracePrivate *priv)   /* IN */
+{
+	GHashTableIter iter;
+	MemtraceSite *site;
+	GPtrArray *sites;
+	PkaSample *s;
+	guint i;
+
+	sites = g_ptr_array_new();
+	g_hash_table_iter_init(&iter, priv->sites);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&site)) {
+		if (site->live_bytes) {
+			g_ptr_array_add(sites, site);
+		}
+	}
+	g_ptr_array_sort(sites, memtrace_site_compare);
+	for (i = 0; i < sites->len && i < (guint)priv->n_sites; i++) {
+		site = g_ptr_array_index(sites, i);
+		s = pka_sample_new_packed(priv->manifest);
+		pka_sample_append_uint64(s, ROW_SITE, site->caller);
+		pka_sample_append_uint64(s, ROW_SITE_LIVE_BYTES, site->live_bytes);
+		pka_sample_append_uint64(s, ROW_SITE_LIVE_ALLOCATIONS,
+		                         site->live_count);
+		pka_sample_append_uint64(s, ROW_SITE_ALLOCATIONS, site->n_allocs);
+		pka_source_deliver_sample(source, s);
+		pka_sample_unref(s);
+	}
+	g_ptr_array_free(sites, TRUE);
+}
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * memtrace_sample --
+ *
+ *    Drains the ring and delivers the allocation statistics of the tick.
+ *
+ * Returns:
+ *    None.
+ *
+ * Side effects:
+ *    The per-tick counts are reset.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+memtrace_sample (PkaSourceSimple *source,    /* IN */
+                 gpointer         user_data) /* IN */
+{
+	MemtracePrivate *priv = MEMTRACE_SOURCE(source)->priv;
+	struct timespec ts;
+	gchar name[32];
+	PkaSample *s;
+	gdouble elapsed;
+	gdouble now;
+	gint i;
+
+	if (!priv->ring) {
+		return;
+	}
+
+	ENTRY;
+	if (G_UNLIKELY(!priv->manifest)) {
+		priv->manifest = pka_manifest_sized_new(ROW_SITE_ALLOCATIONS);
+		pka_manifest_set_packed(priv->manifest, TRUE);
+		pka_manifest_append(priv->manifest, "Allocations", G_TYPE_DOUBLE);
+		pka_manifest_append(priv->manifest, "Frees", G_TYPE_DOUBLE);
+		pka_manifest_append(priv->manifest, "Allocated Bytes", G_TYPE_DOUBLE);
+		pka_manifest_append(priv->manifest, "Live Bytes", G_TYPE_UINT64);
+		pka_manifest_append(priv->manifest, "Live Allocations", G_TYPE_UINT64);
+		pka_manifest_append(priv->manifest, "Dropped", G_TYPE_UINT64);
+		for (i = 0; i < MEMTRACE_N_CLASSES; i++) {
+			g_snprintf(name, sizeof(name), "Size <%" G_GUINT64_FORMAT,
+			           G_GUINT64_CONSTANT(1) << i);
+			pka_manifest_append(priv->manifest, name, G_TYPE_UINT64);
+		}
+		pka_manifest_append(priv->manifest, "Call Site", G_TYPE_UINT64);
+		pka_manifest_append(priv->manifest, "Site Live Bytes", G_TYPE_UINT64);
+		pka_manifest_append(priv->manifest, "Site Live Allocations",
+		                    G_TYPE_UINT64);
+		pka_manifest_append(priv->manifest, "Site Allocations", G_TYPE_UINT64);
+		pka_source_deliver_manifest(PKA_SOURCE(source), priv->manifest);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		priv->last = ts.tv_sec + ts.tv_nsec / 1000000000.0;
+	}
+
+	memtrace_drain(priv);
+
+	/*
+	 * Rates are per second over the time since the previous tick.
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec + ts.tv_nsec / 1000000000.0;
+	if ((elapsed = now - priv->last) <= 0.0) {
+		elapsed = 1.0;
+	}
+	priv->last = now;
+
+	s = pka_sample_new_packed(priv->manifest);
+	pka_sample_append_double(s, ROW_ALLOCATIONS, priv->n_allocs / elapsed);
+	pka_sample_append_double(s, ROW_FREES, priv->n_frees / elapsed);
+	pka_sample_append_double(s, ROW_ALLOCATED_BYTES, priv->alloc_bytes / elapsed);
+	pka_sample_append_uint64(s, ROW_LIVE_BYTES, priv->live_bytes);
+	pka_sample_append_uint64(s, ROW_LIVE_ALLOCATIONS, priv->live_count);
+	pka_sample_append_uint64(s, ROW_DROPPED, priv->ring->dropped);
+	pka_sample_append_uint64_array(s, ROW_SIZE_CLASS, priv->classes,
+	                               MEMTRACE_N_CLASSES);
+	pka_source_deliver_sample(PKA_SOURCE(source), s);
+	pka_sample_unref(s);
+
+	memtrace_deliver_sites(PKA_SOURCE(source), priv);
+
+	priv->n_allocs = 0;
+	priv->n_frees = 0;
+	priv->alloc_bytes = 0;
+	memset(priv->classes, 0, sizeof(priv->classes));
+	EXIT;
+}
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * memtrace_stopped --
+ *
+ *    Closes the ring once the source is stopped so that the channel can
+ *    be started again with a new inferior.
+ *
+ * Returns:
+ *    None.
+ *
+ * Side effects:
+ *    The shared memory object is unlinked.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+memtrace_stopped (PkaSource *source) /* IN */
+{
+	ENTRY;
+	/*
+	 * PkaSourceSimple waits for a running sample callback and invokes no
+	 * more afterwards, so the ring is no longer read once this returns.
+	 */
+	PKA_SOURCE_CLASS(memtrace_parent_class)->stopped(source);
+	memtrace_ring_close(MEMTRACE_SOURCE(source)->priv);
+	EXIT;
+}
+
+static void
+memtrace_finalize (GObject *object)
+{
+	MemtracePrivate *priv = MEMTRACE_SOURCE(object)->priv;
+
+	memtrace_ring_close(priv);
+	if (priv->manifest) {
+		pka_manifest_unref(priv->manifest);
+	}
+	g_hash_table_unref(priv->live);
+	g_hash_table_unref(priv->sites);
+	g_hash_table_unref(priv->orphans);
+
+	G_OBJECT_CLASS(memtrace_parent_class)->finalize(object);
+}
+
+static void
+memtrace_class_init (MemtraceClass *klass)
+{
+	GObjectClass *object_class;
+	PkaSourceClass *source_class;
+
+	object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = memtrace_finalize;
+	g_type_class_add_private(object_class, sizeof(MemtracePrivate));
+
+	source_class = PKA_SOURCE_CLASS(klass);
+	source_class->modify_spawn_info = memtrace_modify_spawn_info;
+	source_class->stopped = memtrace_stopped;
+}
+
+static void
+memtrace_init (Memtrace *memtrace)
+{
+	MemtracePrivate *priv;
+	GTimeVal freq = { 0 };
+
+	memtrace->priv = G_TYPE_INSTANCE_GET_PRIVATE(memtrace,
+	                                             MEMTRACE_TYPE_SOURCE,
+	                                             MemtracePrivate);
+	priv = memtrace->priv;
+	priv->live = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	                                   NULL, memtrace_live_free);
+	priv->sites = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	                                    NULL, memtrace_site_free);
+	priv->orphans = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	                                      NULL, memtrace_orphan_free);
+	priv->n_sites = pka_config_get_integer("source.memtrace", "sites", 32);
+
+	pka_source_simple_set_sample_callback(PKA_SOURCE_SIMPLE(memtrace),
+	                                      memtrace_sample, NULL, NULL);
+	g_time_val_add(&freq, pka_config_get_integer("source.memtrace",
+	                                             "frequency", 1000) * 1000);
+	pka_source_simple_set_frequency(PKA_SOURCE_SIMPLE(memtrace), &freq);
+}
+
+GObject *
+memtrace_new (GError **error)
+{
+	return g_object_new(MEMTRACE_TYPE_SOURCE, NULL);
+}
+
+const PkaPluginInfo pka_plugin_info = {
+	.id          = "Memtrace",
+	.name        = "Allocation tracer",
+	.description = "Allocation rates, live memory by call site and "
+	               "allocation sizes of the process, traced by a "
+	               "preloaded library.",
+	.version     = "0.1.1",
+	.copyright   = "Christian Hergert",
+	.factory     = memtrace_new,
+	.plugin_type = PKA_PLUGIN_SOURCE,
+};
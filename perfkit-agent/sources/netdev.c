@@ -19,10 +19,16 @@
 #include <glib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include <perfkit-agent/perfkit-agent.h>
 #include "src-utils.h"
 
+#ifdef G_LOG_DOMAIN
+#undef G_LOG_DOMAIN
+#endif
+#define G_LOG_DOMAIN "NetDev"
+
 /*
 Entries looks like this...
 ------------------------------------------------------------------------------------------------------------------------------
@@ -33,84 +39,176 @@ Inter-|   Receive                                                |  Transmit
 ------------------------------------------------------------------------------------------------------------------------------
 */
 
+/*
+ * The NetDev source delivers every interface in a single packed sample per
+ * tick, with a row per counter named after the interface.  Interfaces are
+ * interned by name the first time they are seen and keep their rows for the
+ * life of the source, so the manifest is only rebuilt when a new interface
+ * shows up; interfaces that go away are skipped in later samples.
+ *
+ * The counters are 64-bit in the kernel and are delivered as such.  With
+ * "rates" set in the [source.netdev] group the per-second rate of each
+ * counter since the previous tick is delivered instead.
+ */
+
+#define NETDEV_N_COUNTERS (16)
 
 typedef struct
 {
-	PkaManifest *manifest;
+	gchar    *name;
+	guint64   counters[NETDEV_N_COUNTERS];
+	guint64   last[NETDEV_N_COUNTERS];
+	gboolean  has_last; /* last holds the counters of the previous tick */
+	guint     seen;     /* Generation the interface was last listed in */
+} NetDevIface;
+
+typedef struct
+{
+	PkaManifest  *manifest;
+	SrcUtilsProc *proc;       /* /proc/net/dev */
+	gboolean      rates;      /* Deliver rates rather than counters */
+	GArray       *ifaces;     /* NetDevIface in order of discovery */
+	GHashTable   *index;      /* Interface name to position in ifaces */
+	guint         n_rows;     /* Interfaces in the current manifest */
+	guint         generation;
+	gdouble       last_time;  /* Monotonic seconds of the previous tick */
 } NetDevData;
 
+static const gchar *counter_names[NETDEV_N_COUNTERS] = {
+	"rxBytes",
+	"rxPackets",
+	"rxErrors",
+	"rxDropped",
+	"rxFifo",
+	"rxFrame",
+	"rxCompressed",
+	"rxMulticast",
+	"txBytes",
+	"txPackets",
+	"txErrors",
+	"txDropped",
+	"txFifo",
+	"txCollisions",
+	"txCarrier",
+	"txCompressed",
+};
+
+/*
+ * Parse an unsigned integer following optional spaces.  Missing columns
+ * are read as 0 without moving past the end of the line.
+ */
+static inline const gchar*
+netdev_parse_uint64 (const gchar *p,
+                     guint64     *v)
+{
+	guint64 u = 0;
+
+	while (*p == ' ') {
+		p++;
+	}
+	while (*p >= '0' && *p <= '9') {
+		u = u * 10 + (*p - '0');
+		p++;
+	}
+	*v = u;
+	return p;
+}
+
+/*
+ * Find the interned interface named @name, adding it if needed.
+ */
+static NetDevIface*
+netdev_lookup (NetDevData  *ndd,
+               const gchar *name)
+{
+	NetDevIface iface = { 0 };
+	gpointer index;
+
+	if (g_hash_table_lookup_extended(ndd->index, name, NULL, &index)) {
+		return &g_array_index(ndd->ifaces, NetDevIface,
+		                      GPOINTER_TO_UINT(index));
+	}
+	iface.name = g_strdup(name);
+	g_hash_table_insert(ndd->index, iface.name,
+	                    GUINT_TO_POINTER(ndd->ifaces->len));
+	g_array_append_val(ndd->ifaces, iface);
+	return &g_array_index(ndd->ifaces, NetDevIface, ndd->ifaces->len - 1);
+}
 
 /*
- * Read /proc/net/dev and store to the list of data in
- * NetDevData.  Returns the number of devices read.
+ * Parse the contents of /proc/net/dev into the interned interfaces.  The
+ * header lines have no ':' and are skipped.
  */
-static gint
-netdev_read (PkaSourceSimple *source) /* IN */
+static void
+netdev_parse (NetDevData  *ndd,
+              const gchar *p)
+{
+	NetDevIface *iface;
+	const gchar *colon;
+	const gchar *name;
+	const gchar *eol;
+	gchar buf[64];
+	gsize len;
+	gint i;
+
+	ndd->generation++;
+	for (; p && *p; p = eol) {
+		if ((eol = strchr(p, '\n'))) {
+			eol++;
+		}
+		if (!(colon = strchr(p, ':')) || (eol && colon > eol)) {
+			continue;
+		}
+		for (name = p; *name == ' '; name++);
+		if (!(len = colon - name) || len >= sizeof(buf)) {
+			continue;
+		}
+		memcpy(buf, name, len);
+		buf[len] = '\0';
+		iface = netdev_lookup(ndd, buf);
+		if (iface->seen) {
+			memcpy(iface->last, iface->counters, sizeof(iface->last));
+			iface->has_last = (iface->seen == ndd->generation - 1);
+		}
+		iface->seen = ndd->generation;
+		p = colon + 1;
+		for (i = 0; i < NETDEV_N_COUNTERS; i++) {
+			p = netdev_parse_uint64(p, &iface->counters[i]);
+		}
+	}
+}
+
+/*
+ * Rebuild the manifest when interfaces were added.
+ */
+static void
+netdev_update_manifest (PkaSourceSimple *source,
+                        NetDevData      *ndd)
 {
-   gchar *content;
-   gint devicesRead = 0;
-   gchar filebuf[1024];
-   gint delim_index = -1;
-
-   ENTRY;
-   content = src_utils_read_file("/proc/net/dev", filebuf, 1024);
-
-   while (content != NULL) {
-      /*
-       * So this file can't be directly parsed using sscanf due to lack of
-       * separation of some of the fields.  Hence we have to separate it by
-       * using some string magic.
-       */
-
-      gchar *next_line = src_utils_str_tok('\n', content);
-      gchar iface_name[64];
-      gint val[16] = {-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1};
-      gint data_read = 0;
-
-      //g_printf("In the Loop\n");
-      if (delim_index < 0) {
-         /* Find the index points of each field by searching for the | char. */
-         src_utils_str_tok('|', content);
-         delim_index = strlen(content);
-      } else if (content[delim_index] == ':') {
-         gchar *ptr = content;
-         content[delim_index] = '\0';
-
-         // First scan in the device name
-         while(!g_ascii_isalnum(*ptr))
-            ptr++;
-         data_read += sscanf(ptr, "%s", iface_name);
-         //g_printf("1:Read %d entries. %s\n", data_read, content);
-
-         // Now scan in the first set of data removing trailing whitespace.
-         ptr = &content[delim_index + 1];
-         while(!g_ascii_isdigit(*ptr))
-            ptr++;
-         data_read += sscanf(ptr,
-                             "%d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d",
-                             &val[0], &val[1], &val[2], &val[3],
-                             &val[4], &val[5], &val[6], &val[7],
-                             &val[8], &val[9], &val[10], &val[11],
-                             &val[12], &val[13], &val[14], &val[15]);
-         //g_printf("2:Read %d entries. %d:%d\n", data_read, val[0], val[8]);
-         devicesRead++;
-
-         if (data_read == 17) {
-            gint i;
-            PkaSample *s = pka_sample_new();
-
-            pka_sample_append_string(s, 1, iface_name);
-            for (i = 0; i < 16; i++) {
-               pka_sample_append_int(s, i+2, val[i]);
-            }
-
-            pka_source_deliver_sample(PKA_SOURCE(source), s);
-            pka_sample_unref(s);
-         }
-      }
-      content = next_line;
-   }
-   RETURN(devicesRead);
+	NetDevIface *iface;
+	gchar *name;
+	guint i;
+	gint j;
+
+	if (G_LIKELY(ndd->manifest && ndd->n_rows == ndd->ifaces->len)) {
+		return;
+	}
+	if (ndd->manifest) {
+		pka_manifest_unref(ndd->manifest);
+	}
+	ndd->n_rows = ndd->ifaces->len;
+	ndd->manifest = pka_manifest_sized_new(ndd->n_rows * NETDEV_N_COUNTERS);
+	pka_manifest_set_packed(ndd->manifest, TRUE);
+	for (i = 0; i < ndd->ifaces->len; i++) {
+		iface = &g_array_index(ndd->ifaces, NetDevIface, i);
+		for (j = 0; j < NETDEV_N_COUNTERS; j++) {
+			name = g_strdup_printf("%s %s", iface->name, counter_names[j]);
+			pka_manifest_append(ndd->manifest, name,
+			                    ndd->rates ? G_TYPE_DOUBLE : G_TYPE_UINT64);
+			g_free(name);
+		}
+	}
+	pka_source_deliver_manifest(PKA_SOURCE(source), ndd->manifest);
 }
 
 /*
@@ -121,36 +219,56 @@ netdev_sample (PkaSourceSimple *source,    /* IN */
                gpointer         user_data) /* IN */
 {
 	NetDevData *ndd = user_data;
+	const gchar *contents;
+	NetDevIface *iface;
+	struct timespec ts;
+	PkaSample *s;
+	gdouble now;
+	gdouble elapsed;
+	gint row;
+	guint i;
+	gint j;
 
-	/*
-	 * Create and deliver our manifest if it has not yet been done.
-	 */
-	if (G_UNLIKELY(!ndd->manifest)) {
-		ndd->manifest = pka_manifest_sized_new(17);
-		pka_manifest_append(ndd->manifest, "InterfaceName", G_TYPE_STRING);
-		pka_manifest_append(ndd->manifest, "rxBytes", G_TYPE_UINT);
-		pka_manifest_append(ndd->manifest, "rxPackets", G_TYPE_UINT);
-		pka_manifest_append(ndd->manifest, "rxErrors", G_TYPE_UINT);
-		pka_manifest_append(ndd->manifest, "rxDropped", G_TYPE_UINT);
-		pka_manifest_append(ndd->manifest, "rxFifo", G_TYPE_UINT);
-		pka_manifest_append(ndd->manifest, "rxFrame", G_TYPE_UINT);
-		pka_manifest_append(ndd->manifest, "rxCompressed", G_TYPE_UINT);
-		pka_manifest_append(ndd->manifest, "rxMulticast", G_TYPE_UINT);
-		pka_manifest_append(ndd->manifest, "txBytes", G_TYPE_UINT);
-		pka_manifest_append(ndd->manifest, "txPackets", G_TYPE_UINT);
-		pka_manifest_append(ndd->manifest, "txErrors", G_TYPE_UINT);
-		pka_manifest_append(ndd->manifest, "txDropped", G_TYPE_UINT);
-		pka_manifest_append(ndd->manifest, "txFifo", G_TYPE_UINT);
-		pka_manifest_append(ndd->manifest, "txCollisions", G_TYPE_UINT);
-		pka_manifest_append(ndd->manifest, "txCarrier", G_TYPE_UINT);
-		pka_manifest_append(ndd->manifest, "txCompressed", G_TYPE_UINT);
-		pka_source_deliver_manifest(PKA_SOURCE(source), ndd->manifest);
+	ENTRY;
+	if (!(contents = src_utils_proc_read(ndd->proc, NULL))) {
+		EXIT;
+	}
+	netdev_parse(ndd, contents);
+	src_utils_proc_release(ndd->proc);
+	if (!ndd->ifaces->len) {
+		EXIT;
 	}
 
-	/*
-	 * Retrieve the sample.
-	 */
-	netdev_read(source);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec + ts.tv_nsec / 1000000000.0;
+	elapsed = now - ndd->last_time;
+	ndd->last_time = now;
+
+	netdev_update_manifest(source, ndd);
+	s = pka_sample_new_packed(ndd->manifest);
+	for (i = 0; i < ndd->ifaces->len; i++) {
+		iface = &g_array_index(ndd->ifaces, NetDevIface, i);
+		if (iface->seen != ndd->generation) {
+			continue;
+		}
+		row = i * NETDEV_N_COUNTERS + 1;
+		if (!ndd->rates) {
+			pka_sample_append_uint64_array(s, row, iface->counters,
+			                               NETDEV_N_COUNTERS);
+			continue;
+		}
+		for (j = 0; j < NETDEV_N_COUNTERS; j++, row++) {
+			if (iface->has_last && elapsed > 0) {
+				/* a counter that went backwards was reset */
+				pka_sample_append_double(s, row,
+					iface->counters[j] < iface->last[j] ? 0.0 :
+					(iface->counters[j] - iface->last[j]) / elapsed);
+			}
+		}
+	}
+	pka_source_deliver_sample(PKA_SOURCE(source), s);
+	pka_sample_unref(s);
+	EXIT;
 }
 
 
@@ -180,6 +298,10 @@ netdev_free (gpointer data)
 	if (ndd->manifest) {
 		pka_manifest_unref(ndd->manifest);
 	}
+	src_utils_proc_close(ndd->proc);
+	/* the names are owned by the hash table */
+	g_hash_table_unref(ndd->index);
+	g_array_unref(ndd->ifaces);
 	g_slice_free(NetDevData, ndd);
 	EXIT;
 }
@@ -196,6 +318,11 @@ netdev_new (GError **error) /* OUT */
 
 	ENTRY;
 	netdev = g_slice_new0(NetDevData);
+	netdev->proc = src_utils_proc_open("/proc/net/dev");
+	netdev->rates = pka_config_get_boolean("source.netdev", "rates", FALSE);
+	netdev->ifaces = g_array_new(FALSE, FALSE, sizeof(NetDevIface));
+	netdev->index = g_hash_table_new_full(g_str_hash, g_str_equal,
+	                                      g_free, NULL);
 	source = pka_source_simple_new_full(netdev_sample,
 	                                    netdev_spawn,
 	                                    netdev,
@@ -207,7 +334,7 @@ const PkaPluginInfo pka_plugin_info = {
 	.id          = "NetDev",
 	.name        = "Network usage",
 	.description = "This source provides network usage of a given network interface.",
-	.version     = "0.1.1",
+	.version     = "0.2.0",
 	.copyright   = "2010 Andrew Stiegmann",
 	.factory     = netdev_new,
 	.plugin_type = PKA_PLUGIN_SOURCE,
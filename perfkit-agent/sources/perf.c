@@ -0,0 +1,292 @@
+/* perf.c
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <perfkit-agent/perfkit-agent.h>
+
+#ifdef G_LOG_DOMAIN
+#undef G_LOG_DOMAIN
+#endif
+#define G_LOG_DOMAIN "Perf"
+
+/*
+ * The Perf source counts events of the channel's process with a
+ * perf_event_open() group, which is read with a single read() per tick.
+ * The group is led by the task-clock software event so that it can be
+ * opened everywhere; the other events are added when the host supports
+ * them, so inside a virtual machine without a PMU only the software events
+ * are delivered.  The manifest holds the events that could be opened.
+ *
+ * The group is opened when the channel is started.  PkaChannel spawns the
+ * inferior with g_spawn_async(), which has exec'd by the time its pid is
+ * known, so the events cannot be enabled on exec and count from start.
+ * Threads created later are counted when the kernel allows inherited
+ * groups, otherwise only the main thread is.
+ *
+ * The software events mostly happen in the kernel on behalf of the task,
+ * so time spent in the kernel is counted whenever allowed.  Only when
+ * perf_event_paranoid refuses that are the events restricted to user
+ * space.
+ */
+
+#define PERF_N_EVENTS (6)
+
+typedef struct
+{
+	const gchar *name;
+	guint32      type;
+	guint64      config;
+} PerfEvent;
+
+typedef struct
+{
+	PkaManifest *manifest;
+	gint         fds[PERF_N_EVENTS];
+	gint         events[PERF_N_EVENTS]; /* Index in perf_events of fds */
+	gint         n_fds;
+} Perf;
+
+static const PerfEvent perf_events[PERF_N_EVENTS] = {
+	{ "Task Clock",       PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+	{ "Context Switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+	{ "CPU Migrations",   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+	{ "Page Faults",      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+	{ "Cycles",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "Instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+};
+
+/*
+ * Open @event for @pid within the group led by @group_fd.
+ */
+static gint
+perf_open (const PerfEvent *event,
+           GPid             pid,
+           gint             group_fd,
+           gboolean         inherit,
+           gboolean         exclude_kernel)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = event->type;
+	attr.config = event->config;
+	attr.read_format = PERF_FORMAT_GROUP |
+	                   PERF_FORMAT_TOTAL_TIME_ENABLED |
+	                   PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.disabled = (group_fd == -1);
+	attr.inherit = inherit;
+	attr.exclude_kernel = exclude_kernel;
+	attr.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &attr, pid, -1, group_fd,
+	               PERF_FLAG_FD_CLOEXEC);
+}
+
+/*
+ * Close the counters of the group.
+ */
+static void
+perf_close (Perf *perf)
+{
+	gint i;
+
+	for (i = perf->n_fds - 1; i >= 0; i--) {
+		close(perf->fds[i]);
+	}
+	perf->n_fds = 0;
+}
+
+/*
+ * Open the group for @pid, skipping the events the host does not support.
+ */
+static gboolean
+perf_open_group (Perf *perf,
+                 GPid  pid)
+{
+	gboolean exclude_kernel = FALSE;
+	gboolean inherit = TRUE;
+	gint fd;
+	gint i;
+
+	ENTRY;
+	perf_close(perf);
+	/* the events available may differ from the previous group */
+	if (perf->manifest) {
+		pka_manifest_unref(perf->manifest);
+		perf->manifest = NULL;
+	}
+	while ((fd = perf_open(&perf_events[0], pid, -1, inherit,
+	                       exclude_kernel)) < 0) {
+		if (errno == EINVAL && inherit) {
+			/* older kernels refuse to read inherited groups */
+			inherit = FALSE;
+		} else if ((errno == EACCES || errno == EPERM) && !exclude_kernel) {
+			INFO(Perf, "Counting user space only: %s", g_strerror(errno));
+			exclude_kernel = TRUE;
+		} else {
+			break;
+		}
+	}
+	if (fd < 0) {
+		WARNING(Perf, "Failed to open counters for %d: %s",
+		        (gint)pid, g_strerror(errno));
+		RETURN(FALSE);
+	}
+	perf->fds[0] = fd;
+	perf->events[0] = 0;
+	perf->n_fds = 1;
+	for (i = 1; i < PERF_N_EVENTS; i++) {
+		if ((fd = perf_open(&perf_events[i], pid, perf->fds[0],
+		                    inherit, exclude_kernel)) < 0) {
+			INFO(Perf, "%s are not available: %s",
+			     perf_events[i].name, g_strerror(errno));
+			continue;
+		}
+		perf->fds[perf->n_fds] = fd;
+		perf->events[perf->n_fds] = i;
+		perf->n_fds++;
+	}
+	ioctl(perf->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	RETURN(TRUE);
+}
+
+/*
+ * Handle a sample callback from the PkaSourceSimple.
+ */
+static void
+perf_sample (PkaSourceSimple *source,
+             gpointer         user_data)
+{
+	Perf *perf = user_data;
+	guint64 buf[3 + PERF_N_EVENTS];
+	PkaSample *s;
+	guint64 enabled;
+	guint64 running;
+	guint64 value;
+	gssize len;
+	gint i;
+
+	ENTRY;
+	if (!perf->n_fds) {
+		EXIT;
+	}
+	if (G_UNLIKELY(!perf->manifest)) {
+		TRACE(Perf, "Initializing manifest");
+		perf->manifest = pka_manifest_sized_new(perf->n_fds);
+		for (i = 0; i < perf->n_fds; i++) {
+			pka_manifest_append(perf->manifest,
+			                    perf_events[perf->events[i]].name,
+			                    G_TYPE_UINT64);
+		}
+		pka_source_deliver_manifest(PKA_SOURCE(source), perf->manifest);
+	}
+
+	/*
+	 * The group is read as { nr, time_enabled, time_running, values[nr] }.
+	 */
+	len = read(perf->fds[0], buf, sizeof(buf));
+	if (len < (gssize)((3 + perf->n_fds) * sizeof(guint64))) {
+		if (len < 0 && errno != ESRCH) {
+			WARNING(Perf, "Failed to read counters: %s",
+			        g_strerror(errno));
+		}
+		EXIT;
+	}
+	enabled = buf[1];
+	running = buf[2];
+
+	s = pka_sample_new();
+	for (i = 0; i < perf->n_fds; i++) {
+		value = buf[3 + i];
+		/* scale counts while the PMU was multiplexed */
+		if (running && running < enabled) {
+			value = (gdouble)value * enabled / running;
+		}
+		pka_sample_append_uint64(s, i + 1, value);
+	}
+	pka_source_deliver_sample(PKA_SOURCE(source), s);
+	pka_sample_unref(s);
+	EXIT;
+}
+
+/*
+ * Handle a spawn event from the PkaSourceSimple.
+ */
+static void
+perf_spawn (PkaSourceSimple *source,
+            PkaSpawnInfo    *spawn_info,
+            gpointer         user_data)
+{
+	Perf *perf = user_data;
+
+	ENTRY;
+	if (spawn_info->pid) {
+		perf_open_group(perf, spawn_info->pid);
+	}
+	EXIT;
+}
+
+/*
+ * Free the perf state when source is destroyed.
+ */
+static void
+perf_free (gpointer data)
+{
+	Perf *perf = data;
+
+	g_return_if_fail(perf != NULL);
+
+	ENTRY;
+	perf_close(perf);
+	if (perf->manifest) {
+		pka_manifest_unref(perf->manifest);
+	}
+	g_slice_free(Perf, data);
+	EXIT;
+}
+
+/*
+ * Create a new PkaSourceSimple for counting perf events.
+ */
+GObject*
+perf_new (GError **error)
+{
+	Perf *perf;
+
+	ENTRY;
+	perf = g_slice_new0(Perf);
+	RETURN(G_OBJECT(pka_source_simple_new_full(perf_sample,
+	                                           perf_spawn,
+	                                           perf,
+	                                           perf_free)));
+}
+
+const PkaPluginInfo pka_plugin_info = {
+	.id          = "Perf",
+	.name        = "Performance counters",
+	.description = "Software and hardware event counts of the process.",
+	.version     = "0.1.1",
+	.copyright   = "Copyright 2010 Christian Hergert",
+	.factory     = perf_new,
+	.plugin_type = PKA_PLUGIN_SOURCE,
+};
@@ -0,0 +1,358 @@
+/* probe.c
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <perfkit-agent/perfkit-agent.h>
+
+#include "pkp-region.h"
+
+#ifdef G_LOG_DOMAIN
+#undef G_LOG_DOMAIN
+#endif
+#define G_LOG_DOMAIN "Probe"
+
+/*
+ * The Probe source delivers the metrics a process publishes with
+ * libperfkit-probe.  The library keeps them in a shared memory region
+ * named after the pid, which is mapped read-only once the process has
+ * created it.  Every tick the marks recorded since the previous tick are
+ * delivered, each at the time it happened, followed by a single sample
+ * holding the counters, gauges and histogram buckets.
+ *
+ * Metrics may be registered at any time, so the manifest is rebuilt
+ * whenever the region publishes more of them.
+ */
+
+typedef struct
+{
+	PkaManifest *manifest;
+	GPid         pid;
+	PkpRegion   *region;
+	guint        n_metrics;   /* Metrics described by the manifest */
+	guint       *rows;        /* First manifest row of each metric */
+	guint64      mark_tail;   /* Next mark to read */
+	guint64      lost;        /* Marks overwritten before being read */
+} Probe;
+
+/*
+ * Unmap the region of the process.
+ */
+static void
+probe_close (Probe *probe)
+{
+	if (probe->region) {
+		munmap(probe->region, sizeof(PkpRegion));
+		probe->region = NULL;
+	}
+	if (probe->manifest) {
+		pka_manifest_unref(probe->manifest);
+		probe->manifest = NULL;
+	}
+	g_free(probe->rows);
+	probe->rows = NULL;
+	probe->n_metrics = 0;
+	probe->mark_tail = 0;
+}
+
+/*
+ * Map the region of the process if it has been created.
+ */
+static gboolean
+probe_open (Probe *probe)
+{
+	struct stat st;
+	gchar name[32];
+	gpointer map;
+	gint fd;
+
+	g_snprintf(name, sizeof(name), PKP_REGION_NAME, (gint)probe->pid);
+	if ((fd = shm_open(name, O_RDONLY, 0)) < 0) {
+		return FALSE;
+	}
+	if (fstat(fd, &st) < 0 || (gsize)st.st_size < sizeof(PkpRegion)) {
+		close(fd);
+		return FALSE;
+	}
+	map = mmap(NULL, sizeof(PkpRegion), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return FALSE;
+	}
+	if (((PkpRegion *)map)->magic != PKP_REGION_MAGIC) {
+		/* still being initialized */
+		munmap(map, sizeof(PkpRegion));
+		return FALSE;
+	}
+	__sync_synchronize();
+	if (((PkpRegion *)map)->version != PKP_REGION_VERSION) {
+		g_warning("Probe region %s has unsupported version %u.",
+		          name, ((PkpRegion *)map)->version);
+		munmap(map, sizeof(PkpRegion));
+		return FALSE;
+	}
+	probe->region = map;
+	probe->mark_tail = probe->region->mark_head;
+	return TRUE;
+}
+
+/*
+ * Rebuild the manifest for the first n_metrics metrics of the region.
+ */
+static void
+probe_rebuild (Probe     *probe,
+               PkaSource *source,
+               guint      n_metrics)
+{
+	PkpRegionMetric *desc;
+	gchar name[PKP_REGION_NAME_MAX + 32];
+	guint row = 1;
+	guint i;
+	guint j;
+
+	if (probe->manifest) {
+		pka_manifest_unref(probe->manifest);
+	}
+	probe->rows = g_renew(guint, probe->rows, n_metrics);
+	probe->manifest = pka_manifest_new();
+	pka_manifest_set_packed(probe->manifest, TRUE);
+	for (i = 0; i < n_metrics; i++) {
+		desc = &probe->region->metrics[i];
+		g_snprintf(name, sizeof(name), "%.*s",
+		           PKP_REGION_NAME_MAX - 1, desc->name);
+		probe->rows[i] = row;
+		switch (desc->type) {
+		case PKP_REGION_COUNTER:
+			pka_manifest_append(probe->manifest, name, G_TYPE_UINT64);
+			row++;
+			break;
+		case PKP_REGION_GAUGE:
+			pka_manifest_append(probe->manifest, name, G_TYPE_INT64);
+			row++;
+			break;
+		case PKP_REGION_HISTOGRAM:
+			for (j = 0; j < PKP_REGION_N_BUCKETS; j++) {
+				g_snprintf(name, sizeof(name), "%.*s <%" G_GUINT64_FORMAT,
+				           PKP_REGION_NAME_MAX - 1, desc->name,
+				           G_GUINT64_CONSTANT(1) << j);
+				pka_manifest_append(probe->manifest, name, G_TYPE_UINT64);
+				row++;
+			}
+			break;
+		case PKP_REGION_MARK:
+			pka_manifest_append(probe->manifest, name, G_TYPE_BOOLEAN);
+			row++;
+			break;
+		default:
+			g_warning("Unknown metric type %u.", desc->type);
+			break;
+		}
+	}
+	probe->n_metrics = n_metrics;
+	pka_source_deliver_manifest(source, probe->manifest);
+}
+
+/*
+ * Sum a cell over the slots of all threads.
+ */
+static guint64
+probe_sum (PkpRegion *region,
+           guint      cell)
+{
+	guint64 total = 0;
+	gint i;
+
+	for (i = 0; i < PKP_REGION_N_SLOTS; i++) {
+		total += region->slots[i].cells[cell];
+	}
+	return total;
+}
+
+/*
+ * Deliver the marks recorded since the previous tick.  Marks not yet
+ * complete are left for the next tick.
+ */
+static void
+probe_marks (Probe     *probe,
+             PkaSource *source)
+{
+	PkpRegion *region = probe->region;
+	PkpRegionMark *entry;
+	PkpRegionMark mark;
+	struct timespec ts;
+	PkaSample *s;
+	guint64 head;
+	guint64 seq;
+
+	head = region->mark_head;
+	if (head - probe->mark_tail > PKP_REGION_N_MARKS) {
+		probe->lost += head - probe->mark_tail - PKP_REGION_N_MARKS;
+		probe->mark_tail = head - PKP_REGION_N_MARKS;
+	}
+	for (; probe->mark_tail != head; probe->mark_tail++) {
+		entry = &region->marks[probe->mark_tail & (PKP_REGION_N_MARKS - 1)];
+		if ((seq = entry->seq) < probe->mark_tail + 1) {
+			break;
+		}
+		__sync_synchronize();
+		memcpy(&mark, entry, sizeof(mark));
+		__sync_synchronize();
+		if (seq != probe->mark_tail + 1 || entry->seq != seq) {
+			/* overwritten by a newer mark */
+			probe->lost++;
+			continue;
+		}
+		if (mark.metric >= probe->n_metrics) {
+			break;
+		}
+		ts.tv_sec = mark.tv_sec;
+		ts.tv_nsec = mark.tv_nsec;
+		s = pka_sample_new_packed(probe->manifest);
+		pka_sample_set_timespec(s, &ts);
+		pka_sample_append_boolean(s, probe->rows[mark.metric], TRUE);
+		pka_source_deliver_sample(source, s);
+		pka_sample_unref(s);
+	}
+}
+
+/*
+ * Handle a sample callback from the PkaSourceSimple.
+ */
+static void
+probe_sample (PkaSourceSimple *source,
+              gpointer         user_data)
+{
+	Probe *probe = user_data;
+	PkpRegionMetric *desc;
+	PkaSample *s;
+	guint n_metrics;
+	guint64 count;
+	guint i;
+	guint j;
+
+	ENTRY;
+	if (!probe->region && (!probe->pid || !probe_open(probe))) {
+		EXIT;
+	}
+
+	n_metrics = probe->region->n_metrics;
+	__sync_synchronize();
+	if (n_metrics != probe->n_metrics) {
+		probe_rebuild(probe, PKA_SOURCE(source), n_metrics);
+	}
+	if (!n_metrics) {
+		EXIT;
+	}
+
+	probe_marks(probe, PKA_SOURCE(source));
+	if (probe->lost) {
+		INFO(Probe, "Lost %" G_GUINT64_FORMAT " marks", probe->lost);
+		probe->lost = 0;
+	}
+
+	s = pka_sample_new_packed(probe->manifest);
+	for (i = 0; i < n_metrics; i++) {
+		desc = &probe->region->metrics[i];
+		switch (desc->type) {
+		case PKP_REGION_COUNTER:
+			pka_sample_append_uint64(s, probe->rows[i],
+			                         probe_sum(probe->region, desc->cell));
+			break;
+		case PKP_REGION_GAUGE:
+			pka_sample_append_int64(s, probe->rows[i],
+			                        probe->region->gauges[i]);
+			break;
+		case PKP_REGION_HISTOGRAM:
+			/* empty buckets are skipped */
+			for (j = 0; j < PKP_REGION_N_BUCKETS; j++) {
+				if ((count = probe_sum(probe->region, desc->cell + j))) {
+					pka_sample_append_uint64(s, probe->rows[i] + j, count);
+				}
+			}
+			break;
+		case PKP_REGION_MARK:
+		default:
+			break;
+		}
+	}
+	pka_source_deliver_sample(PKA_SOURCE(source), s);
+	pka_sample_unref(s);
+	EXIT;
+}
+
+/*
+ * Handle a spawn event from the PkaSourceSimple.
+ */
+static void
+probe_spawn (PkaSourceSimple *source,
+             PkaSpawnInfo    *spawn_info,
+             gpointer         user_data)
+{
+	Probe *probe = user_data;
+
+	ENTRY;
+	probe_close(probe);
+	probe->pid = spawn_info->pid;
+	EXIT;
+}
+
+/*
+ * Free the probe state when source is destroyed.
+ */
+static void
+probe_free (gpointer data)
+{
+	Probe *probe = data;
+
+	g_return_if_fail(probe != NULL);
+
+	ENTRY;
+	probe_close(probe);
+	g_slice_free(Probe, data);
+	EXIT;
+}
+
+/*
+ * Create a new PkaSourceSimple for the metrics published by the process.
+ */
+GObject*
+probe_new (GError **error)
+{
+	Probe *probe;
+
+	ENTRY;
+	probe = g_slice_new0(Probe);
+	RETURN(G_OBJECT(pka_source_simple_new_full(probe_sample,
+	                                           probe_spawn,
+	                                           probe,
+	                                           probe_free)));
+}
+
+const PkaPluginInfo pka_plugin_info = {
+	.id          = "Probe",
+	.name        = "Application probes",
+	.description = "Counters, gauges, histograms and marks published by "
+	               "the process with libperfkit-probe.",
+	.version     = "0.1.1",
+	.copyright   = "Copyright 2010 Christian Hergert",
+	.factory     = probe_new,
+	.plugin_type = PKA_PLUGIN_SOURCE,
+};
@@ -0,0 +1,491 @@
+/* proctree.c
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <perfkit-agent/perfkit-agent.h>
+
+#include "src-utils.h"
+
+#ifdef G_LOG_DOMAIN
+#undef G_LOG_DOMAIN
+#endif
+#define G_LOG_DOMAIN "ProcTree"
+
+/*
+ * The ProcTree source follows every thread of the channel's process and
+ * of its descendants.  A sample is delivered for each thread every tick
+ * with its CPU time, resident size in bytes, faults and context switches
+ * read from /proc/<pid>/task/<tid>/stat and status, which stay open
+ * between ticks.
+ *
+ * Discovering tasks means listing the task directories of every process,
+ * so it is only done when the tree itself shows a change: a process
+ * reports a different number of threads in its stat than the tasks known
+ * for it, or the children file of a known task changed since the previous
+ * tick.  Tasks that exit are dropped when their files can no longer be
+ * read.
+ */
+
+typedef struct
+{
+	GPid  pid;
+	DIR     *task_dir;  /* /proc/<pid>/task */
+	guint    seen;      /* Scan the process was last found in */
+	guint64  n_threads; /* Threads reported by the process this tick */
+	guint64  n_tasks;   /* Tasks of the process read this tick */
+} ProcTreeProcess;
+
+typedef struct
+{
+	ProcTreeProcess *process;
+	gint             tid;
+	SrcUtilsProc    *stat;
+	SrcUtilsProc    *status;
+	SrcUtilsProc    *children;
+	guint            children_hash; /* Contents of the children file */
+	guint            seen;          /* Scan the task was last found in */
+} ProcTreeTask;
+
+typedef struct
+{
+	PkaManifest  *manifest;
+	GPid          pid;
+	guint64       page_size;
+	gboolean      stale;      /* The tree changed since the last scan */
+	GHashTable   *processes;  /* pid to ProcTreeProcess */
+	GHashTable   *tasks;      /* tid to ProcTreeTask */
+	GArray       *queue;      /* Processes left to scan */
+	guint         scan;
+} ProcTree;
+
+/*
+ * Skip @n space separated fields.
+ */
+static inline const gchar*
+proctree_skip (const gchar *p,
+               gint         n)
+{
+	for (; n > 0 && *p; n--) {
+		while (*p && *p != ' ') {
+			p++;
+		}
+		while (*p == ' ') {
+			p++;
+		}
+	}
+	return p;
+}
+
+/*
+ * Parse an unsigned integer following optional white space.
+ */
+static inline const gchar*
+proctree_parse_uint64 (const gchar *p,
+                       guint64     *v)
+{
+	guint64 u = 0;
+
+	while (*p == ' ' || *p == '\t') {
+		p++;
+	}
+	while (*p >= '0' && *p <= '9') {
+		u = u * 10 + (*p - '0');
+		p++;
+	}
+	*v = u;
+	return p;
+}
+
+/*
+ * Find the value following @key in the contents of a status file.
+ */
+static inline guint64
+proctree_parse_status (const gchar *contents,
+                       const gchar *key)
+{
+	const gchar *p;
+	guint64 v = 0;
+
+	if ((p = strstr(contents, key))) {
+		proctree_parse_uint64(p + strlen(key), &v);
+	}
+	return v;
+}
+
+static void
+proctree_process_free (gpointer data)
+{
+	ProcTreeProcess *process = data;
+
+	if (process->task_dir) {
+		closedir(process->task_dir);
+	}
+	g_slice_free(ProcTreeProcess, process);
+}
+
+static void
+proctree_task_free (gpointer data)
+{
+	ProcTreeTask *task = data;
+
+	src_utils_proc_close(task->stat);
+	src_utils_proc_close(task->status);
+	src_utils_proc_close(task->children);
+	g_slice_free(ProcTreeTask, task);
+}
+
+/*
+ * Queue the children listed in the children file of @task.
+ */
+static void
+proctree_queue_children (ProcTree     *tree,
+                         ProcTreeTask *task)
+{
+	const gchar *contents;
+	const gchar *p;
+	guint64 pid;
+
+	if (!(contents = src_utils_proc_read(task->children, NULL))) {
+		return;
+	}
+	task->children_hash = g_str_hash(contents);
+	for (p = contents; *p;) {
+		p = proctree_parse_uint64(p, &pid);
+		if (!pid) {
+			break;
+		}
+		g_array_append_val(tree->queue, pid);
+	}
+	src_utils_proc_release(task->children);
+}
+
+/*
+ * Check if the children of @task changed since it was scanned.
+ */
+static gboolean
+proctree_children_changed (ProcTreeTask *task)
+{
+	const gchar *contents;
+	gboolean ret;
+
+	if (!(contents = src_utils_proc_read(task->children, NULL))) {
+		return FALSE;
+	}
+	ret = g_str_hash(contents) != task->children_hash;
+	src_utils_proc_release(task->children);
+	return ret;
+}
+
+/*
+ * List the threads of @pid and queue its children.
+ */
+static void
+proctree_scan_process (ProcTree *tree,
+                       GPid      pid)
+{
+	ProcTreeProcess *process;
+	ProcTreeTask *task;
+	struct dirent *ent;
+	gchar path[64];
+	gint tid;
+
+	if (!(process = g_hash_table_lookup(tree->processes,
+	                                    GINT_TO_POINTER(pid)))) {
+		process = g_slice_new0(ProcTreeProcess);
+		process->pid = pid;
+		g_hash_table_insert(tree->processes, GINT_TO_POINTER(pid), process);
+	}
+	if (process->seen == tree->scan) {
+		return;
+	}
+	process->seen = tree->scan;
+	if (!process->task_dir) {
+		g_snprintf(path, sizeof(path), "/proc/%d/task", (gint)pid);
+		if (!(process->task_dir = opendir(path))) {
+			return;
+		}
+	} else {
+		rewinddir(process->task_dir);
+	}
+	while ((ent = readdir(process->task_dir))) {
+		if (!g_ascii_isdigit(ent->d_name[0])) {
+			continue;
+		}
+		tid = atoi(ent->d_name);
+		if (!(task = g_hash_table_lookup(tree->tasks,
+		                                 GINT_TO_POINTER(tid)))) {
+			task = g_slice_new0(ProcTreeTask);
+			task->process = process;
+			task->tid = tid;
+			g_snprintf(path, sizeof(path), "task/%d/stat", tid);
+			task->stat = src_utils_proc_open_pid(pid, path);
+			g_snprintf(path, sizeof(path), "task/%d/status", tid);
+			task->status = src_utils_proc_open_pid(pid, path);
+			g_snprintf(path, sizeof(path), "task/%d/children", tid);
+			task->children = src_utils_proc_open_pid(pid, path);
+			g_hash_table_insert(tree->tasks, GINT_TO_POINTER(tid), task);
+		}
+		task->seen = tree->scan;
+		proctree_queue_children(tree, task);
+	}
+}
+
+static gboolean
+proctree_process_gone (gpointer key,
+                       gpointer value,
+                       gpointer user_data)
+{
+	return ((ProcTreeProcess *)value)->seen != ((ProcTree *)user_data)->scan;
+}
+
+static gboolean
+proctree_task_gone (gpointer key,
+                    gpointer value,
+                    gpointer user_data)
+{
+	return ((ProcTreeTask *)value)->seen != ((ProcTree *)user_data)->scan;
+}
+
+/*
+ * Walk the tree from the channel's process, adding new tasks and dropping
+ * the ones that were not found.
+ */
+static void
+proctree_scan (ProcTree *tree)
+{
+	guint i;
+
+	ENTRY;
+	tree->scan++;
+	tree->stale = FALSE;
+	g_array_set_size(tree->queue, 0);
+	proctree_scan_process(tree, tree->pid);
+	for (i = 0; i < tree->queue->len; i++) {
+		proctree_scan_process(tree, g_array_index(tree->queue, guint64, i));
+	}
+	g_hash_table_foreach_remove(tree->processes, proctree_process_gone, tree);
+	g_hash_table_foreach_remove(tree->tasks, proctree_task_gone, tree);
+	EXIT;
+}
+
+/*
+ * Read the counters of @task into @s.  Returns %FALSE if the task exited.
+ */
+static gboolean
+proctree_read_task (ProcTree     *tree,
+                    ProcTreeTask *task,
+                    PkaSample    *s)
+{
+	const gchar *contents;
+	const gchar *p;
+	guint64 minflt;
+	guint64 majflt;
+	guint64 utime;
+	guint64 stime;
+	guint64 n_threads;
+	guint64 rss;
+
+	if (!(contents = src_utils_proc_read(task->stat, NULL))) {
+		return FALSE;
+	}
+	/* the command may hold spaces and parentheses */
+	if (!(p = strrchr(contents, ')'))) {
+		src_utils_proc_release(task->stat);
+		return FALSE;
+	}
+	p = proctree_skip(p + 2, 7);
+	p = proctree_parse_uint64(p, &minflt);
+	p = proctree_parse_uint64(proctree_skip(p + 1, 1), &majflt);
+	p = proctree_parse_uint64(proctree_skip(p + 1, 1), &utime);
+	p = proctree_parse_uint64(p, &stime);
+	p = proctree_parse_uint64(proctree_skip(p + 1, 4), &n_threads);
+	proctree_parse_uint64(proctree_skip(p + 1, 3), &rss);
+	src_utils_proc_release(task->stat);
+
+	task->process->n_threads = n_threads;
+	task->process->n_tasks++;
+
+	pka_sample_append_int(s, 1, task->process->pid);
+	pka_sample_append_int(s, 2, task->tid);
+	pka_sample_append_uint64(s, 3, utime);
+	pka_sample_append_uint64(s, 4, stime);
+	pka_sample_append_uint64(s, 5, rss * tree->page_size);
+	pka_sample_append_uint64(s, 6, minflt);
+	pka_sample_append_uint64(s, 7, majflt);
+
+	if ((contents = src_utils_proc_read(task->status, NULL))) {
+		pka_sample_append_uint64(s, 8,
+			proctree_parse_status(contents, "\nvoluntary_ctxt_switches:"));
+		pka_sample_append_uint64(s, 9,
+			proctree_parse_status(contents, "\nnonvoluntary_ctxt_switches:"));
+		src_utils_proc_release(task->status);
+	}
+	return TRUE;
+}
+
+/*
+ * Handle a sample callback from the PkaSourceSimple.
+ */
+static void
+proctree_sample (PkaSourceSimple *source,
+                 gpointer         user_data)
+{
+	ProcTree *tree = user_data;
+	ProcTreeProcess *process;
+	GHashTableIter iter;
+	ProcTreeTask *task;
+	PkaSample *s;
+
+	ENTRY;
+	if (!tree->pid) {
+		EXIT;
+	}
+	if (G_UNLIKELY(!tree->manifest)) {
+		TRACE(ProcTree, "Initializing manifest");
+		tree->manifest = pka_manifest_sized_new(9);
+		pka_manifest_set_packed(tree->manifest, TRUE);
+		pka_manifest_append(tree->manifest, "Pid", G_TYPE_INT);
+		pka_manifest_append(tree->manifest, "Thread", G_TYPE_INT);
+		pka_manifest_append(tree->manifest, "User Time", G_TYPE_UINT64);
+		pka_manifest_append(tree->manifest, "System Time", G_TYPE_UINT64);
+		pka_manifest_append(tree->manifest, "RSS Bytes", G_TYPE_UINT64);
+		pka_manifest_append(tree->manifest, "Minor Faults", G_TYPE_UINT64);
+		pka_manifest_append(tree->manifest, "Major Faults", G_TYPE_UINT64);
+		pka_manifest_append(tree->manifest, "Voluntary Switches",
+		                    G_TYPE_UINT64);
+		pka_manifest_append(tree->manifest, "Involuntary Switches",
+		                    G_TYPE_UINT64);
+		pka_source_deliver_manifest(PKA_SOURCE(source), tree->manifest);
+	}
+
+	/*
+	 * Only walk the tree if the previous tick saw it change, or if the
+	 * process could not be found yet.
+	 */
+	if (tree->stale || !g_hash_table_size(tree->tasks)) {
+		proctree_scan(tree);
+	}
+
+	g_hash_table_iter_init(&iter, tree->processes);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&process)) {
+		process->n_threads = 0;
+		process->n_tasks = 0;
+	}
+	g_hash_table_iter_init(&iter, tree->tasks);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&task)) {
+		s = pka_sample_new_packed(tree->manifest);
+		if (proctree_read_task(tree, task, s)) {
+			pka_source_deliver_sample(PKA_SOURCE(source), s);
+			if (!tree->stale && proctree_children_changed(task)) {
+				tree->stale = TRUE;
+			}
+		} else {
+			g_hash_table_iter_remove(&iter);
+		}
+		pka_sample_unref(s);
+	}
+
+	/*
+	 * Threads created or exited within a known process show in the count
+	 * every thread reports in its stat.
+	 */
+	g_hash_table_iter_init(&iter, tree->processes);
+	while (!tree->stale &&
+	       g_hash_table_iter_next(&iter, NULL, (gpointer *)&process)) {
+		if (process->n_threads != process->n_tasks) {
+			tree->stale = TRUE;
+		}
+	}
+	EXIT;
+}
+
+/*
+ * Handle a spawn event from the PkaSourceSimple.
+ */
+static void
+proctree_spawn (PkaSourceSimple *source,
+                PkaSpawnInfo    *spawn_info,
+                gpointer         user_data)
+{
+	ProcTree *tree = user_data;
+
+	ENTRY;
+	g_hash_table_remove_all(tree->tasks);
+	g_hash_table_remove_all(tree->processes);
+	tree->pid = spawn_info->pid;
+	tree->stale = TRUE;
+	EXIT;
+}
+
+/*
+ * Free the tree state when source is destroyed.
+ */
+static void
+proctree_free (gpointer data)
+{
+	ProcTree *tree = data;
+
+	g_return_if_fail(tree != NULL);
+
+	ENTRY;
+	if (tree->manifest) {
+		pka_manifest_unref(tree->manifest);
+	}
+	g_hash_table_unref(tree->tasks);
+	g_hash_table_unref(tree->processes);
+	g_array_unref(tree->queue);
+	g_slice_free(ProcTree, data);
+	EXIT;
+}
+
+/*
+ * Create a new PkaSourceSimple for sampling the process tree.
+ */
+GObject*
+proctree_new (GError **error)
+{
+	ProcTree *tree;
+
+	ENTRY;
+	tree = g_slice_new0(ProcTree);
+	tree->page_size = sysconf(_SC_PAGESIZE);
+	tree->stale = TRUE;
+	tree->processes = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	                                        NULL, proctree_process_free);
+	tree->tasks = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	                                    NULL, proctree_task_free);
+	tree->queue = g_array_new(FALSE, FALSE, sizeof(guint64));
+	RETURN(G_OBJECT(pka_source_simple_new_full(proctree_sample,
+	                                           proctree_spawn,
+	                                           tree,
+	                                           proctree_free)));
+}
+
+const PkaPluginInfo pka_plugin_info = {
+	.id          = "ProcTree",
+	.name        = "Process tree",
+	.description = "CPU time, memory, faults and context switches of every "
+	               "thread of the process and its children.",
+	.version     = "0.1.1",
+	.copyright   = "Copyright 2010 Christian Hergert",
+	.factory     = proctree_new,
+	.plugin_type = PKA_PLUGIN_SOURCE,
+};
@@ -0,0 +1,577 @@
+/* profile.c
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <perfkit-agent/perfkit-agent.h>
+
+#ifdef G_LOG_DOMAIN
+#undef G_LOG_DOMAIN
+#endif
+#define G_LOG_DOMAIN "Profile"
+
+/*
+ * The Profile source samples the call stacks of the channel's process with
+ * a cpu-clock perf event, which works without a PMU.  The kernel refuses
+ * to map an inherited event that follows a task on any CPU, so an event is
+ * opened per CPU, which also follows the threads created later.  The
+ * kernel writes the samples to a ring buffer per CPU mapped into the
+ * agent, which a reader thread drains as they fill.  CPUs brought online
+ * after the channel started are not sampled.  Each call chain is counted
+ * in a hash table keyed by the chain within the ring buffer itself, so a
+ * chain is only copied the first time it is seen.
+ *
+ * The reader thread runs from the start of the channel until the source
+ * is stopped or the process exits.  The events and the reader of a spawn
+ * are kept together, so that they are swapped under the mutex as a whole
+ * and torn down after being unpublished, outside of the mutex the reader
+ * takes to count.
+ *
+ * Every tick the counts since the previous tick are delivered, a sample per
+ * distinct stack holding its folded return addresses, outermost first, and
+ * the number of times it was hit.  Addresses are not resolved here; the
+ * client symbolizes the stacks it actually displays.
+ */
+
+#define PROFILE_MAX_DEPTH (127)
+
+/*
+ * The layout of a callchain within a PERF_RECORD_SAMPLE, used as the key
+ * of the stack counts.
+ */
+typedef struct
+{
+	guint64 nr;
+	guint64 ips[1];
+} ProfileStack;
+
+#define PROFILE_TYPE_SOURCE            (profile_get_type())
+#define PROFILE_SOURCE(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), PROFILE_TYPE_SOURCE, Profile))
+#define PROFILE_SOURCE_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), PROFILE_TYPE_SOURCE, Profile const))
+#define PROFILE_SOURCE_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  PROFILE_TYPE_SOURCE, ProfileClass))
+#define PROFILE_IS_SOURCE(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), PROFILE_TYPE_SOURCE))
+#define PROFILE_IS_SOURCE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  PROFILE_TYPE_SOURCE))
+#define PROFILE_SOURCE_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  PROFILE_TYPE_SOURCE, ProfileClass))
+
+typedef struct _Profile        Profile;
+typedef struct _ProfileClass   ProfileClass;
+typedef struct _ProfilePrivate ProfilePrivate;
+typedef struct _ProfileEvents  ProfileEvents;
+
+struct _Profile
+{
+	PkaSourceSimple parent;
+
+	/*< private >*/
+	ProfilePrivate *priv;
+};
+
+struct _ProfileClass
+{
+	PkaSourceSimpleClass parent_class;
+};
+
+G_DEFINE_TYPE(Profile, profile, PKA_TYPE_SOURCE_SIMPLE)
+
+struct _ProfilePrivate
+{
+	PkaManifest   *manifest;
+	gint           frequency;  /* Samples per second */
+	gint           n_pages;    /* Data pages of each ring buffer */
+	GMutex        *mutex;
+	ProfileEvents *events;     /* Events of the current spawn, or NULL */
+	GHashTable    *counts;     /* ProfileStack to hit count */
+	guint64        lost;
+};
+
+/*
+ * The sampling events of a spawn and the thread reading them.
+ */
+struct _ProfileEvents
+{
+	ProfilePrivate  *priv;
+	gint             n_cpus;     /* CPUs the event could be opened on */
+	gint            *fds;        /* Sampling event of each CPU */
+	guint8         **rings;      /* Metadata page then data pages, per CPU */
+	gsize            ring_size;
+	GThread         *thread;
+	gint             stop;
+};
+
+static guint
+profile_stack_hash (gconstpointer key)
+{
+	const ProfileStack *stack = key;
+	guint hash = stack->nr;
+	guint64 i;
+
+	for (i = 0; i < stack->nr; i++) {
+		hash = (hash * 31) ^ (guint)(stack->ips[i] ^ (stack->ips[i] >> 32));
+	}
+	return hash;
+}
+
+static gboolean
+profile_stack_equal (gconstpointer a,
+                     gconstpointer b)
+{
+	const ProfileStack *sa = a;
+	const ProfileStack *sb = b;
+
+	return sa->nr == sb->nr &&
+	       memcmp(sa->ips, sb->ips, sa->nr * sizeof(guint64)) == 0;
+}
+
+static GHashTable*
+profile_counts_new (void)
+{
+	return g_hash_table_new_full(profile_stack_hash, profile_stack_equal,
+	                             g_free, NULL);
+}
+
+/*
+ * Count a hit of @stack.  @stack may point into the ring buffer, it is
+ * copied only when it was not seen yet.
+ */
+static void
+profile_count (ProfilePrivate     *priv,
+               const ProfileStack *stack)
+{
+	gpointer key;
+	gpointer count;
+	gsize size;
+
+	if (g_hash_table_lookup_extended(priv->counts, stack, &key, &count)) {
+		g_hash_table_insert(priv->counts, key,
+		                    GUINT_TO_POINTER(GPOINTER_TO_UINT(count) + 1));
+		return;
+	}
+	size = (stack->nr + 1) * sizeof(guint64);
+	g_hash_table_insert(priv->counts, g_memdup(stack, size),
+	                    GUINT_TO_POINTER(1));
+}
+
+/*
+ * Consume the records written to @ring since the last call.
+ */
+static void
+profile_drain (ProfilePrivate *priv,
+               guint8         *ring,
+               gsize           ring_size)
+{
+	struct perf_event_mmap_page *meta;
+	struct perf_event_header *header;
+	guint64 buf[PROFILE_MAX_DEPTH + 8];
+	guint8 *data;
+	guint64 size;
+	guint64 head;
+	guint64 tail;
+	guint64 offset;
+	guint64 len;
+
+	meta = (struct perf_event_mmap_page *)ring;
+	data = ring + getpagesize();
+	size = ring_size - getpagesize();
+	head = meta->data_head;
+	__sync_synchronize();
+	tail = meta->data_tail;
+
+	g_mutex_lock(priv->mutex);
+	while (tail < head) {
+		offset = tail % size;
+		header = (struct perf_event_header *)(data + offset);
+		len = header->size;
+		if (!len) {
+			break;
+		}
+		/* only a record wrapping around the end is copied */
+		if (offset + len > size) {
+			if (len > sizeof(buf)) {
+				tail += len;
+				continue;
+			}
+			memcpy(buf, data + offset, size - offset);
+			memcpy((guint8 *)buf + (size - offset), data,
+			       len - (size - offset));
+			header = (struct perf_event_header *)buf;
+		}
+		switch (header->type) {
+		case PERF_RECORD_SAMPLE:
+			/* header, then pid and tid, then the callchain */
+			profile_count(priv,
+			              (ProfileStack *)((guint8 *)(header + 1) + 8));
+			break;
+		case PERF_RECORD_LOST:
+			priv->lost += ((guint64 *)(header + 1))[1];
+			break;
+		default:
+			break;
+		}
+		tail += len;
+	}
+	g_mutex_unlock(priv->mutex);
+
+	__sync_synchronize();
+	meta->data_tail = tail;
+}
+
+/*
+ * Drain the ring buffers each time the kernel wakes us up, until the
+ * process exits or the source is stopped.
+ */
+static gpointer
+profile_reader (gpointer data)
+{
+	ProfileEvents *events = data;
+	struct pollfd *pfds;
+	gint n_open = events->n_cpus;
+	gint i;
+
+	pfds = g_new0(struct pollfd, events->n_cpus);
+	for (i = 0; i < events->n_cpus; i++) {
+		pfds[i].fd = events->fds[i];
+		pfds[i].events = POLLIN;
+	}
+	while (n_open && !g_atomic_int_get(&events->stop)) {
+		if (poll(pfds, events->n_cpus, 100) < 0 && errno != EINTR) {
+			break;
+		}
+		for (i = 0; i < events->n_cpus; i++) {
+			profile_drain(events->priv, events->rings[i], events->ring_size);
+			/* the process exited, nothing more will be written */
+			if (pfds[i].fd >= 0 && (pfds[i].revents & POLLHUP)) {
+				pfds[i].fd = -1;
+				n_open--;
+			}
+		}
+	}
+	g_free(pfds);
+	return NULL;
+}
+
+/*
+ * Stop the reader thread of @events and release them.  @events must no
+ * longer be reachable from the profile.
+ */
+static void
+profile_events_free (ProfileEvents *events)
+{
+	gint i;
+
+	ENTRY;
+	if (events->thread) {
+		g_atomic_int_set(&events->stop, TRUE);
+		g_thread_join(events->thread);
+	}
+	for (i = 0; i < events->n_cpus; i++) {
+		munmap(events->rings[i], events->ring_size);
+		close(events->fds[i]);
+	}
+	g_free(events->rings);
+	g_free(events->fds);
+	g_slice_free(ProfileEvents, events);
+	EXIT;
+}
+
+/*
+ * Stop sampling the current spawn, if any.
+ */
+static void
+profile_close (ProfilePrivate *priv)
+{
+	ProfileEvents *events;
+
+	ENTRY;
+	g_mutex_lock(priv->mutex);
+	events = priv->events;
+	priv->events = NULL;
+	g_mutex_unlock(priv->mutex);
+	/* the reader takes the mutex to count, so it is joined without it */
+	if (events) {
+		profile_events_free(events);
+	}
+	EXIT;
+}
+
+/*
+ * Open the sampling event for @pid on every CPU and start the reader
+ * thread.  The events replace those of a previous spawn.
+ */
+static gboolean
+profile_open (ProfilePrivate *priv,
+              GPid            pid)
+{
+	struct perf_event_attr attr;
+	ProfileEvents *events;
+	GError *error = NULL;
+	guint8 *ring;
+	glong n_cpus;
+	gint cpu;
+	gint fd;
+
+	ENTRY;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_SOFTWARE;
+	attr.config = PERF_COUNT_SW_CPU_CLOCK;
+	attr.freq = 1;
+	attr.sample_freq = priv->frequency;
+	attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN;
+	attr.disabled = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.watermark = 1;
+	attr.wakeup_watermark = priv->n_pages * getpagesize() / 4;
+	n_cpus = MAX(1, sysconf(_SC_NPROCESSORS_CONF));
+	events = g_slice_new0(ProfileEvents);
+	events->priv = priv;
+	events->fds = g_new(gint, n_cpus);
+	events->rings = g_new(guint8*, n_cpus);
+	events->ring_size = (priv->n_pages + 1) * getpagesize();
+	for (cpu = 0; cpu < n_cpus; cpu++) {
+		fd = syscall(__NR_perf_event_open, &attr, pid, cpu, -1,
+		             PERF_FLAG_FD_CLOEXEC);
+		if (fd < 0) {
+			/* offline */
+			if (errno == ENODEV) {
+				continue;
+			}
+			WARNING(Profile, "Failed to open sampling event for %d: %s",
+			        (gint)pid, g_strerror(errno));
+			GOTO(failed);
+		}
+		ring = mmap(NULL, events->ring_size, PROT_READ | PROT_WRITE,
+		            MAP_SHARED, fd, 0);
+		if (ring == MAP_FAILED) {
+			WARNING(Profile, "Failed to map sampling buffer: %s",
+			        g_strerror(errno));
+			close(fd);
+			GOTO(failed);
+		}
+		events->fds[events->n_cpus] = fd;
+		events->rings[events->n_cpus] = ring;
+		events->n_cpus++;
+	}
+	if (!events->n_cpus) {
+		WARNING(Profile, "No CPU to sample %d on.", (gint)pid);
+		GOTO(failed);
+	}
+	if (!(events->thread = g_thread_create(profile_reader, events,
+	                                       TRUE, &error))) {
+		WARNING(Profile, "Failed to start reader: %s", error->message);
+		g_error_free(error);
+		GOTO(failed);
+	}
+	for (cpu = 0; cpu < events->n_cpus; cpu++) {
+		ioctl(events->fds[cpu], PERF_EVENT_IOC_ENABLE, 0);
+	}
+	profile_close(priv);
+	g_mutex_lock(priv->mutex);
+	priv->events = events;
+	g_mutex_unlock(priv->mutex);
+	RETURN(TRUE);
+
+  failed:
+	profile_events_free(events);
+	RETURN(FALSE);
+}
+
+/*
+ * Format @stack as folded addresses, outermost frame first.  The context
+ * markers the kernel inserts are skipped.
+ */
+static void
+profile_fold (const ProfileStack *stack,
+              GString            *str)
+{
+	gint64 i;
+
+	g_string_truncate(str, 0);
+	for (i = stack->nr - 1; i >= 0; i--) {
+		if (stack->ips[i] >= (guint64)PERF_CONTEXT_MAX) {
+			continue;
+		}
+		g_string_append_printf(str, "%s0x%" G_GINT64_MODIFIER "x",
+		                       str->len ? ";" : "", stack->ips[i]);
+	}
+}
+
+/*
+ * Handle a sample callback from the PkaSourceSimple.
+ */
+static void
+profile_sample (PkaSourceSimple *source,
+                gpointer         user_data)
+{
+	ProfilePrivate *priv = PROFILE_SOURCE(source)->priv;
+	GHashTable *counts;
+	GHashTableIter iter;
+	gpointer stack;
+	gpointer count;
+	PkaSample *s;
+	GString *str;
+	guint64 lost;
+
+	ENTRY;
+	if (G_UNLIKELY(!priv->manifest)) {
+		TRACE(Profile, "Initializing manifest");
+		priv->manifest = pka_manifest_sized_new(2);
+		pka_manifest_append(priv->manifest, "Stack", G_TYPE_STRING);
+		pka_manifest_append(priv->manifest, "Count", G_TYPE_UINT);
+		pka_source_deliver_manifest(PKA_SOURCE(source), priv->manifest);
+	}
+
+	/*
+	 * Swap the counts so the reader is only held up for the swap.
+	 */
+	g_mutex_lock(priv->mutex);
+	counts = priv->counts;
+	priv->counts = profile_counts_new();
+	lost = priv->lost;
+	priv->lost = 0;
+	g_mutex_unlock(priv->mutex);
+
+	if (lost) {
+		INFO(Profile, "Lost %" G_GUINT64_FORMAT " samples", lost);
+	}
+
+	str = g_string_sized_new(256);
+	g_hash_table_iter_init(&iter, counts);
+	while (g_hash_table_iter_next(&iter, &stack, &count)) {
+		profile_fold(stack, str);
+		s = pka_sample_new();
+		pka_sample_append_string(s, 1, str->str);
+		pka_sample_append_uint(s, 2, GPOINTER_TO_UINT(count));
+		pka_source_deliver_sample(PKA_SOURCE(source), s);
+		pka_sample_unref(s);
+	}
+	g_string_free(str, TRUE);
+	g_hash_table_unref(counts);
+	EXIT;
+}
+
+/*
+ * Handle a spawn event from the PkaSourceSimple.
+ */
+static void
+profile_spawn (PkaSourceSimple *source,
+               PkaSpawnInfo    *spawn_info,
+               gpointer         user_data)
+{
+	ProfilePrivate *priv = PROFILE_SOURCE(source)->priv;
+
+	ENTRY;
+	if (spawn_info->pid) {
+		profile_open(priv, spawn_info->pid);
+	} else {
+		profile_close(priv);
+	}
+	EXIT;
+}
+
+/*
+ * Stop sampling when the source is stopped.  The parent first makes sure
+ * no sample callback is running or will run.
+ */
+static void
+profile_stopped (PkaSource *source)
+{
+	ENTRY;
+	PKA_SOURCE_CLASS(profile_parent_class)->stopped(source);
+	profile_close(PROFILE_SOURCE(source)->priv);
+	EXIT;
+}
+
+static void
+profile_finalize (GObject *object)
+{
+	ProfilePrivate *priv = PROFILE_SOURCE(object)->priv;
+
+	profile_close(priv);
+	if (priv->manifest) {
+		pka_manifest_unref(priv->manifest);
+	}
+	g_hash_table_unref(priv->counts);
+	g_mutex_free(priv->mutex);
+
+	G_OBJECT_CLASS(profile_parent_class)->finalize(object);
+}
+
+static void
+profile_class_init (ProfileClass *klass)
+{
+	GObjectClass *object_class;
+	PkaSourceClass *source_class;
+
+	object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = profile_finalize;
+	g_type_class_add_private(object_class, sizeof(ProfilePrivate));
+
+	source_class = PKA_SOURCE_CLASS(klass);
+	source_class->stopped = profile_stopped;
+}
+
+static void
+profile_init (Profile *profile)
+{
+	ProfilePrivate *priv;
+	gint n_pages;
+
+	profile->priv = G_TYPE_INSTANCE_GET_PRIVATE(profile, PROFILE_TYPE_SOURCE,
+	                                            ProfilePrivate);
+	priv = profile->priv;
+	priv->mutex = g_mutex_new();
+	priv->counts = profile_counts_new();
+	priv->frequency = pka_config_get_integer("source.profile",
+	                                         "frequency", 1000);
+	/* the data pages must be a power of two */
+	n_pages = pka_config_get_integer("source.profile", "pages", 64);
+	for (priv->n_pages = 1; priv->n_pages < n_pages;) {
+		priv->n_pages <<= 1;
+	}
+	pka_source_simple_set_sample_callback(PKA_SOURCE_SIMPLE(profile),
+	                                      profile_sample, NULL, NULL);
+	pka_source_simple_set_spawn_callback(PKA_SOURCE_SIMPLE(profile),
+	                                     profile_spawn, NULL, NULL);
+}
+
+/*
+ * Create a new PkaSourceSimple for sampling call stacks.
+ */
+GObject*
+profile_new (GError **error)
+{
+	return g_object_new(PROFILE_TYPE_SOURCE, NULL);
+}
+
+const PkaPluginInfo pka_plugin_info = {
+	.id          = "Profile",
+	.name        = "Stack sampling profiler",
+	.description = "Call stacks of the process sampled with perf events.",
+	.version     = "0.1.1",
+	.copyright   = "Copyright 2010 Christian Hergert",
+	.factory     = profile_new,
+	.plugin_type = PKA_PLUGIN_SOURCE,
+};
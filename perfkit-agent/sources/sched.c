@@ -17,23 +17,20 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <egg-time.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <perfkit-agent/perfkit-agent.h>
 
+#include "src-utils.h"
+
 #ifdef G_LOG_DOMAIN
 #undef G_LOG_DOMAIN
 #endif
 #define G_LOG_DOMAIN "Scheduler"
 
-typedef struct
-{
-	PkaManifest *manifest;
-	gchar       *filename;
-	GPid         pid;
-} Sched;
-
 /*
 Entries looks like this...
 ---------------------------------------------------------
@@ -45,188 +42,315 @@ se.vruntime                        :      57042775.413011
 clock-delta                        :                  409
 */
 
+/*
+ * The names and types of the fields are learned from the first read and
+ * become the manifest.  Later reads scan the file once, matching each line
+ * against the next fields of the schema, and append the values straight to
+ * a packed sample.  Fields the kernel omits are skipped and unknown fields
+ * are ignored.
+ *
+ * With "per-thread" set in the [source.sched] group a sample is delivered
+ * for each thread in /proc/<pid>/task, with the thread id as first row.
+ */
+
 typedef enum
 {
-	SCHED_UNKNOWN = 0,
-	SCHED_INT,
+	SCHED_INT = 1,
 	SCHED_DOUBLE,
 } SchedType;
 
-typedef union
+typedef struct
 {
-	gint i;
-	gdouble d;
-} SchedValue;
+	gchar     *name;
+	gsize      name_len;
+	SchedType  type;
+} SchedField;
 
 typedef struct
 {
-	gchar      *name;
-	SchedType   type;
-	SchedValue  val;
-} SchedEntry;
+	SrcUtilsProc *proc;
+	guint         seen; /* Generation the thread was last listed in */
+} SchedThread;
 
-static inline gchar*
-sched_read (Sched *sched)
+typedef struct
 {
-	gchar *contents = NULL;
-	GError *error = NULL;
-
-	ENTRY;
-	if (G_UNLIKELY(!sched->filename)) {
-		sched->filename = g_strdup_printf("/proc/%d/sched", sched->pid);
-		g_assert(sched->filename);
-	}
-	if (!g_file_get_contents(sched->filename, &contents, NULL, &error)) {
-		WARNING(Scheduler, "Failed to read: %s: %s",
-		        sched->filename, error->message);
-		g_error_free(error);
-	}
-	RETURN(contents);
-}
+	PkaManifest  *manifest;
+	SrcUtilsProc *proc;
+	GPid          pid;
+	gboolean      per_thread;
+	GArray       *fields;     /* SchedField schema */
+	DIR          *task_dir;   /* /proc/<pid>/task in per-thread mode */
+	GHashTable   *threads;    /* tid to SchedThread */
+	guint         generation;
+} Sched;
 
+/*
+ * Find the next "name : value" line, where the name is made of word
+ * characters, dots and dashes and the value of an optional minus sign
+ * followed by digits and dots.  Other lines are skipped.  Returns %FALSE
+ * at the end of the contents.
+ */
 static inline gboolean
-has_decimal (gchar *str)
+sched_next_line (const gchar **p,
+                 const gchar **name,
+                 gsize        *name_len,
+                 const gchar **value,
+                 gsize        *value_len)
 {
-	gchar *ptr = str;
-
-	for(; *ptr; ptr++) {
-		if (*ptr == '.') 
-			return TRUE;
+	const gchar *c;
+	const gchar *eol;
+
+	for (c = *p; *c; c = eol) {
+		if ((eol = strchr(c, '\n'))) {
+			eol++;
+		} else {
+			eol = c + strlen(c);
+		}
+		*name = c;
+		while (g_ascii_isalnum(*c) || *c == '_' || *c == '.' || *c == '-') {
+			c++;
+		}
+		if (!(*name_len = c - *name)) {
+			continue;
+		}
+		while (*c == ' ' || *c == '\t') {
+			c++;
+		}
+		if (*c++ != ':') {
+			continue;
+		}
+		while (*c == ' ' || *c == '\t') {
+			c++;
+		}
+		*value = c;
+		if (*c == '-') {
+			c++;
+		}
+		while (g_ascii_isdigit(*c) || *c == '.') {
+			c++;
+		}
+		if (!(*value_len = c - *value) || (*c != '\n' && *c != '\0') ||
+		    (**value == '-' && *value_len == 1)) {
+			continue;
+		}
+		*p = eol;
+		return TRUE;
 	}
-
+	*p = c;
 	return FALSE;
 }
 
 /*
- * Given a pre-allocated array of SchedEntry, fill each entry until
- * we either run out of entries or space in the array, which ever one
- * happens first.  Note that if the names and types in the SchedEntry are
- * already filled out we will not fill them out again.  This is done to
- * save time and because the names and value types probably won't change, 
- * but their values will.
+ * Learn the fields of the schema from the first read.
  */
-static gboolean
-sched_parse (Sched      *sched,
-             GArray     *entries)
+static void
+sched_learn (Sched       *sched,
+             const gchar *contents)
 {
-	static gsize initialized = FALSE;
-	static GRegex *regex = NULL;
-	GMatchInfo *matchInfo = NULL;
-	gchar *contents = NULL;
+	const gchar *name;
+	const gchar *value;
+	SchedField field;
+	gsize name_len;
+	gsize value_len;
 
 	ENTRY;
-
-	if (g_once_init_enter(&initialized)) {
-		regex = g_regex_new("^([\\w\\.\\-]+)\\s*:\\s*([\\d\\.]+)$",
-		                    G_REGEX_CASELESS | G_REGEX_MULTILINE,
-		                    G_REGEX_MATCH_NOTBOL | G_REGEX_MATCH_NOTEOL,
-		                    NULL);
-		g_once_init_leave(&initialized, TRUE);
+	while (sched_next_line(&contents, &name, &name_len, &value, &value_len)) {
+		field.name = g_strndup(name, name_len);
+		field.name_len = name_len;
+		field.type = memchr(value, '.', value_len) ? SCHED_DOUBLE : SCHED_INT;
+		g_array_append_val(sched->fields, field);
 	}
+	EXIT;
+}
 
-	if (!(contents = sched_read(sched))) {
-		g_warning("sched: Error reading scheduler file.");
-		return FALSE;
-	}
+/*
+ * Parse a 64-bit integer value.  The value is known to be made of digits
+ * with an optional leading minus sign.
+ */
+static inline gint64
+sched_parse_int (const gchar *value,
+                 gsize        value_len)
+{
+	gboolean negative = FALSE;
+	guint64 u = 0;
 
-	if (!g_regex_match(regex, contents, 0, &matchInfo)) {
-		g_warning("sched: No match in scheduler file.");
-		return FALSE;
+	if (value_len && *value == '-') {
+		negative = TRUE;
+		value_len--;
+		value++;
 	}
-
-	for (; g_match_info_matches(matchInfo); g_match_info_next(matchInfo, NULL)) {
-		gint matches = g_match_info_get_match_count(matchInfo);
-
-		if (matches == 3) {
-			gchar *val = g_match_info_fetch(matchInfo, 2);
-			SchedEntry se = { 0 };
-
-			/* Don't populate the names if they already exist */
-			if (!se.name) {
-				se.name = g_match_info_fetch(matchInfo, 1);	
-			}
-
-			/* Same practice with the type */
-			if (se.type == SCHED_UNKNOWN) {
-				se.type = has_decimal(val) ? SCHED_DOUBLE : SCHED_INT;
-			}
-
-			switch (se.type) {
-			case SCHED_INT:
-				se.val.i = atoi(val);
-				break;
-			case SCHED_DOUBLE:
-				se.val.d = g_strtod(val, NULL);
-				break;
-			case SCHED_UNKNOWN:
-			default:
-				se.val.i = -1;  // Signals error.
-				se.type = SCHED_UNKNOWN;
-				break;
-			}
-
-			g_array_append_val(entries, se);
-			g_free(val);
-		}
+	for (; value_len && g_ascii_isdigit(*value); value_len--, value++) {
+		u = u * 10 + (*value - '0');
 	}
-
-	g_match_info_free(matchInfo);
-	g_free(contents);
-
-	RETURN(TRUE);
+	return negative ? -(gint64)u : (gint64)u;
 }
 
-static inline void
-populate_manifest (PkaManifest *m,
-                   GArray      *entries)
+/*
+ * Scan @contents and append the value of each field of the schema to @s,
+ * starting at @row.
+ */
+static void
+sched_parse (Sched       *sched,
+             const gchar *contents,
+             PkaSample   *s,
+             gint         row)
 {
-	SchedEntry *ent;
-	gint i;
-
-	ENTRY;
-	for (i = 0; i < entries->len; i++) {
-		ent = &g_array_index(entries, SchedEntry, i);
-
-		switch (ent->type) {
+	const gchar *name;
+	const gchar *value;
+	SchedField *field;
+	gsize name_len;
+	gsize value_len;
+	guint next = 0;
+	guint i;
+
+	while (next < sched->fields->len &&
+	       sched_next_line(&contents, &name, &name_len, &value, &value_len)) {
+		for (i = next; i < sched->fields->len; i++) {
+			field = &g_array_index(sched->fields, SchedField, i);
+			if (field->name_len == name_len &&
+			    memcmp(field->name, name, name_len) == 0) {
+				break;
+			}
+		}
+		if (i == sched->fields->len) {
+			continue;
+		}
+		switch (field->type) {
 		case SCHED_INT:
-			pka_manifest_append(m, ent->name, G_TYPE_INT);
+			pka_sample_append_int64(s, row + i,
+			                        sched_parse_int(value, value_len));
 			break;
 		case SCHED_DOUBLE:
-			pka_manifest_append(m, ent->name, G_TYPE_DOUBLE);
+			pka_sample_append_double(s, row + i,
+			                         g_ascii_strtod(value, NULL));
 			break;
-		case SCHED_UNKNOWN:
 		default:
 			g_warn_if_reached();
 			break;
 		}
+		next = i + 1;
 	}
-	EXIT;
 }
 
-static inline void
-populate_sample (PkaSample *s,
-                 GArray    *entries)
+/*
+ * Create and deliver the manifest from the schema.
+ */
+static void
+sched_deliver_manifest (PkaSourceSimple *source,
+                        Sched           *sched)
 {
-	SchedEntry *ent;
-	int i;
+	SchedField *field;
+	guint i;
 
 	ENTRY;
-	for (i = 0; i < entries->len; i++) {
-		ent = &g_array_index(entries, SchedEntry, i);
+	sched->manifest = pka_manifest_sized_new(sched->fields->len + 1);
+	pka_manifest_set_packed(sched->manifest, TRUE);
+	if (sched->per_thread) {
+		pka_manifest_append(sched->manifest, "Thread", G_TYPE_INT);
+	}
+	for (i = 0; i < sched->fields->len; i++) {
+		field = &g_array_index(sched->fields, SchedField, i);
+		pka_manifest_append(sched->manifest, field->name,
+		                    field->type == SCHED_DOUBLE ? G_TYPE_DOUBLE
+		                                                : G_TYPE_INT64);
+	}
+	pka_source_deliver_manifest(PKA_SOURCE(source), sched->manifest);
+	EXIT;
+}
 
-		switch (ent->type) {
-		case SCHED_INT:
-			pka_sample_append_uint(s, i + 1, ent->val.i);
-			break;
-		case SCHED_DOUBLE:
-			pka_sample_append_double(s, i + 1, ent->val.d);
-			break;
-		case SCHED_UNKNOWN:
-		default:
-			g_warn_if_reached();
-			break;
+/*
+ * Deliver the sample for the contents of a sched file.  @tid is the thread
+ * id in per-thread mode.
+ */
+static void
+sched_deliver (PkaSourceSimple *source,
+               Sched           *sched,
+               const gchar     *contents,
+               gint             tid)
+{
+	PkaSample *s;
+	gint row = 1;
+
+	if (G_UNLIKELY(!sched->manifest)) {
+		sched_learn(sched, contents);
+		if (!sched->fields->len) {
+			g_warning("sched: No match in scheduler file.");
+			return;
+		}
+		sched_deliver_manifest(source, sched);
+	}
+	s = pka_sample_new_packed(sched->manifest);
+	if (sched->per_thread) {
+		pka_sample_append_int(s, row++, tid);
+	}
+	sched_parse(sched, contents, s, row);
+	pka_source_deliver_sample(PKA_SOURCE(source), s);
+	pka_sample_unref(s);
+}
+
+static gboolean
+sched_thread_gone (gpointer key,
+                   gpointer value,
+                   gpointer user_data)
+{
+	return ((SchedThread *)value)->seen != ((Sched *)user_data)->generation;
+}
+
+static void
+sched_thread_free (gpointer data)
+{
+	SchedThread *thread = data;
+
+	src_utils_proc_close(thread->proc);
+	g_slice_free(SchedThread, thread);
+}
+
+/*
+ * Deliver a sample for each thread of the process.  The task directory
+ * stays open and is rewound every tick, threads are added as they appear
+ * and dropped once they are no longer listed.
+ */
+static void
+sched_sample_threads (PkaSourceSimple *source,
+                      Sched           *sched)
+{
+	SchedThread *thread;
+	const gchar *contents;
+	struct dirent *ent;
+	gchar path[64];
+	gint tid;
+
+	ENTRY;
+	if (G_UNLIKELY(!sched->task_dir)) {
+		g_snprintf(path, sizeof(path), "/proc/%d/task", (gint)sched->pid);
+		if (!(sched->task_dir = opendir(path))) {
+			EXIT;
+		}
+	} else {
+		rewinddir(sched->task_dir);
+	}
+	sched->generation++;
+	while ((ent = readdir(sched->task_dir))) {
+		if (!g_ascii_isdigit(ent->d_name[0])) {
+			continue;
+		}
+		tid = atoi(ent->d_name);
+		if (!(thread = g_hash_table_lookup(sched->threads,
+		                                   GINT_TO_POINTER(tid)))) {
+			thread = g_slice_new0(SchedThread);
+			g_snprintf(path, sizeof(path), "task/%d/sched", tid);
+			thread->proc = src_utils_proc_open_pid(sched->pid, path);
+			g_hash_table_insert(sched->threads, GINT_TO_POINTER(tid),
+			                    thread);
+		}
+		thread->seen = sched->generation;
+		/* the thread may exit before it is read */
+		if ((contents = src_utils_proc_read(thread->proc, NULL))) {
+			sched_deliver(source, sched, contents, tid);
+			src_utils_proc_release(thread->proc);
 		}
 	}
+	g_hash_table_foreach_remove(sched->threads, sched_thread_gone, sched);
 	EXIT;
 }
 
@@ -235,38 +359,43 @@ sched_sample (PkaSourceSimple *source,
               gpointer         user_data)
 {
 	Sched *sched = user_data;
-	SchedEntry *ent;
-	GArray *entries;
-	PkaSample *s;
-	gint linesRead, i;
+	const gchar *contents;
 
 	ENTRY;
-	entries = g_array_sized_new(FALSE, FALSE, sizeof(SchedEntry), 64);
-
-	if (!(linesRead = sched_parse(sched, entries))) {
-		goto cleanup;
+	if (sched->per_thread) {
+		sched_sample_threads(source, sched);
+		EXIT;
 	}
-
-	if (G_UNLIKELY(!sched->manifest)) {
-		sched->manifest = pka_manifest_new();
-		populate_manifest(sched->manifest, entries);
-		pka_source_deliver_manifest(PKA_SOURCE(source), sched->manifest);
+	if (G_UNLIKELY(!sched->proc)) {
+		sched->proc = src_utils_proc_open_pid(sched->pid, "sched");
 	}
-
-	s = pka_sample_new();
-	populate_sample(s, entries);
-	pka_source_deliver_sample(PKA_SOURCE(source), s);
-	pka_sample_unref(s);
-
-  cleanup:
-	for (i = 0; i < entries->len; i++) {
-		ent = &g_array_index(entries, SchedEntry, i);
-		g_free(ent->name);
+	if (!(contents = src_utils_proc_read(sched->proc, NULL))) {
+		WARNING(Scheduler, "Failed to read: /proc/%d/sched: %s",
+		        (gint)sched->pid, g_strerror(errno));
+		EXIT;
 	}
-	g_array_unref(entries);
+	sched_deliver(source, sched, contents, 0);
+	src_utils_proc_release(sched->proc);
 	EXIT;
 }
 
+/*
+ * Close the files of the current process.
+ */
+static void
+sched_close (Sched *sched)
+{
+	if (sched->proc) {
+		src_utils_proc_close(sched->proc);
+		sched->proc = NULL;
+	}
+	if (sched->task_dir) {
+		closedir(sched->task_dir);
+		sched->task_dir = NULL;
+	}
+	g_hash_table_remove_all(sched->threads);
+}
+
 static void
 sched_spawn (PkaSourceSimple *source,
              PkaSpawnInfo    *spawn_info,
@@ -275,6 +404,7 @@ sched_spawn (PkaSourceSimple *source,
 	Sched *sched = user_data;
 
 	ENTRY;
+	sched_close(sched);
 	sched->pid = spawn_info->pid;
 	EXIT;
 }
@@ -283,11 +413,18 @@ static void
 sched_free (gpointer data)
 {
 	Sched *sched = data;
+	guint i;
 
 	ENTRY;
+	sched_close(sched);
+	g_hash_table_unref(sched->threads);
 	if (sched->manifest) {
 		pka_manifest_unref(sched->manifest);
 	}
+	for (i = 0; i < sched->fields->len; i++) {
+		g_free(g_array_index(sched->fields, SchedField, i).name);
+	}
+	g_array_unref(sched->fields);
 	g_slice_free(Sched, data);
 	EXIT;
 }
@@ -299,6 +436,11 @@ sched_new (GError **error)
 
 	ENTRY;
 	sched = g_slice_new0(Sched);
+	sched->per_thread = pka_config_get_boolean("source.sched", "per-thread",
+	                                           FALSE);
+	sched->fields = g_array_new(FALSE, FALSE, sizeof(SchedField));
+	sched->threads = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	                                       NULL, sched_thread_free);
 	RETURN(G_OBJECT(pka_source_simple_new_full(sched_sample, sched_spawn,
 	                                           sched, sched_free)));
 }
@@ -26,11 +26,44 @@
 #include "config.h"
 #endif
 
+#include <errno.h>
 #include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <egg-time.h>
 
 #include "src-utils.h"
 
 
+/*
+ * Reads of the same file within this many microseconds are served from
+ * the previous read, so sources sampled on the same tick share one read.
+ */
+#define PROC_FRESH_USEC (1000)
+#define PROC_BUF_SIZE   (4096)
+
+
+struct _SrcUtilsProc
+{
+   gchar   *path;
+   gint     ref_count;
+   GMutex  *mutex;     /* Held between read and release */
+   gint     fd;        /* Persistent descriptor, or -1 */
+   gboolean dead;      /* The process backing the file exited */
+   gchar   *buf;       /* Contents of the last read */
+   gsize    buf_size;
+   gsize    len;
+   guint64  read_at;   /* Monotonic usec of the last read, 0 if none */
+};
+
+
+/*
+ * Open files shared by path.
+ */
+static GHashTable *procs = NULL;
+G_LOCK_DEFINE_STATIC(procs);
+
+
 /**
  * src_utils_str_tok:
  * @delim: (IN) The delimeter.
@@ -105,3 +138,265 @@ src_utils_read_file (const gchar *path, /* IN */
       return contents;
    }
 } /* src_utils_read_file */
+
+
+/**
+ * src_utils_proc_open:
+ * @*path: (IN) Path to a file in procfs.
+ * @Returns: A #SrcUtilsProc to be closed with src_utils_proc_close().
+ *
+ * Opens a procfs file to be read every tick.  The descriptor stays open
+ * between reads and is shared with every other source within the plugin
+ * reading the same path.
+ *
+ **/
+SrcUtilsProc*
+src_utils_proc_open (const gchar *path) /* IN */
+{
+   SrcUtilsProc *proc;
+
+   g_return_val_if_fail(path != NULL, NULL);
+
+   G_LOCK(procs);
+   if (G_UNLIKELY(!procs)) {
+      procs = g_hash_table_new(g_str_hash, g_str_equal);
+   }
+   /*
+    * A dead process file is not shared, its pid may have been reused.
+    */
+   if ((proc = g_hash_table_lookup(procs, path)) && !proc->dead) {
+      proc->ref_count++;
+   } else {
+      proc = g_slice_new0(SrcUtilsProc);
+      proc->path = g_strdup(path);
+      proc->ref_count = 1;
+      proc->mutex = g_mutex_new();
+      proc->fd = -1;
+      proc->buf_size = PROC_BUF_SIZE;
+      proc->buf = g_malloc(proc->buf_size);
+      g_hash_table_replace(procs, proc->path, proc);
+   }
+   G_UNLOCK(procs);
+   return proc;
+} /* src_utils_proc_open */
+
+
+/**
+ * src_utils_proc_open_pid:
+ * @pid: (IN) The process id.
+ * @*name: (IN) The name of the file within /proc/<pid>.
+ * @Returns: A #SrcUtilsProc to be closed with src_utils_proc_close().
+ *
+ * Opens /proc/<pid>/<name> like src_utils_proc_open().  Since the
+ * descriptor refers to the process that was running when it was opened,
+ * reads fail once that process exits even if its pid is reused.
+ *
+ **/
+SrcUtilsProc*
+src_utils_proc_open_pid (GPid         pid,  /* IN */
+                         const gchar *name) /* IN */
+{
+   SrcUtilsProc *proc;
+   gchar path[64];
+
+   g_return_val_if_fail(name != NULL, NULL);
+
+   g_snprintf(path, sizeof(path), "/proc/%d/%s", (gint)pid, name);
+   proc = src_utils_proc_open(path);
+   return proc;
+} /* src_utils_proc_open_pid */
+
+
+/**
+ * src_utils_proc_read:
+ * @*proc: (IN) A #SrcUtilsProc.
+ * @*len: (OUT) A location for the length of the contents, or NULL.
+ * @Returns: The nul terminated contents of the file or NULL on failure.
+ *
+ * Reads the whole file with pread() into a buffer that grows until the
+ * file fits.  If another source read the file within the current tick,
+ * its contents are returned without reading the file again.
+ *
+ * On success, the contents remain valid and must not be modified until
+ * src_utils_proc_release() is called.  On failure errno is set.  Once the
+ * process backing a /proc/<pid> file exits, every read fails.
+ *
+ **/
+const gchar*
+src_utils_proc_read (SrcUtilsProc *proc, /* IN */
+                     gsize        *len)  /* OUT */
+{
+   struct timespec ts;
+   guint64 now;
+   ssize_t n;
+   gint errsv;
+
+   g_return_val_if_fail(proc != NULL, NULL);
+
+   g_mutex_lock(proc->mutex);
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   timespec_to_usec(&ts, &now);
+   if (proc->read_at && now - proc->read_at < PROC_FRESH_USEC) {
+      goto done;
+   }
+   if (proc->dead) {
+      errno = ESRCH;
+      goto failed;
+   }
+   if (proc->fd < 0) {
+      if ((proc->fd = open(proc->path, O_RDONLY)) < 0) {
+         goto failed;
+      }
+   }
+   for (;;) {
+      if ((n = pread(proc->fd, proc->buf, proc->buf_size - 1, 0)) < 0) {
+         if (errno == ESRCH) {
+            /* the process exited; never reopen a reused pid */
+            close(proc->fd);
+            proc->fd = -1;
+            proc->dead = TRUE;
+         }
+         goto failed;
+      }
+      if ((gsize)n < proc->buf_size - 1) {
+         break;
+      }
+      proc->buf_size *= 2;
+      proc->buf = g_realloc(proc->buf, proc->buf_size);
+   }
+   proc->buf[n] = '\0';
+   proc->len = n;
+   proc->read_at = now;
+
+done:
+   if (len) {
+      *len = proc->len;
+   }
+   return proc->buf;
+
+failed:
+   errsv = errno;
+   proc->read_at = 0;
+   g_mutex_unlock(proc->mutex);
+   errno = errsv;
+   return NULL;
+} /* src_utils_proc_read */
+
+
+/**
+ * src_utils_proc_release:
+ * @*proc: (IN) A #SrcUtilsProc.
+ *
+ * Releases the contents returned by a successful src_utils_proc_read().
+ *
+ **/
+void
+src_utils_proc_release (SrcUtilsProc *proc) /* IN */
+{
+   g_return_if_fail(proc != NULL);
+
+   g_mutex_unlock(proc->mutex);
+} /* src_utils_proc_release */
+
+
+/**
+ * src_utils_proc_close:
+ * @*proc: (IN) A #SrcUtilsProc.
+ *
+ * Drops a reference to @proc.  The descriptor is closed once no source
+ * reads the file anymore.
+ *
+ **/
+void
+src_utils_proc_close (SrcUtilsProc *proc) /* IN */
+{
+   g_return_if_fail(proc != NULL);
+
+   G_LOCK(procs);
+   if (--proc->ref_count > 0) {
+      G_UNLOCK(procs);
+      return;
+   }
+   if (g_hash_table_lookup(procs, proc->path) == proc) {
+      g_hash_table_remove(procs, proc->path);
+   }
+   G_UNLOCK(procs);
+
+   if (proc->fd >= 0) {
+      close(proc->fd);
+   }
+   g_mutex_free(proc->mutex);
+   g_free(proc->buf);
+   g_free(proc->path);
+   g_slice_free(SrcUtilsProc, proc);
+} /* src_utils_proc_close */
+
+
+/**
+ * src_utils_environ_copy:
+ * @Returns: A newly allocated environment vector.
+ *
+ * Copies the environment of the agent, which is what a spawned process
+ * inherits when its #PkaSpawnInfo does not supply one.  Free it with
+ * g_strfreev().
+ *
+ **/
+gchar**
+src_utils_environ_copy (void)
+{
+   gchar **names;
+   gchar **env;
+   guint n;
+   guint i;
+
+   names = g_listenv();
+   n = g_strv_length(names);
+   env = g_new0(gchar*, n + 1);
+   for (i = 0; i < n; i++) {
+      env[i] = g_strdup_printf("%s=%s", names[i], g_getenv(names[i]));
+   }
+   g_strfreev(names);
+   return env;
+} /* src_utils_environ_copy */
+
+
+/**
+ * src_utils_environ_set:
+ * @**env: (IN/OUT) A location of a %NULL terminated environment vector.
+ * @*key: (IN) The variable to set.
+ * @*value: (IN) The value.
+ * @sep: (IN) The separator to append @value with, or 0 to replace.
+ *
+ * Sets @key to @value within @env, which may be reallocated.  If @sep is
+ * not 0 and @key already has a value, @value is appended to it after
+ * @sep, as for list variables such as LD_PRELOAD.
+ *
+ **/
+void
+src_utils_environ_set (gchar       ***env,   /* IN/OUT */
+                       const gchar   *key,   /* IN */
+                       const gchar   *value, /* IN */
+                       gchar          sep)   /* IN */
+{
+   gsize len = strlen(key);
+   gchar *entry;
+   guint n;
+   guint i;
+
+   n = g_strv_length(*env);
+   for (i = 0; i < n; i++) {
+      if (!strncmp((*env)[i], key, len) && (*env)[i][len] == '=') {
+         if (sep && (*env)[i][len + 1]) {
+            entry = g_strdup_printf("%s%c%s", (*env)[i], sep, value);
+         } else {
+            entry = g_strdup_printf("%s=%s", key, value);
+         }
+         g_free((*env)[i]);
+         (*env)[i] = entry;
+         return;
+      }
+   }
+   *env = g_renew(gchar*, *env, n + 2);
+   (*env)[n] = g_strdup_printf("%s=%s", key, value);
+   (*env)[n + 1] = NULL;
+} /* src_utils_environ_set */
@@ -33,6 +33,27 @@ gchar* src_utils_read_file(const char*,
                            gchar*,
                            gssize);
 
+typedef struct _SrcUtilsProc SrcUtilsProc;
+
+SrcUtilsProc* src_utils_proc_open(const gchar*);
+
+SrcUtilsProc* src_utils_proc_open_pid(GPid,
+                                      const gchar*);
+
+const gchar* src_utils_proc_read(SrcUtilsProc*,
+                                 gsize*);
+
+void src_utils_proc_release(SrcUtilsProc*);
+
+void src_utils_proc_close(SrcUtilsProc*);
+
+gchar** src_utils_environ_copy(void);
+
+void src_utils_environ_set(gchar***,
+                           const gchar*,
+                           const gchar*,
+                           gchar);
+
 G_END_DECLS
 
 #endif /* __SRC_UTILS_H__ */
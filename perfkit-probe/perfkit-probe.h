@@ -0,0 +1,58 @@
+/* perfkit-probe.h
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PERFKIT_PROBE_H__
+#define __PERFKIT_PROBE_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * PkpMetric:
+ *
+ * An opaque handle to a metric published by the process.  Handles are
+ * never freed.  Every function accepts %NULL, which is what registration
+ * returns once the region is full or could not be created, so a process
+ * keeps running unchanged without an agent.
+ */
+typedef struct _PkpMetric PkpMetric;
+
+PkpMetric* pkp_counter_register   (const char *name);
+PkpMetric* pkp_gauge_register     (const char *name);
+PkpMetric* pkp_histogram_register (const char *name);
+PkpMetric* pkp_mark_register      (const char *name);
+void       pkp_counter_add        (PkpMetric  *counter,
+                                   uint64_t    n);
+void       pkp_gauge_set          (PkpMetric  *gauge,
+                                   int64_t     value);
+void       pkp_gauge_add          (PkpMetric  *gauge,
+                                   int64_t     n);
+void       pkp_histogram_record   (PkpMetric  *histogram,
+                                   uint64_t    value);
+void       pkp_mark               (PkpMetric  *mark);
+
+#define pkp_counter_inc(counter) pkp_counter_add((counter), 1)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PERFKIT_PROBE_H__ */
@@ -0,0 +1,500 @@
+/* pkp-probe.c
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "perfkit-probe.h"
+#include "pkp-region.h"
+
+/*
+ * libperfkit-probe is linked into or preloaded by the process being
+ * profiled, which may not use GLib, so it only depends on the C library.
+ *
+ * Registration is rare and serialized by a mutex.  Updates take no lock:
+ * each thread owns a slot of cells for counters and histograms, so an
+ * update is a single atomic add to a cache line no other thread writes.
+ * The add is still atomic because a thread that finds no free slot
+ * shares one, and slots are reused by later threads.
+ */
+
+struct _PkpMetric
+{
+	uint32_t id;
+	uint32_t type;
+	uint32_t cell;
+};
+
+static pthread_once_t   pkp_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t  pkp_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t    pkp_slot_key;
+static PkpRegion       *pkp_region = NULL;
+static char             pkp_region_name[32];
+static PkpMetric        pkp_metrics[PKP_REGION_N_METRICS];
+static __thread PkpRegionSlot *pkp_slot = NULL;
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * pkp_slot_release --
+ *
+ *    Releases the slot of an exiting thread.  The cells are kept so the
+ *    totals stay monotonic; the next owner adds on top of them.
+ *
+ * Returns:
+ *    None.
+ *
+ * Side effects:
+ *    The slot may be acquired by another thread.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+pkp_slot_release (void *data) /* IN */
+{
+	PkpRegionSlot *slot = data;
+
+	__sync_lock_release(&slot->in_use);
+}
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * pkp_atfork_child --
+ *
+ *    Detaches a forked child from the region of its parent, whose pid it
+ *    is named after.  Metrics are no-ops in the child.
+ *
+ * Returns:
+ *    None.
+ *
+ * Side effects:
+ *    The region is unmapped.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+pkp_atfork_child (void)
+{
+	if (pkp_region) {
+		munmap(pkp_region, sizeof(PkpRegion));
+		pkp_region = NULL;
+	}
+	pkp_slot = NULL;
+}
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * pkp_region_unlink --
+ *
+ *    Removes the name of the region when the process exits.
+ *
+ * Returns:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+pkp_region_unlink (void)
+{
+	if (pkp_region) {
+		shm_unlink(pkp_region_name);
+	}
+}
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * pkp_region_init --
+ *
+ *    Creates the region of the process.  A region left behind by an
+ *    earlier process with the same pid is replaced.
+ *
+ * Returns:
+ *    None.
+ *
+ * Side effects:
+ *    pkp_region is set if successful.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+pkp_region_init (void)
+{
+	PkpRegion *region;
+	void *map;
+	int fd;
+
+	snprintf(pkp_region_name, sizeof(pkp_region_name), PKP_REGION_NAME,
+	         (int)getpid());
+	shm_unlink(pkp_region_name);
+	fd = shm_open(pkp_region_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		return;
+	}
+	if (ftruncate(fd, sizeof(PkpRegion)) < 0) {
+		close(fd);
+		shm_unlink(pkp_region_name);
+		return;
+	}
+	map = mmap(NULL, sizeof(PkpRegion), PROT_READ | PROT_WRITE,
+	           MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		shm_unlink(pkp_region_name);
+		return;
+	}
+	if (pthread_key_create(&pkp_slot_key, pkp_slot_release) != 0) {
+		munmap(map, sizeof(PkpRegion));
+		shm_unlink(pkp_region_name);
+		return;
+	}
+
+	/*
+	 * The region is zero filled by ftruncate().  The magic is written
+	 * last so the agent does not read a region being initialized.
+	 */
+	region = map;
+	region->version = PKP_REGION_VERSION;
+	__sync_synchronize();
+	region->magic = PKP_REGION_MAGIC;
+	pkp_region = region;
+
+	pthread_atfork(NULL, NULL, pkp_atfork_child);
+	atexit(pkp_region_unlink);
+}
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * pkp_slot_acquire --
+ *
+ *    Finds a slot for the calling thread.  A free slot is claimed; when
+ *    there is none the thread shares one picked by its thread id.
+ *
+ * Returns:
+ *    The slot, or NULL if there is no region.
+ *
+ * Side effects:
+ *    The slot is released when the thread exits.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static PkpRegionSlot*
+pkp_slot_acquire (void)
+{
+	PkpRegionSlot *slot;
+	int tid;
+	int i;
+
+	if (!pkp_region) {
+		return NULL;
+	}
+	tid = (int)syscall(SYS_gettid);
+	for (i = 0; i < PKP_REGION_N_SLOTS; i++) {
+		slot = &pkp_region->slots[i];
+		if (!__sync_lock_test_and_set(&slot->in_use, 1)) {
+			slot->tid = tid;
+			pthread_setspecific(pkp_slot_key, slot);
+			return pkp_slot = slot;
+		}
+	}
+	return pkp_slot = &pkp_region->slots[tid % PKP_REGION_N_SLOTS];
+}
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * pkp_register --
+ *
+ *    Registers a metric in the region, or finds the metric registered
+ *    before under @name.
+ *
+ * Returns:
+ *    The metric, or NULL if the region is full, could not be created, or
+ *    @name is registered with another type.
+ *
+ * Side effects:
+ *    The region is created on the first registration.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static PkpMetric*
+pkp_register (const char *name,    /* IN */
+              uint32_t    type,    /* IN */
+              uint32_t    n_cells) /* IN */
+{
+	PkpRegionMetric *desc;
+	PkpMetric *metric = NULL;
+	uint32_t i;
+
+	if (!name || !*name) {
+		return NULL;
+	}
+	pthread_once(&pkp_once, pkp_region_init);
+	pthread_mutex_lock(&pkp_mutex);
+	if (!pkp_region) {
+		goto unlock;
+	}
+	for (i = 0; i < pkp_region->n_metrics; i++) {
+		desc = &pkp_region->metrics[i];
+		if (!strncmp(desc->name, name, PKP_REGION_NAME_MAX - 1)) {
+			if (desc->type == type) {
+				metric = &pkp_metrics[i];
+			}
+			goto unlock;
+		}
+	}
+	if (pkp_region->n_metrics == PKP_REGION_N_METRICS ||
+	    pkp_region->n_cells + n_cells > PKP_REGION_N_CELLS) {
+		goto unlock;
+	}
+
+	desc = &pkp_region->metrics[i];
+	strncpy(desc->name, name, PKP_REGION_NAME_MAX - 1);
+	desc->type = type;
+	desc->cell = pkp_region->n_cells;
+	desc->n_cells = n_cells;
+	metric = &pkp_metrics[i];
+	metric->id = i;
+	metric->type = type;
+	metric->cell = desc->cell;
+	pkp_region->n_cells += n_cells;
+
+	/* the descriptor must be complete before it is published */
+	__sync_synchronize();
+	pkp_region->n_metrics = i + 1;
+
+  unlock:
+	pthread_mutex_unlock(&pkp_mutex);
+	return metric;
+}
+
+/**
+ * pkp_counter_register:
+ * @name: The name of the counter.
+ *
+ * Registers a counter, a total that only grows, such as the number of
+ * requests handled.  Registering an existing name returns the same
+ * counter.
+ *
+ * Returns: The counter, or %NULL.
+ * Side effects: The counter is published to the agent.
+ */
+PkpMetric*
+pkp_counter_register (const char *name) /* IN */
+{
+	return pkp_register(name, PKP_REGION_COUNTER, 1);
+}
+
+/**
+ * pkp_gauge_register:
+ * @name: The name of the gauge.
+ *
+ * Registers a gauge, a value that goes up and down, such as the depth of
+ * a queue.
+ *
+ * Returns: The gauge, or %NULL.
+ * Side effects: The gauge is published to the agent.
+ */
+PkpMetric*
+pkp_gauge_register (const char *name) /* IN */
+{
+	return pkp_register(name, PKP_REGION_GAUGE, 0);
+}
+
+/**
+ * pkp_histogram_register:
+ * @name: The name of the histogram.
+ *
+ * Registers a histogram, such as of request latencies.  Bucket 0 counts
+ * values of 0 and bucket n values from 2^(n-1) up to 2^n.  The last
+ * bucket also counts everything larger.
+ *
+ * Returns: The histogram, or %NULL.
+ * Side effects: The histogram is published to the agent.
+ */
+PkpMetric*
+pkp_histogram_register (const char *name) /* IN */
+{
+	return pkp_register(name, PKP_REGION_HISTOGRAM, PKP_REGION_N_BUCKETS);
+}
+
+/**
+ * pkp_mark_register:
+ * @name: The name of the mark.
+ *
+ * Registers a mark, an event such as the start of a phase which the agent
+ * delivers with the time it happened at.
+ *
+ * Returns: The mark, or %NULL.
+ * Side effects: The mark is published to the agent.
+ */
+PkpMetric*
+pkp_mark_register (const char *name) /* IN */
+{
+	return pkp_register(name, PKP_REGION_MARK, 0);
+}
+
+/**
+ * pkp_counter_add:
+ * @counter: A counter.
+ * @n: The amount to add.
+ *
+ * Adds @n to @counter.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pkp_counter_add (PkpMetric *counter, /* IN */
+                 uint64_t   n)       /* IN */
+{
+	PkpRegionSlot *slot;
+
+	if (counter && ((slot = pkp_slot) || (slot = pkp_slot_acquire()))) {
+		__sync_fetch_and_add(&slot->cells[counter->cell], n);
+	}
+}
+
+/**
+ * pkp_gauge_set:
+ * @gauge: A gauge.
+ * @value: The value.
+ *
+ * Sets the value of @gauge.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pkp_gauge_set (PkpMetric *gauge, /* IN */
+               int64_t    value) /* IN */
+{
+	PkpRegion *region = pkp_region;
+
+	if (gauge && region) {
+		*(volatile int64_t *)&region->gauges[gauge->id] = value;
+	}
+}
+
+/**
+ * pkp_gauge_add:
+ * @gauge: A gauge.
+ * @n: The amount to add, which may be negative.
+ *
+ * Adds @n to the value of @gauge.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pkp_gauge_add (PkpMetric *gauge, /* IN */
+               int64_t    n)     /* IN */
+{
+	PkpRegion *region = pkp_region;
+
+	if (gauge && region) {
+		__sync_fetch_and_add(&region->gauges[gauge->id], n);
+	}
+}
+
+/**
+ * pkp_histogram_record:
+ * @histogram: A histogram.
+ * @value: The value.
+ *
+ * Counts @value in its bucket of @histogram.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pkp_histogram_record (PkpMetric *histogram, /* IN */
+                      uint64_t   value)     /* IN */
+{
+	PkpRegionSlot *slot;
+	uint32_t bucket = 0;
+
+	if (histogram && ((slot = pkp_slot) || (slot = pkp_slot_acquire()))) {
+		if (value) {
+			bucket = 64 - __builtin_clzll(value);
+			if (bucket >= PKP_REGION_N_BUCKETS) {
+				bucket = PKP_REGION_N_BUCKETS - 1;
+			}
+		}
+		__sync_fetch_and_add(&slot->cells[histogram->cell + bucket], 1);
+	}
+}
+
+/**
+ * pkp_mark:
+ * @mark: A mark.
+ *
+ * Records that @mark happened now.  Marks are kept in a ring until the
+ * agent reads them; if the agent falls behind by more than the ring, the
+ * oldest are lost.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pkp_mark (PkpMetric *mark) /* IN */
+{
+	PkpRegion *region = pkp_region;
+	PkpRegionMark *entry;
+	struct timespec ts;
+	uint64_t idx;
+
+	if (!mark || !region) {
+		return;
+	}
+	clock_gettime(CLOCK_REALTIME, &ts);
+	idx = __sync_fetch_and_add(&region->mark_head, 1);
+	entry = &region->marks[idx & (PKP_REGION_N_MARKS - 1)];
+	entry->seq = 0;
+	__sync_synchronize();
+	entry->metric = mark->id;
+	entry->tv_sec = ts.tv_sec;
+	entry->tv_nsec = ts.tv_nsec;
+
+	/* the entry must be complete before it is published */
+	__sync_synchronize();
+	entry->seq = idx + 1;
+}
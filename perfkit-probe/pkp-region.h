@@ -0,0 +1,97 @@
+/* pkp-region.h
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PKP_REGION_H__
+#define __PKP_REGION_H__
+
+#include <stdint.h>
+
+/*
+ * Layout of the shared memory region a probed process publishes its
+ * metrics in, shared between libperfkit-probe and the Probe source of the
+ * agent.  The region is named after the pid of the process, so the agent
+ * can find it whether it spawned the process or attached to it.
+ *
+ * The schema is append only.  A metric descriptor is written before
+ * n_metrics is advanced past it, so the reader only sees complete
+ * descriptors.  Counters and histograms are spread over per-thread slots
+ * which the reader sums; gauges have a single value; marks go through a
+ * ring whose entries are valid once their seq is the index plus one.
+ */
+
+#define PKP_REGION_NAME          "/perfkit-probe-%d"
+#define PKP_REGION_MAGIC         (0x504b5052)
+#define PKP_REGION_VERSION       (1)
+#define PKP_REGION_CACHELINE     (64)
+#define PKP_REGION_NAME_MAX      (48)
+#define PKP_REGION_N_METRICS     (256)
+#define PKP_REGION_N_CELLS       (1024)
+#define PKP_REGION_N_SLOTS       (32)
+#define PKP_REGION_N_MARKS       (1024) /* A power of two */
+#define PKP_REGION_N_BUCKETS     (32)
+
+typedef enum
+{
+	PKP_REGION_COUNTER   = 1,
+	PKP_REGION_GAUGE     = 2,
+	PKP_REGION_HISTOGRAM = 3,
+	PKP_REGION_MARK      = 4,
+} PkpRegionType;
+
+typedef struct
+{
+	char     name[PKP_REGION_NAME_MAX];
+	uint32_t type;     /* PkpRegionType */
+	uint32_t cell;     /* First cell of counters and histograms */
+	uint32_t n_cells;
+	uint32_t pad;
+} PkpRegionMetric;
+
+typedef struct
+{
+	uint64_t seq;      /* Index of the mark plus one once written */
+	uint32_t metric;
+	uint32_t pad;
+	int64_t  tv_sec;   /* CLOCK_REALTIME of the mark */
+	int64_t  tv_nsec;
+} PkpRegionMark;
+
+typedef struct
+{
+	int32_t  tid;      /* Last thread to own the slot, 0 if never used */
+	uint32_t in_use;
+	uint8_t  pad[PKP_REGION_CACHELINE - 8];
+	uint64_t cells[PKP_REGION_N_CELLS];
+} PkpRegionSlot;
+
+typedef struct
+{
+	uint32_t        magic;      /* Set last, once the region is ready */
+	uint32_t        version;
+	uint32_t        n_metrics;
+	uint32_t        n_cells;
+	uint8_t         pad0[PKP_REGION_CACHELINE - 16];
+	uint64_t        mark_head;
+	uint8_t         pad1[PKP_REGION_CACHELINE - 8];
+	PkpRegionMetric metrics[PKP_REGION_N_METRICS];
+	int64_t         gauges[PKP_REGION_N_METRICS];
+	PkpRegionMark   marks[PKP_REGION_N_MARKS];
+	PkpRegionSlot   slots[PKP_REGION_N_SLOTS];
+} PkpRegion;
+
+#endif /* __PKP_REGION_H__ */
@@ -63,10 +63,10 @@ ppg_cpu_instrument_calc_cpu (PpgModel *model,
                              GValue *value,
                              gpointer user_data)
 {
-	gint user;
-	gint nice_;
-	gint system;
-	gint idle;
+	guint64 user;
+	guint64 nice_;
+	guint64 system;
+	guint64 idle;
 	gdouble percent;
 
 	ppg_model_get(model, iter,
@@ -144,10 +144,10 @@ get_model (PpgCpuInstrument *instrument,
 		model = g_object_new(PPG_TYPE_MODEL, NULL);
 
 		ppg_model_add_mapping(model, COLUMN_CPUNUM, "CPU Number", G_TYPE_INT, PPG_MODEL_RAW);
-		ppg_model_add_mapping(model, COLUMN_USER, "User", G_TYPE_INT, PPG_MODEL_COUNTER);
-		ppg_model_add_mapping(model, COLUMN_NICE, "Nice", G_TYPE_INT, PPG_MODEL_COUNTER);
-		ppg_model_add_mapping(model, COLUMN_SYSTEM, "System", G_TYPE_INT, PPG_MODEL_COUNTER);
-		ppg_model_add_mapping(model, COLUMN_IDLE, "Idle", G_TYPE_INT, PPG_MODEL_COUNTER);
+		ppg_model_add_mapping(model, COLUMN_USER, "User", G_TYPE_UINT64, PPG_MODEL_COUNTER);
+		ppg_model_add_mapping(model, COLUMN_NICE, "Nice", G_TYPE_UINT64, PPG_MODEL_COUNTER);
+		ppg_model_add_mapping(model, COLUMN_SYSTEM, "System", G_TYPE_UINT64, PPG_MODEL_COUNTER);
+		ppg_model_add_mapping(model, COLUMN_IDLE, "Idle", G_TYPE_UINT64, PPG_MODEL_COUNTER);
 		ppg_model_add_mapping_func(model, COLUMN_COOKED, ppg_cpu_instrument_calc_cpu, instrument);
 
 		/* add current manifest */
@@ -239,6 +239,10 @@ ppg_cpu_instrument_sample_cb (PkManifest *manifest,
 	row = pk_manifest_get_row_id(manifest, "CPU Number");
 	pk_sample_get_value(sample, row, &value);
 	cpu = g_value_get_int(&value);
+	/* the aggregate of all cpus */
+	if (cpu < 0) {
+		return;
+	}
 	model = get_model(instrument, manifest, cpu);
 
 	ppg_model_insert_sample(model, manifest, sample);
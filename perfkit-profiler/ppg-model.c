@@ -97,6 +97,18 @@ _g_value_subtract (GValue *left,
 		g_value_set_ulong(left, x - y);
 		break;
 	}
+	case G_TYPE_INT64: {
+		gint64 x = g_value_get_int64(left);
+		gint64 y = g_value_get_int64(right);
+		g_value_set_int64(left, x - y);
+		break;
+	}
+	case G_TYPE_UINT64: {
+		guint64 x = g_value_get_uint64(left);
+		guint64 y = g_value_get_uint64(right);
+		g_value_set_uint64(left, x - y);
+		break;
+	}
 	case G_TYPE_FLOAT: {
 		gfloat x = g_value_get_float(left);
 		gfloat y = g_value_get_float(right);
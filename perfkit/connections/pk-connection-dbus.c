@@ -24,6 +24,7 @@
 #include <unistd.h>
 
 #include "pk-connection-dbus.h"
+#include "pk-decoder.h"
 #include "pk-log.h"
 
 /**
@@ -149,6 +150,7 @@ struct _PkConnectionDBusPrivate
 	DBusConnection *client;        /* Handle to client on private DBus */
 	GStaticRWLock   handlers_lock; /* RWLock for subscription handlers */
 	GHashTable     *handlers;      /* Hash of subscription handlers */
+	GHashTable     *decoders;      /* Decoder plugin by subscription */
 };
 
 typedef struct
@@ -163,17 +165,69 @@ typedef struct
 	GClosure   *manifest;          /* Manifest callback closure */
 	GClosure   *sample;            /* Sample callback closure */
 	GTree      *manifests;         /* Source manifests indexed by source id */
+	PkDecoder  *decoder;           /* Decoder for encoded buffers or NULL */
 } Handler;
 
 static void
 handler_free (Handler *handler) /* IN */
 {
+	if (handler->decoder) {
+		pk_decoder_free(handler->decoder);
+	}
 	g_closure_unref(handler->manifest);
 	g_closure_unref(handler->sample);
 	g_tree_unref(handler->manifests);
 	g_slice_free(Handler, handler);
 }
 
+static void
+handler_set_decoder (Handler     *handler, /* IN */
+                     const gchar *plugin)  /* IN */
+{
+	if (handler->decoder) {
+		pk_decoder_free(handler->decoder);
+		handler->decoder = NULL;
+	}
+	if (plugin && !(handler->decoder = pk_decoder_new(plugin))) {
+		g_warning("No decoder is available for encoder plugin %s.", plugin);
+	}
+}
+
+/**
+ * pk_connection_dbus_decode:
+ * @handler: A #Handler.
+ * @data: A location containing the received buffer.
+ * @data_len: A location containing the length of the received buffer.
+ * @error: A location for a #GError, or %NULL.
+ *
+ * Decodes a buffer received for the subscription of @handler if the
+ * subscription is using an encoder.  On success, @data and @data_len are
+ * replaced with the decoded buffer, which is only valid until the next
+ * buffer is decoded for @handler.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ * Side effects: The decoder state is advanced.
+ */
+static inline gboolean
+pk_connection_dbus_decode (Handler       *handler,  /* IN */
+                           const guint8 **data,     /* IN/OUT */
+                           gsize         *data_len, /* IN/OUT */
+                           GError       **error)    /* OUT */
+{
+	ENTRY;
+	if (!handler->decoder) {
+		RETURN(TRUE);
+	}
+	if (!pk_decoder_decode(handler->decoder, *data, *data_len,
+	                       data, data_len)) {
+		g_set_error(error, PK_CONNECTION_DBUS_ERROR,
+		            PK_CONNECTION_DBUS_ERROR_DBUS,
+		            "The buffer could not be decoded.");
+		RETURN(FALSE);
+	}
+	RETURN(TRUE);
+}
+
 static inline gboolean
 pk_connection_dbus_dispatch_manifest (PkConnectionDBus  *connection,   /* IN */
                                       gint               subscription, /* IN */
@@ -208,6 +262,9 @@ pk_connection_dbus_dispatch_manifest (PkConnectionDBus  *connection,   /* IN */
 		dbus_error_free(&dbus_error);
 		GOTO(invalid_data);
 	}
+	if (!pk_connection_dbus_decode(handler, &data, &data_len, error)) {
+		GOTO(invalid_data);
+	}
 	if (!(manifest = pk_manifest_new_from_data(data, data_len))) {
 		g_set_error(error, PK_CONNECTION_DBUS_ERROR,
 		            PK_CONNECTION_DBUS_ERROR_DBUS,
@@ -297,11 +354,9 @@ pk_connection_dbus_dispatch_sample (PkConnectionDBus  *connection,   /* IN */
 		dbus_error_free(&dbus_error);
 		GOTO(invalid_data);
 	}
-	/*
-	 * TODO: This should be using a matching "decoder" for the subscription
-	 *  rather than being hard coded to the default encoder/decoder.  However,
-	 *  since that wont really be supported for a while, this seems easier.
-	 */
+	if (!pk_connection_dbus_decode(handler, &data, &data_len, error)) {
+		GOTO(invalid_data);
+	}
 	while (data_len > 0) {
 		if (!(sample = pk_sample_new_from_data(handler_manifest_lookup,
 		                                       handler,
@@ -4641,6 +4696,166 @@ finish:
 }
 
 
+static void
+pk_connection_dbus_manager_add_encoder_async (PkConnection        *connection,  /* IN */
+                                              const gchar         *plugin,      /* IN */
+                                              GCancellable        *cancellable, /* IN */
+                                              GAsyncReadyCallback  callback,    /* IN */
+                                              gpointer             user_data)   /* IN */
+{
+	PkConnectionDBusPrivate *priv;
+	DBusPendingCall *call = NULL;
+	GSimpleAsyncResult *result;
+	DBusMessageIter iter;
+	DBusMessage *msg;
+
+	g_return_if_fail(PK_IS_CONNECTION_DBUS(connection));
+
+	ENTRY;
+	priv = PK_CONNECTION_DBUS(connection)->priv;
+
+	/*
+	 * Allocate DBus message.
+	 */
+	msg = dbus_message_new(DBUS_MESSAGE_TYPE_METHOD_CALL);
+	g_assert(msg);
+
+	/*
+	 * Create asynchronous connection handle.
+	 */
+	result = g_simple_async_result_new(
+			G_OBJECT(connection), callback, user_data,
+			pk_connection_dbus_manager_add_encoder_async);
+
+	/*
+	 * Wire cancellable if needed.
+	 */
+	if (cancellable) {
+		g_cancellable_connect(cancellable,
+		                      G_CALLBACK(pk_connection_dbus_cancel),
+		                      g_object_ref(result), g_object_unref);
+	}
+
+	/*
+	 * Build the DBus message.
+	 */
+	dbus_message_set_destination(msg, "org.perfkit.Agent");
+	dbus_message_set_interface(msg, "org.perfkit.Agent.Manager");
+	dbus_message_set_member(msg, "AddEncoder");
+	dbus_message_set_path(msg, "/org/perfkit/Agent/Manager");
+
+	/*
+	 * Add message parameters.
+	 */
+	dbus_message_iter_init_append(msg, &iter);
+	APPEND_OBJECT_PARAM("/org/perfkit/Agent/Plugin/%s", plugin);
+
+	/*
+	 * Send message to agent and schedule to be notified of the result.
+	 */
+	if (!dbus_connection_send_with_reply(priv->dbus, msg, &call, -1)) {
+		g_warning("Error dispatching message to %s/%s",
+		          dbus_message_get_path(msg),
+		          dbus_message_get_member(msg));
+		dbus_message_unref(msg);
+		EXIT;
+	}
+
+	/*
+	 * Get notified when the reply is received or timeout expires.
+	 */
+	dbus_pending_call_set_notify(call, pk_connection_dbus_notify,
+	                             result, g_object_unref);
+
+	/*
+	 * Release resources.
+	 */
+	dbus_message_unref(msg);
+	EXIT;
+}
+
+
+static gboolean
+pk_connection_dbus_manager_add_encoder_finish (PkConnection  *connection, /* IN */
+                                               GAsyncResult  *result,     /* IN */
+                                               gint          *encoder,    /* OUT */
+                                               GError       **error)      /* OUT */
+{
+	DBusPendingCall *call;
+	DBusMessage *msg;
+	gboolean ret = FALSE;
+	gchar *error_str = NULL;
+	DBusError dbus_error = { 0 };
+	gchar *encoder_path = NULL;
+
+	g_return_val_if_fail(encoder != NULL, FALSE);
+	g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(result), FALSE);
+	g_return_val_if_fail(RESULT_IS_VALID(manager_add_encoder), FALSE);
+
+	if (!(call = GET_RESULT_POINTER(DBusPendingCall, result))) {
+		return FALSE;
+	}
+
+	/*
+	 * Clear out params.
+	 */
+	*encoder = 0;
+
+	/*
+	 * Check if call was cancelled.
+	 */
+	if (!(msg = dbus_pending_call_steal_reply(call))) {
+		g_simple_async_result_propagate_error(
+				G_SIMPLE_ASYNC_RESULT(result),
+				error);
+		goto finish;
+	}
+
+	/*
+	 * Check if response is an error.
+	 */
+	if (dbus_message_get_type(msg) == DBUS_MESSAGE_TYPE_ERROR) {
+		dbus_message_get_args(msg, NULL,
+		                      DBUS_TYPE_STRING, &error_str,
+		                      DBUS_TYPE_INVALID);
+		g_set_error(error, PK_CONNECTION_DBUS_ERROR,
+		            PK_CONNECTION_DBUS_ERROR_DBUS,
+		            "%s: %s",
+		            dbus_message_get_error_name(msg),
+		            error_str);
+		goto finish;
+	}
+
+	/*
+	 * Process message arguments.
+	 */
+	if (!dbus_message_get_args(msg,
+	                           &dbus_error,
+
+	                           DBUS_TYPE_OBJECT_PATH, &encoder_path,
+	                           DBUS_TYPE_INVALID)) {
+		g_set_error(error, PK_CONNECTION_DBUS_ERROR,
+		            PK_CONNECTION_DBUS_ERROR_DBUS,
+		            "%s: %s", dbus_error.name, dbus_error.message);
+		dbus_error_free(&dbus_error);
+		GOTO(finish);
+	}
+
+	if (encoder_path) {
+		sscanf(encoder_path,
+		       "/org/perfkit/Agent/Encoder/%d",
+		       encoder);
+	}
+
+	ret = TRUE;
+
+finish:
+	dbus_message_unref(msg);
+	g_object_unref(result);
+	RETURN(ret);
+}
+
+
 static void
 pk_connection_dbus_manager_add_source_async (PkConnection        *connection,  /* IN */
                                              const gchar         *plugin,      /* IN */
@@ -7441,13 +7656,11 @@ finish:
 
 
 static void
-pk_connection_dbus_subscription_add_channel_async (PkConnection        *connection,   /* IN */
-                                                   gint                 subscription, /* IN */
-                                                   gint                 channel,      /* IN */
-                                                   gboolean             monitor,      /* IN */
-                                                   GCancellable        *cancellable,  /* IN */
-                                                   GAsyncReadyCallback  callback,     /* IN */
-                                                   gpointer             user_data)    /* IN */
+pk_connection_dbus_source_get_stats_async (PkConnection        *connection,  /* IN */
+                                           gint                 source,      /* IN */
+                                           GCancellable        *cancellable, /* IN */
+                                           GAsyncReadyCallback  callback,    /* IN */
+                                           gpointer             user_data)   /* IN */
 {
 	PkConnectionDBusPrivate *priv;
 	DBusPendingCall *call = NULL;
@@ -7472,7 +7685,7 @@ pk_connection_dbus_subscription_add_channel_async (PkConnection        *connecti
 	 */
 	result = g_simple_async_result_new(
 			G_OBJECT(connection), callback, user_data,
-			pk_connection_dbus_subscription_add_channel_async);
+			pk_connection_dbus_source_get_stats_async);
 
 	/*
 	 * Wire cancellable if needed.
@@ -7487,10 +7700,10 @@ pk_connection_dbus_subscription_add_channel_async (PkConnection        *connecti
 	 * Build the DBus message.
 	 */
 	dbus_message_set_destination(msg, "org.perfkit.Agent");
-	dbus_message_set_interface(msg, "org.perfkit.Agent.Subscription");
-	dbus_message_set_member(msg, "AddChannel");
-	dbus_path = g_strdup_printf("/org/perfkit/Agent/Subscription/%d",
-	                            subscription);
+	dbus_message_set_interface(msg, "org.perfkit.Agent.Source");
+	dbus_message_set_member(msg, "GetStats");
+	dbus_path = g_strdup_printf("/org/perfkit/Agent/Source/%d",
+	                            source);
 	dbus_message_set_path(msg, dbus_path);
 	g_free(dbus_path);
 
@@ -7498,8 +7711,6 @@ pk_connection_dbus_subscription_add_channel_async (PkConnection        *connecti
 	 * Add message parameters.
 	 */
 	dbus_message_iter_init_append(msg, &iter);
-	APPEND_INT_PARAM(channel);
-	APPEND_BOOLEAN_PARAM(monitor);
 
 	/*
 	 * Send message to agent and schedule to be notified of the result.
@@ -7527,17 +7738,34 @@ pk_connection_dbus_subscription_add_channel_async (PkConnection        *connecti
 
 
 static gboolean
-pk_connection_dbus_subscription_add_channel_finish (PkConnection  *connection, /* IN */
-                                                    GAsyncResult  *result,     /* IN */
-                                                    GError       **error)      /* OUT */
+pk_connection_dbus_source_get_stats_finish (PkConnection  *connection,   /* IN */
+                                            GAsyncResult  *result,       /* IN */
+                                            guint64       *n_samples,    /* OUT */
+                                            guint64       *n_missed,     /* OUT */
+                                            guint32      **lateness,     /* OUT */
+                                            gsize         *lateness_len, /* OUT */
+                                            guint32      **duration,     /* OUT */
+                                            gsize         *duration_len, /* OUT */
+                                            GError       **error)        /* OUT */
 {
 	DBusPendingCall *call;
 	DBusMessage *msg;
 	gboolean ret = FALSE;
 	gchar *error_str = NULL;
-
+	DBusError dbus_error = { 0 };
+	guint32 *lateness_data = NULL;
+	gint lateness_data_len = 0;
+	guint32 *duration_data = NULL;
+	gint duration_data_len = 0;
+
+	g_return_val_if_fail(n_samples != NULL, FALSE);
+	g_return_val_if_fail(n_missed != NULL, FALSE);
+	g_return_val_if_fail(lateness != NULL, FALSE);
+	g_return_val_if_fail(lateness_len != NULL, FALSE);
+	g_return_val_if_fail(duration != NULL, FALSE);
+	g_return_val_if_fail(duration_len != NULL, FALSE);
 	g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(result), FALSE);
-	g_return_val_if_fail(RESULT_IS_VALID(subscription_add_channel), FALSE);
+	g_return_val_if_fail(RESULT_IS_VALID(source_get_stats), FALSE);
 
 	if (!(call = GET_RESULT_POINTER(DBusPendingCall, result))) {
 		return FALSE;
@@ -7546,6 +7774,12 @@ pk_connection_dbus_subscription_add_channel_finish (PkConnection  *connection, /
 	/*
 	 * Clear out params.
 	 */
+	*n_samples = 0;
+	*n_missed = 0;
+	*lateness = NULL;
+	*lateness_len = 0;
+	*duration = NULL;
+	*duration_len = 0;
 
 	/*
 	 * Check if call was cancelled.
@@ -7572,6 +7806,30 @@ pk_connection_dbus_subscription_add_channel_finish (PkConnection  *connection, /
 		goto finish;
 	}
 
+	/*
+	 * Process message arguments.
+	 */
+	if (!dbus_message_get_args(msg,
+	                           &dbus_error,
+	                           DBUS_TYPE_UINT64, n_samples,
+	                           DBUS_TYPE_UINT64, n_missed,
+	                           DBUS_TYPE_ARRAY, DBUS_TYPE_UINT32, &lateness_data, &lateness_data_len,
+	                           DBUS_TYPE_ARRAY, DBUS_TYPE_UINT32, &duration_data, &duration_data_len,
+	                           DBUS_TYPE_INVALID)) {
+		g_set_error(error, PK_CONNECTION_DBUS_ERROR,
+		            PK_CONNECTION_DBUS_ERROR_DBUS,
+		            "%s: %s", dbus_error.name, dbus_error.message);
+		dbus_error_free(&dbus_error);
+		GOTO(finish);
+	}
+
+	/*
+	 * The arrays belong to the message, so copy them for the caller.
+	 */
+	*lateness = g_memdup(lateness_data, lateness_data_len * sizeof(guint32));
+	*lateness_len = lateness_data_len;
+	*duration = g_memdup(duration_data, duration_data_len * sizeof(guint32));
+	*duration_len = duration_data_len;
 
 	ret = TRUE;
 
@@ -7583,12 +7841,13 @@ finish:
 
 
 static void
-pk_connection_dbus_subscription_add_source_async (PkConnection        *connection,   /* IN */
-                                                  gint                 subscription, /* IN */
-                                                  gint                 source,       /* IN */
-                                                  GCancellable        *cancellable,  /* IN */
-                                                  GAsyncReadyCallback  callback,     /* IN */
-                                                  gpointer             user_data)    /* IN */
+pk_connection_dbus_subscription_add_channel_async (PkConnection        *connection,   /* IN */
+                                                   gint                 subscription, /* IN */
+                                                   gint                 channel,      /* IN */
+                                                   gboolean             monitor,      /* IN */
+                                                   GCancellable        *cancellable,  /* IN */
+                                                   GAsyncReadyCallback  callback,     /* IN */
+                                                   gpointer             user_data)    /* IN */
 {
 	PkConnectionDBusPrivate *priv;
 	DBusPendingCall *call = NULL;
@@ -7613,7 +7872,7 @@ pk_connection_dbus_subscription_add_source_async (PkConnection        *connectio
 	 */
 	result = g_simple_async_result_new(
 			G_OBJECT(connection), callback, user_data,
-			pk_connection_dbus_subscription_add_source_async);
+			pk_connection_dbus_subscription_add_channel_async);
 
 	/*
 	 * Wire cancellable if needed.
@@ -7629,7 +7888,7 @@ pk_connection_dbus_subscription_add_source_async (PkConnection        *connectio
 	 */
 	dbus_message_set_destination(msg, "org.perfkit.Agent");
 	dbus_message_set_interface(msg, "org.perfkit.Agent.Subscription");
-	dbus_message_set_member(msg, "AddSource");
+	dbus_message_set_member(msg, "AddChannel");
 	dbus_path = g_strdup_printf("/org/perfkit/Agent/Subscription/%d",
 	                            subscription);
 	dbus_message_set_path(msg, dbus_path);
@@ -7639,7 +7898,8 @@ pk_connection_dbus_subscription_add_source_async (PkConnection        *connectio
 	 * Add message parameters.
 	 */
 	dbus_message_iter_init_append(msg, &iter);
-	APPEND_INT_PARAM(source);
+	APPEND_INT_PARAM(channel);
+	APPEND_BOOLEAN_PARAM(monitor);
 
 	/*
 	 * Send message to agent and schedule to be notified of the result.
@@ -7667,9 +7927,9 @@ pk_connection_dbus_subscription_add_source_async (PkConnection        *connectio
 
 
 static gboolean
-pk_connection_dbus_subscription_add_source_finish (PkConnection  *connection, /* IN */
-                                                   GAsyncResult  *result,     /* IN */
-                                                   GError       **error)      /* OUT */
+pk_connection_dbus_subscription_add_channel_finish (PkConnection  *connection, /* IN */
+                                                    GAsyncResult  *result,     /* IN */
+                                                    GError       **error)      /* OUT */
 {
 	DBusPendingCall *call;
 	DBusMessage *msg;
@@ -7677,7 +7937,7 @@ pk_connection_dbus_subscription_add_source_finish (PkConnection  *connection, /*
 	gchar *error_str = NULL;
 
 	g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(result), FALSE);
-	g_return_val_if_fail(RESULT_IS_VALID(subscription_add_source), FALSE);
+	g_return_val_if_fail(RESULT_IS_VALID(subscription_add_channel), FALSE);
 
 	if (!(call = GET_RESULT_POINTER(DBusPendingCall, result))) {
 		return FALSE;
@@ -7723,8 +7983,9 @@ finish:
 
 
 static void
-pk_connection_dbus_subscription_get_buffer_async (PkConnection        *connection,   /* IN */
+pk_connection_dbus_subscription_add_source_async (PkConnection        *connection,   /* IN */
                                                   gint                 subscription, /* IN */
+                                                  gint                 source,       /* IN */
                                                   GCancellable        *cancellable,  /* IN */
                                                   GAsyncReadyCallback  callback,     /* IN */
                                                   gpointer             user_data)    /* IN */
@@ -7752,7 +8013,7 @@ pk_connection_dbus_subscription_get_buffer_async (PkConnection        *connectio
 	 */
 	result = g_simple_async_result_new(
 			G_OBJECT(connection), callback, user_data,
-			pk_connection_dbus_subscription_get_buffer_async);
+			pk_connection_dbus_subscription_add_source_async);
 
 	/*
 	 * Wire cancellable if needed.
@@ -7768,7 +8029,7 @@ pk_connection_dbus_subscription_get_buffer_async (PkConnection        *connectio
 	 */
 	dbus_message_set_destination(msg, "org.perfkit.Agent");
 	dbus_message_set_interface(msg, "org.perfkit.Agent.Subscription");
-	dbus_message_set_member(msg, "GetBuffer");
+	dbus_message_set_member(msg, "AddSource");
 	dbus_path = g_strdup_printf("/org/perfkit/Agent/Subscription/%d",
 	                            subscription);
 	dbus_message_set_path(msg, dbus_path);
@@ -7778,6 +8039,7 @@ pk_connection_dbus_subscription_get_buffer_async (PkConnection        *connectio
 	 * Add message parameters.
 	 */
 	dbus_message_iter_init_append(msg, &iter);
+	APPEND_INT_PARAM(source);
 
 	/*
 	 * Send message to agent and schedule to be notified of the result.
@@ -7805,19 +8067,157 @@ pk_connection_dbus_subscription_get_buffer_async (PkConnection        *connectio
 
 
 static gboolean
-pk_connection_dbus_subscription_get_buffer_finish (PkConnection  *connection, /* IN */
+pk_connection_dbus_subscription_add_source_finish (PkConnection  *connection, /* IN */
                                                    GAsyncResult  *result,     /* IN */
-                                                   gint          *timeout,    /* OUT */
-                                                   gint          *size,       /* OUT */
                                                    GError       **error)      /* OUT */
 {
 	DBusPendingCall *call;
 	DBusMessage *msg;
 	gboolean ret = FALSE;
 	gchar *error_str = NULL;
-	DBusError dbus_error = { 0 };
 
-	g_return_val_if_fail(timeout != NULL, FALSE);
+	g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(result), FALSE);
+	g_return_val_if_fail(RESULT_IS_VALID(subscription_add_source), FALSE);
+
+	if (!(call = GET_RESULT_POINTER(DBusPendingCall, result))) {
+		return FALSE;
+	}
+
+	/*
+	 * Clear out params.
+	 */
+
+	/*
+	 * Check if call was cancelled.
+	 */
+	if (!(msg = dbus_pending_call_steal_reply(call))) {
+		g_simple_async_result_propagate_error(
+				G_SIMPLE_ASYNC_RESULT(result),
+				error);
+		goto finish;
+	}
+
+	/*
+	 * Check if response is an error.
+	 */
+	if (dbus_message_get_type(msg) == DBUS_MESSAGE_TYPE_ERROR) {
+		dbus_message_get_args(msg, NULL,
+		                      DBUS_TYPE_STRING, &error_str,
+		                      DBUS_TYPE_INVALID);
+		g_set_error(error, PK_CONNECTION_DBUS_ERROR,
+		            PK_CONNECTION_DBUS_ERROR_DBUS,
+		            "%s: %s",
+		            dbus_message_get_error_name(msg),
+		            error_str);
+		goto finish;
+	}
+
+
+	ret = TRUE;
+
+finish:
+	dbus_message_unref(msg);
+	g_object_unref(result);
+	RETURN(ret);
+}
+
+
+static void
+pk_connection_dbus_subscription_get_buffer_async (PkConnection        *connection,   /* IN */
+                                                  gint                 subscription, /* IN */
+                                                  GCancellable        *cancellable,  /* IN */
+                                                  GAsyncReadyCallback  callback,     /* IN */
+                                                  gpointer             user_data)    /* IN */
+{
+	PkConnectionDBusPrivate *priv;
+	DBusPendingCall *call = NULL;
+	GSimpleAsyncResult *result;
+	DBusMessageIter iter;
+	DBusMessage *msg;
+	gchar *dbus_path;
+
+	g_return_if_fail(PK_IS_CONNECTION_DBUS(connection));
+
+	ENTRY;
+	priv = PK_CONNECTION_DBUS(connection)->priv;
+
+	/*
+	 * Allocate DBus message.
+	 */
+	msg = dbus_message_new(DBUS_MESSAGE_TYPE_METHOD_CALL);
+	g_assert(msg);
+
+	/*
+	 * Create asynchronous connection handle.
+	 */
+	result = g_simple_async_result_new(
+			G_OBJECT(connection), callback, user_data,
+			pk_connection_dbus_subscription_get_buffer_async);
+
+	/*
+	 * Wire cancellable if needed.
+	 */
+	if (cancellable) {
+		g_cancellable_connect(cancellable,
+		                      G_CALLBACK(pk_connection_dbus_cancel),
+		                      g_object_ref(result), g_object_unref);
+	}
+
+	/*
+	 * Build the DBus message.
+	 */
+	dbus_message_set_destination(msg, "org.perfkit.Agent");
+	dbus_message_set_interface(msg, "org.perfkit.Agent.Subscription");
+	dbus_message_set_member(msg, "GetBuffer");
+	dbus_path = g_strdup_printf("/org/perfkit/Agent/Subscription/%d",
+	                            subscription);
+	dbus_message_set_path(msg, dbus_path);
+	g_free(dbus_path);
+
+	/*
+	 * Add message parameters.
+	 */
+	dbus_message_iter_init_append(msg, &iter);
+
+	/*
+	 * Send message to agent and schedule to be notified of the result.
+	 */
+	if (!dbus_connection_send_with_reply(priv->dbus, msg, &call, -1)) {
+		g_warning("Error dispatching message to %s/%s",
+		          dbus_message_get_path(msg),
+		          dbus_message_get_member(msg));
+		dbus_message_unref(msg);
+		EXIT;
+	}
+
+	/*
+	 * Get notified when the reply is received or timeout expires.
+	 */
+	dbus_pending_call_set_notify(call, pk_connection_dbus_notify,
+	                             result, g_object_unref);
+
+	/*
+	 * Release resources.
+	 */
+	dbus_message_unref(msg);
+	EXIT;
+}
+
+
+static gboolean
+pk_connection_dbus_subscription_get_buffer_finish (PkConnection  *connection, /* IN */
+                                                   GAsyncResult  *result,     /* IN */
+                                                   gint          *timeout,    /* OUT */
+                                                   gint          *size,       /* OUT */
+                                                   GError       **error)      /* OUT */
+{
+	DBusPendingCall *call;
+	DBusMessage *msg;
+	gboolean ret = FALSE;
+	gchar *error_str = NULL;
+	DBusError dbus_error = { 0 };
+
+	g_return_val_if_fail(timeout != NULL, FALSE);
 	g_return_val_if_fail(size != NULL, FALSE);
 	g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(result), FALSE);
 	g_return_val_if_fail(RESULT_IS_VALID(subscription_get_buffer), FALSE);
@@ -8216,6 +8616,173 @@ finish:
 }
 
 
+static void
+pk_connection_dbus_subscription_get_stats_async (PkConnection        *connection,   /* IN */
+                                                 gint                 subscription, /* IN */
+                                                 GCancellable        *cancellable,  /* IN */
+                                                 GAsyncReadyCallback  callback,     /* IN */
+                                                 gpointer             user_data)    /* IN */
+{
+	PkConnectionDBusPrivate *priv;
+	DBusPendingCall *call = NULL;
+	GSimpleAsyncResult *result;
+	DBusMessageIter iter;
+	DBusMessage *msg;
+	gchar *dbus_path;
+
+	g_return_if_fail(PK_IS_CONNECTION_DBUS(connection));
+
+	ENTRY;
+	priv = PK_CONNECTION_DBUS(connection)->priv;
+
+	/*
+	 * Allocate DBus message.
+	 */
+	msg = dbus_message_new(DBUS_MESSAGE_TYPE_METHOD_CALL);
+	g_assert(msg);
+
+	/*
+	 * Create asynchronous connection handle.
+	 */
+	result = g_simple_async_result_new(
+			G_OBJECT(connection), callback, user_data,
+			pk_connection_dbus_subscription_get_stats_async);
+
+	/*
+	 * Wire cancellable if needed.
+	 */
+	if (cancellable) {
+		g_cancellable_connect(cancellable,
+		                      G_CALLBACK(pk_connection_dbus_cancel),
+		                      g_object_ref(result), g_object_unref);
+	}
+
+	/*
+	 * Build the DBus message.
+	 */
+	dbus_message_set_destination(msg, "org.perfkit.Agent");
+	dbus_message_set_interface(msg, "org.perfkit.Agent.Subscription");
+	dbus_message_set_member(msg, "GetStats");
+	dbus_path = g_strdup_printf("/org/perfkit/Agent/Subscription/%d",
+	                            subscription);
+	dbus_message_set_path(msg, dbus_path);
+	g_free(dbus_path);
+
+	/*
+	 * Add message parameters.
+	 */
+	dbus_message_iter_init_append(msg, &iter);
+
+	/*
+	 * Send message to agent and schedule to be notified of the result.
+	 */
+	if (!dbus_connection_send_with_reply(priv->dbus, msg, &call, -1)) {
+		g_warning("Error dispatching message to %s/%s",
+		          dbus_message_get_path(msg),
+		          dbus_message_get_member(msg));
+		dbus_message_unref(msg);
+		EXIT;
+	}
+
+	/*
+	 * Get notified when the reply is received or timeout expires.
+	 */
+	dbus_pending_call_set_notify(call, pk_connection_dbus_notify,
+	                             result, g_object_unref);
+
+	/*
+	 * Release resources.
+	 */
+	dbus_message_unref(msg);
+	EXIT;
+}
+
+
+static gboolean
+pk_connection_dbus_subscription_get_stats_finish (PkConnection  *connection, /* IN */
+                                                  GAsyncResult  *result,     /* IN */
+                                                  guint64       *queued,     /* OUT */
+                                                  guint64       *delivered,  /* OUT */
+                                                  guint64       *dropped,    /* OUT */
+                                                  GError       **error)      /* OUT */
+{
+	DBusPendingCall *call;
+	DBusMessage *msg;
+	gboolean ret = FALSE;
+	gchar *error_str = NULL;
+	DBusError dbus_error = { 0 };
+
+	g_return_val_if_fail(queued != NULL, FALSE);
+	g_return_val_if_fail(delivered != NULL, FALSE);
+	g_return_val_if_fail(dropped != NULL, FALSE);
+	g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(result), FALSE);
+	g_return_val_if_fail(RESULT_IS_VALID(subscription_get_stats), FALSE);
+
+	if (!(call = GET_RESULT_POINTER(DBusPendingCall, result))) {
+		return FALSE;
+	}
+
+	/*
+	 * Clear out params.
+	 */
+	*queued = 0;
+	*delivered = 0;
+	*dropped = 0;
+
+	/*
+	 * Check if call was cancelled.
+	 */
+	if (!(msg = dbus_pending_call_steal_reply(call))) {
+		g_simple_async_result_propagate_error(
+				G_SIMPLE_ASYNC_RESULT(result),
+				error);
+		goto finish;
+	}
+
+	/*
+	 * Check if response is an error.
+	 */
+	if (dbus_message_get_type(msg) == DBUS_MESSAGE_TYPE_ERROR) {
+		dbus_message_get_args(msg, NULL,
+		                      DBUS_TYPE_STRING, &error_str,
+		                      DBUS_TYPE_INVALID);
+		g_set_error(error, PK_CONNECTION_DBUS_ERROR,
+		            PK_CONNECTION_DBUS_ERROR_DBUS,
+		            "%s: %s",
+		            dbus_message_get_error_name(msg),
+		            error_str);
+		goto finish;
+	}
+
+	/*
+	 * Process message arguments.
+	 */
+	if (!dbus_message_get_args(msg,
+	                           &dbus_error,
+
+	                           DBUS_TYPE_UINT64, queued,
+
+	                           DBUS_TYPE_UINT64, delivered,
+
+	                           DBUS_TYPE_UINT64, dropped,
+	                           DBUS_TYPE_INVALID)) {
+		g_set_error(error, PK_CONNECTION_DBUS_ERROR,
+		            PK_CONNECTION_DBUS_ERROR_DBUS,
+		            "%s: %s", dbus_error.name, dbus_error.message);
+		dbus_error_free(&dbus_error);
+		GOTO(finish);
+	}
+
+
+	ret = TRUE;
+
+finish:
+	dbus_message_unref(msg);
+	g_object_unref(result);
+	RETURN(ret);
+}
+
+
 static void
 pk_connection_dbus_subscription_mute_async (PkConnection        *connection,   /* IN */
                                             gint                 subscription, /* IN */
@@ -8778,6 +9345,155 @@ finish:
 }
 
 
+typedef struct
+{
+	PkConnectionDBus *connection;   /* Connection owning the subscription */
+	gint              subscription; /* Subscription id in agent */
+} DecoderRequest;
+
+static void
+decoder_request_free (DecoderRequest *request) /* IN */
+{
+	g_object_unref(request->connection);
+	g_slice_free(DecoderRequest, request);
+}
+
+/**
+ * pk_connection_dbus_set_decoder:
+ * @connection: A #PkConnectionDBus.
+ * @subscription: The subscription id.
+ * @plugin: The plugin which created the subscription's encoder, or %NULL.
+ *
+ * Selects the decoder used for buffers delivered to @subscription.  The
+ * decoder is created for the handler now if one is registered, or later
+ * when the handler is registered.
+ *
+ * Returns: None.
+ * Side effects: The existing decoder for @subscription is released.
+ */
+static void
+pk_connection_dbus_set_decoder (PkConnectionDBus *connection,   /* IN */
+                                gint              subscription, /* IN */
+                                const gchar      *plugin)       /* IN */
+{
+	PkConnectionDBusPrivate *priv;
+	Handler *handler;
+
+	ENTRY;
+	priv = connection->priv;
+	g_static_rw_lock_writer_lock(&priv->handlers_lock);
+	if (plugin) {
+		g_hash_table_insert(priv->decoders, GINT_TO_POINTER(subscription),
+		                    g_strdup(plugin));
+	} else {
+		g_hash_table_remove(priv->decoders, GINT_TO_POINTER(subscription));
+	}
+	if ((handler = g_hash_table_lookup(priv->handlers, &subscription))) {
+		handler_set_decoder(handler, plugin);
+	}
+	g_static_rw_lock_writer_unlock(&priv->handlers_lock);
+	EXIT;
+}
+
+/**
+ * pk_connection_dbus_decoder_notify:
+ * @call: A #DBusPendingCall.
+ * @user_data: A #DecoderRequest.
+ *
+ * Callback for the reply to the "GetPlugin" request issued by
+ * pk_connection_dbus_request_decoder().
+ *
+ * Returns: None.
+ * Side effects: The decoder for the subscription is replaced.
+ */
+static void
+pk_connection_dbus_decoder_notify (DBusPendingCall *call,      /* IN */
+                                   gpointer         user_data) /* IN */
+{
+	static const gchar prefix[] = "/org/perfkit/Agent/Plugin/";
+	DecoderRequest *request = user_data;
+	DBusMessage *msg;
+	gchar *plugin_path = NULL;
+	gchar *plugin = NULL;
+
+	ENTRY;
+	if (!(msg = dbus_pending_call_steal_reply(call))) {
+		EXIT;
+	}
+	if (dbus_message_get_type(msg) == DBUS_MESSAGE_TYPE_METHOD_RETURN &&
+	    dbus_message_get_args(msg, NULL,
+	                          DBUS_TYPE_OBJECT_PATH, &plugin_path,
+	                          DBUS_TYPE_INVALID) &&
+	    g_str_has_prefix(plugin_path, prefix)) {
+		plugin = g_strdup(plugin_path + sizeof(prefix) - 1);
+	} else {
+		g_warning("Failed to retrieve encoder plugin for subscription %d.",
+		          request->subscription);
+	}
+	pk_connection_dbus_set_decoder(request->connection,
+	                               request->subscription, plugin);
+	g_free(plugin);
+	dbus_message_unref(msg);
+	EXIT;
+}
+
+/**
+ * pk_connection_dbus_request_decoder:
+ * @connection: A #PkConnectionDBus.
+ * @subscription: The subscription id.
+ * @encoder: The encoder id, or -1 for the default encoding.
+ *
+ * Looks up the plugin which created @encoder so that the matching decoder
+ * can be selected for @subscription.  This must be sent ahead of the
+ * "SetEncoder" request; since the agent replies in order, the decoder is
+ * in place by the time pk_connection_subscription_set_encoder() completes.
+ *
+ * Buffers already in flight when the encoder is changed cannot be decoded,
+ * so the encoder should be set while the subscription is muted.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pk_connection_dbus_request_decoder (PkConnectionDBus *connection,   /* IN */
+                                    gint              subscription, /* IN */
+                                    gint              encoder)      /* IN */
+{
+	PkConnectionDBusPrivate *priv;
+	DBusPendingCall *call = NULL;
+	DecoderRequest *request;
+	DBusMessage *msg;
+	gchar *dbus_path;
+
+	ENTRY;
+	priv = connection->priv;
+	if (encoder < 0) {
+		pk_connection_dbus_set_decoder(connection, subscription, NULL);
+		EXIT;
+	}
+	dbus_path = g_strdup_printf("/org/perfkit/Agent/Encoder/%d", encoder);
+	msg = dbus_message_new_method_call("org.perfkit.Agent", dbus_path,
+	                                   "org.perfkit.Agent.Encoder",
+	                                   "GetPlugin");
+	g_free(dbus_path);
+	if (!dbus_connection_send_with_reply(priv->dbus, msg, &call, -1)) {
+		g_warning("Error dispatching message to %s/%s",
+		          dbus_message_get_path(msg),
+		          dbus_message_get_member(msg));
+		dbus_message_unref(msg);
+		EXIT;
+	}
+	request = g_slice_new0(DecoderRequest);
+	request->connection = g_object_ref(connection);
+	request->subscription = subscription;
+	dbus_pending_call_set_notify(call, pk_connection_dbus_decoder_notify,
+	                             request, (DBusFreeFunction)decoder_request_free);
+	dbus_pending_call_unref(call);
+	dbus_message_unref(msg);
+	EXIT;
+}
+
+
 static void
 pk_connection_dbus_subscription_set_encoder_async (PkConnection        *connection,   /* IN */
                                                    gint                 subscription, /* IN */
@@ -8837,6 +9553,12 @@ pk_connection_dbus_subscription_set_encoder_async (PkConnection        *connecti
 	dbus_message_iter_init_append(msg, &iter);
 	APPEND_INT_PARAM(encoder);
 
+	/*
+	 * Select the matching decoder before the agent switches encoders.
+	 */
+	pk_connection_dbus_request_decoder(PK_CONNECTION_DBUS(connection),
+	                                   subscription, encoder);
+
 	/*
 	 * Send message to agent and schedule to be notified of the result.
 	 */
@@ -8962,6 +9684,9 @@ pk_connection_dbus_subscription_set_handlers_async (PkConnection        *connect
 	g_closure_set_marshal(handler->manifest, g_cclosure_marshal_VOID__VOID);
 	g_closure_set_marshal(handler->sample, g_cclosure_marshal_VOID__BOXED);
 	g_static_rw_lock_writer_lock(&priv->handlers_lock);
+	handler_set_decoder(handler,
+	                    g_hash_table_lookup(priv->decoders,
+	                                        GINT_TO_POINTER(subscription)));
 	g_hash_table_insert(priv->handlers, &handler->subscription, handler);
 	g_static_rw_lock_writer_unlock(&priv->handlers_lock);
 	g_mutex_lock(priv->mutex);
@@ -9167,6 +9892,7 @@ pk_connection_dbus_finalize (GObject *object)
 	if (priv->dbus) {
 		dbus_connection_unref(priv->dbus);
 	}
+	g_hash_table_destroy(priv->decoders);
 
 	G_OBJECT_CLASS(pk_connection_dbus_parent_class)->finalize(object);
 }
@@ -9222,6 +9948,7 @@ pk_connection_dbus_class_init (PkConnectionDBusClass *klass)
 	OVERRIDE_VTABLE(disconnect);
 	OVERRIDE_VTABLE(encoder_get_plugin);
 	OVERRIDE_VTABLE(manager_add_channel);
+	OVERRIDE_VTABLE(manager_add_encoder);
 	OVERRIDE_VTABLE(manager_add_source);
 	OVERRIDE_VTABLE(manager_add_subscription);
 	OVERRIDE_VTABLE(manager_get_channels);
@@ -9240,11 +9967,13 @@ pk_connection_dbus_class_init (PkConnectionDBusClass *klass)
 	OVERRIDE_VTABLE(plugin_get_plugin_type);
 	OVERRIDE_VTABLE(plugin_get_version);
 	OVERRIDE_VTABLE(source_get_plugin);
+	OVERRIDE_VTABLE(source_get_stats);
 	OVERRIDE_VTABLE(subscription_add_channel);
 	OVERRIDE_VTABLE(subscription_add_source);
 	OVERRIDE_VTABLE(subscription_get_buffer);
 	OVERRIDE_VTABLE(subscription_get_created_at);
 	OVERRIDE_VTABLE(subscription_get_sources);
+	OVERRIDE_VTABLE(subscription_get_stats);
 	OVERRIDE_VTABLE(subscription_mute);
 	OVERRIDE_VTABLE(subscription_remove_channel);
 	OVERRIDE_VTABLE(subscription_remove_source);
@@ -9274,6 +10003,8 @@ pk_connection_dbus_init (PkConnectionDBus *dbus)
 	g_static_rw_lock_init(&dbus->priv->handlers_lock);
 	dbus->priv->handlers = g_hash_table_new_full(g_int_hash, g_int_equal, NULL,
 	                                             (GDestroyNotify)handler_free);
+	dbus->priv->decoders = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	                                             NULL, g_free);
 }
 
 /**
@@ -327,6 +327,19 @@ gboolean      pk_connection_manager_add_channel_finish        (PkConnection
                                                                GAsyncResult          *result,
                                                                gint                  *channel,
                                                                GError               **error);
+gboolean      pk_connection_manager_add_encoder               (PkConnection          *connection,
+                                                               const gchar           *plugin,
+                                                               gint                  *encoder,
+                                                               GError               **error);
+void          pk_connection_manager_add_encoder_async         (PkConnection          *connection,
+                                                               const gchar           *plugin,
+                                                               GCancellable          *cancellable,
+                                                               GAsyncReadyCallback    callback,
+                                                               gpointer               user_data);
+gboolean      pk_connection_manager_add_encoder_finish        (PkConnection          *connection,
+                                                               GAsyncResult          *result,
+                                                               gint                  *encoder,
+                                                               GError               **error);
 gboolean      pk_connection_manager_add_source                (PkConnection          *connection,
                                                                const gchar           *plugin,
                                                                gint                  *source,
@@ -553,6 +566,29 @@ gboolean      pk_connection_source_get_plugin_finish          (PkConnection
                                                                GAsyncResult          *result,
                                                                gchar                **plugin,
                                                                GError               **error);
+gboolean      pk_connection_source_get_stats                  (PkConnection          *connection,
+                                                               gint                   source,
+                                                               guint64               *n_samples,
+                                                               guint64               *n_missed,
+                                                               guint32              **lateness,
+                                                               gsize                 *lateness_len,
+                                                               guint32              **duration,
+                                                               gsize                 *duration_len,
+                                                               GError               **error);
+void          pk_connection_source_get_stats_async            (PkConnection          *connection,
+                                                               gint                   source,
+                                                               GCancellable          *cancellable,
+                                                               GAsyncReadyCallback    callback,
+                                                               gpointer               user_data);
+gboolean      pk_connection_source_get_stats_finish           (PkConnection          *connection,
+                                                               GAsyncResult          *result,
+                                                               guint64               *n_samples,
+                                                               guint64               *n_missed,
+                                                               guint32              **lateness,
+                                                               gsize                 *lateness_len,
+                                                               guint32              **duration,
+                                                               gsize                 *duration_len,
+                                                               GError               **error);
 gboolean      pk_connection_subscription_add_channel          (PkConnection          *connection,
                                                                gint                   subscription,
                                                                gint                   channel,
@@ -624,6 +660,23 @@ gboolean      pk_connection_subscription_get_sources_finish   (PkConnection
                                                                gint                 **sources,
                                                                gsize                 *sources_len,
                                                                GError               **error);
+gboolean      pk_connection_subscription_get_stats            (PkConnection          *connection,
+                                                               gint                   subscription,
+                                                               guint64               *queued,
+                                                               guint64               *delivered,
+                                                               guint64               *dropped,
+                                                               GError               **error);
+void          pk_connection_subscription_get_stats_async      (PkConnection          *connection,
+                                                               gint                   subscription,
+                                                               GCancellable          *cancellable,
+                                                               GAsyncReadyCallback    callback,
+                                                               gpointer               user_data);
+gboolean      pk_connection_subscription_get_stats_finish     (PkConnection          *connection,
+                                                               GAsyncResult          *result,
+                                                               guint64               *queued,
+                                                               guint64               *delivered,
+                                                               guint64               *dropped,
+                                                               GError               **error);
 gboolean      pk_connection_subscription_mute                 (PkConnection          *connection,
                                                                gint                   subscription,
                                                                gboolean               drain,
@@ -3290,6 +3290,136 @@ pk_connection_manager_add_channel_finish (PkConnection  *connection, /* IN */
 	RETURN(ret);
 }
 
+/**
+ * pk_connection_manager_add_encoder_cb:
+ * @source: A #PkConnection.
+ * @result: A #GAsyncResult.
+ * @user_data: A #GAsyncResult.
+ *
+ * Callback to notify a synchronous call to the "manager_add_encoder" RPC that it
+ * has completed.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pk_connection_manager_add_encoder_cb (GObject      *source,    /* IN */
+                                      GAsyncResult *result,    /* IN */
+                                      gpointer      user_data) /* IN */
+{
+	PkConnectionSync *async = user_data;
+
+	g_return_if_fail(PK_IS_CONNECTION(source));
+	g_return_if_fail(async != NULL);
+
+	ENTRY;
+	async->result = pk_connection_manager_add_encoder_finish(PK_CONNECTION(source),
+	                                                        result,
+	                                                        async->params[0],
+	                                                        async->error);
+	pk_connection_sync_signal(async);
+	EXIT;
+}
+
+/**
+ * pk_connection_manager_add_encoder:
+ * @connection: A #PkConnection.
+ *
+ * Synchronous implemenation of the "manager_add_encoder" RPC.  Using
+ * synchronous RPCs is generally frowned upon.
+ *
+ * Create a new encoder from a plugin in the Agent.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ * Side effects: None.
+ */
+gboolean
+pk_connection_manager_add_encoder (PkConnection  *connection, /* IN */
+                                   const gchar   *plugin,     /* IN */
+                                   gint          *encoder,    /* OUT */
+                                   GError       **error)      /* OUT */
+{
+	PkConnectionSync async;
+
+	g_return_val_if_fail(PK_IS_CONNECTION(connection), FALSE);
+
+	ENTRY;
+	CHECK_FOR_RPC(manager_add_encoder);
+	pk_connection_sync_init(&async);
+	async.error = error;
+	async.params[0] = encoder;
+	pk_connection_manager_add_encoder_async(connection,
+	                                        plugin,
+	                                        NULL,
+	                                        pk_connection_manager_add_encoder_cb,
+	                                        &async);
+	pk_connection_sync_wait(&async);
+	pk_connection_sync_destroy(&async);
+	RETURN(async.result);
+}
+
+/**
+ * pk_connection_manager_add_encoder_async:
+ * @connection: A #PkConnection.
+ *
+ * Asynchronous implementation of the "manager_add_encoder_async" RPC.
+ *
+ * Create a new encoder from a plugin in the Agent.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pk_connection_manager_add_encoder_async (PkConnection        *connection,  /* IN */
+                                         const gchar         *plugin,      /* IN */
+                                         GCancellable        *cancellable, /* IN */
+                                         GAsyncReadyCallback  callback,    /* IN */
+                                         gpointer             user_data)   /* IN */
+{
+	g_return_if_fail(PK_IS_CONNECTION(connection));
+	g_return_if_fail(callback != NULL);
+
+	ENTRY;
+	RPC_ASYNC(manager_add_encoder)(connection,
+	                               plugin,
+	                               cancellable,
+	                               callback,
+	                               user_data);
+	EXIT;
+}
+
+/**
+ * pk_connection_manager_add_encoder_finish:
+ * @connection: (in): A #PkConnection.
+ * @result: (in): A #GAsyncResult.
+ * @encoder: (out): A location for the encoder id.
+ * @error: A location for a #GError or %NULL.
+ *
+ * Completion of an asynchronous call to the "manager_add_encoder_finish" RPC.
+ *
+ * Create a new encoder from a plugin in the Agent.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ * Side effects: None.
+ */
+gboolean
+pk_connection_manager_add_encoder_finish (PkConnection  *connection, /* IN */
+                                          GAsyncResult  *result,     /* IN */
+                                          gint          *encoder,    /* OUT */
+                                          GError       **error)      /* OUT */
+{
+	gboolean ret;
+
+	g_return_val_if_fail(PK_IS_CONNECTION(connection), FALSE);
+
+	ENTRY;
+	RPC_FINISH(ret, manager_add_encoder)(connection,
+	                                     result,
+	                                     encoder,
+	                                     error);
+	RETURN(ret);
+}
+
 /**
  * pk_connection_manager_add_source_cb:
  * @source: A #PkConnection.
@@ -5613,6 +5743,179 @@ pk_connection_source_get_plugin_finish (PkConnection  *connection, /* IN */
 	RETURN(ret);
 }
 
+/**
+ * pk_connection_source_get_stats_cb:
+ * @source: A #PkConnection.
+ * @result: A #GAsyncResult.
+ * @user_data: A #GAsyncResult.
+ *
+ * Callback to notify a synchronous call to the "source_get_stats" RPC that it
+ * has completed.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pk_connection_source_get_stats_cb (GObject      *source,    /* IN */
+                                   GAsyncResult *result,    /* IN */
+                                   gpointer      user_data) /* IN */
+{
+	PkConnectionSync *async = user_data;
+
+	g_return_if_fail(PK_IS_CONNECTION(source));
+	g_return_if_fail(async != NULL);
+
+	ENTRY;
+	async->result = pk_connection_source_get_stats_finish(PK_CONNECTION(source),
+	                                                      result,
+	                                                      async->params[0],
+	                                                      async->params[1],
+	                                                      async->params[2],
+	                                                      async->params[3],
+	                                                      async->params[4],
+	                                                      async->params[5],
+	                                                      async->error);
+	pk_connection_sync_signal(async);
+	EXIT;
+}
+
+/**
+ * pk_connection_source_get_stats:
+ * @connection: A #PkConnection.
+ * @source: (in): The source id.
+ * @n_samples: (out): A location for the number of samples taken.
+ * @n_missed: (out): A location for the number of missed sampling periods.
+ * @lateness: (out) (array length=lateness_len): A location for the
+ *   histogram of sampling lateness.
+ * @lateness_len: (out): A location for the length of @lateness.
+ * @duration: (out) (array length=duration_len): A location for the
+ *   histogram of sampling duration.
+ * @duration_len: (out): A location for the length of @duration.
+ * @error: (out): A location for a #GError or %NULL.
+ *
+ * Synchronous implemenation of the "source_get_stats" RPC.  Using
+ * synchronous RPCs is generally frowned upon.
+ *
+ * Retrieves the sampling statistics of the source.  Bucket n of the
+ * histograms counts samples below 2^n microseconds.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ * Side effects: None.
+ */
+gboolean
+pk_connection_source_get_stats (PkConnection  *connection,   /* IN */
+                                gint           source,       /* IN */
+                                guint64       *n_samples,    /* OUT */
+                                guint64       *n_missed,     /* OUT */
+                                guint32      **lateness,     /* OUT */
+                                gsize         *lateness_len, /* OUT */
+                                guint32      **duration,     /* OUT */
+                                gsize         *duration_len, /* OUT */
+                                GError       **error)        /* OUT */
+{
+	PkConnectionSync async;
+
+	g_return_val_if_fail(PK_IS_CONNECTION(connection), FALSE);
+
+	ENTRY;
+	CHECK_FOR_RPC(source_get_stats);
+	pk_connection_sync_init(&async);
+	async.error = error;
+	async.params[0] = n_samples;
+	async.params[1] = n_missed;
+	async.params[2] = lateness;
+	async.params[3] = lateness_len;
+	async.params[4] = duration;
+	async.params[5] = duration_len;
+	pk_connection_source_get_stats_async(connection,
+	                                     source,
+	                                     NULL,
+	                                     pk_connection_source_get_stats_cb,
+	                                     &async);
+	pk_connection_sync_wait(&async);
+	pk_connection_sync_destroy(&async);
+	RETURN(async.result);
+}
+
+/**
+ * pk_connection_source_get_stats_async:
+ * @connection: A #PkConnection.
+ *
+ * Asynchronous implementation of the "source_get_stats_async" RPC.
+ *
+ * Retrieves the sampling statistics of the source.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pk_connection_source_get_stats_async (PkConnection        *connection,  /* IN */
+                                      gint                 source,      /* IN */
+                                      GCancellable        *cancellable, /* IN */
+                                      GAsyncReadyCallback  callback,    /* IN */
+                                      gpointer             user_data)   /* IN */
+{
+	g_return_if_fail(PK_IS_CONNECTION(connection));
+	g_return_if_fail(callback != NULL);
+
+	ENTRY;
+	RPC_ASYNC(source_get_stats)(connection,
+	                            source,
+	                            cancellable,
+	                            callback,
+	                            user_data);
+	EXIT;
+}
+
+/**
+ * pk_connection_source_get_stats_finish:
+ * @connection: A #PkConnection.
+ * @n_samples: (out): A location for the number of samples taken.
+ * @n_missed: (out): A location for the number of missed sampling periods.
+ * @lateness: (out) (array length=lateness_len): A location for the
+ *   histogram of sampling lateness.
+ * @lateness_len: (out): A location for the length of @lateness.
+ * @duration: (out) (array length=duration_len): A location for the
+ *   histogram of sampling duration.
+ * @duration_len: (out): A location for the length of @duration.
+ * @error: (out): A location for a #GError or %NULL.
+ *
+ * Completion of an asynchronous call to the "source_get_stats_finish" RPC.
+ *
+ * Retrieves the sampling statistics of the source.  The histograms should
+ * be freed with g_free().
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ * Side effects: None.
+ */
+gboolean
+pk_connection_source_get_stats_finish (PkConnection  *connection,   /* IN */
+                                       GAsyncResult  *result,       /* IN */
+                                       guint64       *n_samples,    /* OUT */
+                                       guint64       *n_missed,     /* OUT */
+                                       guint32      **lateness,     /* OUT */
+                                       gsize         *lateness_len, /* OUT */
+                                       guint32      **duration,     /* OUT */
+                                       gsize         *duration_len, /* OUT */
+                                       GError       **error)        /* OUT */
+{
+	gboolean ret;
+
+	g_return_val_if_fail(PK_IS_CONNECTION(connection), FALSE);
+
+	ENTRY;
+	RPC_FINISH(ret, source_get_stats)(connection,
+	                                  result,
+	                                  n_samples,
+	                                  n_missed,
+	                                  lateness,
+	                                  lateness_len,
+	                                  duration,
+	                                  duration_len,
+	                                  error);
+	RETURN(ret);
+}
+
 /**
  * pk_connection_subscription_add_channel_cb:
  * @source: A #PkConnection.
@@ -6287,6 +6590,152 @@ pk_connection_subscription_get_sources_finish (PkConnection  *connection,  /* IN
 	RETURN(ret);
 }
 
+/**
+ * pk_connection_subscription_get_stats_cb:
+ * @source: A #PkConnection.
+ * @result: A #GAsyncResult.
+ * @user_data: A #GAsyncResult.
+ *
+ * Callback to notify a synchronous call to the "subscription_get_stats" RPC that it
+ * has completed.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pk_connection_subscription_get_stats_cb (GObject      *source,    /* IN */
+                                         GAsyncResult *result,    /* IN */
+                                         gpointer      user_data) /* IN */
+{
+	PkConnectionSync *async = user_data;
+
+	g_return_if_fail(PK_IS_CONNECTION(source));
+	g_return_if_fail(async != NULL);
+
+	ENTRY;
+	async->result = pk_connection_subscription_get_stats_finish(PK_CONNECTION(source),
+	                                                           result,
+	                                                           async->params[0],
+	                                                           async->params[1],
+	                                                           async->params[2],
+	                                                           async->error);
+	pk_connection_sync_signal(async);
+	EXIT;
+}
+
+/**
+ * pk_connection_subscription_get_stats:
+ * @connection: A #PkConnection.
+ *
+ * Synchronous implemenation of the "subscription_get_stats" RPC.  Using
+ * synchronous RPCs is generally frowned upon.
+ *
+ * Retrieves the delivery counters for the subscription.  @queued is the
+ * number of samples handed to the subscription, @delivered the number
+ * delivered to the subscriber and @dropped the number dropped because the
+ * subscriber could not keep up or the buffer was discarded.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ * Side effects: None.
+ */
+gboolean
+pk_connection_subscription_get_stats (PkConnection  *connection,   /* IN */
+                                      gint           subscription, /* IN */
+                                      guint64       *queued,       /* OUT */
+                                      guint64       *delivered,    /* OUT */
+                                      guint64       *dropped,      /* OUT */
+                                      GError       **error)        /* OUT */
+{
+	PkConnectionSync async;
+
+	g_return_val_if_fail(PK_IS_CONNECTION(connection), FALSE);
+
+	ENTRY;
+	CHECK_FOR_RPC(subscription_get_stats);
+	pk_connection_sync_init(&async);
+	async.error = error;
+	async.params[0] = queued;
+	async.params[1] = delivered;
+	async.params[2] = dropped;
+	pk_connection_subscription_get_stats_async(connection,
+	                                           subscription,
+	                                           NULL,
+	                                           pk_connection_subscription_get_stats_cb,
+	                                           &async);
+	pk_connection_sync_wait(&async);
+	pk_connection_sync_destroy(&async);
+	RETURN(async.result);
+}
+
+/**
+ * pk_connection_subscription_get_stats_async:
+ * @connection: A #PkConnection.
+ *
+ * Asynchronous implementation of the "subscription_get_stats_async" RPC.
+ *
+ * Retrieves the delivery counters for the subscription.  @queued is the
+ * number of samples handed to the subscription, @delivered the number
+ * delivered to the subscriber and @dropped the number dropped because the
+ * subscriber could not keep up or the buffer was discarded.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pk_connection_subscription_get_stats_async (PkConnection        *connection,   /* IN */
+                                            gint                 subscription, /* IN */
+                                            GCancellable        *cancellable,  /* IN */
+                                            GAsyncReadyCallback  callback,     /* IN */
+                                            gpointer             user_data)    /* IN */
+{
+	g_return_if_fail(PK_IS_CONNECTION(connection));
+	g_return_if_fail(callback != NULL);
+
+	ENTRY;
+	RPC_ASYNC(subscription_get_stats)(connection,
+	                                  subscription,
+	                                  cancellable,
+	                                  callback,
+	                                  user_data);
+	EXIT;
+}
+
+/**
+ * pk_connection_subscription_get_stats_finish:
+ * @connection: A #PkConnection.
+ *
+ * Completion of an asynchronous call to the "subscription_get_stats_finish" RPC.
+ *
+ * Retrieves the delivery counters for the subscription.  @queued is the
+ * number of samples handed to the subscription, @delivered the number
+ * delivered to the subscriber and @dropped the number dropped because the
+ * subscriber could not keep up or the buffer was discarded.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ * Side effects: None.
+ */
+gboolean
+pk_connection_subscription_get_stats_finish (PkConnection  *connection, /* IN */
+                                             GAsyncResult  *result,     /* IN */
+                                             guint64       *queued,     /* OUT */
+                                             guint64       *delivered,  /* OUT */
+                                             guint64       *dropped,    /* OUT */
+                                             GError       **error)      /* OUT */
+{
+	gboolean ret;
+
+	g_return_val_if_fail(PK_IS_CONNECTION(connection), FALSE);
+
+	ENTRY;
+	RPC_FINISH(ret, subscription_get_stats)(connection,
+	                                        result,
+	                                        queued,
+	                                        delivered,
+	                                        dropped,
+	                                        error);
+	RETURN(ret);
+}
+
 /**
  * pk_connection_subscription_mute_cb:
  * @source: A #PkConnection.
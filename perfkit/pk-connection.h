@@ -307,6 +307,15 @@ struct _PkConnectionClass
 	                                                     GAsyncResult          *result,
 	                                                     gint                  *channel,
 	                                                     GError               **error);
+	void          (*manager_add_encoder_async)          (PkConnection          *connection,
+	                                                     const gchar           *plugin,
+	                                                     GCancellable          *cancellable,
+	                                                     GAsyncReadyCallback    callback,
+	                                                     gpointer               user_data);
+	gboolean      (*manager_add_encoder_finish)         (PkConnection          *connection,
+	                                                     GAsyncResult          *result,
+	                                                     gint                  *encoder,
+	                                                     GError               **error);
 	void          (*manager_add_source_async)           (PkConnection          *connection,
 	                                                     const gchar           *plugin,
 	                                                     GCancellable          *cancellable,
@@ -465,6 +474,20 @@ struct _PkConnectionClass
 	                                                     GAsyncResult          *result,
 	                                                     gchar                **plugin,
 	                                                     GError               **error);
+	void          (*source_get_stats_async)             (PkConnection          *connection,
+	                                                     gint                   source,
+	                                                     GCancellable          *cancellable,
+	                                                     GAsyncReadyCallback    callback,
+	                                                     gpointer               user_data);
+	gboolean      (*source_get_stats_finish)            (PkConnection          *connection,
+	                                                     GAsyncResult          *result,
+	                                                     guint64               *n_samples,
+	                                                     guint64               *n_missed,
+	                                                     guint32              **lateness,
+	                                                     gsize                 *lateness_len,
+	                                                     guint32              **duration,
+	                                                     gsize                 *duration_len,
+	                                                     GError               **error);
 	void          (*subscription_add_channel_async)     (PkConnection          *connection,
 	                                                     gint                   subscription,
 	                                                     gint                   channel,
@@ -513,6 +536,17 @@ struct _PkConnectionClass
 	                                                     gint                 **sources,
 	                                                     gsize                 *sources_len,
 	                                                     GError               **error);
+	void          (*subscription_get_stats_async)       (PkConnection          *connection,
+	                                                     gint                   subscription,
+	                                                     GCancellable          *cancellable,
+	                                                     GAsyncReadyCallback    callback,
+	                                                     gpointer               user_data);
+	gboolean      (*subscription_get_stats_finish)      (PkConnection          *connection,
+	                                                     GAsyncResult          *result,
+	                                                     guint64               *queued,
+	                                                     guint64               *delivered,
+	                                                     guint64               *dropped,
+	                                                     GError               **error);
 	void          (*subscription_mute_async)            (PkConnection          *connection,
 	                                                     gint                   subscription,
 	                                                     gboolean               drain,
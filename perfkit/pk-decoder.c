@@ -0,0 +1,778 @@
+/* pk-decoder.c
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <zlib.h>
+
+#include "pk-decoder.h"
+#include "pk-log.h"
+#include "pk-manifest.h"
+
+/**
+ * SECTION:pk-decoder
+ * @title: PkDecoder
+ * @short_description: Client side counterpart of agent encoders
+ *
+ * Subscriptions in the agent may encode their manifests and samples with
+ * an encoder plugin.  #PkDecoder undoes that encoding so that the buffers
+ * can be parsed with pk_manifest_new_from_data() and
+ * pk_sample_new_from_data().  Decoders are looked up by the identifier of
+ * the plugin that created the agent's encoder.
+ *
+ * Decoders may be stateful, so every buffer delivered for a subscription
+ * must pass through the same #PkDecoder in the order it was received.
+ */
+
+#define CHUNK_SIZE           (4096)
+#define DELTA_FRAME_MANIFEST ('M')
+#define DELTA_FRAME_SAMPLES  ('S')
+#define DELTA_ZIGZAG(_i)     (((guint64)(_i) << 1) ^ (guint64)((gint64)(_i) >> 63))
+#define DELTA_UNZIGZAG(_u)   ((gint64)(((_u) >> 1) ^ -((_u) & 0x1)))
+
+typedef struct
+{
+	const gchar *plugin;
+	gpointer   (*create)  (void);
+	gboolean   (*decode)  (gpointer      state,
+	                       const guint8 *data,
+	                       gsize         data_len,
+	                       GByteArray   *decoded);
+	void       (*destroy) (gpointer      state);
+} PkDecoderInfo;
+
+typedef enum
+{
+	DELTA_ROW_RAW,
+	DELTA_ROW_SIGNED,
+	DELTA_ROW_UNSIGNED,
+	DELTA_ROW_DOUBLE,
+	DELTA_ROW_BOOLEAN,
+	DELTA_ROW_FLOAT,
+	DELTA_ROW_STRING,
+} DeltaRowKind;
+
+typedef struct
+{
+	gint     n_rows;
+	guint8  *kinds;     /* DeltaRowKind indexed by row id */
+	guint64 *prev;      /* Previous value indexed by row id */
+	guint64  prev_time; /* Previous relative timestamp */
+	gboolean packed;    /* Samples use the packed layout */
+} DeltaSource;
+
+typedef struct
+{
+	GHashTable *sources; /* Source id to DeltaSource */
+	GByteArray *payload; /* Reused sample data buffer */
+} DeltaState;
+
+struct _PkDecoder
+{
+	const PkDecoderInfo *info;    /* Decoder implementation */
+	gpointer             state;   /* Implementation state */
+	GByteArray          *decoded; /* Reused output buffer */
+};
+
+/**
+ * pk_decoder_zlib_create:
+ *
+ * Creates the inflate stream matching the persistent deflate stream of
+ * the agent's ZLib encoder.
+ *
+ * Returns: A z_stream or %NULL.
+ * Side effects: None.
+ */
+static gpointer
+pk_decoder_zlib_create (void)
+{
+	z_stream *stream;
+
+	ENTRY;
+	stream = g_slice_new0(z_stream);
+	if (inflateInit(stream) != Z_OK) {
+		g_slice_free(z_stream, stream);
+		RETURN(NULL);
+	}
+	RETURN(stream);
+}
+
+/**
+ * pk_decoder_zlib_decode:
+ * @state: A z_stream.
+ * @data: The compressed buffer.
+ * @data_len: The length of @data.
+ * @decoded: A #GByteArray to append the inflated data to.
+ *
+ * Inflates @data onto the end of @decoded.  The agent terminates every
+ * buffer with a sync flush, so all of @data can be inflated immediately.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE.
+ * Side effects: The inflate stream is advanced.
+ */
+static gboolean
+pk_decoder_zlib_decode (gpointer      state,    /* IN */
+                        const guint8 *data,     /* IN */
+                        gsize         data_len, /* IN */
+                        GByteArray   *decoded)  /* IN */
+{
+	z_stream *stream = state;
+	guint offset;
+	gint ret;
+
+	ENTRY;
+	stream->next_in = (guint8 *)data;
+	stream->avail_in = data_len;
+	do {
+		offset = decoded->len;
+		g_byte_array_set_size(decoded, offset + CHUNK_SIZE);
+		stream->next_out = decoded->data + offset;
+		stream->avail_out = CHUNK_SIZE;
+		ret = inflate(stream, Z_SYNC_FLUSH);
+		g_byte_array_set_size(decoded,
+		                      offset + CHUNK_SIZE - stream->avail_out);
+		/*
+		 * Z_BUF_ERROR only means no progress was possible; if there was
+		 * room left in the output, the input has been consumed.
+		 */
+		if (ret == Z_STREAM_END ||
+		    (ret == Z_BUF_ERROR && stream->avail_out)) {
+			BREAK;
+		}
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			g_warning("Failed to inflate buffer: %s",
+			          stream->msg ? stream->msg : "unknown error");
+			RETURN(FALSE);
+		}
+	} while (stream->avail_in || !stream->avail_out);
+	RETURN(TRUE);
+}
+
+/**
+ * pk_decoder_zlib_destroy:
+ * @state: A z_stream.
+ *
+ * Releases the inflate stream.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pk_decoder_zlib_destroy (gpointer state) /* IN */
+{
+	ENTRY;
+	inflateEnd(state);
+	g_slice_free(z_stream, state);
+	EXIT;
+}
+
+static void
+pk_decoder_delta_source_free (gpointer data) /* IN */
+{
+	DeltaSource *source = data;
+
+	g_free(source->kinds);
+	g_free(source->prev);
+	g_slice_free(DeltaSource, source);
+}
+
+static inline gboolean
+pk_decoder_read_varint (const guint8 **p,   /* IN/OUT */
+                        const guint8  *end, /* IN */
+                        guint64       *v)   /* OUT */
+{
+	guint64 r = 0;
+	guint shift;
+	guint8 b;
+
+	for (shift = 0; *p < end && shift < 64; shift += 7) {
+		b = *(*p)++;
+		r |= (guint64)(b & 0x7F) << shift;
+		if (!(b & 0x80)) {
+			*v = r;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static inline void
+pk_decoder_write_varint (GByteArray *ar, /* IN */
+                         guint64     v)  /* IN */
+{
+	guint8 buf[10];
+	gint n = 0;
+
+	do {
+		buf[n++] = ((v > 0x7F) << 7) | (v & 0x7F);
+		v >>= 7;
+	} while (v);
+	g_byte_array_append(ar, buf, n);
+}
+
+/**
+ * pk_decoder_delta_create:
+ *
+ * Creates the state tracking the previous values of each source for the
+ * agent's Delta encoder.
+ *
+ * Returns: A DeltaState.
+ * Side effects: None.
+ */
+static gpointer
+pk_decoder_delta_create (void)
+{
+	DeltaState *state;
+
+	ENTRY;
+	state = g_slice_new0(DeltaState);
+	state->sources = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	                                       NULL,
+	                                       pk_decoder_delta_source_free);
+	state->payload = g_byte_array_sized_new(256);
+	RETURN(state);
+}
+
+/**
+ * pk_decoder_delta_decode_manifest:
+ * @state: A DeltaState.
+ * @data: The default encoding of a manifest.
+ * @data_len: The length of @data.
+ *
+ * Learns the row types of the manifest and resets the previous values of
+ * its source, mirroring the agent.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE.
+ * Side effects: None.
+ */
+static gboolean
+pk_decoder_delta_decode_manifest (DeltaState   *state,    /* IN */
+                                  const guint8 *data,     /* IN */
+                                  gsize         data_len) /* IN */
+{
+	PkManifest *manifest;
+	DeltaSource *source;
+	gint i;
+
+	ENTRY;
+	if (!(manifest = pk_manifest_new_from_data(data, data_len))) {
+		RETURN(FALSE);
+	}
+	source = g_slice_new0(DeltaSource);
+	source->n_rows = pk_manifest_get_n_rows(manifest);
+	source->packed = pk_manifest_get_packed(manifest);
+	source->kinds = g_new0(guint8, source->n_rows + 1);
+	source->prev = g_new0(guint64, source->n_rows + 1);
+	for (i = 1; i <= source->n_rows; i++) {
+		switch (pk_manifest_get_row_type(manifest, i)) {
+		case G_TYPE_INT:
+		case G_TYPE_INT64:
+			source->kinds[i] = DELTA_ROW_SIGNED;
+			break;
+		case G_TYPE_UINT:
+		case G_TYPE_UINT64:
+			source->kinds[i] = DELTA_ROW_UNSIGNED;
+			break;
+		case G_TYPE_DOUBLE:
+			source->kinds[i] = DELTA_ROW_DOUBLE;
+			break;
+		case G_TYPE_BOOLEAN:
+			source->kinds[i] = DELTA_ROW_BOOLEAN;
+			break;
+		case G_TYPE_FLOAT:
+			source->kinds[i] = DELTA_ROW_FLOAT;
+			break;
+		case G_TYPE_STRING:
+			source->kinds[i] = DELTA_ROW_STRING;
+			break;
+		default:
+			source->kinds[i] = DELTA_ROW_RAW;
+			break;
+		}
+	}
+	g_hash_table_replace(state->sources,
+	                     GINT_TO_POINTER(pk_manifest_get_source_id(manifest)),
+	                     source);
+	pk_manifest_unref(manifest);
+	RETURN(TRUE);
+}
+
+/**
+ * pk_decoder_delta_decode_xor:
+ * @source: A DeltaSource.
+ * @row: The row of the value.
+ * @p: A location of the XOR encoded value, advanced past it.
+ * @end: The end of the sample data.
+ * @ar: A #GByteArray to append the restored double to.
+ *
+ * Restores a double row encoded as the XOR with its previous value.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE.
+ * Side effects: The previous value of @row is updated.
+ */
+static inline gboolean
+pk_decoder_delta_decode_xor (DeltaSource   *source, /* IN */
+                             guint64        row,    /* IN */
+                             const guint8 **p,      /* IN/OUT */
+                             const guint8  *end,    /* IN */
+                             GByteArray    *ar)     /* IN */
+{
+	guint8 bytes[8];
+	guint64 u;
+	guint n;
+	guint trail;
+	guint i;
+
+	if (*p == end) {
+		return FALSE;
+	}
+	n = **p & 0xF;
+	trail = *(*p)++ >> 4;
+	if (n + trail > 8 || (guint)(end - *p) < n) {
+		return FALSE;
+	}
+	for (u = 0, i = 0; i < n; i++) {
+		u |= (guint64)(*p)[i] << (8 * (trail + i));
+	}
+	*p += n;
+	u ^= source->prev[row];
+	source->prev[row] = u;
+	for (i = 0; i < 8; i++) {
+		bytes[i] = (u >> (8 * i)) & 0xFF;
+	}
+	g_byte_array_append(ar, bytes, 8);
+	return TRUE;
+}
+
+/**
+ * pk_decoder_delta_decode_payload:
+ * @source: A DeltaSource.
+ * @p: The beginning of the delta encoded sample data.
+ * @end: The end of the sample data.
+ * @ar: A #GByteArray to append the restored sample data to.
+ *
+ * Restores the absolute value of every field of a single sample.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE.
+ * Side effects: The previous values of @source are updated.
+ */
+static gboolean
+pk_decoder_delta_decode_payload (DeltaSource  *source, /* IN */
+                                 const guint8 *p,      /* IN */
+                                 const guint8 *end,    /* IN */
+                                 GByteArray   *ar)     /* IN */
+{
+	DeltaRowKind kind;
+	guint64 field;
+	guint64 row;
+	guint64 len;
+	guint64 u;
+
+	while (p < end) {
+		if (!pk_decoder_read_varint(&p, end, &field)) {
+			return FALSE;
+		}
+		pk_decoder_write_varint(ar, field);
+		row = field >> 3;
+		kind = DELTA_ROW_RAW;
+		if (row >= 1 && row <= (guint64)source->n_rows) {
+			kind = source->kinds[row];
+		}
+		switch (field & 0x7) {
+		case 0: /* Varint */
+			if (!pk_decoder_read_varint(&p, end, &u)) {
+				return FALSE;
+			}
+			if (kind == DELTA_ROW_SIGNED || kind == DELTA_ROW_UNSIGNED) {
+				u = source->prev[row] + DELTA_UNZIGZAG(u);
+				source->prev[row] = u;
+				if (kind == DELTA_ROW_SIGNED) {
+					u = DELTA_ZIGZAG(u);
+				}
+			}
+			pk_decoder_write_varint(ar, u);
+			break;
+		case 1: /* 64-bit */
+			if (kind != DELTA_ROW_DOUBLE) {
+				if (end - p < 8) {
+					return FALSE;
+				}
+				g_byte_array_append(ar, p, 8);
+				p += 8;
+				break;
+			}
+			if (!pk_decoder_delta_decode_xor(source, row, &p, end, ar)) {
+				return FALSE;
+			}
+			break;
+		case 2: /* Length delimited */
+			if (!pk_decoder_read_varint(&p, end, &len) ||
+			    len > (guint64)(end - p)) {
+				return FALSE;
+			}
+			pk_decoder_write_varint(ar, len);
+			g_byte_array_append(ar, p, len);
+			p += len;
+			break;
+		case 5: /* 32-bit */
+			if (end - p < 4) {
+				return FALSE;
+			}
+			g_byte_array_append(ar, p, 4);
+			p += 4;
+			break;
+		default:
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * pk_decoder_delta_decode_packed:
+ * @source: A DeltaSource.
+ * @p: The beginning of the delta encoded sample data.
+ * @end: The end of the sample data.
+ * @ar: A #GByteArray to append the restored sample data to.
+ *
+ * Restores the absolute value of every present row of a single packed
+ * sample.  The rows are found through the bitmap and the manifest types,
+ * as the values are not tagged.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE.
+ * Side effects: The previous values of @source are updated.
+ */
+static gboolean
+pk_decoder_delta_decode_packed (DeltaSource  *source, /* IN */
+                                const guint8 *p,      /* IN */
+                                const guint8 *end,    /* IN */
+                                GByteArray   *ar)     /* IN */
+{
+	const guint8 *bitmap = p;
+	guint64 len;
+	guint64 u;
+	gint row;
+
+	if (end - p < (source->n_rows + 7) / 8) {
+		return FALSE;
+	}
+	g_byte_array_append(ar, p, (source->n_rows + 7) / 8);
+	p += (source->n_rows + 7) / 8;
+
+	for (row = 1; row <= source->n_rows; row++) {
+		if (!(bitmap[(row - 1) / 8] & (1 << ((row - 1) % 8)))) {
+			continue;
+		}
+		switch (source->kinds[row]) {
+		case DELTA_ROW_SIGNED:
+		case DELTA_ROW_UNSIGNED:
+			if (!pk_decoder_read_varint(&p, end, &u)) {
+				return FALSE;
+			}
+			u = source->prev[row] + DELTA_UNZIGZAG(u);
+			source->prev[row] = u;
+			if (source->kinds[row] == DELTA_ROW_SIGNED) {
+				u = DELTA_ZIGZAG(u);
+			}
+			pk_decoder_write_varint(ar, u);
+			break;
+		case DELTA_ROW_DOUBLE:
+			if (!pk_decoder_delta_decode_xor(source, row, &p, end, ar)) {
+				return FALSE;
+			}
+			break;
+		case DELTA_ROW_BOOLEAN:
+		case DELTA_ROW_FLOAT:
+			len = (source->kinds[row] == DELTA_ROW_BOOLEAN) ? 1 : 4;
+			if (len > (guint64)(end - p)) {
+				return FALSE;
+			}
+			g_byte_array_append(ar, p, len);
+			p += len;
+			break;
+		case DELTA_ROW_STRING:
+			if (!pk_decoder_read_varint(&p, end, &len) ||
+			    len > (guint64)(end - p)) {
+				return FALSE;
+			}
+			pk_decoder_write_varint(ar, len);
+			g_byte_array_append(ar, p, len);
+			p += len;
+			break;
+		default:
+			return FALSE;
+		}
+	}
+	return p == end;
+}
+
+/**
+ * pk_decoder_delta_decode_samples:
+ * @state: A DeltaState.
+ * @p: The beginning of the delta encoded samples.
+ * @end: The end of the samples.
+ * @decoded: A #GByteArray to append the default encoding to.
+ *
+ * Restores the default encoding of the samples of a single frame.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE.
+ * Side effects: The previous values of the sources are updated.
+ */
+static gboolean
+pk_decoder_delta_decode_samples (DeltaState   *state,   /* IN */
+                                 const guint8 *p,       /* IN */
+                                 const guint8 *end,     /* IN */
+                                 GByteArray   *decoded) /* IN */
+{
+	DeltaSource *source;
+	guint64 source_id;
+	guint64 field;
+	guint64 len;
+	guint64 t;
+
+	ENTRY;
+	while (p < end) {
+		if (!pk_decoder_read_varint(&p, end, &field) ||
+		    field != ((1 << 3) | 0) ||
+		    !pk_decoder_read_varint(&p, end, &source_id)) {
+			RETURN(FALSE);
+		}
+		source = g_hash_table_lookup(state->sources,
+		                             GINT_TO_POINTER((gint)source_id));
+		if (!source) {
+			g_warning("Sample for source %d without a manifest.",
+			          (gint)source_id);
+			RETURN(FALSE);
+		}
+		pk_decoder_write_varint(decoded, field);
+		pk_decoder_write_varint(decoded, source_id);
+		if (!pk_decoder_read_varint(&p, end, &field) ||
+		    field != ((2 << 3) | 0) ||
+		    !pk_decoder_read_varint(&p, end, &t)) {
+			RETURN(FALSE);
+		}
+		source->prev_time += DELTA_UNZIGZAG(t);
+		pk_decoder_write_varint(decoded, field);
+		pk_decoder_write_varint(decoded, source->prev_time);
+		if (!pk_decoder_read_varint(&p, end, &field) ||
+		    field != ((3 << 3) | 2) ||
+		    !pk_decoder_read_varint(&p, end, &len) ||
+		    len > (guint64)(end - p)) {
+			RETURN(FALSE);
+		}
+		g_byte_array_set_size(state->payload, 0);
+		if (source->packed) {
+			if (!pk_decoder_delta_decode_packed(source, p, p + len,
+			                                    state->payload)) {
+				RETURN(FALSE);
+			}
+		} else if (!pk_decoder_delta_decode_payload(source, p, p + len,
+		                                            state->payload)) {
+			RETURN(FALSE);
+		}
+		p += len;
+		pk_decoder_write_varint(decoded, field);
+		pk_decoder_write_varint(decoded, state->payload->len);
+		g_byte_array_append(decoded, state->payload->data,
+		                    state->payload->len);
+	}
+	RETURN(TRUE);
+}
+
+/**
+ * pk_decoder_delta_decode:
+ * @state: A DeltaState.
+ * @data: The delta encoded buffer.
+ * @data_len: The length of @data.
+ * @decoded: A #GByteArray to append the default encoding to.
+ *
+ * Restores the default encoding of the frames encoded by the agent's
+ * Delta encoder onto the end of @decoded.  Each frame is a byte marking
+ * it as a manifest or as samples followed by its length as a varint; the
+ * agent concatenates the frames of several batches into a single buffer.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE.
+ * Side effects: The previous values of the sources are updated.
+ */
+static gboolean
+pk_decoder_delta_decode (gpointer      data_state, /* IN */
+                         const guint8 *data,       /* IN */
+                         gsize         data_len,   /* IN */
+                         GByteArray   *decoded)    /* IN */
+{
+	DeltaState *state = data_state;
+	const guint8 *p = data;
+	const guint8 *end = data + data_len;
+	guint64 len;
+	guint8 frame;
+
+	ENTRY;
+	if (!data_len) {
+		RETURN(FALSE);
+	}
+	while (p < end) {
+		frame = *p++;
+		if (!pk_decoder_read_varint(&p, end, &len) ||
+		    len > (guint64)(end - p)) {
+			RETURN(FALSE);
+		}
+		switch (frame) {
+		case DELTA_FRAME_MANIFEST:
+			if (!pk_decoder_delta_decode_manifest(state, p, len)) {
+				RETURN(FALSE);
+			}
+			g_byte_array_append(decoded, p, len);
+			break;
+		case DELTA_FRAME_SAMPLES:
+			if (!pk_decoder_delta_decode_samples(state, p, p + len,
+			                                     decoded)) {
+				RETURN(FALSE);
+			}
+			break;
+		default:
+			RETURN(FALSE);
+		}
+		p += len;
+	}
+	RETURN(TRUE);
+}
+
+/**
+ * pk_decoder_delta_destroy:
+ * @state: A DeltaState.
+ *
+ * Releases the state of the Delta decoder.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pk_decoder_delta_destroy (gpointer data_state) /* IN */
+{
+	DeltaState *state = data_state;
+
+	ENTRY;
+	g_hash_table_destroy(state->sources);
+	g_byte_array_free(state->payload, TRUE);
+	g_slice_free(DeltaState, state);
+	EXIT;
+}
+
+static const PkDecoderInfo decoders[] = {
+	{ "Delta",
+	  pk_decoder_delta_create,
+	  pk_decoder_delta_decode,
+	  pk_decoder_delta_destroy },
+	{ "ZLib",
+	  pk_decoder_zlib_create,
+	  pk_decoder_zlib_decode,
+	  pk_decoder_zlib_destroy },
+	{ NULL }
+};
+
+/**
+ * pk_decoder_new:
+ * @plugin: The identifier of the plugin that created the agent's encoder.
+ *
+ * Creates a new decoder for buffers encoded by an encoder created from
+ * @plugin.
+ *
+ * Returns: A #PkDecoder which should be freed with pk_decoder_free(), or
+ *   %NULL if no decoder is available for @plugin.
+ * Side effects: None.
+ */
+PkDecoder*
+pk_decoder_new (const gchar *plugin) /* IN */
+{
+	PkDecoder *decoder;
+	gpointer state;
+	gint i;
+
+	g_return_val_if_fail(plugin != NULL, NULL);
+
+	ENTRY;
+	for (i = 0; decoders[i].plugin; i++) {
+		if (g_str_equal(decoders[i].plugin, plugin)) {
+			if (!(state = decoders[i].create())) {
+				RETURN(NULL);
+			}
+			decoder = g_slice_new0(PkDecoder);
+			decoder->info = &decoders[i];
+			decoder->state = state;
+			decoder->decoded = g_byte_array_sized_new(CHUNK_SIZE);
+			RETURN(decoder);
+		}
+	}
+	RETURN(NULL);
+}
+
+/**
+ * pk_decoder_decode:
+ * @decoder: A #PkDecoder.
+ * @data: The encoded buffer.
+ * @data_len: The length of @data.
+ * @decoded: A location for the decoded buffer.
+ * @decoded_len: A location for the length of the decoded buffer.
+ *
+ * Decodes @data.  The decoded buffer is owned by @decoder and is only
+ * valid until the next call to pk_decoder_decode().
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE.
+ * Side effects: None.
+ */
+gboolean
+pk_decoder_decode (PkDecoder     *decoder,     /* IN */
+                   const guint8  *data,        /* IN */
+                   gsize          data_len,    /* IN */
+                   const guint8 **decoded,     /* OUT */
+                   gsize         *decoded_len) /* OUT */
+{
+	g_return_val_if_fail(decoder != NULL, FALSE);
+	g_return_val_if_fail(decoded != NULL, FALSE);
+	g_return_val_if_fail(decoded_len != NULL, FALSE);
+
+	ENTRY;
+	g_byte_array_set_size(decoder->decoded, 0);
+	if (!decoder->info->decode(decoder->state, data, data_len,
+	                           decoder->decoded)) {
+		RETURN(FALSE);
+	}
+	*decoded = decoder->decoded->data;
+	*decoded_len = decoder->decoded->len;
+	RETURN(TRUE);
+}
+
+/**
+ * pk_decoder_free:
+ * @decoder: A #PkDecoder.
+ *
+ * Frees @decoder and its state.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+void
+pk_decoder_free (PkDecoder *decoder) /* IN */
+{
+	g_return_if_fail(decoder != NULL);
+
+	ENTRY;
+	decoder->info->destroy(decoder->state);
+	g_byte_array_free(decoder->decoded, TRUE);
+	g_slice_free(PkDecoder, decoder);
+	EXIT;
+}
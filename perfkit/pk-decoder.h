@@ -0,0 +1,38 @@
+/* pk-decoder.h
+ *
+ * Copyright (C) 2010 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PK_DECODER_H__
+#define __PK_DECODER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _PkDecoder PkDecoder;
+
+PkDecoder* pk_decoder_new    (const gchar   *plugin);
+gboolean   pk_decoder_decode (PkDecoder     *decoder,
+                              const guint8  *data,
+                              gsize          data_len,
+                              const guint8 **decoded,
+                              gsize         *decoded_len);
+void       pk_decoder_free   (PkDecoder     *decoder);
+
+G_END_DECLS
+
+#endif /* __PK_DECODER_H__ */
@@ -34,6 +34,7 @@ struct _PkManifest
 	volatile gint   ref_count;
 	struct timespec ts;
 	PkResolution    resolution;
+	gboolean        packed;
 	gint            source_id;
 	gint            n_rows;
 	GArray         *rows;
@@ -208,6 +209,25 @@ pk_manifest_get_resolution (PkManifest *manifest) /* IN */
 	return manifest->resolution;
 }
 
+/**
+ * pk_manifest_get_packed:
+ * @manifest: A #PkManifest.
+ *
+ * Retrieves if the samples of the manifest use the packed layout, where
+ * the row values follow a bitmap of the rows present rather than being
+ * tagged individually.
+ *
+ * Returns: %TRUE if the samples are packed; otherwise %FALSE.
+ *
+ * Side effects: None.
+ */
+gboolean
+pk_manifest_get_packed (PkManifest *manifest) /* IN */
+{
+	g_return_val_if_fail(manifest != NULL, FALSE);
+	return manifest->packed;
+}
+
 /**
  * pk_manifest_get_n_rows:
  * @manifest: A #PkManifest.
@@ -448,5 +468,18 @@ decode (PkManifest *manifest,
 		}
 	}
 
+	/* packed samples, only sent when set */
+	if (egg_buffer_get_pos(buffer) < egg_buffer_get_length(buffer)) {
+		if (!egg_buffer_read_tag(buffer, &field, &tag)) {
+			return FALSE;
+		}
+		if (field != 5 || tag != EGG_BUFFER_BOOLEAN) {
+			return FALSE;
+		}
+		if (!egg_buffer_read_boolean(buffer, &manifest->packed)) {
+			return FALSE;
+		}
+	}
+
 	return TRUE;
 }
@@ -49,6 +49,7 @@ PkManifest*     pk_manifest_new_from_data  (const guint8    *data,
 PkManifest*     pk_manifest_ref            (PkManifest      *manifest);
 void            pk_manifest_unref          (PkManifest      *manifest);
 PkResolution    pk_manifest_get_resolution (PkManifest      *manifest);
+gboolean        pk_manifest_get_packed     (PkManifest      *manifest);
 gint            pk_manifest_get_n_rows     (PkManifest      *manifest);
 GType           pk_manifest_get_row_type   (PkManifest      *manifest,
                                             gint             row);
@@ -151,6 +151,144 @@ pk_sample_init_value (PkSample   *sample,
 	return TRUE;
 }
 
+#define PK_SAMPLE_RUN_MAX         (32)
+#define PK_SAMPLE_ROW_PRESENT(b,i) ((b)[((i) - 1) / 8] & (1 << (((i) - 1) % 8)))
+
+/*
+ * Decodes a run of present 64-bit unsigned rows starting at @first with a
+ * single call to egg_buffer_read_uint64_array().  Returns the number of rows
+ * decoded, or 0 on failure.
+ */
+static gint
+pk_sample_decode_uint64_run (PkSample     *sample,
+                             EggBuffer    *buffer,
+                             PkManifest   *manifest,
+                             const guint8 *bitmap,
+                             gint          first)
+{
+	guint64 v[PK_SAMPLE_RUN_MAX];
+	gint n_rows;
+	gint n;
+	gint i;
+
+	n_rows = pk_manifest_get_n_rows(manifest);
+	for (n = 0; n < PK_SAMPLE_RUN_MAX && first + n <= n_rows; n++) {
+		if (!PK_SAMPLE_ROW_PRESENT(bitmap, first + n) ||
+		    pk_manifest_get_row_type(manifest, first + n) != G_TYPE_UINT64) {
+			break;
+		}
+	}
+	if (!egg_buffer_read_uint64_array(buffer, v, n)) {
+		return 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		PkSampleField item;
+		GValue value = {0};
+
+		g_value_init(&value, G_TYPE_UINT64);
+		value.data[0].v_uint64 = v[i];
+		item.field = first + i;
+		item.value = value;
+		g_array_append_val(sample->ar, item);
+	}
+	return n;
+}
+
+/*
+ * Decodes the values of a packed sample.  The bitmap of the rows present is
+ * followed by their values in row order, each read according to the row
+ * type from the manifest.  Runs of 64-bit unsigned rows, the counters most
+ * sources deliver, are read in bulk.
+ */
+static gboolean
+pk_sample_decode_packed (PkSample   *sample,
+                         EggBuffer  *buffer,
+                         PkManifest *manifest,
+                         gsize       end)
+{
+	const guint8 *bitmap;
+	gint n_rows;
+	gint i;
+
+	n_rows = pk_manifest_get_n_rows(manifest);
+	if (!egg_buffer_read_bytes(buffer, &bitmap, (n_rows + 7) / 8)) {
+		return FALSE;
+	}
+
+	for (i = 1; i <= n_rows; i++) {
+		PkSampleField item;
+		GValue value = {0};
+		gchar *str;
+		gint n;
+
+		if (!PK_SAMPLE_ROW_PRESENT(bitmap, i)) {
+			continue;
+		}
+
+		if (pk_manifest_get_row_type(manifest, i) == G_TYPE_UINT64) {
+			if (!(n = pk_sample_decode_uint64_run(sample, buffer, manifest,
+			                                      bitmap, i))) {
+				return FALSE;
+			}
+			i += n - 1;
+			continue;
+		}
+
+		if (!pk_sample_init_value(sample, manifest, i, &value)) {
+			return FALSE;
+		}
+
+		switch (G_VALUE_TYPE(&value)) {
+		case G_TYPE_BOOLEAN:
+			if (!egg_buffer_read_boolean(buffer, &value.data[0].v_int)) {
+				return FALSE;
+			}
+			break;
+		case G_TYPE_INT:
+			if (!egg_buffer_read_int(buffer, &value.data[0].v_int)) {
+				return FALSE;
+			}
+			break;
+		case G_TYPE_UINT:
+			if (!egg_buffer_read_uint(buffer, &value.data[0].v_uint)) {
+				return FALSE;
+			}
+			break;
+		case G_TYPE_INT64:
+			if (!egg_buffer_read_int64(buffer, &value.data[0].v_int64)) {
+				return FALSE;
+			}
+			break;
+		case G_TYPE_DOUBLE:
+			if (!egg_buffer_read_double(buffer, &value.data[0].v_double)) {
+				return FALSE;
+			}
+			break;
+		case G_TYPE_FLOAT:
+			if (!egg_buffer_read_float(buffer, &value.data[0].v_float)) {
+				return FALSE;
+			}
+			break;
+		case G_TYPE_STRING:
+			if (!egg_buffer_read_string(buffer, &str)) {
+				return FALSE;
+			}
+			g_value_take_string(&value, str);
+			break;
+		default:
+			return FALSE;
+		}
+
+		item.field = i;
+		item.value = value;
+		g_array_append_val(sample->ar, item);
+	}
+
+	/* The values must fill the data section exactly. */
+	return egg_buffer_get_pos(buffer) == end;
+}
+
 static gboolean
 pk_sample_decode_data (PkSample   *sample,
                        EggBuffer  *buffer,
@@ -159,7 +297,8 @@ pk_sample_decode_data (PkSample   *sample,
 	guint field, tag;
 	guint data_len;
 	gsize total_len,
-	      offset;
+	      offset,
+	      end;
 
 	/* Make sure the buffer is at field 2, data. */
 	if (!egg_buffer_read_tag(buffer, &field, &tag)) {
@@ -182,7 +321,15 @@ pk_sample_decode_data (PkSample   *sample,
 		return FALSE;
 	}
 
-	while (offset < total_len) {
+	/*
+	 * The buffer may contain more samples after this one, so only read
+	 * up to the end of this samples data section.
+	 */
+	end = offset + data_len;
+	if (pk_manifest_get_packed(manifest)) {
+		return pk_sample_decode_packed(sample, buffer, manifest, end);
+	}
+	while (offset < end) {
 		PkSampleField item;
 		GValue value = {0};
 		GType type;
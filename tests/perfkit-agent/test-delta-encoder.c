@@ -0,0 +1,225 @@
+#include <perfkit-agent/perfkit-agent.h>
+#include <perfkit/pk-decoder.h>
+#include <string.h>
+
+extern GObject* delta_encoder_new          (GError **error);
+extern void     pka_manifest_set_source_id (PkaManifest *m, gint i);
+
+static void
+decode_append (PkDecoder  *decoder,
+               GByteArray *buffer,
+               GByteArray *ar)
+{
+	const guint8 *decoded;
+	gsize decoded_len;
+
+	g_assert(pk_decoder_decode(decoder, buffer->data, buffer->len,
+	                           &decoded, &decoded_len));
+	g_byte_array_append(ar, decoded, decoded_len);
+	g_byte_array_set_size(buffer, 0);
+}
+
+static void
+test_DeltaEncoder_roundtrip (void)
+{
+	PkaEncoder *encoder;
+	PkDecoder *decoder;
+	PkaManifest *m1;
+	PkaManifest *m2;
+	PkaSample *s1[3];
+	PkaSample *s2[3];
+	GByteArray *expected;
+	GByteArray *decoded;
+	GByteArray *buffer;
+	gint i;
+	gint j;
+
+	encoder = PKA_ENCODER(delta_encoder_new(NULL));
+	decoder = pk_decoder_new("Delta");
+	g_assert(decoder != NULL);
+
+	m1 = pka_manifest_new();
+	pka_manifest_set_source_id(m1, 1);
+	pka_manifest_append(m1, "Counter", G_TYPE_UINT64);
+	pka_manifest_append(m1, "Gauge", G_TYPE_INT);
+	pka_manifest_append(m1, "Ratio", G_TYPE_DOUBLE);
+
+	m2 = pka_manifest_new();
+	pka_manifest_set_source_id(m2, 2);
+	pka_manifest_append(m2, "Name", G_TYPE_STRING);
+	pka_manifest_append(m2, "Counter", G_TYPE_UINT);
+
+	expected = g_byte_array_new();
+	decoded = g_byte_array_new();
+	buffer = g_byte_array_new();
+
+	/*
+	 * Both manifests in a single buffer.
+	 */
+	g_assert(pka_encoder_encode_manifest_append(NULL, m1, expected));
+	g_assert(pka_encoder_encode_manifest_append(NULL, m2, expected));
+	g_assert(pka_encoder_encode_manifest_append(encoder, m1, buffer));
+	g_assert(pka_encoder_encode_manifest_append(encoder, m2, buffer));
+	decode_append(decoder, buffer, decoded);
+
+	for (i = 0; i < 32; i++) {
+		/*
+		 * Halfway through, the manifest of the first source changes and
+		 * the types of its rows with it.
+		 */
+		if (i == 16) {
+			pka_manifest_unref(m1);
+			m1 = pka_manifest_new();
+			pka_manifest_set_source_id(m1, 1);
+			pka_manifest_append(m1, "Ratio", G_TYPE_DOUBLE);
+			pka_manifest_append(m1, "Counter", G_TYPE_INT64);
+			g_assert(pka_encoder_encode_manifest_append(NULL, m1, expected));
+			g_assert(pka_encoder_encode_manifest_append(encoder, m1, buffer));
+			decode_append(decoder, buffer, decoded);
+		}
+		for (j = 0; j < G_N_ELEMENTS(s1); j++) {
+			s1[j] = pka_sample_new();
+			s2[j] = pka_sample_new();
+			if (i < 16) {
+				pka_sample_append_uint64(s1[j], 1, G_MAXUINT64 - i * 3 - j);
+				pka_sample_append_int(s1[j], 2, (i * 3 + j) * ((j & 1) ? -7 : 7));
+				pka_sample_append_double(s1[j], 3, 1.0 / (i * 3 + j + 1));
+			} else {
+				pka_sample_append_double(s1[j], 1, i * 0.25);
+				pka_sample_append_int64(s1[j], 2, G_MININT64 + i * 3 + j);
+			}
+			pka_sample_append_string(s2[j], 1, "unchanged");
+			pka_sample_append_uint(s2[j], 2, i * 1000 + j);
+		}
+		g_assert(pka_encoder_encode_samples_append(NULL, m1, s1,
+		                                           G_N_ELEMENTS(s1),
+		                                           expected));
+		g_assert(pka_encoder_encode_samples_append(NULL, m2, s2,
+		                                           G_N_ELEMENTS(s2),
+		                                           expected));
+		/*
+		 * The batches of both sources concatenated into one buffer, as
+		 * done by the subscription when it flushes.
+		 */
+		g_assert(pka_encoder_encode_samples_append(encoder, m1, s1,
+		                                           G_N_ELEMENTS(s1),
+		                                           buffer));
+		g_assert(pka_encoder_encode_samples_append(encoder, m2, s2,
+		                                           G_N_ELEMENTS(s2),
+		                                           buffer));
+		decode_append(decoder, buffer, decoded);
+		g_assert_cmpint(decoded->len, ==, expected->len);
+		for (j = 0; j < G_N_ELEMENTS(s1); j++) {
+			pka_sample_unref(s1[j]);
+			pka_sample_unref(s2[j]);
+		}
+	}
+	g_assert(memcmp(decoded->data, expected->data, expected->len) == 0);
+
+	g_byte_array_unref(expected);
+	g_byte_array_unref(decoded);
+	g_byte_array_unref(buffer);
+	pka_manifest_unref(m1);
+	pka_manifest_unref(m2);
+	pk_decoder_free(decoder);
+	g_object_unref(encoder);
+}
+
+static void
+test_DeltaEncoder_packed (void)
+{
+	PkaEncoder *encoder;
+	PkDecoder *decoder;
+	PkaManifest *m;
+	PkaSample *s[4];
+	GByteArray *expected;
+	GByteArray *decoded;
+	GByteArray *buffer;
+	gint i;
+	gint j;
+
+	encoder = PKA_ENCODER(delta_encoder_new(NULL));
+	decoder = pk_decoder_new("Delta");
+
+	m = pka_manifest_new();
+	pka_manifest_set_source_id(m, 1);
+	pka_manifest_set_packed(m, TRUE);
+	pka_manifest_append(m, "Counter", G_TYPE_UINT64);
+	pka_manifest_append(m, "Gauge", G_TYPE_INT);
+	pka_manifest_append(m, "Ratio", G_TYPE_DOUBLE);
+	pka_manifest_append(m, "Up", G_TYPE_BOOLEAN);
+	pka_manifest_append(m, "Load", G_TYPE_FLOAT);
+	pka_manifest_append(m, "Name", G_TYPE_STRING);
+	pka_manifest_append(m, "Errors", G_TYPE_UINT);
+	pka_manifest_append(m, "Offset", G_TYPE_INT64);
+	pka_manifest_append(m, "Total", G_TYPE_UINT64);
+
+	expected = g_byte_array_new();
+	decoded = g_byte_array_new();
+	buffer = g_byte_array_new();
+
+	g_assert(pka_encoder_encode_manifest_append(NULL, m, expected));
+	g_assert(pka_encoder_encode_manifest_append(encoder, m, buffer));
+	decode_append(decoder, buffer, decoded);
+
+	for (i = 0; i < 32; i++) {
+		for (j = 0; j < G_N_ELEMENTS(s); j++) {
+			/*
+			 * Rows are skipped in turn, so the values do not line up with
+			 * the same rows from one sample to the next.
+			 */
+			s[j] = pka_sample_new_packed(m);
+			if ((i + j) % 3) {
+				pka_sample_append_uint64(s[j], 1, G_MAXUINT64 - i * 1000 - j);
+			}
+			pka_sample_append_int(s[j], 2, (i * 4 + j) * ((j & 1) ? -3 : 3));
+			if ((i + j) % 4) {
+				pka_sample_append_double(s[j], 3, 1.0 / (i * 4 + j + 1));
+			}
+			pka_sample_append_boolean(s[j], 4, j & 1);
+			pka_sample_append_float(s[j], 5, i * 0.5f);
+			if (j == 2) {
+				pka_sample_append_string(s[j], 6, "eth0");
+			}
+			pka_sample_append_uint(s[j], 7, i * 10);
+			pka_sample_append_int64(s[j], 8, G_MININT64 + i * 4 + j);
+			if ((i + j) % 5) {
+				pka_sample_append_uint64(s[j], 9, (guint64)i << 40);
+			}
+		}
+		g_assert(pka_encoder_encode_samples_append(NULL, m, s,
+		                                           G_N_ELEMENTS(s),
+		                                           expected));
+		g_assert(pka_encoder_encode_samples_append(encoder, m, s, 2,
+		                                           buffer));
+		g_assert(pka_encoder_encode_samples_append(encoder, m, s + 2, 2,
+		                                           buffer));
+		decode_append(decoder, buffer, decoded);
+		g_assert_cmpint(decoded->len, ==, expected->len);
+		for (j = 0; j < G_N_ELEMENTS(s); j++) {
+			pka_sample_unref(s[j]);
+		}
+	}
+	g_assert(memcmp(decoded->data, expected->data, expected->len) == 0);
+
+	g_byte_array_unref(expected);
+	g_byte_array_unref(decoded);
+	g_byte_array_unref(buffer);
+	pka_manifest_unref(m);
+	pk_decoder_free(decoder);
+	g_object_unref(encoder);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+	g_thread_init(NULL);
+	g_type_init();
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/DeltaEncoder/roundtrip", test_DeltaEncoder_roundtrip);
+	g_test_add_func("/DeltaEncoder/packed", test_DeltaEncoder_packed);
+
+	return g_test_run();
+}
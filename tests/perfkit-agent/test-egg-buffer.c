@@ -0,0 +1,261 @@
+#include <glib.h>
+#include <string.h>
+#include <cut-n-paste/egg-buffer.h>
+
+#define N_VALUES (4096)
+
+static const guint64 boundaries[] = {
+	0,
+	1,
+	0x7F,
+	0x80,
+	0x3FFF,
+	0x4000,
+	0x1FFFFF,
+	0x200000,
+	0xFFFFFFF,
+	0x10000000,
+	G_MAXUINT32,
+	G_GUINT64_CONSTANT(0x100000000),
+	G_GUINT64_CONSTANT(0xFFFFFFFFFFFFFF),
+	G_GUINT64_CONSTANT(0x100000000000000),
+	G_GUINT64_CONSTANT(0x7FFFFFFFFFFFFFFF),
+	G_MAXUINT64,
+};
+
+/*
+ * Generates values with a uniformly distributed number of significant bits
+ * so that every varint length is represented.
+ */
+static void
+fill_values (guint64 *v,
+             gsize    n_v,
+             guint    max_bits)
+{
+	guint64 u;
+	guint bits;
+	gsize i;
+
+	for (i = 0; i < n_v; i++) {
+		bits = g_test_rand_int_range(0, max_bits + 1);
+		u = ((guint64)g_test_rand_int() << 32) | (guint32)g_test_rand_int();
+		v[i] = bits ? (u >> (64 - bits)) : 0;
+	}
+}
+
+static void
+test_EggBuffer_uint64 (void)
+{
+	EggBuffer *w;
+	EggBuffer *b;
+	const guint8 *data;
+	gsize len;
+	guint64 u;
+	gint i;
+
+	w = egg_buffer_new();
+	for (i = 0; i < G_N_ELEMENTS(boundaries); i++) {
+		egg_buffer_write_uint64(w, boundaries[i]);
+	}
+	egg_buffer_get_buffer(w, &data, &len);
+	g_assert_cmpint(len, ==, 1 + 1 + 1 + 2 + 2 + 3 + 3 + 4 + 4 + 5 + 5 + 5 +
+	                         8 + 9 + 9 + 10);
+	b = egg_buffer_new_from_data(data, len);
+	for (i = 0; i < G_N_ELEMENTS(boundaries); i++) {
+		g_assert(egg_buffer_read_uint64(b, &u));
+		g_assert_cmpuint(u, ==, boundaries[i]);
+	}
+	g_assert_cmpint(egg_buffer_get_pos(b), ==, len);
+	g_assert(!egg_buffer_read_uint64(b, &u));
+	egg_buffer_unref(b);
+	egg_buffer_unref(w);
+}
+
+static void
+test_EggBuffer_uint (void)
+{
+	EggBuffer *w;
+	EggBuffer *b;
+	const guint8 *data;
+	gsize len;
+	guint u;
+	gint i;
+
+	w = egg_buffer_new();
+	for (i = 0; boundaries[i] <= G_MAXUINT32; i++) {
+		egg_buffer_write_uint(w, boundaries[i]);
+	}
+	/* too long for a 32-bit integer */
+	egg_buffer_write_uint64(w, G_GUINT64_CONSTANT(0x10000000000));
+	egg_buffer_get_buffer(w, &data, &len);
+	b = egg_buffer_new_from_data(data, len);
+	for (i = 0; boundaries[i] <= G_MAXUINT32; i++) {
+		g_assert(egg_buffer_read_uint(b, &u));
+		g_assert_cmpuint(u, ==, boundaries[i]);
+	}
+	g_assert(!egg_buffer_read_uint(b, &u));
+	egg_buffer_unref(b);
+	egg_buffer_unref(w);
+}
+
+static void
+test_EggBuffer_truncated (void)
+{
+	static const guint8 data[] = { 0x80, 0x80, 0x80, 0x80,
+	                               0x80, 0x80, 0x80, 0x80,
+	                               0x80, 0x80, 0x80, 0x01 };
+	EggBuffer *b;
+	guint64 u;
+	gsize i;
+
+	/* every prefix ends in the middle of a varint */
+	for (i = 0; i < sizeof data; i++) {
+		b = egg_buffer_new_from_data(data, i);
+		g_assert(!egg_buffer_read_uint64(b, &u));
+		egg_buffer_unref(b);
+	}
+	/* more than 10 bytes never terminates a 64-bit varint */
+	b = egg_buffer_new_from_data(data, sizeof data);
+	g_assert(!egg_buffer_read_uint64(b, &u));
+	egg_buffer_unref(b);
+}
+
+static void
+test_EggBuffer_uint64_array (void)
+{
+	EggBuffer *w;
+	EggBuffer *b;
+	EggBuffer *single;
+	const guint8 *data;
+	const guint8 *sdata;
+	guint64 *v;
+	guint64 *r;
+	gsize len;
+	gsize slen;
+	gint i;
+
+	v = g_new(guint64, N_VALUES);
+	r = g_new(guint64, N_VALUES);
+	fill_values(v, N_VALUES, 64);
+
+	/* bulk encoding matches encoding one at a time */
+	w = egg_buffer_new();
+	single = egg_buffer_new();
+	egg_buffer_write_uint64_array(w, v, N_VALUES);
+	for (i = 0; i < N_VALUES; i++) {
+		egg_buffer_write_uint64(single, v[i]);
+	}
+	egg_buffer_get_buffer(w, &data, &len);
+	egg_buffer_get_buffer(single, &sdata, &slen);
+	g_assert_cmpint(len, ==, slen);
+	g_assert(memcmp(data, sdata, len) == 0);
+	egg_buffer_unref(single);
+
+	/* and decodes back to the same values */
+	b = egg_buffer_new_from_data(data, len);
+	g_assert(egg_buffer_read_uint64_array(b, r, N_VALUES));
+	g_assert(memcmp(v, r, N_VALUES * sizeof(guint64)) == 0);
+	g_assert_cmpint(egg_buffer_get_pos(b), ==, len);
+	egg_buffer_unref(b);
+
+	/* a failed bulk read does not move the offset */
+	b = egg_buffer_new_from_data(data, len - 1);
+	g_assert(!egg_buffer_read_uint64_array(b, r, N_VALUES));
+	g_assert_cmpint(egg_buffer_get_pos(b), ==, 0);
+	egg_buffer_unref(b);
+	egg_buffer_unref(w);
+
+	g_free(v);
+	g_free(r);
+}
+
+static void
+test_EggBuffer_perf (void)
+{
+	EggBuffer *w;
+	EggBuffer *b;
+	const guint8 *data;
+	gsize len;
+	guint64 *v;
+	guint64 u;
+	gdouble elapsed;
+	gint rounds = 1000;
+	gint i;
+	gint j;
+
+	v = g_new(guint64, N_VALUES);
+	/* counter style values, mostly 1 to 5 bytes */
+	fill_values(v, N_VALUES, 32);
+
+	w = egg_buffer_new();
+	g_test_timer_start();
+	for (i = 0; i < rounds; i++) {
+		egg_buffer_reset(w);
+		for (j = 0; j < N_VALUES; j++) {
+			egg_buffer_write_uint64(w, v[j]);
+		}
+	}
+	elapsed = g_test_timer_elapsed();
+	g_test_minimized_result(elapsed * 1e9 / (rounds * N_VALUES),
+	                        "write_uint64: %.2f ns/varint",
+	                        elapsed * 1e9 / (rounds * N_VALUES));
+
+	g_test_timer_start();
+	for (i = 0; i < rounds; i++) {
+		egg_buffer_reset(w);
+		egg_buffer_write_uint64_array(w, v, N_VALUES);
+	}
+	elapsed = g_test_timer_elapsed();
+	g_test_minimized_result(elapsed * 1e9 / (rounds * N_VALUES),
+	                        "write_uint64_array: %.2f ns/varint",
+	                        elapsed * 1e9 / (rounds * N_VALUES));
+
+	/*
+	 * The readers are timed including the copy of the encoded buffer made
+	 * by egg_buffer_new_from_data() on every round.
+	 */
+	egg_buffer_get_buffer(w, &data, &len);
+	g_test_timer_start();
+	for (i = 0; i < rounds; i++) {
+		b = egg_buffer_new_from_data(data, len);
+		for (j = 0; j < N_VALUES; j++) {
+			egg_buffer_read_uint64(b, &u);
+		}
+		egg_buffer_unref(b);
+	}
+	elapsed = g_test_timer_elapsed();
+	g_test_minimized_result(elapsed * 1e9 / (rounds * N_VALUES),
+	                        "read_uint64: %.2f ns/varint",
+	                        elapsed * 1e9 / (rounds * N_VALUES));
+
+	g_test_timer_start();
+	for (i = 0; i < rounds; i++) {
+		b = egg_buffer_new_from_data(data, len);
+		egg_buffer_read_uint64_array(b, v, N_VALUES);
+		egg_buffer_unref(b);
+	}
+	elapsed = g_test_timer_elapsed();
+	g_test_minimized_result(elapsed * 1e9 / (rounds * N_VALUES),
+	                        "read_uint64_array: %.2f ns/varint",
+	                        elapsed * 1e9 / (rounds * N_VALUES));
+
+	egg_buffer_unref(w);
+	g_free(v);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/EggBuffer/uint64", test_EggBuffer_uint64);
+	g_test_add_func("/EggBuffer/uint", test_EggBuffer_uint);
+	g_test_add_func("/EggBuffer/truncated", test_EggBuffer_truncated);
+	g_test_add_func("/EggBuffer/uint64_array", test_EggBuffer_uint64_array);
+	if (g_test_perf()) {
+		g_test_add_func("/EggBuffer/perf", test_EggBuffer_perf);
+	}
+
+	return g_test_run();
+}
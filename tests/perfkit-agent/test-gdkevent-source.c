@@ -0,0 +1,141 @@
+#include "perfkit-agent/sources/gdkevent.c"
+
+extern void pka_config_init (const gchar *filename);
+
+static const gchar*
+ring_name (gchar **env)
+{
+	gsize len = strlen(GDKEVENT_RING_ENV);
+	gint i;
+
+	for (i = 0; env[i]; i++) {
+		if (g_str_has_prefix(env[i], GDKEVENT_RING_ENV) &&
+		    env[i][len] == '=') {
+			return &env[i][len + 1];
+		}
+	}
+	return NULL;
+}
+
+static GdkeventRing*
+producer_open (gchar **env)
+{
+	const gchar *name;
+	gpointer map;
+	gint fd;
+
+	name = ring_name(env);
+	g_assert(name != NULL);
+	fd = shm_open(name, O_RDWR, 0);
+	g_assert_cmpint(fd, >=, 0);
+	map = mmap(NULL, sizeof(GdkeventRing), PROT_READ | PROT_WRITE,
+	           MAP_SHARED, fd, 0);
+	close(fd);
+	g_assert(map != MAP_FAILED);
+	return map;
+}
+
+static void
+producer_write (GdkeventRing *ring,
+                gint          n_records)
+{
+	GdkeventRecord *record;
+	gint i;
+
+	for (i = 0; i < n_records; i++) {
+		record = &ring->records[ring->head & (ring->n_records - 1)];
+		memset(record, 0, sizeof(*record));
+		record->type = i;
+		record->time = 1000 + i;
+		__sync_synchronize();
+		ring->head++;
+	}
+}
+
+static void
+test_Gdkevent_ring (void)
+{
+	PkaSpawnInfo spawn_info = { 0 };
+	GdkeventPrivate *priv;
+	GdkeventRing *ring;
+	PkaSource *source;
+	GError *error = NULL;
+	gchar *first;
+
+	source = PKA_SOURCE(gdkevent_new(NULL));
+	priv = GDKEVENT_SOURCE(source)->priv;
+	g_assert(PKA_SOURCE_GET_CLASS(source)->modify_spawn_info(source,
+	                                                         &spawn_info,
+	                                                         &error));
+	g_assert_no_error(error);
+	g_assert(priv->ring != NULL);
+	g_assert_cmpstr(ring_name(spawn_info.env), ==, priv->name);
+
+	ring = producer_open(spawn_info.env);
+	g_assert_cmpint(ring->magic, ==, GDKEVENT_RING_MAGIC);
+	g_assert_cmpint(ring->n_records, ==, GDKEVENT_RING_N_RECORDS);
+
+	/* released once drained, across the end of the ring */
+	producer_write(ring, GDKEVENT_RING_N_RECORDS - 3);
+	gdkevent_sample(PKA_SOURCE_SIMPLE(source), NULL);
+	g_assert_cmpint(ring->tail, ==, ring->head);
+	producer_write(ring, 7);
+	gdkevent_sample(PKA_SOURCE_SIMPLE(source), NULL);
+	g_assert_cmpint(ring->tail, ==, GDKEVENT_RING_N_RECORDS + 4);
+	g_assert(priv->manifest != NULL);
+	munmap(ring, sizeof(GdkeventRing));
+
+	/* respawned without being stopped, the old ring is replaced */
+	first = g_strdup(priv->name);
+	g_strfreev(spawn_info.env);
+	spawn_info.env = NULL;
+	g_assert(PKA_SOURCE_GET_CLASS(source)->modify_spawn_info(source,
+	                                                         &spawn_info,
+	                                                         NULL));
+	g_assert_cmpstr(priv->name, !=, first);
+	g_assert_cmpint(shm_open(first, O_RDWR, 0), ==, -1);
+	g_assert_cmpint(errno, ==, ENOENT);
+	ring = producer_open(spawn_info.env);
+	g_assert_cmpint(ring->head, ==, 0);
+	g_assert_cmpint(ring->tail, ==, 0);
+	munmap(ring, sizeof(GdkeventRing));
+	g_free(first);
+
+	/* closed when stopped */
+	first = g_strdup(priv->name);
+	gdkevent_stopped(source);
+	g_assert(priv->ring == NULL);
+	g_assert(priv->name == NULL);
+	g_assert_cmpint(shm_open(first, O_RDWR, 0), ==, -1);
+	g_free(first);
+
+	/* and sampling a stopped source does nothing */
+	gdkevent_sample(PKA_SOURCE_SIMPLE(source), NULL);
+
+	g_strfreev(spawn_info.env);
+	g_object_unref(source);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+	gchar *filename;
+	gint fd;
+
+	g_thread_init(NULL);
+	g_type_init();
+	g_test_init(&argc, &argv, NULL);
+
+	/* an empty configuration, so the defaults are used */
+	fd = g_file_open_tmp("test-gdkevent-XXXXXX", &filename, NULL);
+	g_assert_cmpint(fd, >=, 0);
+	close(fd);
+	pka_config_init(filename);
+	unlink(filename);
+	g_free(filename);
+
+	g_test_add_func("/Gdkevent/ring", test_Gdkevent_ring);
+
+	return g_test_run();
+}
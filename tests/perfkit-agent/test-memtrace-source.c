@@ -0,0 +1,254 @@
+#include "perfkit-agent/sources/memtrace.c"
+
+extern void pka_config_init (const gchar *filename);
+
+static void
+priv_init (MemtracePrivate *priv)
+{
+	memset(priv, 0, sizeof(*priv));
+	priv->ring = g_malloc0(sizeof(MemtraceRing));
+	priv->live = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	                                   NULL, memtrace_live_free);
+	priv->sites = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	                                    NULL, memtrace_site_free);
+	priv->orphans = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	                                      NULL, memtrace_orphan_free);
+}
+
+static void
+priv_destroy (MemtracePrivate *priv)
+{
+	g_free(priv->ring);
+	g_hash_table_unref(priv->live);
+	g_hash_table_unref(priv->sites);
+	g_hash_table_unref(priv->orphans);
+}
+
+static MemtraceBlock*
+reserve (MemtraceRing *ring)
+{
+	return &ring->blocks[ring->head++ & (MEMTRACE_RING_N_BLOCKS - 1)];
+}
+
+static void
+record (MemtraceBlock *block,
+        guint32        type,
+        guint64        addr,
+        guint64        size,
+        guint64        caller,
+        guint64        time_)
+{
+	MemtraceRecord *rec = &block->records[block->n_records++];
+
+	rec->type = type;
+	rec->addr = addr;
+	rec->size = size;
+	rec->caller = caller;
+	rec->time = time_;
+}
+
+static void
+publish (MemtraceRing  *ring,
+         MemtraceBlock *block)
+{
+	block->seq = (block - ring->blocks) + 1;
+}
+
+static MemtraceSite*
+site (MemtracePrivate *priv,
+      guint64          caller)
+{
+	return g_hash_table_lookup(priv->sites, GSIZE_TO_POINTER(caller));
+}
+
+static void
+test_Memtrace_drain (void)
+{
+	MemtracePrivate priv;
+	MemtraceBlock *a;
+	MemtraceBlock *b;
+
+	priv_init(&priv);
+
+	a = reserve(priv.ring);
+	record(a, MEMTRACE_MALLOC, 0x1000, 100, 1, 10);
+	record(a, MEMTRACE_MALLOC, 0x2000, 50, 2, 11);
+	record(a, MEMTRACE_MMAP, 0x10000, 4096, 2, 12);
+	publish(priv.ring, a);
+	b = reserve(priv.ring);
+	record(b, MEMTRACE_FREE, 0x1000, 0, 0, 20);
+	record(b, MEMTRACE_MUNMAP, 0x10000, 4096, 0, 21);
+	publish(priv.ring, b);
+
+	memtrace_drain(&priv);
+	g_assert_cmpint(priv.ring->tail, ==, priv.ring->head);
+	g_assert_cmpint(priv.n_allocs, ==, 3);
+	g_assert_cmpint(priv.n_frees, ==, 2);
+	g_assert_cmpint(priv.alloc_bytes, ==, 4246);
+	g_assert_cmpint(priv.classes[g_bit_storage(100)], ==, 1);
+	g_assert_cmpint(priv.live_count, ==, 1);
+	g_assert_cmpint(priv.live_bytes, ==, 50);
+	g_assert_cmpint(site(&priv, 1)->live_bytes, ==, 0);
+	g_assert_cmpint(site(&priv, 1)->n_allocs, ==, 1);
+	g_assert_cmpint(site(&priv, 2)->live_bytes, ==, 50);
+	g_assert_cmpint(site(&priv, 2)->n_allocs, ==, 2);
+
+	/* a block reserved but not yet published holds back the ones after it */
+	a = reserve(priv.ring);
+	record(a, MEMTRACE_FREE, 0x2000, 0, 0, 30);
+	b = reserve(priv.ring);
+	record(b, MEMTRACE_MALLOC, 0x3000, 8, 3, 31);
+	publish(priv.ring, b);
+	memtrace_drain(&priv);
+	g_assert_cmpint(priv.ring->tail, ==, priv.ring->head - 2);
+	g_assert_cmpint(priv.live_count, ==, 1);
+
+	publish(priv.ring, a);
+	memtrace_drain(&priv);
+	g_assert_cmpint(priv.ring->tail, ==, priv.ring->head);
+	g_assert_cmpint(priv.live_count, ==, 1);
+	g_assert_cmpint(priv.live_bytes, ==, 8);
+	g_assert_cmpint(g_hash_table_size(priv.orphans), ==, 0);
+
+	priv_destroy(&priv);
+}
+
+static void
+test_Memtrace_reorder (void)
+{
+	MemtracePrivate priv;
+	MemtraceBlock *a;
+	MemtraceBlock *b;
+
+	priv_init(&priv);
+
+	/*
+	 * Thread a allocates and frees an address which thread b allocates
+	 * next, and the block of b is read first.
+	 */
+	b = reserve(priv.ring);
+	record(b, MEMTRACE_MALLOC, 0x1000, 7, 2, 30);
+	a = reserve(priv.ring);
+	record(a, MEMTRACE_MALLOC, 0x1000, 100, 1, 10);
+	record(a, MEMTRACE_FREE, 0x1000, 0, 0, 20);
+	publish(priv.ring, a);
+	publish(priv.ring, b);
+	memtrace_drain(&priv);
+	g_assert_cmpint(priv.live_count, ==, 1);
+	g_assert_cmpint(priv.live_bytes, ==, 7);
+	g_assert_cmpint(site(&priv, 1)->live_count, ==, 0);
+	g_assert_cmpint(site(&priv, 2)->live_bytes, ==, 7);
+	g_assert_cmpint(g_hash_table_size(priv.orphans), ==, 0);
+
+	/* a free read before its allocation */
+	a = reserve(priv.ring);
+	record(a, MEMTRACE_FREE, 0x2000, 0, 0, 40);
+	publish(priv.ring, a);
+	memtrace_drain(&priv);
+	g_assert_cmpint(g_hash_table_size(priv.orphans), ==, 1);
+	b = reserve(priv.ring);
+	record(b, MEMTRACE_MALLOC, 0x2000, 16, 1, 35);
+	publish(priv.ring, b);
+	memtrace_drain(&priv);
+	g_assert_cmpint(priv.live_count, ==, 1);
+	g_assert_cmpint(g_hash_table_size(priv.orphans), ==, 0);
+
+	/* an orphan older than the allocation released an earlier one */
+	a = reserve(priv.ring);
+	record(a, MEMTRACE_FREE, 0x3000, 0, 0, 41);
+	record(a, MEMTRACE_MALLOC, 0x3000, 32, 1, 50);
+	publish(priv.ring, a);
+	memtrace_drain(&priv);
+	g_assert_cmpint(priv.live_count, ==, 2);
+	g_assert_cmpint(priv.live_bytes, ==, 39);
+
+	/* orphans whose allocation never shows up expire */
+	a = reserve(priv.ring);
+	record(a, MEMTRACE_FREE, 0x4000, 0, 0, 60);
+	publish(priv.ring, a);
+	b = reserve(priv.ring);
+	record(b, MEMTRACE_MALLOC, 0x5000, 1, 1, 61 + MEMTRACE_ORPHAN_NSEC);
+	publish(priv.ring, b);
+	memtrace_drain(&priv);
+	g_assert_cmpint(g_hash_table_size(priv.orphans), ==, 0);
+	g_assert_cmpint(priv.live_count, ==, 3);
+
+	priv_destroy(&priv);
+}
+
+static void
+test_Memtrace_respawn (void)
+{
+	PkaSpawnInfo spawn_info = { 0 };
+	MemtracePrivate *priv;
+	MemtraceBlock *block;
+	PkaSource *source;
+	GError *error = NULL;
+	gchar *first;
+
+	source = PKA_SOURCE(memtrace_new(NULL));
+	priv = MEMTRACE_SOURCE(source)->priv;
+	g_assert(PKA_SOURCE_GET_CLASS(source)->modify_spawn_info(source,
+	                                                         &spawn_info,
+	                                                         &error));
+	g_assert_no_error(error);
+	g_assert(priv->ring != NULL);
+	block = reserve(priv->ring);
+	record(block, MEMTRACE_MALLOC, 0x1000, 100, 1, 10);
+	publish(priv->ring, block);
+	memtrace_drain(priv);
+	g_assert_cmpint(priv->live_count, ==, 1);
+
+	/* respawned without being stopped, the old ring and counts go away */
+	first = g_strdup(priv->name);
+	g_strfreev(spawn_info.env);
+	spawn_info.env = NULL;
+	g_assert(PKA_SOURCE_GET_CLASS(source)->modify_spawn_info(source,
+	                                                         &spawn_info,
+	                                                         NULL));
+	g_assert_cmpstr(priv->name, !=, first);
+	g_assert_cmpint(shm_open(first, O_RDWR, 0), ==, -1);
+	g_assert_cmpint(priv->ring->head, ==, 0);
+	g_assert_cmpint(priv->live_count, ==, 0);
+	g_assert_cmpint(priv->live_bytes, ==, 0);
+	g_assert_cmpint(g_hash_table_size(priv->live), ==, 0);
+	g_assert_cmpint(g_hash_table_size(priv->sites), ==, 0);
+	g_free(first);
+
+	/* closed when stopped */
+	first = g_strdup(priv->name);
+	memtrace_stopped(source);
+	g_assert(priv->ring == NULL);
+	g_assert(priv->name == NULL);
+	g_assert_cmpint(shm_open(first, O_RDWR, 0), ==, -1);
+	g_free(first);
+
+	g_strfreev(spawn_info.env);
+	g_object_unref(source);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+	gchar *filename;
+	gint fd;
+
+	g_thread_init(NULL);
+	g_type_init();
+	g_test_init(&argc, &argv, NULL);
+
+	/* an empty configuration, so the defaults are used */
+	fd = g_file_open_tmp("test-memtrace-XXXXXX", &filename, NULL);
+	g_assert_cmpint(fd, >=, 0);
+	close(fd);
+	pka_config_init(filename);
+	unlink(filename);
+	g_free(filename);
+
+	g_test_add_func("/Memtrace/drain", test_Memtrace_drain);
+	g_test_add_func("/Memtrace/reorder", test_Memtrace_reorder);
+	g_test_add_func("/Memtrace/respawn", test_Memtrace_respawn);
+
+	return g_test_run();
+}
@@ -1,5 +1,6 @@
 #include <perfkit-agent/perfkit-agent.h>
 #include <cut-n-paste/egg-buffer.h>
+#include <string.h>
 
 extern void pka_manifest_set_source_id (PkaManifest *m, gint i);
 extern void pka_sample_set_source_id   (PkaSample   *s, gint i);
@@ -198,6 +199,98 @@ test_PkaEncoder_encode_samples (void)
 	pka_sample_unref(samples[3]);
 }
 
+static void
+test_PkaEncoder_encode_append (void)
+{
+	PkaSample *samples[2];
+	PkaManifest *m;
+	GByteArray *ar;
+	guint8 *buf;
+	gsize len;
+	guint offset;
+
+	SETUP_MANIFEST(m);
+	samples[0] = pka_sample_new();
+	samples[1] = pka_sample_new();
+	pka_sample_append_uint(samples[0], 1, 123);
+	pka_sample_append_double(samples[1], 3, 123.45);
+
+	ar = g_byte_array_new();
+	g_byte_array_append(ar, (guint8 *)"xyz", 3);
+
+	/* manifest appended after existing data */
+	g_assert(pka_encoder_encode_manifest(NULL, m, &buf, &len));
+	g_assert(pka_encoder_encode_manifest_append(NULL, m, ar));
+	g_assert_cmpint(ar->len, ==, 3 + len);
+	g_assert(memcmp(ar->data, "xyz", 3) == 0);
+	g_assert(memcmp(ar->data + 3, buf, len) == 0);
+	g_free(buf);
+
+	/* samples appended after the manifest */
+	offset = ar->len;
+	g_assert(pka_encoder_encode_samples(NULL, m, samples, 2, &buf, &len));
+	g_assert(pka_encoder_encode_samples_append(NULL, m, samples, 2, ar));
+	g_assert_cmpint(ar->len, ==, offset + len);
+	g_assert(memcmp(ar->data + offset, buf, len) == 0);
+	g_free(buf);
+
+	g_byte_array_unref(ar);
+	pka_sample_unref(samples[0]);
+	pka_sample_unref(samples[1]);
+	pka_manifest_unref(m);
+}
+
+static void
+test_PkaEncoder_encode_shared (void)
+{
+	PkaSample *samples[2];
+	PkaManifest *m;
+	GByteArray *a;
+	GByteArray *b;
+	guint8 *buf;
+	gsize len;
+
+	SETUP_MANIFEST(m);
+	samples[0] = pka_sample_new();
+	samples[1] = pka_sample_new();
+	pka_sample_append_uint(samples[0], 1, 123);
+	pka_sample_append_double(samples[1], 3, 123.45);
+
+	/* the default encoding is shared */
+	g_assert(pka_encoder_is_shareable(NULL));
+
+	/* manifest is encoded once and matches the default encoding */
+	a = pka_encoder_encode_manifest_shared(NULL, m);
+	b = pka_encoder_encode_manifest_shared(NULL, m);
+	g_assert(a != NULL);
+	g_assert(a == b);
+	g_assert(pka_encoder_encode_manifest(NULL, m, &buf, &len));
+	g_assert_cmpint(a->len, ==, len);
+	g_assert(memcmp(a->data, buf, len) == 0);
+	g_free(buf);
+	g_byte_array_unref(a);
+	g_byte_array_unref(b);
+
+	/* concatenated samples match encoding them in one call */
+	a = pka_encoder_encode_sample_shared(NULL, m, samples[0]);
+	b = pka_encoder_encode_sample_shared(NULL, m, samples[0]);
+	g_assert(a == b);
+	g_byte_array_unref(b);
+	b = pka_encoder_encode_sample_shared(NULL, m, samples[1]);
+	g_assert(a != b);
+	g_assert(pka_encoder_encode_samples(NULL, m, samples, 2, &buf, &len));
+	g_assert_cmpint(a->len + b->len, ==, len);
+	g_assert(memcmp(buf, a->data, a->len) == 0);
+	g_assert(memcmp(buf + a->len, b->data, b->len) == 0);
+	g_free(buf);
+	g_byte_array_unref(a);
+	g_byte_array_unref(b);
+
+	pka_sample_unref(samples[0]);
+	pka_sample_unref(samples[1]);
+	pka_manifest_unref(m);
+}
+
 gint
 main (gint    argc,
       gchar  *argv[])
@@ -206,6 +299,8 @@ main (gint    argc,
 
 	g_test_add_func("/PkaEncoder/encode_manifest", test_PkaEncoder_encode_manifest);
 	g_test_add_func("/PkaEncoder/encode_samples", test_PkaEncoder_encode_samples);
+	g_test_add_func("/PkaEncoder/encode_append", test_PkaEncoder_encode_append);
+	g_test_add_func("/PkaEncoder/encode_shared", test_PkaEncoder_encode_shared);
 
 	return g_test_run();
 }
@@ -1,6 +1,10 @@
+#include <string.h>
+
 #include <perfkit-agent/perfkit-agent.h>
 #include <cut-n-paste/egg-buffer.h>
 
+extern void pka_sample_set_source_id (PkaSample *s, gint i);
+
 static void
 test_PkaSample_new (void)
 {
@@ -140,6 +144,137 @@ test_PkaSample_append_uint (void)
 	pka_sample_unref(s);
 }
 
+static void
+test_PkaSample_recycle (void)
+{
+	PkaSample *s;
+	const guint8 *buf;
+	gsize len;
+	gint i;
+
+	for (i = 0; i < 128; i++) {
+		s = pka_sample_new();
+		pka_sample_get_data(s, &buf, &len);
+		g_assert_cmpint(len, ==, 0);
+		g_assert_cmpint(pka_sample_get_source_id(s), ==, -1);
+		pka_sample_append_string(s, 1, "recycled sample");
+		pka_sample_set_source_id(s, i);
+		pka_sample_unref(s);
+	}
+}
+
+static void
+test_PkaSample_recycle_large (void)
+{
+	PkaSample *s;
+	EggBuffer *b;
+	const guint8 *buf;
+	gchar *str;
+	gsize len;
+	gint i;
+
+	/*
+	 * A buffer that once grew large keeps its storage across resets, so
+	 * its capacity must still be seen after a small sample reused it.
+	 */
+	b = egg_buffer_new();
+	str = g_strnfill(8192, 'x');
+	egg_buffer_write_string(b, str);
+	egg_buffer_reset(b);
+	egg_buffer_write_uint(b, 1);
+	g_assert_cmpint(egg_buffer_get_length(b), ==, 1);
+	g_assert_cmpint(egg_buffer_get_capacity(b), >, 8192);
+	egg_buffer_unref(b);
+
+	for (i = 0; i < 4; i++) {
+		s = pka_sample_new();
+		pka_sample_get_data(s, &buf, &len);
+		g_assert_cmpint(len, ==, 0);
+		pka_sample_append_string(s, 1, str);
+		pka_sample_unref(s);
+	}
+	g_free(str);
+}
+
+static void
+test_PkaSample_packed (void)
+{
+	PkaManifest *m;
+	EggBuffer *b;
+	PkaSample *s;
+	const guint8 *buf;
+	const guint8 *bitmap;
+	gsize len;
+	gint i;
+	gchar *c;
+
+	m = pka_manifest_new();
+	pka_manifest_set_packed(m, TRUE);
+	for (i = 0; i < 10; i++) {
+		pka_manifest_append(m, "Row", (i % 2) ? G_TYPE_INT : G_TYPE_STRING);
+	}
+	s = pka_sample_new_packed(m);
+	pka_sample_append_string(s, 1, "first");
+	pka_sample_append_int(s, 4, -2);
+	pka_sample_append_int(s, 10, 3);
+	pka_sample_get_data(s, &buf, &len);
+	b = egg_buffer_new_from_data(buf, len);
+	g_assert(egg_buffer_read_bytes(b, &bitmap, 2));
+	g_assert_cmpint(bitmap[0], ==, 0x09);
+	g_assert_cmpint(bitmap[1], ==, 0x02);
+	g_assert(egg_buffer_read_string(b, &c));
+	g_assert_cmpstr(c, ==, "first");
+	g_free(c);
+	g_assert(egg_buffer_read_int(b, &i));
+	g_assert_cmpint(i, ==, -2);
+	g_assert(egg_buffer_read_int(b, &i));
+	g_assert_cmpint(i, ==, 3);
+	g_assert_cmpint(egg_buffer_get_pos(b), ==, len);
+	egg_buffer_unref(b);
+	pka_sample_unref(s);
+	pka_manifest_unref(m);
+}
+
+static void
+test_PkaSample_uint64_array (void)
+{
+	static const guint64 v[] = { 0, 1, 300, G_MAXUINT64 };
+	PkaManifest *m;
+	EggBuffer *b;
+	PkaSample *s;
+	const guint8 *buf;
+	const guint8 *bitmap;
+	guint64 r[4];
+	gsize len;
+	gint i;
+
+	m = pka_manifest_new();
+	pka_manifest_set_packed(m, TRUE);
+	pka_manifest_append(m, "Row", G_TYPE_INT);
+	for (i = 0; i < 9; i++) {
+		pka_manifest_append(m, "Row", G_TYPE_UINT64);
+	}
+	s = pka_sample_new_packed(m);
+	pka_sample_append_int(s, 1, 7);
+	pka_sample_append_uint64_array(s, 3, v, G_N_ELEMENTS(v));
+	pka_sample_append_uint64_array(s, 8, &v[2], 2);
+	pka_sample_get_data(s, &buf, &len);
+	b = egg_buffer_new_from_data(buf, len);
+	g_assert(egg_buffer_read_bytes(b, &bitmap, 2));
+	g_assert_cmpint(bitmap[0], ==, 0xBD);
+	g_assert_cmpint(bitmap[1], ==, 0x01);
+	g_assert(egg_buffer_read_int(b, &i));
+	g_assert_cmpint(i, ==, 7);
+	g_assert(egg_buffer_read_uint64_array(b, r, 4));
+	g_assert(memcmp(r, v, sizeof(v)) == 0);
+	g_assert(egg_buffer_read_uint64_array(b, r, 2));
+	g_assert(memcmp(r, &v[2], 2 * sizeof(guint64)) == 0);
+	g_assert_cmpint(egg_buffer_get_pos(b), ==, len);
+	egg_buffer_unref(b);
+	pka_sample_unref(s);
+	pka_manifest_unref(m);
+}
+
 gint
 main (gint   argc,
       gchar *argv[])
@@ -150,6 +285,10 @@ main (gint   argc,
 	g_test_add_func("/PkaSample/append_int", test_PkaSample_append_int);
 	g_test_add_func("/PkaSample/append_string", test_PkaSample_append_string);
 	g_test_add_func("/PkaSample/append_uint", test_PkaSample_append_uint);
+	g_test_add_func("/PkaSample/recycle", test_PkaSample_recycle);
+	g_test_add_func("/PkaSample/recycle_large", test_PkaSample_recycle_large);
+	g_test_add_func("/PkaSample/packed", test_PkaSample_packed);
+	g_test_add_func("/PkaSample/uint64_array", test_PkaSample_uint64_array);
 
 	return g_test_run();
 }
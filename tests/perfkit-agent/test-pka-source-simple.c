@@ -2,6 +2,7 @@
 
 extern void pka_source_notify_started (PkaSource *, PkaSpawnInfo *);
 extern void pka_source_notify_stopped (PkaSource *);
+extern void pka_source_simple_set_n_workers (gint);
 
 static void
 test_PkaSourceSimple_threaded_cb (PkaSourceSimple *source,
@@ -56,6 +57,198 @@ test_PkaSourceSimple_shared (void)
 	g_object_unref(source);
 }
 
+/*
+ * Tests the shared worker with many sources of differing frequencies.
+ */
+static void
+test_PkaSourceSimple_shared_many (void)
+{
+	PkaSourceSimple *sources[64];
+	PkaSpawnInfo info = {0};
+	GTimeVal freq;
+	gint counts[64] = {0};
+	gint i;
+
+	for (i = 0; i < G_N_ELEMENTS(sources); i++) {
+		freq.tv_sec = 0;
+		freq.tv_usec = 100000 + (i % 4) * 100000;
+		sources[i] = g_object_new(PKA_TYPE_SOURCE_SIMPLE, "use-thread", FALSE, NULL);
+		pka_source_simple_set_sample_callback(sources[i], test_PkaSourceSimple_threaded_cb, &counts[i], NULL);
+		pka_source_simple_set_frequency(sources[i], &freq);
+		pka_source_notify_started(PKA_SOURCE(sources[i]), &info);
+	}
+	g_usleep(2 * G_USEC_PER_SEC);
+	for (i = 0; i < G_N_ELEMENTS(sources); i++) {
+		pka_source_notify_stopped(PKA_SOURCE(sources[i]));
+	}
+	for (i = 0; i < G_N_ELEMENTS(sources); i++) {
+		/* 2 seconds at 100 to 400 msec, with some slack */
+		g_assert_cmpint(counts[i], >=, 2000 / (100 + (i % 4) * 100) - 2);
+		g_assert_cmpint(counts[i], <=, 2000 / (100 + (i % 4) * 100) + 2);
+		g_object_unref(sources[i]);
+	}
+}
+
+static void
+test_PkaSourceSimple_blocking_cb (PkaSourceSimple *source,
+                                  gpointer         user_data)
+{
+	(*((gint *)user_data))++;
+	g_usleep(G_USEC_PER_SEC);
+}
+
+/*
+ * Tests that a blocking source does not stall the other shared sources.
+ */
+static void
+test_PkaSourceSimple_shared_blocking (void)
+{
+	PkaSourceSimple *blocking;
+	PkaSourceSimple *source;
+	GTimeVal freq = {0, 100000};
+	PkaSpawnInfo info = {0};
+	gint i = 0;
+	gint j = 0;
+
+	blocking = g_object_new(PKA_TYPE_SOURCE_SIMPLE, "use-thread", FALSE, NULL);
+	pka_source_simple_set_sample_callback(blocking, test_PkaSourceSimple_blocking_cb, &i, NULL);
+	pka_source_simple_set_frequency(blocking, &freq);
+	source = g_object_new(PKA_TYPE_SOURCE_SIMPLE, "use-thread", FALSE, NULL);
+	pka_source_simple_set_sample_callback(source, test_PkaSourceSimple_threaded_cb, &j, NULL);
+	pka_source_simple_set_frequency(source, &freq);
+	pka_source_notify_started(PKA_SOURCE(blocking), &info);
+	pka_source_notify_started(PKA_SOURCE(source), &info);
+	g_usleep(2 * G_USEC_PER_SEC);
+	pka_source_notify_stopped(PKA_SOURCE(source));
+	pka_source_notify_stopped(PKA_SOURCE(blocking));
+	g_assert_cmpint(i, <=, 3);
+	g_assert_cmpint(j, >=, 15); /* 2 seconds at 100 msec */
+
+	g_object_unref(source);
+	g_object_unref(blocking);
+}
+
+static void
+test_PkaSourceSimple_aligned_cb (PkaSourceSimple *source,
+                                 gpointer         user_data)
+{
+	GArray *stamps = user_data;
+	struct timespec ts;
+	PkaSample *sample;
+
+	sample = pka_sample_new();
+	pka_sample_get_timespec(sample, &ts);
+	g_array_append_val(stamps, ts);
+	pka_sample_unref(sample);
+}
+
+/*
+ * Tests that aligned sources of harmonic frequencies share their ticks.
+ */
+static void
+test_PkaSourceSimple_aligned (void)
+{
+	PkaSourceSimple *fast;
+	PkaSourceSimple *slow;
+	GTimeVal fast_freq = {0, 100000};
+	GTimeVal slow_freq = {0, 200000};
+	PkaSpawnInfo info = {0};
+	struct timespec *a;
+	struct timespec *b;
+	GArray *fast_stamps;
+	GArray *slow_stamps;
+	gboolean found;
+	gint i;
+	gint j;
+
+	fast_stamps = g_array_new(FALSE, FALSE, sizeof(struct timespec));
+	slow_stamps = g_array_new(FALSE, FALSE, sizeof(struct timespec));
+	fast = g_object_new(PKA_TYPE_SOURCE_SIMPLE, "aligned", TRUE, NULL);
+	slow = g_object_new(PKA_TYPE_SOURCE_SIMPLE, "aligned", TRUE, NULL);
+	g_assert(pka_source_simple_get_aligned(fast));
+	pka_source_simple_set_sample_callback(fast, test_PkaSourceSimple_aligned_cb, fast_stamps, NULL);
+	pka_source_simple_set_sample_callback(slow, test_PkaSourceSimple_aligned_cb, slow_stamps, NULL);
+	pka_source_simple_set_frequency(fast, &fast_freq);
+	pka_source_simple_set_frequency(slow, &slow_freq);
+	pka_source_notify_started(PKA_SOURCE(fast), &info);
+	pka_source_notify_started(PKA_SOURCE(slow), &info);
+	g_usleep(2 * G_USEC_PER_SEC);
+	pka_source_notify_stopped(PKA_SOURCE(slow));
+	pka_source_notify_stopped(PKA_SOURCE(fast));
+
+	g_assert_cmpint(fast_stamps->len, >=, 15);
+	g_assert_cmpint(slow_stamps->len, >=, 7);
+	for (i = 0; i < slow_stamps->len; i++) {
+		b = &g_array_index(slow_stamps, struct timespec, i);
+		found = FALSE;
+		for (j = 0; !found && j < fast_stamps->len; j++) {
+			a = &g_array_index(fast_stamps, struct timespec, j);
+			found = (a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec);
+		}
+		g_assert(found);
+	}
+
+	g_object_unref(slow);
+	g_object_unref(fast);
+	g_array_unref(slow_stamps);
+	g_array_unref(fast_stamps);
+}
+
+static void
+test_PkaSourceSimple_slow_cb (PkaSourceSimple *source,
+                              gpointer         user_data)
+{
+	(*((gint *)user_data))++;
+	g_usleep(G_USEC_PER_SEC / 4);
+}
+
+/*
+ * Tests that the timing statistics count every callback and the periods a
+ * slow source misses.
+ */
+static void
+test_PkaSourceSimple_stats (void)
+{
+	PkaSourceSimple *source;
+	PkaSourceSimpleStats stats;
+	PkaSourceSimpleStats total;
+	GTimeVal freq = {0, 100000};
+	PkaSpawnInfo info = {0};
+	guint64 n_lateness = 0;
+	guint64 n_slow = 0;
+	gint i = 0;
+	gint j;
+
+	source = g_object_new(PKA_TYPE_SOURCE_SIMPLE, "use-thread", FALSE, NULL);
+	pka_source_simple_set_sample_callback(source, test_PkaSourceSimple_slow_cb, &i, NULL);
+	pka_source_simple_set_frequency(source, &freq);
+	pka_source_notify_started(PKA_SOURCE(source), &info);
+	g_usleep(2 * G_USEC_PER_SEC);
+	pka_source_notify_stopped(PKA_SOURCE(source));
+	/* let a callback still running finish */
+	g_usleep(G_USEC_PER_SEC / 2);
+
+	pka_source_simple_get_stats(source, &stats);
+	g_assert_cmpint(i, >=, 4);
+	g_assert_cmpuint(stats.n_samples, ==, i);
+	/* each 250 msec callback makes the next sample miss a period */
+	g_assert_cmpuint(stats.n_missed, >=, i - 1);
+	for (j = 0; j < PKA_SOURCE_SIMPLE_N_BUCKETS; j++) {
+		n_lateness += stats.lateness[j];
+		if (j >= 18) { /* 2^17 usec and longer */
+			n_slow += stats.duration[j];
+		}
+	}
+	g_assert_cmpuint(n_lateness, ==, stats.n_samples);
+	g_assert_cmpuint(n_slow, ==, stats.n_samples);
+
+	pka_source_simple_get_total_stats(&total);
+	g_assert_cmpuint(total.n_samples, >=, stats.n_samples);
+	g_assert_cmpuint(total.n_missed, >=, stats.n_missed);
+
+	g_object_unref(source);
+}
+
 gint
 main (gint   argc,
       gchar *argv[])
@@ -63,9 +256,14 @@ main (gint   argc,
 	g_thread_init(NULL);
 	g_type_init();
 	g_test_init(&argc, &argv, NULL);
+	pka_source_simple_set_n_workers(4);
 
 	g_test_add_func("/PkaSourceSimple/threaded", test_PkaSourceSimple_threaded);
 	g_test_add_func("/PkaSourceSimple/shared", test_PkaSourceSimple_shared);
+	g_test_add_func("/PkaSourceSimple/shared_many", test_PkaSourceSimple_shared_many);
+	g_test_add_func("/PkaSourceSimple/shared_blocking", test_PkaSourceSimple_shared_blocking);
+	g_test_add_func("/PkaSourceSimple/aligned", test_PkaSourceSimple_aligned);
+	g_test_add_func("/PkaSourceSimple/stats", test_PkaSourceSimple_stats);
 
 	return g_test_run();
 }
@@ -0,0 +1,181 @@
+#include <string.h>
+#include <unistd.h>
+#include <perfkit-agent/perfkit-agent.h>
+
+extern void pka_source_stream_set_backlog_default (gint size);
+
+typedef struct
+{
+	PkaSourceStream parent;
+	GMutex *mutex;
+	GString *lines;
+	gint n_lines;
+	gint n_reads;
+	gint closed;
+} TestStream;
+
+typedef struct
+{
+	PkaSourceStreamClass parent_class;
+} TestStreamClass;
+
+G_DEFINE_TYPE(TestStream, test_stream, PKA_TYPE_SOURCE_STREAM)
+
+/*
+ * Consumes whole lines and leaves a partial line in the backlog.
+ */
+static gsize
+test_stream_read (PkaSourceStream *stream,
+                  gint             fd,
+                  const guint8    *data,
+                  gsize            len)
+{
+	TestStream *test = (TestStream *)stream;
+	gsize consumed = 0;
+	gsize i;
+
+	g_mutex_lock(test->mutex);
+	test->n_reads++;
+	for (i = 0; i < len; i++) {
+		if (data[i] == '\n') {
+			g_string_append_len(test->lines, (const gchar *)data + consumed,
+			                    i + 1 - consumed);
+			test->n_lines++;
+			consumed = i + 1;
+		}
+	}
+	g_mutex_unlock(test->mutex);
+	return consumed;
+}
+
+static void
+test_stream_closed (PkaSourceStream *stream,
+                    gint             fd)
+{
+	g_atomic_int_inc(&((TestStream *)stream)->closed);
+}
+
+static void
+test_stream_finalize (GObject *object)
+{
+	TestStream *test = (TestStream *)object;
+
+	g_string_free(test->lines, TRUE);
+	g_mutex_free(test->mutex);
+	G_OBJECT_CLASS(test_stream_parent_class)->finalize(object);
+}
+
+static void
+test_stream_class_init (TestStreamClass *klass)
+{
+	G_OBJECT_CLASS(klass)->finalize = test_stream_finalize;
+	PKA_SOURCE_STREAM_CLASS(klass)->read = test_stream_read;
+	PKA_SOURCE_STREAM_CLASS(klass)->closed = test_stream_closed;
+}
+
+static void
+test_stream_init (TestStream *test)
+{
+	test->mutex = g_mutex_new();
+	test->lines = g_string_new(NULL);
+}
+
+/*
+ * Tests that writes within the window are delivered together.
+ */
+static void
+test_PkaSourceStream_batch (void)
+{
+	TestStream *test;
+	gint fds[2];
+
+	g_assert_cmpint(pipe(fds), ==, 0);
+	test = g_object_new(test_stream_get_type(), NULL);
+	pka_source_stream_set_window(PKA_SOURCE_STREAM(test), 200000);
+	g_assert_cmpint(pka_source_stream_get_window(PKA_SOURCE_STREAM(test)), ==, 200000);
+	g_assert(pka_source_stream_add_fd(PKA_SOURCE_STREAM(test), fds[0], NULL));
+	g_assert_cmpint(write(fds[1], "a\n", 2), ==, 2);
+	g_usleep(10000);
+	g_assert_cmpint(write(fds[1], "b\n", 2), ==, 2);
+	g_usleep(10000);
+	g_assert_cmpint(write(fds[1], "c\n", 2), ==, 2);
+	g_usleep(G_USEC_PER_SEC / 2);
+
+	g_mutex_lock(test->mutex);
+	g_assert_cmpint(test->n_reads, ==, 1);
+	g_assert_cmpint(test->n_lines, ==, 3);
+	g_assert_cmpstr(test->lines->str, ==, "a\nb\nc\n");
+	g_mutex_unlock(test->mutex);
+
+	pka_source_stream_remove_fd(PKA_SOURCE_STREAM(test), fds[0]);
+	close(fds[0]);
+	close(fds[1]);
+	g_object_unref(test);
+}
+
+/*
+ * Tests that a partial record stays in the backlog until it is complete,
+ * including across the end of the ring, and that the end of the stream is
+ * reported.
+ */
+static void
+test_PkaSourceStream_backlog (void)
+{
+	TestStream *test;
+	GString *expected;
+	gchar line[1000];
+	gint fds[2];
+	gint i;
+
+	g_assert_cmpint(pipe(fds), ==, 0);
+	test = g_object_new(test_stream_get_type(), NULL);
+	pka_source_stream_set_window(PKA_SOURCE_STREAM(test), 0);
+	g_assert(pka_source_stream_add_fd(PKA_SOURCE_STREAM(test), fds[0], NULL));
+
+	g_assert_cmpint(write(fds[1], "abc", 3), ==, 3);
+	g_usleep(G_USEC_PER_SEC / 10);
+	g_assert_cmpint(write(fds[1], "def\n", 4), ==, 4);
+	g_usleep(G_USEC_PER_SEC / 10);
+	g_mutex_lock(test->mutex);
+	g_assert_cmpstr(test->lines->str, ==, "abcdef\n");
+	g_mutex_unlock(test->mutex);
+
+	/* 4096 byte ring, lines of 1000 bytes written in halves */
+	expected = g_string_new("abcdef\n");
+	memset(line, 'x', sizeof(line) - 1);
+	line[sizeof(line) - 1] = '\n';
+	for (i = 0; i < 20; i++) {
+		g_assert_cmpint(write(fds[1], line, 600), ==, 600);
+		g_usleep(G_USEC_PER_SEC / 100);
+		g_assert_cmpint(write(fds[1], line + 600, 400), ==, 400);
+		g_usleep(G_USEC_PER_SEC / 100);
+		g_string_append_len(expected, line, sizeof(line));
+	}
+	close(fds[1]);
+	g_usleep(G_USEC_PER_SEC / 10);
+
+	g_mutex_lock(test->mutex);
+	g_assert_cmpint(test->n_lines, ==, 21);
+	g_assert_cmpstr(test->lines->str, ==, expected->str);
+	g_mutex_unlock(test->mutex);
+	g_assert_cmpint(g_atomic_int_get(&test->closed), ==, 1);
+
+	close(fds[0]);
+	g_string_free(expected, TRUE);
+	g_object_unref(test);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+	g_thread_init(NULL);
+	g_type_init();
+	g_test_init(&argc, &argv, NULL);
+	pka_source_stream_set_backlog_default(4096);
+
+	g_test_add_func("/PkaSourceStream/batch", test_PkaSourceStream_batch);
+	g_test_add_func("/PkaSourceStream/backlog", test_PkaSourceStream_backlog);
+
+	return g_test_run();
+}
@@ -0,0 +1,176 @@
+#include "perfkit-agent/sources/profile.c"
+
+static void
+write_record (guint8       *data,
+              gsize         size,
+              guint64      *head,
+              const guint8 *record,
+              gsize         len)
+{
+	gsize i;
+
+	for (i = 0; i < len; i++) {
+		data[(*head + i) % size] = record[i];
+	}
+	*head += len;
+}
+
+static void
+write_sample (guint8        *data,
+              gsize          size,
+              guint64       *head,
+              const guint64 *ips,
+              guint64        nr)
+{
+	struct perf_event_header *header;
+	guint64 record[8];
+
+	header = (struct perf_event_header *)record;
+	header->type = PERF_RECORD_SAMPLE;
+	header->misc = 0;
+	header->size = (3 + nr) * sizeof(guint64);
+	record[1] = 0; /* pid and tid */
+	record[2] = nr;
+	memcpy(&record[3], ips, nr * sizeof(guint64));
+	write_record(data, size, head, (guint8 *)record, header->size);
+}
+
+static void
+test_Profile_drain (void)
+{
+	static const guint64 a[] = { 0x1000, 0x2000 };
+	static const guint64 b[] = { PERF_CONTEXT_USER, 0x10, 0x20 };
+	struct perf_event_mmap_page *meta;
+	struct perf_event_header *header;
+	ProfilePrivate priv = { 0 };
+	guint64 key[3] = { 2, 0x1000, 0x2000 };
+	guint64 record[3];
+	guint64 head;
+	guint8 *ring;
+	GHashTableIter iter;
+	gpointer stack;
+	gpointer count;
+	GString *str;
+	gsize page = getpagesize();
+
+	priv.mutex = g_mutex_new();
+	priv.counts = profile_counts_new();
+	ring = g_malloc0(page * 2);
+	meta = (struct perf_event_mmap_page *)ring;
+
+	/* the first record wraps around the end of the data pages */
+	head = page - 24;
+	meta->data_tail = head;
+	write_sample(ring + page, page, &head, a, G_N_ELEMENTS(a));
+	write_sample(ring + page, page, &head, b, G_N_ELEMENTS(b));
+	write_sample(ring + page, page, &head, a, G_N_ELEMENTS(a));
+	header = (struct perf_event_header *)record;
+	header->type = PERF_RECORD_LOST;
+	header->misc = 0;
+	header->size = sizeof(record);
+	record[1] = 0;
+	record[2] = 5;
+	write_record(ring + page, page, &head, (guint8 *)record, sizeof(record));
+	meta->data_head = head;
+
+	profile_drain(&priv, ring, page * 2);
+	g_assert_cmpint(meta->data_tail, ==, head);
+	g_assert_cmpint(priv.lost, ==, 5);
+	g_assert_cmpint(g_hash_table_size(priv.counts), ==, 2);
+	g_assert_cmpint(GPOINTER_TO_UINT(g_hash_table_lookup(priv.counts, key)),
+	                ==, 2);
+
+	/* outermost first, without the context marker */
+	str = g_string_new(NULL);
+	g_hash_table_iter_init(&iter, priv.counts);
+	while (g_hash_table_iter_next(&iter, &stack, &count)) {
+		if (((ProfileStack *)stack)->nr == 3) {
+			profile_fold(stack, str);
+			g_assert_cmpstr(str->str, ==, "0x20;0x10");
+			g_assert_cmpint(GPOINTER_TO_UINT(count), ==, 1);
+		}
+	}
+	g_string_free(str, TRUE);
+
+	/* nothing new */
+	profile_drain(&priv, ring, page * 2);
+	g_assert_cmpint(g_hash_table_size(priv.counts), ==, 2);
+
+	g_free(ring);
+	g_hash_table_unref(priv.counts);
+	g_mutex_free(priv.mutex);
+}
+
+static gpointer
+spin (gpointer data)
+{
+	GTimer *timer = g_timer_new();
+	volatile guint64 n = 0;
+
+	while (g_timer_elapsed(timer, NULL) < 0.3) {
+		n++;
+	}
+	g_timer_destroy(timer);
+	return NULL;
+}
+
+static void
+test_Profile_threads (void)
+{
+	struct perf_event_attr attr;
+	ProfilePrivate priv = { 0 };
+	GThread *thread;
+	gint fd;
+
+	/* perf_event_paranoid or the sandbox may forbid sampling */
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_SOFTWARE;
+	attr.config = PERF_COUNT_SW_CPU_CLOCK;
+	attr.exclude_kernel = 1;
+	attr.inherit = 1;
+	if ((fd = syscall(__NR_perf_event_open, &attr, getpid(), 0, -1, 0)) < 0) {
+		g_test_message("Skipped, perf events are not available: %s",
+		               g_strerror(errno));
+		return;
+	}
+	close(fd);
+
+	priv.mutex = g_mutex_new();
+	priv.counts = profile_counts_new();
+	priv.frequency = 1000;
+	priv.n_pages = 8;
+	g_assert(profile_open(&priv, getpid()));
+	g_assert(priv.events != NULL);
+	g_assert_cmpint(priv.events->n_cpus, >, 0);
+
+	/* created after the events were opened, so only seen if inherited */
+	thread = g_thread_create(spin, NULL, TRUE, NULL);
+	g_thread_join(thread);
+
+	/* opening again replaces the events of the previous spawn */
+	g_assert(profile_open(&priv, getpid()));
+	g_assert(priv.events != NULL);
+	g_assert_cmpint(priv.events->n_cpus, >, 0);
+
+	profile_close(&priv);
+	g_assert(priv.events == NULL);
+	g_assert_cmpint(g_hash_table_size(priv.counts), >, 0);
+
+	g_hash_table_unref(priv.counts);
+	g_mutex_free(priv.mutex);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+	g_thread_init(NULL);
+	g_type_init();
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/Profile/drain", test_Profile_drain);
+	g_test_add_func("/Profile/threads", test_Profile_threads);
+
+	return g_test_run();
+}
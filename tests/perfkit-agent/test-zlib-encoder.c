@@ -0,0 +1,145 @@
+#include <perfkit-agent/perfkit-agent.h>
+#include <string.h>
+#include <zlib.h>
+
+extern GObject* zlib_encoder_new           (GError **error);
+extern void     pka_manifest_set_source_id (PkaManifest *m, gint i);
+
+static void
+inflate_append (z_stream     *stream,
+                const guint8 *data,
+                gsize         len,
+                GByteArray   *ar)
+{
+	guint offset;
+	gint ret;
+
+	stream->next_in = (guint8 *)data;
+	stream->avail_in = len;
+	do {
+		offset = ar->len;
+		g_byte_array_set_size(ar, offset + 4096);
+		stream->next_out = ar->data + offset;
+		stream->avail_out = 4096;
+		ret = inflate(stream, Z_SYNC_FLUSH);
+		g_assert(ret == Z_OK || ret == Z_BUF_ERROR);
+		g_byte_array_set_size(ar, offset + 4096 - stream->avail_out);
+	} while (stream->avail_in || !stream->avail_out);
+}
+
+static void
+test_ZlibEncoder_roundtrip (void)
+{
+	PkaEncoder *encoder;
+	PkaManifest *m;
+	PkaSample *samples[4];
+	GByteArray *expected;
+	GByteArray *inflated;
+	GByteArray *buffer;
+	z_stream stream;
+	gint i;
+	gint j;
+
+	encoder = PKA_ENCODER(zlib_encoder_new(NULL));
+	g_assert(encoder != NULL);
+	g_assert(!pka_encoder_is_shareable(encoder));
+
+	m = pka_manifest_new();
+	pka_manifest_set_source_id(m, 1);
+	pka_manifest_append(m, "Counter", G_TYPE_UINT);
+	pka_manifest_append(m, "Name", G_TYPE_STRING);
+
+	memset(&stream, 0, sizeof(stream));
+	g_assert_cmpint(inflateInit(&stream), ==, Z_OK);
+	expected = g_byte_array_new();
+	inflated = g_byte_array_new();
+	buffer = g_byte_array_new();
+
+	/*
+	 * Every buffer must inflate as soon as it arrives, with the dictionary
+	 * carried over from the buffers before it.
+	 */
+	g_assert(pka_encoder_encode_manifest_append(NULL, m, expected));
+	g_assert(pka_encoder_encode_manifest_append(encoder, m, buffer));
+	inflate_append(&stream, buffer->data, buffer->len, inflated);
+	g_assert_cmpint(inflated->len, ==, expected->len);
+
+	for (i = 0; i < 16; i++) {
+		for (j = 0; j < G_N_ELEMENTS(samples); j++) {
+			samples[j] = pka_sample_new();
+			pka_sample_append_uint(samples[j], 1, i * 100 + j);
+			pka_sample_append_string(samples[j], 2, "same string every time");
+		}
+		g_assert(pka_encoder_encode_samples_append(NULL, m, samples,
+		                                           G_N_ELEMENTS(samples),
+		                                           expected));
+		/*
+		 * Several batches concatenated into one delivery, as done by the
+		 * subscription when it flushes.
+		 */
+		g_byte_array_set_size(buffer, 0);
+		g_assert(pka_encoder_encode_samples_append(encoder, m, samples, 2,
+		                                           buffer));
+		g_assert(pka_encoder_encode_samples_append(encoder, m, samples + 2,
+		                                           2, buffer));
+		inflate_append(&stream, buffer->data, buffer->len, inflated);
+		g_assert_cmpint(inflated->len, ==, expected->len);
+		for (j = 0; j < G_N_ELEMENTS(samples); j++) {
+			pka_sample_unref(samples[j]);
+		}
+	}
+	g_assert(memcmp(inflated->data, expected->data, expected->len) == 0);
+
+	inflateEnd(&stream);
+	g_byte_array_unref(expected);
+	g_byte_array_unref(inflated);
+	g_byte_array_unref(buffer);
+	pka_manifest_unref(m);
+	g_object_unref(encoder);
+}
+
+static void
+test_ZlibEncoder_one_subscription (void)
+{
+	PkaEncoder *encoder;
+	PkaSubscription *a;
+	PkaSubscription *b;
+	PkaContext *context;
+	GError *error = NULL;
+
+	encoder = PKA_ENCODER(zlib_encoder_new(NULL));
+	context = pka_context_new();
+	a = pka_subscription_new();
+	b = pka_subscription_new();
+
+	g_assert(pka_subscription_set_encoder(a, context, encoder, NULL));
+	g_assert(pka_subscription_set_encoder(a, context, encoder, NULL));
+	g_assert(!pka_subscription_set_encoder(b, context, encoder, &error));
+	g_assert_error(error, PKA_ENCODER_ERROR, PKA_ENCODER_ERROR_IN_USE);
+	g_clear_error(&error);
+
+	/* released once detached */
+	g_assert(pka_subscription_set_encoder(a, context, NULL, NULL));
+	g_assert(pka_subscription_set_encoder(b, context, encoder, NULL));
+	pka_subscription_unref(b);
+	g_assert(pka_subscription_set_encoder(a, context, encoder, NULL));
+
+	pka_subscription_unref(a);
+	pka_context_unref(context);
+	g_object_unref(encoder);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+	g_thread_init(NULL);
+	g_type_init();
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/ZlibEncoder/roundtrip", test_ZlibEncoder_roundtrip);
+	g_test_add_func("/ZlibEncoder/one_subscription",
+	                test_ZlibEncoder_one_subscription);
+
+	return g_test_run();
+}
@@ -0,0 +1,166 @@
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <glib.h>
+
+#include "perfkit-probe.h"
+#include "pkp-region.h"
+
+/*
+ * Maps the region of the test process the way the agent does.
+ */
+static PkpRegion*
+test_region (void)
+{
+	static PkpRegion *region = NULL;
+	gchar name[32];
+	gpointer map;
+	gint fd;
+
+	if (!region) {
+		g_snprintf(name, sizeof(name), PKP_REGION_NAME, (gint)getpid());
+		fd = shm_open(name, O_RDONLY, 0);
+		g_assert_cmpint(fd, >=, 0);
+		map = mmap(NULL, sizeof(PkpRegion), PROT_READ, MAP_SHARED, fd, 0);
+		g_assert(map != MAP_FAILED);
+		close(fd);
+		region = map;
+		g_assert_cmpint(region->magic, ==, PKP_REGION_MAGIC);
+		g_assert_cmpint(region->version, ==, PKP_REGION_VERSION);
+	}
+	return region;
+}
+
+static guint64
+test_sum (guint cell)
+{
+	guint64 total = 0;
+	gint i;
+
+	for (i = 0; i < PKP_REGION_N_SLOTS; i++) {
+		total += test_region()->slots[i].cells[cell];
+	}
+	return total;
+}
+
+static gpointer
+test_counter_thread (gpointer data)
+{
+	gint i;
+
+	for (i = 0; i < 10000; i++) {
+		pkp_counter_inc(data);
+	}
+	return NULL;
+}
+
+static void
+test_PkpProbe_register (void)
+{
+	PkpMetric *counter;
+	PkpRegion *region;
+
+	counter = pkp_counter_register("requests");
+	g_assert(counter);
+	g_assert(pkp_counter_register("requests") == counter);
+	g_assert(pkp_gauge_register("requests") == NULL);
+	g_assert(pkp_counter_register("") == NULL);
+
+	region = test_region();
+	g_assert_cmpint(region->n_metrics, >=, 1);
+	g_assert_cmpstr(region->metrics[0].name, ==, "requests");
+	g_assert_cmpint(region->metrics[0].type, ==, PKP_REGION_COUNTER);
+
+	/* NULL metrics are ignored */
+	pkp_counter_inc(NULL);
+	pkp_gauge_set(NULL, 1);
+	pkp_histogram_record(NULL, 1);
+	pkp_mark(NULL);
+}
+
+static void
+test_PkpProbe_counter (void)
+{
+	PkpMetric *counter;
+	GThread *threads[8];
+	guint cell;
+	gint i;
+
+	counter = pkp_counter_register("counter");
+	for (i = 0; i < G_N_ELEMENTS(threads); i++) {
+		threads[i] = g_thread_create(test_counter_thread, counter, TRUE, NULL);
+	}
+	for (i = 0; i < G_N_ELEMENTS(threads); i++) {
+		g_thread_join(threads[i]);
+	}
+	cell = test_region()->metrics[test_region()->n_metrics - 1].cell;
+	g_assert_cmpint(test_sum(cell), ==, 80000);
+}
+
+static void
+test_PkpProbe_gauge (void)
+{
+	PkpMetric *gauge;
+	guint id;
+
+	gauge = pkp_gauge_register("gauge");
+	id = test_region()->n_metrics - 1;
+	pkp_gauge_set(gauge, 10);
+	pkp_gauge_add(gauge, -3);
+	g_assert_cmpint(test_region()->gauges[id], ==, 7);
+}
+
+static void
+test_PkpProbe_histogram (void)
+{
+	PkpMetric *histogram;
+	guint cell;
+
+	histogram = pkp_histogram_register("histogram");
+	cell = test_region()->metrics[test_region()->n_metrics - 1].cell;
+	pkp_histogram_record(histogram, 0);
+	pkp_histogram_record(histogram, 1);
+	pkp_histogram_record(histogram, 1000);
+	pkp_histogram_record(histogram, 1023);
+	pkp_histogram_record(histogram, G_MAXUINT64);
+	g_assert_cmpint(test_sum(cell), ==, 1);
+	g_assert_cmpint(test_sum(cell + 1), ==, 1);
+	g_assert_cmpint(test_sum(cell + 10), ==, 2);
+	g_assert_cmpint(test_sum(cell + PKP_REGION_N_BUCKETS - 1), ==, 1);
+}
+
+static void
+test_PkpProbe_mark (void)
+{
+	PkpRegionMark *entry;
+	PkpMetric *mark;
+	guint64 head;
+	guint id;
+
+	mark = pkp_mark_register("mark");
+	id = test_region()->n_metrics - 1;
+	head = test_region()->mark_head;
+	pkp_mark(mark);
+	g_assert_cmpint(test_region()->mark_head, ==, head + 1);
+	entry = &test_region()->marks[head & (PKP_REGION_N_MARKS - 1)];
+	g_assert_cmpint(entry->seq, ==, head + 1);
+	g_assert_cmpint(entry->metric, ==, id);
+	g_assert_cmpint(entry->tv_sec, >, 0);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/PkpProbe/register", test_PkpProbe_register);
+	g_test_add_func("/PkpProbe/counter", test_PkpProbe_counter);
+	g_test_add_func("/PkpProbe/gauge", test_PkpProbe_gauge);
+	g_test_add_func("/PkpProbe/histogram", test_PkpProbe_histogram);
+	g_test_add_func("/PkpProbe/mark", test_PkpProbe_mark);
+
+	return g_test_run();
+}
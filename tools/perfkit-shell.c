@@ -1961,6 +1961,81 @@ pk_shell_manager_add_channel (EggLine  *line,   /* IN */
 	RETURN(EGG_LINE_STATUS_OK);
 }
 
+/**
+ * pk_shell_manager_add_encoder_cb:
+ * @object: A #PkConnection.
+ * @result: A #GAsyncResult.
+ * @user_data: A #gpointer.
+ *
+ * Asynchronous completion of pk_connection_manager_add_encoder_async().
+ *
+ * Returns: None.
+ * Side effects: Blocking AsyncTask is signaled.
+ */
+static void
+pk_shell_manager_add_encoder_cb (GObject       *object,    /* IN */
+                                 GAsyncResult  *result,    /* IN */
+                                 gpointer       user_data) /* IN */
+{
+	AsyncTask *task = user_data;
+
+	ENTRY;
+	task->result = pk_connection_manager_add_encoder_finish(
+			PK_CONNECTION(object),
+			result,
+			task->params[0], /* encoder */
+			&task->error);
+	async_task_signal(task);
+	EXIT;
+}
+
+/**
+ * pk_shell_manager_add_encoder:
+ * @line: An #EggLine.
+ * @argc: The number of arguments in @argv.
+ * @argv: The arguments to the command.
+ * @error: A location for #GError, or %NULL.
+ *
+ * Creates a new encoder from a plugin in the agent.
+ *
+ * Returns: The commands status.
+ * Side effects: None.
+ */
+static EggLineStatus
+pk_shell_manager_add_encoder (EggLine  *line,   /* IN */
+                              gint      argc,   /* IN */
+                              gchar    *argv[], /* IN */
+                              GError  **error)  /* OUT */
+{
+	AsyncTask task;
+	const gchar* plugin = NULL;
+	gint encoder;
+	gint i = 0;
+	gchar *tmp;
+
+	ENTRY;
+	if (argc != 1) {
+		RETURN(EGG_LINE_STATUS_BAD_ARGS);
+	}
+	plugin = argv[i++];
+	async_task_init(&task);
+	task.params[0] = &encoder;
+	pk_connection_manager_add_encoder_async(conn,
+	                             plugin,
+	                             NULL,
+	                             pk_shell_manager_add_encoder_cb,
+	                             &task);
+	if (!async_task_wait(&task)) {
+		g_propagate_error(error, task.error);
+		RETURN(EGG_LINE_STATUS_FAILURE);
+	}
+	g_print("%16s: %d\n", "encoder", (gint)encoder);
+	tmp = g_strdup_printf("%d", (gint)encoder);
+	egg_line_set_variable(line, "1", tmp);
+	g_free(tmp);
+	RETURN(EGG_LINE_STATUS_OK);
+}
+
 /**
  * pk_shell_manager_add_source_cb:
  * @object: A #PkConnection.
@@ -3396,6 +3471,138 @@ pk_shell_source_get_plugin (EggLine  *line,   /* IN */
 	RETURN(EGG_LINE_STATUS_OK);
 }
 
+/**
+ * pk_shell_source_get_stats_cb:
+ * @object: A #PkConnection.
+ * @result: A #GAsyncResult.
+ * @user_data: A #gpointer.
+ *
+ * Asynchronous completion of pk_connection_source_get_stats_async().
+ *
+ * Returns: None.
+ * Side effects: Blocking AsyncTask is signaled.
+ */
+static void
+pk_shell_source_get_stats_cb (GObject       *object,    /* IN */
+                              GAsyncResult  *result,    /* IN */
+                              gpointer       user_data) /* IN */
+{
+	AsyncTask *task = user_data;
+
+	ENTRY;
+	task->result = pk_connection_source_get_stats_finish(
+			PK_CONNECTION(object),
+			result,
+			task->params[0], /* n_samples */
+			task->params[1], /* n_missed */
+			task->params[2], /* lateness */
+			task->params[3], /* lateness_len */
+			task->params[4], /* duration */
+			task->params[5], /* duration_len */
+			&task->error);
+	async_task_signal(task);
+	EXIT;
+}
+
+/**
+ * pk_shell_print_histogram:
+ * @name: The name of the histogram.
+ * @hist: The histogram buckets.
+ * @hist_len: The number of buckets in @hist.
+ *
+ * Prints the non-empty buckets of a power of two histogram in
+ * microseconds.
+ *
+ * Returns: None.
+ * Side effects: None.
+ */
+static void
+pk_shell_print_histogram (const gchar   *name,     /* IN */
+                          const guint32 *hist,     /* IN */
+                          gsize          hist_len) /* IN */
+{
+	gsize i;
+
+	g_print("%16s:\n", name);
+	for (i = 0; i < hist_len; i++) {
+		if (!hist[i]) {
+			continue;
+		}
+		if (i + 1 < hist_len) {
+			g_print("%16s  < %10luus: %u\n", "", 1UL << i, hist[i]);
+		} else {
+			g_print("%16s >= %10luus: %u\n", "", 1UL << (i - 1), hist[i]);
+		}
+	}
+}
+
+/**
+ * pk_shell_source_get_stats:
+ * @line: An #EggLine.
+ * @argc: The number of arguments in @argv.
+ * @argv: The arguments to the command.
+ * @error: A location for #GError, or %NULL.
+ *
+ * 
+ *
+ * Returns: The commands status.
+ * Side effects: None.
+ */
+static EggLineStatus
+pk_shell_source_get_stats (EggLine  *line,   /* IN */
+                           gint      argc,   /* IN */
+                           gchar    *argv[], /* IN */
+                           GError  **error)  /* OUT */
+{
+	AsyncTask task;
+	gint source = 0;
+	guint64 n_samples;
+	guint64 n_missed;
+	guint32 *lateness;
+	gsize lateness_len;
+	guint32 *duration;
+	gsize duration_len;
+	gint i = 0;
+	gchar *tmp;
+
+	ENTRY;
+	if (argc != 1) {
+		RETURN(EGG_LINE_STATUS_BAD_ARGS);
+	}
+	if (!pk_shell_parse_int(argv[i++], &source)) {
+		RETURN(EGG_LINE_STATUS_BAD_ARGS);
+	}
+	async_task_init(&task);
+	task.params[0] = &n_samples;
+	task.params[1] = &n_missed;
+	task.params[2] = &lateness;
+	task.params[3] = &lateness_len;
+	task.params[4] = &duration;
+	task.params[5] = &duration_len;
+	pk_connection_source_get_stats_async(conn,
+	                             source,
+	                             NULL,
+	                             pk_shell_source_get_stats_cb,
+	                             &task);
+	if (!async_task_wait(&task)) {
+		g_propagate_error(error, task.error);
+		RETURN(EGG_LINE_STATUS_FAILURE);
+	}
+	g_print("%16s: %"G_GUINT64_FORMAT"\n", "samples", n_samples);
+	tmp = g_strdup_printf("%"G_GUINT64_FORMAT, n_samples);
+	egg_line_set_variable(line, "1", tmp);
+	g_free(tmp);
+	g_print("%16s: %"G_GUINT64_FORMAT"\n", "missed", n_missed);
+	tmp = g_strdup_printf("%"G_GUINT64_FORMAT, n_missed);
+	egg_line_set_variable(line, "2", tmp);
+	g_free(tmp);
+	pk_shell_print_histogram("lateness", lateness, lateness_len);
+	pk_shell_print_histogram("duration", duration, duration_len);
+	g_free(lateness);
+	g_free(duration);
+	RETURN(EGG_LINE_STATUS_OK);
+}
+
 /**
  * pk_shell_subscription_add_channel_cb:
  * @object: A #PkConnection.
@@ -3798,6 +4005,97 @@ pk_shell_subscription_get_sources (EggLine  *line,   /* IN */
 	RETURN(EGG_LINE_STATUS_OK);
 }
 
+/**
+ * pk_shell_subscription_get_stats_cb:
+ * @object: A #PkConnection.
+ * @result: A #GAsyncResult.
+ * @user_data: A #gpointer.
+ *
+ * Asynchronous completion of pk_connection_subscription_get_stats_async().
+ *
+ * Returns: None.
+ * Side effects: Blocking AsyncTask is signaled.
+ */
+static void
+pk_shell_subscription_get_stats_cb (GObject       *object,    /* IN */
+            GAsyncResult  *result,    /* IN */
+            gpointer       user_data) /* IN */
+{
+	AsyncTask *task = user_data;
+
+	ENTRY;
+	task->result = pk_connection_subscription_get_stats_finish(
+			PK_CONNECTION(object),
+			result,
+			task->params[0], /* queued */
+			task->params[1], /* delivered */
+			task->params[2], /* dropped */
+			&task->error);
+	async_task_signal(task);
+	EXIT;
+}
+
+/**
+ * pk_shell_subscription_get_stats:
+ * @line: An #EggLine.
+ * @argc: The number of arguments in @argv.
+ * @argv: The arguments to the command.
+ * @error: A location for #GError, or %NULL.
+ *
+ * 
+ *
+ * Returns: The commands status.
+ * Side effects: None.
+ */
+static EggLineStatus
+pk_shell_subscription_get_stats (EggLine  *line,   /* IN */
+                                 gint      argc,   /* IN */
+                                 gchar    *argv[], /* IN */
+                                 GError  **error)  /* OUT */
+{
+	AsyncTask task;
+	gint subscription = 0;
+	guint64 queued;
+	guint64 delivered;
+	guint64 dropped;
+	gint i = 0;
+	gchar *tmp;
+
+	ENTRY;
+	if (argc != 1) {
+		RETURN(EGG_LINE_STATUS_BAD_ARGS);
+	}
+	if (!pk_shell_parse_int(argv[i++], &subscription)) {
+		RETURN(EGG_LINE_STATUS_BAD_ARGS);
+	}
+	async_task_init(&task);
+	task.params[0] = &queued;
+	task.params[1] = &delivered;
+	task.params[2] = &dropped;
+	pk_connection_subscription_get_stats_async(conn,
+	                             subscription,
+	                             NULL,
+	                             pk_shell_subscription_get_stats_cb,
+	                             &task);
+	if (!async_task_wait(&task)) {
+		g_propagate_error(error, task.error);
+		RETURN(EGG_LINE_STATUS_FAILURE);
+	}
+	g_print("%16s: %"G_GUINT64_FORMAT"\n", "queued", queued);
+	tmp = g_strdup_printf("%"G_GUINT64_FORMAT, queued);
+	egg_line_set_variable(line, "1", tmp);
+	g_free(tmp);
+	g_print("%16s: %"G_GUINT64_FORMAT"\n", "delivered", delivered);
+	tmp = g_strdup_printf("%"G_GUINT64_FORMAT, delivered);
+	egg_line_set_variable(line, "2", tmp);
+	g_free(tmp);
+	g_print("%16s: %"G_GUINT64_FORMAT"\n", "dropped", dropped);
+	tmp = g_strdup_printf("%"G_GUINT64_FORMAT, dropped);
+	egg_line_set_variable(line, "3", tmp);
+	g_free(tmp);
+	RETURN(EGG_LINE_STATUS_OK);
+}
+
 /**
  * pk_shell_subscription_mute_cb:
  * @object: A #PkConnection.
@@ -4507,6 +4805,16 @@ static EggLineCommand source_commands[] = {
 		.callback  = pk_shell_source_get_plugin,
 		.usage     = "source get-plugin SOURCE",
 	},
+	{
+		.name      = "get-stats",
+		.help      = "Retrieves the number of samples taken and missed by the source, and\nhistograms of how late and how long each sample took.\n"
+		             "\n"
+		             "options:\n"
+		             "  SOURCE:\t\tAn integer.\n"
+		             "\n",
+		.callback  = pk_shell_source_get_stats,
+		.usage     = "source get-stats SOURCE",
+	},
 	{ NULL }
 };
 
@@ -4517,6 +4825,12 @@ static EggLineCommand manager_commands[] = {
 		.callback  = pk_shell_manager_add_channel,
 		.usage     = "manager add-channel ",
 	},
+	{
+		.name      = "add-encoder",
+		.help      = "Create a new encoder from a plugin in the Agent.",
+		.callback  = pk_shell_manager_add_encoder,
+		.usage     = "manager add-encoder PLUGIN",
+	},
 	{
 		.name      = "add-source",
 		.help      = "Create a new source from a plugin in the Agent.",
@@ -4877,6 +5191,16 @@ static EggLineCommand subscription_commands[] = {
 		.callback  = pk_shell_subscription_get_sources,
 		.usage     = "subscription get-sources SUBSCRIPTION",
 	},
+	{
+		.name      = "get-stats",
+		.help      = "Retrieves the number of samples queued, delivered and dropped by the\nsubscription.\n"
+		             "\n"
+		             "options:\n"
+		             "  SUBSCRIPTION:\t\tAn integer.\n"
+		             "\n",
+		.callback  = pk_shell_subscription_get_stats,
+		.usage     = "subscription get-stats SUBSCRIPTION",
+	},
 	{
 		.name      = "mute",
 		.help      = "Prevents the subscription from further manifest or sample delivery.  If\n@drain is set, the current buffer will be flushed.\n"